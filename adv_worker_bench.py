@@ -0,0 +1,479 @@
+import argparse
+import ctypes
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+from bridge_bench import tag_adv
+
+# Host benchmark of the BLE advertisement path: the GAP callback's filter-and-enqueue step and the worker behind it
+# (ble_adv_worker.c and the msg pool of mem_budget.c, compiled for the host over the stub ESP-IDF and FreeRTOS
+# headers below). Scan results arrive in bursts, only during the scan window of each scan interval, a share of
+# them from tags and the rest foreign. The CPU is modelled as one core in simulated time: the BT host task and
+# the callback preempt everything, the higher priority gateway tasks take a fixed share, and the worker gets the
+# rest at its handler cost per tag advertisement. The real code does the filtering, pool and queue accounting,
+# so drops are read from its own counters. Two paths are compared:
+#  - inline: the original gap_cb, which parsed, logged and copied every scan result in the BT host task, which
+#    buffers a bounded number of reports ahead of it
+#  - worker: ble_adv_submit() in the callback and the parsing on the worker
+# For each, the highest offered rate without a single drop is searched for; the worker path fails the benchmark
+# if it is not above the inline one or below --require. The host cost of one ble_adv_submit() call is reported.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+SCAN_INTERVAL_MS = 50       # scan_interval 0x50 in main.c
+SCAN_WINDOW_MS = 30         # scan_window 0x30
+BT_HOST_US = 60             # Bluedroid's own work per scan result, before the callback
+CALLBACK_FILTERED_US = 15   # ble_adv_submit() on a foreign adv
+CALLBACK_ENQUEUED_US = 30   # ble_adv_submit() on a tag adv
+HANDLER_US = 300            # tag_adv_handler(): decode, sequence filter, aggregation, sample push
+INLINE_US = 1500            # The original gap_cb: parse, ESP_LOGI through the UART, string copies
+HOST_REPORT_QUEUE = 32      # Scan results the BT host buffers ahead of the callback (model)
+GATEWAY_LOAD = 0.25         # CPU share of the OpenThread, sender and coex tasks above the worker
+
+FOREIGN_ADV = bytes((2, 0x01, 0x06, 26, 0xFF, 0x4C, 0x00, 0x02, 0x15)) + bytes(range(23))
+
+HOST_HEADERS = {
+    "sdkconfig.h": "",
+    "esp_err.h": """
+#pragma once
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+""",
+    "esp_check.h": """
+#pragma once
+#include "esp_err.h"
+#define ESP_RETURN_ON_FALSE(a, err_code, log_tag, ...) do { if (!(a)) { return err_code; } } while (0)
+#define ESP_RETURN_ON_ERROR(x, log_tag, ...) do { esp_err_t err_rc_ = (x); if (err_rc_ != ESP_OK) { return err_rc_; } } while (0)
+""",
+    "esp_log.h": """
+#pragma once
+#define ESP_LOGE(tag, ...) ((void)(tag))
+#define ESP_LOGW(tag, ...) ((void)(tag))
+#define ESP_LOGI(tag, ...) ((void)(tag))
+#define ESP_LOGD(tag, ...) ((void)(tag))
+#define ESP_EARLY_LOGW(tag, ...) ((void)(tag))
+""",
+    "esp_timer.h": """
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+typedef void *esp_timer_handle_t;
+typedef struct {
+    void (*callback)(void *arg);
+    void *arg;
+    const char *name;
+} esp_timer_create_args_t;
+int64_t esp_timer_get_time(void);
+static inline esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+    *handle = (void *)args;
+    return ESP_OK;
+}
+static inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t handle, uint64_t period_us)
+{
+    return ESP_OK;
+}
+""",
+    "esp_heap_caps.h": """
+#pragma once
+#include <stddef.h>
+#define MALLOC_CAP_DEFAULT 0
+#define MALLOC_CAP_8BIT 0
+static inline size_t heap_caps_get_largest_free_block(unsigned caps)
+{
+    return 0;
+}
+""",
+    "esp_system.h": """
+#pragma once
+#include <stdint.h>
+static inline uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
+static inline uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return 0;
+}
+""",
+    "esp_gap_ble_api.h": """
+#pragma once
+#include <stdint.h>
+#define ESP_BD_ADDR_LEN 6
+typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
+#define ESP_BLE_ADV_DATA_LEN_MAX 31
+#define ESP_BLE_SCAN_RSP_DATA_LEN_MAX 31
+#define ESP_BLE_AD_TYPE_MANUFACTURER_SPECIFIC_TYPE 0xFF
+struct ble_scan_result_evt_param {
+    esp_bd_addr_t bda;
+    int rssi;
+    uint8_t ble_adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    uint8_t adv_data_len;
+    uint8_t scan_rsp_len;
+};
+""",
+    "openthread/error.h": """
+#pragma once
+typedef int otError;
+#define OT_ERROR_NONE 0
+#define OT_ERROR_FAILED 1
+#define OT_ERROR_NO_BUFS 3
+#define OT_ERROR_INVALID_ARGS 7
+#define OT_ERROR_INVALID_STATE 13
+""",
+    "openthread/cli.h": """
+#pragma once
+#include <openthread/error.h>
+static inline void otCliOutputFormat(const char *format, ...)
+{
+}
+""",
+    "freertos/FreeRTOS.h": """
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+// One simulated core driven by a single host thread: critical sections have nothing to exclude
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+typedef struct { int unused; } StaticTask_t;
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portMUX_INITIALIZE(mux) (*(mux) = 0)
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_SAFE(mux) ((void)(mux))
+#define portEXIT_CRITICAL_SAFE(mux) ((void)(mux))
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffu
+#define pdMS_TO_TICKS(ms) (ms)
+""",
+    "freertos/task.h": """
+#pragma once
+#include "freertos/FreeRTOS.h"
+// Tasks are not run: the benchmark steps the worker itself
+static inline TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg,
+                                             UBaseType_t prio, StackType_t *stack, StaticTask_t *tcb)
+{
+    return tcb;
+}
+static inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg,
+                                     UBaseType_t prio, TaskHandle_t *handle)
+{
+    *handle = (TaskHandle_t)fn;
+    return pdPASS;
+}
+static inline void vTaskSuspendAll(void)
+{
+}
+static inline BaseType_t xTaskResumeAll(void)
+{
+    return pdFALSE;
+}
+static inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t handle)
+{
+    return 0;
+}
+""",
+    "freertos/queue.h": """
+#pragma once
+#include "freertos/FreeRTOS.h"
+typedef struct host_queue {
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+} *QueueHandle_t;
+static inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t queue = calloc(1, sizeof(*queue));
+    queue->items = calloc(length, item_size);
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+static inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    if (queue->count == queue->length) {
+        return pdFALSE;
+    }
+    memcpy(queue->items + ((queue->head + queue->count) % queue->length) * queue->item_size, item, queue->item_size);
+    queue->count++;
+    return pdTRUE;
+}
+static inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    if (queue->count == 0) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    return pdTRUE;
+}
+static inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->count;
+}
+""",
+}
+
+SHIM = r"""
+#include <time.h>
+#include "ble_adv_worker.c"
+
+static int64_t bench_now_us;
+static GATEWAY_CONFIG bench_config = GATEWAY_CONFIG_DEFAULT();
+static uint32_t bench_handled;
+
+int64_t esp_timer_get_time(void)
+{
+    return bench_now_us;
+}
+
+const GATEWAY_CONFIG *gw_config_acquire(void)
+{
+    return &bench_config;
+}
+
+void gw_config_release(const GATEWAY_CONFIG *config)
+{
+}
+
+static void bench_handler(const BLE_ADV_EVENT *event)
+{
+    bench_handled++;
+}
+
+int bench_start(void)
+{
+    memset(&adv_stats, 0, sizeof(adv_stats));
+    return ble_adv_worker_start(bench_handler);
+}
+
+bool bench_submit(const uint8_t *bda, int rssi, const uint8_t *data, uint8_t len, int64_t now_us)
+{
+    struct ble_scan_result_evt_param scan_rst = {.rssi = rssi, .adv_data_len = len};
+
+    memcpy(scan_rst.bda, bda, ESP_BD_ADDR_LEN);
+    memcpy(scan_rst.ble_adv, data, len);
+    bench_now_us = now_us;
+    return ble_adv_submit(&scan_rst);
+}
+
+// One pass of ble_adv_worker_task()'s loop, without blocking
+bool bench_worker_step(void)
+{
+    BLE_ADV_EVENT *event = NULL;
+
+    if (xQueueReceive(adv_queue, &event, 0) != pdTRUE) {
+        return false;
+    }
+    adv_handler(event);
+    msg_pool_free(&adv_pool, event);
+    adv_stats.processed++;
+    return true;
+}
+
+uint32_t bench_depth(void)
+{
+    return uxQueueMessagesWaiting(adv_queue);
+}
+
+// Host nanoseconds per ble_adv_submit() call, the worker draining after each one
+double bench_submit_ns(const uint8_t *data, uint8_t len, int count)
+{
+    static const uint8_t bda[ESP_BD_ADDR_LEN] = {0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01};
+    struct timespec start, end;
+    double spent = 0;
+
+    for (int i = 0; i < count; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bench_submit(bda, -60, data, len, 0);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        spent += (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        while (bench_worker_step()) {
+        }
+    }
+    return spent / count;
+}
+"""
+
+
+class AdvStats(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_uint32) for name in ("received", "filtered", "enqueued", "pool_overflow",
+                                                     "queue_overflow", "processed", "max_depth")]
+
+
+def build_host(workdir, shim_text, sources, headers=HOST_HEADERS):
+    """Compile firmware sources with a shim over the stub headers into a shared library."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run " + " ".join(sources))
+    for name, text in headers.items():
+        path = os.path.join(workdir, name)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, "w") as f:
+            f.write(text)
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(shim_text)
+    lib = os.path.join(workdir, "host.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-w", "-I", workdir, "-I", HERE, "-o", lib, shim,
+                    *(os.path.join(HERE, source) for source in sources)], check=True)
+    return ctypes.CDLL(lib)
+
+
+def load_worker(workdir):
+    """Build ble_adv_worker.c and the msg pool over the stub headers into a shared library."""
+    dll = build_host(workdir, SHIM, ["mem_budget.c"])
+    dll.bench_start.restype = ctypes.c_int
+    dll.bench_submit.restype = ctypes.c_bool
+    dll.bench_submit.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_uint8, ctypes.c_int64]
+    dll.bench_worker_step.restype = ctypes.c_bool
+    dll.bench_depth.restype = ctypes.c_uint32
+    dll.bench_submit_ns.restype = ctypes.c_double
+    dll.bench_submit_ns.argtypes = [ctypes.c_char_p, ctypes.c_uint8, ctypes.c_int]
+    dll.ble_adv_get_stats.argtypes = [ctypes.POINTER(AdvStats)]
+    return dll
+
+
+def scan_results(cfg, seed):
+    """Unit-rate scan results in scan-window time: (window time, tag index or None), scaled per offered rate."""
+    rng = random.Random(seed)
+    count = int(cfg["max_rate"] * cfg["duration_ms"] / 1000)
+    u, results = 0.0, []
+    for _ in range(count):
+        u += rng.expovariate(1.0)
+        results.append((u, rng.randrange(cfg["tags"]) if rng.random() < cfg["tag_share"] else None))
+    return results
+
+
+def arrivals(results, rate, duration_ms):
+    """Scan result times in us at the offered rate (per second), in the scan windows only."""
+    per_window_us = rate / 1e6 * SCAN_INTERVAL_MS / SCAN_WINDOW_MS
+    window_us, interval_us = SCAN_WINDOW_MS * 1000, SCAN_INTERVAL_MS * 1000
+    for u, tag in results:
+        s = u / per_window_us
+        t = int(s // window_us) * interval_us + s % window_us
+        if t >= duration_ms * 1000:
+            return
+        yield t, tag
+
+
+def run_worker(dll, results, rate, cfg):
+    dll.bench_start()
+    seqs = [0] * cfg["tags"]
+    cpu, last = 0.0, 0.0
+    for t, tag in arrivals(results, rate, cfg["duration_ms"]):
+        # The worker runs on what the higher priority tasks leave, until the scan result preempts it
+        cpu += (t - last) * (1 - GATEWAY_LOAD)
+        last = t
+        while cpu >= HANDLER_US and dll.bench_worker_step():
+            cpu -= HANDLER_US
+        if dll.bench_depth() == 0:
+            cpu = min(cpu, 0.0)
+        if tag is None:
+            bda, data = bytes((0xd0, 0, 0, 0, 0, int(t) & 0xff)), FOREIGN_ADV
+        else:
+            seqs[tag] = (seqs[tag] + 1) & 0xff
+            bda, data = bytes((0x24, 0x0a, 0xc4, 0, tag >> 8, tag & 0xff)), tag_adv(150 + tag, seqs[tag])
+        dll.bench_submit(bda, -60, data, len(data), int(t))
+        cpu -= BT_HOST_US + (CALLBACK_FILTERED_US if tag is None else CALLBACK_ENQUEUED_US)
+    stats = AdvStats()
+    dll.ble_adv_get_stats(ctypes.byref(stats))
+    result = {name: getattr(stats, name) for name, _ in AdvStats._fields_}
+    result["dropped"] = stats.pool_overflow + stats.queue_overflow
+    result["consistent"] = (stats.received == stats.filtered + stats.enqueued + result["dropped"] and
+                            stats.processed + dll.bench_depth() == stats.enqueued)
+    return result
+
+
+def run_inline(results, rate, cfg):
+    """The BT host task handles each scan result in the callback, its report buffer dropping the excess."""
+    backlog, cpu, last = 0, 0.0, 0.0
+    result = {"received": 0, "processed": 0, "dropped": 0, "max_depth": 0, "consistent": True}
+    for t, _ in arrivals(results, rate, cfg["duration_ms"]):
+        cpu += t - last
+        last = t
+        while backlog and cpu >= BT_HOST_US + INLINE_US:
+            backlog -= 1
+            cpu -= BT_HOST_US + INLINE_US
+            result["processed"] += 1
+        if not backlog:
+            cpu = min(cpu, 0.0)
+        result["received"] += 1
+        if backlog == HOST_REPORT_QUEUE:
+            result["dropped"] += 1
+        else:
+            backlog += 1
+            result["max_depth"] = max(result["max_depth"], backlog)
+    return result
+
+
+def max_rate(run, cfg):
+    """Highest offered rate, to 1%, at which the run drops nothing; with the runs at and just above it."""
+    lo, hi = 0.0, cfg["max_rate"]
+    best = None
+    while hi - lo > max(1.0, lo * 0.01):
+        mid = (lo + hi) / 2
+        result = run(mid)
+        if result["dropped"] == 0:
+            lo, best = mid, result
+        else:
+            hi = mid
+    return lo, best, run(hi)
+
+
+# python3 adv_worker_bench.py --tags 50 --tag-share 0.1 --duration 10
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Highest scan result rate without drops, inline vs worker")
+    parser.add_argument("--tags", type=int, default=50)
+    parser.add_argument("--tag-share", type=float, default=0.1, help="share of the scan results sent by tags")
+    parser.add_argument("--duration", type=float, default=10.0, help="simulated seconds per rate")
+    parser.add_argument("--max-rate", type=float, default=40000.0, help="highest rate searched, scan results/s")
+    parser.add_argument("--require", type=float, default=2000.0, help="rate the worker path must handle, /s")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    cfg = {"tags": args.tags, "tag_share": args.tag_share, "duration_ms": int(args.duration * 1000),
+           "max_rate": args.max_rate}
+    results = scan_results(cfg, args.seed)
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_worker(workdir)
+        started = time.perf_counter()
+        worker_rate, worker_best, worker_over = max_rate(lambda rate: run_worker(dll, results, rate, cfg), cfg)
+        inline_rate, inline_best, inline_over = max_rate(lambda rate: run_inline(results, rate, cfg), cfg)
+        dll.bench_start()
+        tag = tag_adv(150, 1)
+        host_ns = {"foreign": round(dll.bench_submit_ns(FOREIGN_ADV, len(FOREIGN_ADV), 100000), 1),
+                   "tag": round(dll.bench_submit_ns(tag, len(tag), 100000), 1)}
+        elapsed = time.perf_counter() - started
+
+    ok = (worker_rate > inline_rate and worker_rate >= args.require and
+          all(r is None or r["consistent"] for r in (worker_best, worker_over)))
+    print(json.dumps({"path": "inline", "max_rate_no_drops": round(inline_rate), "at_max": inline_best,
+                      "above_max": inline_over}))
+    print(json.dumps({"path": "worker", "max_rate_no_drops": round(worker_rate), "at_max": worker_best,
+                      "above_max": worker_over, "submit_host_ns": host_ns, "tag_share": args.tag_share,
+                      "require": args.require, "elapsed_s": round(elapsed, 1), "ok": ok}))
+    sys.exit(0 if ok else 1)
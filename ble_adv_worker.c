@@ -0,0 +1,160 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "ble_adv_worker.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "gw_config.h"
+#include "mem_budget.h"
+#include "openthread/cli.h"
+
+#define BLE_ADV_TAG "ble_adv"
+
+static QueueHandle_t adv_queue;    // Carries BLE_ADV_EVENT pointers taken from adv_pool
+MSG_POOL_DEFINE(adv_pool, BLE_ADV_EVENT, BLE_ADV_EVENT_POOL_SIZE);
+GATEWAY_TASK_DEFINE(adv_worker, BLE_ADV_WORKER_STACK_SIZE);
+
+static ble_adv_handler_t adv_handler;
+static BLE_ADV_STATS adv_stats;
+static portMUX_TYPE adv_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Walk the AD structures looking for our manufacturer ID, without copying or logging anything
+static bool ble_adv_is_tag(const uint8_t *data, uint8_t len, uint16_t manufacturer_id)
+{
+    for (int i = 0; i + 1 < len;) {
+        uint8_t field_len = data[i];
+        if (field_len == 0 || i + field_len >= len) {
+            break;
+        }
+        if (data[i + 1] == ESP_BLE_AD_TYPE_MANUFACTURER_SPECIFIC_TYPE && field_len > 2) {
+            uint16_t mfg_id = data[i + 2] | (data[i + 3] << 8);
+            if (mfg_id == manufacturer_id) {
+                return true;
+            }
+        }
+        i += field_len + 1;
+    }
+    return false;
+}
+
+bool ble_adv_submit(const struct ble_scan_result_evt_param *scan_rst)
+{
+    uint8_t len = scan_rst->adv_data_len + scan_rst->scan_rsp_len;
+
+    if (len > sizeof(((BLE_ADV_EVENT *)0)->data)) {
+        len = sizeof(((BLE_ADV_EVENT *)0)->data);
+    }
+    // Filter settings from the runtime configuration, never waits for a "config set" in progress
+    const GATEWAY_CONFIG *config = gw_config_acquire();
+    uint16_t manufacturer_id = config->manufacturer_id;
+    int8_t min_rssi = config->min_rssi;
+    gw_config_release(config);
+    if (scan_rst->rssi < min_rssi || !ble_adv_is_tag(scan_rst->ble_adv, len, manufacturer_id)) {
+        portENTER_CRITICAL(&adv_stats_lock);
+        adv_stats.received++;
+        adv_stats.filtered++;
+        portEXIT_CRITICAL(&adv_stats_lock);
+        return false;
+    }
+
+    BLE_ADV_EVENT *event = msg_pool_alloc(&adv_pool);
+    if (event == NULL) {
+        portENTER_CRITICAL(&adv_stats_lock);
+        adv_stats.received++;
+        adv_stats.pool_overflow++;
+        portEXIT_CRITICAL(&adv_stats_lock);
+        return false;
+    }
+    memcpy(event->bda, scan_rst->bda, sizeof(esp_bd_addr_t));
+    event->rssi = scan_rst->rssi;
+    event->len = len;
+    memcpy(event->data, scan_rst->ble_adv, len);
+    event->rx_time_us = esp_timer_get_time();
+
+    bool queued = xQueueSend(adv_queue, &event, 0) == pdTRUE;
+    if (!queued) {
+        msg_pool_free(&adv_pool, event);
+    }
+    uint32_t depth = uxQueueMessagesWaiting(adv_queue);
+
+    portENTER_CRITICAL(&adv_stats_lock);
+    adv_stats.received++;
+    if (queued) {
+        adv_stats.enqueued++;
+    } else {
+        adv_stats.queue_overflow++;
+    }
+    if (depth > adv_stats.max_depth) {
+        adv_stats.max_depth = depth;
+    }
+    portEXIT_CRITICAL(&adv_stats_lock);
+    return queued;
+}
+
+static void ble_adv_worker_task(void *arg)
+{
+    BLE_ADV_EVENT *event = NULL;
+
+    while (true) {
+        if (xQueueReceive(adv_queue, &event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        adv_handler(event);
+        msg_pool_free(&adv_pool, event);
+
+        portENTER_CRITICAL(&adv_stats_lock);
+        adv_stats.processed++;
+        portEXIT_CRITICAL(&adv_stats_lock);
+    }
+}
+
+esp_err_t ble_adv_worker_start(ble_adv_handler_t handler)
+{
+    adv_handler = handler;
+
+    msg_pool_init(adv_pool, "ble_adv");
+    adv_queue = xQueueCreate(BLE_ADV_EVENT_POOL_SIZE, sizeof(BLE_ADV_EVENT *));
+    ESP_RETURN_ON_FALSE(adv_queue != NULL, ESP_FAIL, BLE_ADV_TAG, "Fail to create adv queue");
+
+    return GATEWAY_TASK_CREATE(adv_worker, ble_adv_worker_task, "ble_adv_worker", NULL, BLE_ADV_WORKER_PRIORITY,
+                               NULL);
+}
+
+void ble_adv_get_stats(BLE_ADV_STATS *stats)
+{
+    portENTER_CRITICAL(&adv_stats_lock);
+    *stats = adv_stats;
+    portEXIT_CRITICAL(&adv_stats_lock);
+}
+
+otError esp_ot_process_ble_stats(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    BLE_ADV_STATS stats;
+
+    if (aArgsLength == 1 && strcmp(aArgs[0], "reset") == 0) {
+        portENTER_CRITICAL(&adv_stats_lock);
+        memset(&adv_stats, 0, sizeof(adv_stats));
+        portEXIT_CRITICAL(&adv_stats_lock);
+        return OT_ERROR_NONE;
+    }
+
+    ble_adv_get_stats(&stats);
+    otCliOutputFormat("received: %" PRIu32 "\n", stats.received);
+    otCliOutputFormat("filtered: %" PRIu32 "\n", stats.filtered);
+    otCliOutputFormat("enqueued: %" PRIu32 "\n", stats.enqueued);
+    otCliOutputFormat("processed: %" PRIu32 "\n", stats.processed);
+    otCliOutputFormat("pool overflow: %" PRIu32 "\n", stats.pool_overflow);
+    otCliOutputFormat("queue overflow: %" PRIu32 "\n", stats.queue_overflow);
+    otCliOutputFormat("max backlog: %" PRIu32 "/%d\n", stats.max_depth, BLE_ADV_EVENT_POOL_SIZE);
+    return OT_ERROR_NONE;
+}
@@ -0,0 +1,91 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "esp_gap_ble_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BLE_ADV_EVENT_POOL_SIZE 32
+#define BLE_ADV_WORKER_STACK_SIZE 3072
+#define BLE_ADV_WORKER_PRIORITY 4
+
+/**
+ * @brief Raw advertisement copied out of the Bluedroid callback.
+ *
+ */
+typedef struct ble_adv_event {
+    esp_bd_addr_t bda;
+    int8_t rssi;
+    uint8_t len;    // adv data followed by scan response data
+    uint8_t data[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    int64_t rx_time_us;
+} BLE_ADV_EVENT;
+
+/**
+ * @brief Advertisement counters, all cumulative since boot.
+ *
+ */
+typedef struct ble_adv_stats {
+    uint32_t received;          // Scan results seen by the callback
+    uint32_t filtered;          // Dropped in the callback, not a tag advertisement or below the RSSI floor
+    uint32_t enqueued;          // Handed to the worker
+    uint32_t pool_overflow;     // Dropped, no free event in the pool
+    uint32_t queue_overflow;    // Dropped, worker queue full
+    uint32_t processed;         // Parsed by the worker
+    uint32_t max_depth;         // Deepest worker backlog observed
+} BLE_ADV_STATS;
+
+/**
+ * @brief Handler run on the worker task for every accepted advertisement.
+ *
+ */
+typedef void (*ble_adv_handler_t)(const BLE_ADV_EVENT *event);
+
+/**
+ * @brief Create the event pool and the worker task. Tag advertisements are told apart by the manufacturer ID and
+ *        RSSI floor of the runtime settings (gw_config.h).
+ *
+ * @param[in] handler   Called on the worker task for each advertisement.
+ *
+ * @return
+ *      - ESP_OK on success.
+ *      - ESP_FAIL on failure in creating the queue or the task.
+ */
+esp_err_t ble_adv_worker_start(ble_adv_handler_t handler);
+
+/**
+ * @brief Filter a scan result and queue it for the worker. Called from the GAP callback.
+ *
+ * @param[in] scan_rst  Scan result from ESP_GAP_BLE_SCAN_RESULT_EVT.
+ *
+ * @return
+ *      - true if the advertisement was queued.
+ */
+bool ble_adv_submit(const struct ble_scan_result_evt_param *scan_rst);
+
+/**
+ * @brief Get a snapshot of the advertisement counters.
+ *
+ */
+void ble_adv_get_stats(BLE_ADV_STATS *stats);
+
+/**
+ * @brief User command "blestats" process.
+ *
+ */
+otError esp_ot_process_ble_stats(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,208 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "ble_scan_filter.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+#include "sdkconfig.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "openthread/cli.h"
+
+#define SCAN_FILTER_TAG "ble_scan_filter"
+
+static esp_ble_gap_set_scan_params_t scan_base_params;
+static ble_scan_mode_t scan_mode = BLE_SCAN_MODE_OPEN;
+static esp_bd_addr_t scan_whitelist[BLE_SCAN_WHITELIST_MAX];
+static int scan_whitelist_count = 0;
+static bool scan_started = false;
+static bool scan_paused = false;
+static SemaphoreHandle_t scan_lock;    // Serialises scan parameter changes from the CLI and the coex scheduler
+
+// Only touched from the BLE adv worker task
+static TAG_SEQ_FILTER scan_seq_filter;
+
+// Call with scan_lock held
+static esp_err_t ble_scan_filter_apply(void)
+{
+    esp_ble_gap_set_scan_params_t params = scan_base_params;
+
+    if (scan_mode == BLE_SCAN_MODE_WHITELIST) {
+        params.scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ONLY_WLST;
+#if CONFIG_BT_CTRL_SCAN_DUPL_TYPE_DATA_DEVICE || CONFIG_BT_LE_SCAN_DUPL_TYPE_DATA_DEVICE
+        // The controller keys duplicates on address + adv data, so each new range (new seq) still gets through
+        params.scan_duplicate = BLE_SCAN_DUPLICATE_ENABLE;
+#endif
+    }
+
+    if (scan_started) {
+        ESP_RETURN_ON_ERROR(esp_ble_gap_stop_scanning(), SCAN_FILTER_TAG, "Fail to stop scanning");
+        scan_started = false;
+    }
+    ESP_RETURN_ON_ERROR(esp_ble_gap_set_scan_params(&params), SCAN_FILTER_TAG, "Fail to set scan params");
+    if (!scan_paused) {
+        ESP_RETURN_ON_ERROR(esp_ble_gap_start_scanning(0), SCAN_FILTER_TAG, "Fail to start scanning");
+        scan_started = true;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ble_scan_filter_apply_locked(void)
+{
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    esp_err_t ret = ble_scan_filter_apply();
+    xSemaphoreGive(scan_lock);
+    return ret;
+}
+
+esp_err_t ble_scan_filter_start(const esp_ble_gap_set_scan_params_t *base_params)
+{
+    scan_lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(scan_lock != NULL, ESP_FAIL, SCAN_FILTER_TAG, "Fail to create scan lock");
+    scan_base_params = *base_params;
+    tag_seq_filter_init(&scan_seq_filter);
+    return ble_scan_filter_apply_locked();
+}
+
+esp_err_t ble_scan_filter_set_window(uint16_t window)
+{
+    ESP_RETURN_ON_FALSE(scan_lock != NULL, ESP_ERR_INVALID_STATE, SCAN_FILTER_TAG, "Scanning not started");
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    scan_base_params.scan_window = MIN(window, scan_base_params.scan_interval);
+    esp_err_t ret = ble_scan_filter_apply();
+    xSemaphoreGive(scan_lock);
+    return ret;
+}
+
+esp_err_t ble_scan_filter_pause(bool pause)
+{
+    esp_err_t ret = ESP_OK;
+
+    ESP_RETURN_ON_FALSE(scan_lock != NULL, ESP_ERR_INVALID_STATE, SCAN_FILTER_TAG, "Scanning not started");
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    scan_paused = pause;
+    if (pause && scan_started) {
+        ret = esp_ble_gap_stop_scanning();
+        scan_started = false;
+    } else if (!pause && !scan_started) {
+        ret = esp_ble_gap_start_scanning(0);
+        scan_started = (ret == ESP_OK);
+    }
+    xSemaphoreGive(scan_lock);
+    return ret;
+}
+
+bool ble_scan_filter_accept(const esp_bd_addr_t bda, uint8_t seq)
+{
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+
+    return tag_seq_filter_check(&scan_seq_filter, bda, seq, now_ms) != TAG_SEQ_DUPLICATE;
+}
+
+void ble_scan_filter_get_stats(uint32_t *accepted, uint32_t *duplicates, int *tags)
+{
+    *accepted = scan_seq_filter.accepted;
+    *duplicates = scan_seq_filter.duplicates;
+    *tags = tag_seq_filter_count(&scan_seq_filter);
+}
+
+static bool ble_scan_parse_addr(const char *str, esp_bd_addr_t bda)
+{
+    unsigned int b[ESP_BD_ADDR_LEN];
+
+    if (sscanf(str, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != ESP_BD_ADDR_LEN) {
+        return false;
+    }
+    for (int i = 0; i < ESP_BD_ADDR_LEN; i++) {
+        bda[i] = (uint8_t)b[i];
+    }
+    return true;
+}
+
+static int ble_scan_whitelist_find(const esp_bd_addr_t bda)
+{
+    for (int i = 0; i < scan_whitelist_count; i++) {
+        if (memcmp(scan_whitelist[i], bda, ESP_BD_ADDR_LEN) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+otError esp_ot_process_tag_filter(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    esp_bd_addr_t bda;
+
+    if (aArgsLength == 0) {
+        otCliOutputFormat("---tagfilter parameter---\n");
+        otCliOutputFormat("status                                   :     scan mode, whitelist and sequence window stats\n");
+        otCliOutputFormat("add <bda>                                :     add a tag address to the controller whitelist\n");
+        otCliOutputFormat("remove <bda>                             :     remove a tag address from the whitelist\n");
+        otCliOutputFormat("mode <open|whitelist>                    :     report all advs, or whitelisted tags only\n");
+        otCliOutputFormat("---example---\n");
+        otCliOutputFormat("whitelist a tag                          :     tagfilter add 24:0a:c4:12:34:56\n");
+        otCliOutputFormat("scan whitelisted tags only               :     tagfilter mode whitelist\n");
+    } else if (strcmp(aArgs[0], "status") == 0) {
+        uint32_t accepted, duplicates;
+        int tags;
+        ble_scan_filter_get_stats(&accepted, &duplicates, &tags);
+        otCliOutputFormat("mode: %s\twindow: 0x%02x/0x%02x%s\n", scan_mode == BLE_SCAN_MODE_WHITELIST ? "whitelist" : "open",
+                          scan_base_params.scan_window, scan_base_params.scan_interval, scan_paused ? " (paused)" : "");
+        for (int i = 0; i < scan_whitelist_count; i++) {
+            otCliOutputFormat("  " ESP_BD_ADDR_STR "\n", ESP_BD_ADDR_HEX(scan_whitelist[i]));
+        }
+        otCliOutputFormat("tags tracked: %d\taccepted: %" PRIu32 "\tduplicates dropped: %" PRIu32 "\n", tags, accepted,
+                          duplicates);
+    } else if (strcmp(aArgs[0], "add") == 0 || strcmp(aArgs[0], "remove") == 0) {
+        bool add = strcmp(aArgs[0], "add") == 0;
+        if (aArgsLength != 2 || !ble_scan_parse_addr(aArgs[1], bda)) {
+            ESP_LOGE(SCAN_FILTER_TAG, "Invalid arguments.");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        int index = ble_scan_whitelist_find(bda);
+        if (add && index < 0) {
+            if (scan_whitelist_count == BLE_SCAN_WHITELIST_MAX) {
+                otCliOutputFormat("Whitelist full!\n");
+                return OT_ERROR_NO_BUFS;
+            }
+            memcpy(scan_whitelist[scan_whitelist_count++], bda, ESP_BD_ADDR_LEN);
+        } else if (!add && index >= 0) {
+            memcpy(scan_whitelist[index], scan_whitelist[--scan_whitelist_count], ESP_BD_ADDR_LEN);
+        } else {
+            return OT_ERROR_NONE;
+        }
+        ESP_RETURN_ON_FALSE(esp_ble_gap_update_whitelist(add, bda, BLE_WL_ADDR_TYPE_PUBLIC) == ESP_OK, OT_ERROR_FAILED,
+                            SCAN_FILTER_TAG, "Fail to update whitelist");
+    } else if (strcmp(aArgs[0], "mode") == 0) {
+        if (aArgsLength != 2) {
+            ESP_LOGE(SCAN_FILTER_TAG, "Invalid arguments.");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        if (strcmp(aArgs[1], "whitelist") == 0) {
+            if (scan_whitelist_count == 0) {
+                otCliOutputFormat("Whitelist is empty!\n");
+                return OT_ERROR_INVALID_STATE;
+            }
+            scan_mode = BLE_SCAN_MODE_WHITELIST;
+        } else if (strcmp(aArgs[1], "open") == 0) {
+            scan_mode = BLE_SCAN_MODE_OPEN;
+        } else {
+            otCliOutputFormat("invalid commands\n");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        ESP_RETURN_ON_FALSE(ble_scan_filter_apply_locked() == ESP_OK, OT_ERROR_FAILED, SCAN_FILTER_TAG,
+                            "Fail to apply scan mode");
+    } else {
+        otCliOutputFormat("invalid commands\n");
+    }
+    return OT_ERROR_NONE;
+}
@@ -0,0 +1,86 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "esp_gap_ble_api.h"
+#include "tag_seq_filter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BLE_SCAN_WHITELIST_MAX 16
+
+/**
+ * @brief Where non-tag advertisements are filtered out.
+ *
+ */
+typedef enum {
+    BLE_SCAN_MODE_OPEN = 0,     // Controller reports everything, the GAP callback filters by manufacturer ID
+    BLE_SCAN_MODE_WHITELIST,    // Controller only reports whitelisted tag addresses
+} ble_scan_mode_t;
+
+/**
+ * @brief Apply the current scan mode on top of the base parameters and start scanning.
+ *
+ * @param[in] base_params   Scan parameters used in open mode, kept for later mode changes.
+ *
+ * @return
+ *      - ESP_OK on success.
+ */
+esp_err_t ble_scan_filter_start(const esp_ble_gap_set_scan_params_t *base_params);
+
+/**
+ * @brief Change the scan window, used by the radio coexistence scheduler.
+ *
+ * @param[in] window    Scan window in 0.625 ms units, clamped to the scan interval.
+ *
+ * @return
+ *      - ESP_OK on success.
+ */
+esp_err_t ble_scan_filter_set_window(uint16_t window);
+
+/**
+ * @brief Stop or resume scanning, e.g. around an exclusive Thread TX window.
+ *
+ * @param[in] pause     true to stop scanning, false to resume.
+ *
+ * @return
+ *      - ESP_OK on success.
+ */
+esp_err_t ble_scan_filter_pause(bool pause);
+
+/**
+ * @brief Per-tag sequence window check, drops repeats of an already forwarded range.
+ *
+ * @param[in] bda   Tag address.
+ * @param[in] seq   Sequence number carried in the advertisement.
+ *
+ * @return
+ *      - true if the sample is new and must be forwarded.
+ */
+bool ble_scan_filter_accept(const esp_bd_addr_t bda, uint8_t seq);
+
+/**
+ * @brief Get a snapshot of the sequence filter counters.
+ *
+ */
+void ble_scan_filter_get_stats(uint32_t *accepted, uint32_t *duplicates, int *tags);
+
+/**
+ * @brief User command "tagfilter" process.
+ *
+ */
+otError esp_ot_process_tag_filter(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,79 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "boot_report.h"
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "openthread/cli.h"
+
+static const char *const boot_phase_names[BOOT_PHASE_MAX] = {
+    [BOOT_PHASE_APP_MAIN] = "app_main",
+    [BOOT_PHASE_NVS_READY] = "nvs ready",
+    [BOOT_PHASE_NETIF_READY] = "netif ready",
+    [BOOT_PHASE_BLE_CONTROLLER_READY] = "ble controller ready",
+    [BOOT_PHASE_BLUEDROID_READY] = "bluedroid ready",
+    [BOOT_PHASE_SCAN_STARTED] = "ble scan started",
+    [BOOT_PHASE_FIRST_ADV] = "first tag adv",
+    [BOOT_PHASE_OT_INIT_DONE] = "openthread init done",
+    [BOOT_PHASE_OT_STARTED] = "openthread started",
+    [BOOT_PHASE_THREAD_ATTACHED] = "thread attached",
+    [BOOT_PHASE_FIRST_SAMPLE_SENT] = "first sample sent",
+};
+
+static int64_t boot_phase_time_us[BOOT_PHASE_MAX];
+static portMUX_TYPE boot_report_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void boot_report_mark(boot_phase_t phase)
+{
+    if (phase >= BOOT_PHASE_MAX) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&boot_report_lock);
+    if (boot_phase_time_us[phase] == 0) {
+        boot_phase_time_us[phase] = now;
+    }
+    portEXIT_CRITICAL(&boot_report_lock);
+}
+
+int64_t boot_report_get(boot_phase_t phase)
+{
+    int64_t time_us = 0;
+
+    if (phase < BOOT_PHASE_MAX) {
+        portENTER_CRITICAL(&boot_report_lock);
+        time_us = boot_phase_time_us[phase];
+        portEXIT_CRITICAL(&boot_report_lock);
+    }
+    return time_us;
+}
+
+otError esp_ot_process_boot_report(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    int64_t prev_us = 0;
+
+    otCliOutputFormat("phase                       at(ms)    delta(ms)\n");
+    for (int phase = 0; phase < BOOT_PHASE_MAX; phase++) {
+        int64_t time_us = boot_report_get(phase);
+        if (time_us == 0) {
+            otCliOutputFormat("%-24s        -            -\n", boot_phase_names[phase]);
+            continue;
+        }
+        otCliOutputFormat("%-24s %9lld    %9lld\n", boot_phase_names[phase], (long long)(time_us / 1000),
+                          (long long)((time_us - prev_us) / 1000));
+        prev_us = time_us;
+    }
+
+    int64_t first_sample_us = boot_report_get(BOOT_PHASE_FIRST_SAMPLE_SENT);
+    if (first_sample_us != 0) {
+        otCliOutputFormat("boot to first delivered sample: %lld ms\n", (long long)(first_sample_us / 1000));
+    } else {
+        otCliOutputFormat("boot to first delivered sample: pending\n");
+    }
+    return OT_ERROR_NONE;
+}
@@ -0,0 +1,61 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <openthread/error.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Boot phases recorded in the startup report, in their expected order.
+ *
+ */
+typedef enum {
+    BOOT_PHASE_APP_MAIN = 0,
+    BOOT_PHASE_NVS_READY,
+    BOOT_PHASE_NETIF_READY,
+    BOOT_PHASE_BLE_CONTROLLER_READY,
+    BOOT_PHASE_BLUEDROID_READY,
+    BOOT_PHASE_SCAN_STARTED,
+    BOOT_PHASE_FIRST_ADV,
+    BOOT_PHASE_OT_INIT_DONE,
+    BOOT_PHASE_OT_STARTED,
+    BOOT_PHASE_THREAD_ATTACHED,
+    BOOT_PHASE_FIRST_SAMPLE_SENT,
+    BOOT_PHASE_MAX,
+} boot_phase_t;
+
+/**
+ * @brief Record the time of a boot phase. Only the first call per phase is kept.
+ *
+ * @param[in] phase  The boot phase that has just completed.
+ *
+ */
+void boot_report_mark(boot_phase_t phase);
+
+/**
+ * @brief Get the recorded time of a boot phase.
+ *
+ * @param[in] phase  The boot phase.
+ *
+ * @return
+ *      - Microseconds since boot when the phase completed, 0 if it has not completed yet.
+ */
+int64_t boot_report_get(boot_phase_t phase);
+
+/**
+ * @brief User command "bootreport" process.
+ *
+ */
+otError esp_ot_process_boot_report(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
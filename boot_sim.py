@@ -0,0 +1,162 @@
+import argparse
+import json
+import random
+import sys
+import tempfile
+
+from link_sim import SEND_PERIOD_MS, load_policy
+
+# Boot-to-first-delivered-sample benchmark of the gateway init sequence (app_main() in main.c), in simulated time on
+# one CPU with 1 ms FreeRTOS ticks: the ready task of highest priority runs, equal priorities take turns. Each init
+# step is CPU time followed by a wait in which the task blocks (controller, Bluedroid and OpenThread round trips),
+# the step durations below being typical ESP32-C6 figures; "bootreport" on the device gives the real ones.
+#  - serial: the original app_main, which started the OpenThread task, then the sender polling the role every
+#    500 ms and sending the latest reading every second, then the BLE scanner one priority lower
+#  - scanner_first: the scanner task created first, right after NVS, at the OpenThread task's priority
+#  - parallel: the current app_main, where the OpenThread task starts as soon as netif is up and the scanner one
+#    priority lower brings BLE up while OpenThread blocks and attaches. Readings wait in the sample queue and the
+#    attach callback wakes the sender, which batches with radio_coex_policy.c (compiled for the host)
+# Each run draws the attach time and the tag phases; the benchmark reports boot-to-first-delivered-sample
+# percentiles per scenario, and fails if the current sequence is ever slower than another one.
+
+TICK_MS = 1
+
+# (cpu ms, blocked ms) per init step
+APP_EARLY = [(1, 0)]                            # Event group, sample queue and pool, shaper
+NVS = [(15, 5)]
+CONFIG = [(3, 0)]                               # gw_config_start(), settings from NVS
+NETIF = [(10, 0), (1, 0)]                       # Event loop and netif, eventfd
+BLE_INIT = [(40, 60), (80, 120), (60, 80)]      # Controller init and enable, Bluedroid init, Bluedroid enable
+BLE_SCAN = [(5, 15)]                            # Worker, GAP callback, scan parameters and start
+OT_INIT = [(150, 50), (20, 0), (10, 0)]         # esp_openthread_init(), CLI and netif glue, auto start
+
+OLD_ROLE_POLL_MS = 500
+OLD_SEND_MS = 1000
+
+SCENARIOS = {
+    "reattach": (1000, 1600),       # Dataset in NVS, the parent answers the first request
+    "first_attach": (3000, 6000),   # Several parent requests, or a router attach
+}
+
+
+class Task:
+    def __init__(self, name, prio, steps, created_ms):
+        self.name, self.prio = name, prio
+        self.steps = [list(step) for step in steps]
+        self.ready_at = created_ms
+        self.done_ms = None
+
+
+def run_tasks(tasks, spawn, end_ms):
+    """Run the tasks tick by tick. spawn(name, now) may add tasks when one finishes; returns finish times."""
+    now, turn = 0, 0
+    finished = {}
+    while now < end_ms and any(t.done_ms is None for t in tasks):
+        ready = [t for t in tasks if t.done_ms is None and t.ready_at <= now]
+        if ready:
+            top = max(t.prio for t in ready)
+            peers = [t for t in ready if t.prio == top]
+            task = peers[turn % len(peers)]
+            turn += 1
+            step = task.steps[0]
+            step[0] -= TICK_MS
+            if step[0] <= 0:
+                task.ready_at = now + TICK_MS + step[1]
+                task.steps.pop(0)
+                if not task.steps:
+                    task.done_ms = task.ready_at
+                    finished[task.name] = task.done_ms
+                    tasks.extend(spawn(task.name, task.done_ms))
+        now += TICK_MS
+    return finished
+
+
+def boot(sequence):
+    """Times at which scanning starts and OpenThread starts attaching."""
+    if sequence == "serial":
+        # app_main creates the OpenThread task (5), the sender (3) and the scanner (4) once netif is up
+        app = Task("app_main", 1, APP_EARLY + NVS + NETIF, 0)
+        spawns = {"app_main": [("ot", 5, OT_INIT), ("ble", 4, BLE_INIT + BLE_SCAN)]}
+    elif sequence == "scanner_first":
+        # The scanner (5) before netif, then the OpenThread task (5)
+        app = Task("app_main", 1, APP_EARLY + NVS + CONFIG, 0)
+        spawns = {"app_main": [("ble", 5, BLE_INIT + BLE_SCAN), ("app_main_rest", 1, NETIF)],
+                  "app_main_rest": [("ot", 5, OT_INIT)]}
+    else:
+        # The OpenThread task (5) once netif is up, the scanner (4) right after it
+        app = Task("app_main", 1, APP_EARLY + NVS + CONFIG + NETIF, 0)
+        spawns = {"app_main": [("ot", 5, OT_INIT), ("ble", 4, BLE_INIT + BLE_SCAN)]}
+
+    def spawn(name, now):
+        return [Task(n, p, s, now) for n, p, s in spawns.get(name, [])]
+
+    finished = run_tasks([app], spawn, 60000)
+    return finished["ble"], finished["ot"]
+
+
+def first_delivered(sequence, attached_ms, adv_times, dll):
+    """Time of the first datagram carrying a sample once attached."""
+    if sequence == "serial":
+        # The sender polls the role from when it is created (right after the OpenThread task starts running)
+        detect = attached_ms + (-attached_ms) % OLD_ROLE_POLL_MS
+        first_adv = adv_times[0]
+        send = detect
+        while send < first_adv:
+            send += OLD_SEND_MS
+        return send
+    policy = dll.sim_policy_new()
+    max_wait = dll.sim_tx_max_wait_ms(policy)
+    queued = [t for t in adv_times if t <= attached_ms]
+    t = attached_ms if queued else next(a for a in adv_times if a > attached_ms)
+    while True:
+        depth = sum(1 for a in adv_times if a <= t)
+        age = t - adv_times[0]
+        if dll.radio_coex_policy_want_tx(policy, depth, age) or age >= max_wait or age >= SEND_PERIOD_MS:
+            return t
+        t += TICK_MS
+
+
+def percentiles(values):
+    values = sorted(values)
+    pick = lambda q: values[min(len(values) - 1, int(q * len(values)))]
+    return {"p50_ms": pick(0.5), "p90_ms": pick(0.9), "max_ms": values[-1]}
+
+
+# python3 boot_sim.py --runs 200 --tags 20 --rate 2
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Boot-to-first-delivered-sample time of the gateway init sequence")
+    parser.add_argument("--runs", type=int, default=200, help="runs per scenario")
+    parser.add_argument("--tags", type=int, default=20)
+    parser.add_argument("--rate", type=float, default=2.0, help="ranges per second per tag")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    boots = {sequence: boot(sequence) for sequence in ("serial", "scanner_first", "parallel")}
+    failed = False
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_policy(workdir)
+        for scenario, (attach_lo, attach_hi) in SCENARIOS.items():
+            rng = random.Random(args.seed)
+            results = {sequence: {"first_sample": [], "attached": []} for sequence in boots}
+            slower = 0
+            for _ in range(args.runs):
+                attach = rng.randint(attach_lo, attach_hi)
+                phases = [rng.uniform(0, 1000 / args.rate) for _ in range(args.tags)]
+                firsts = {}
+                for sequence, (scan_ms, ot_ms) in boots.items():
+                    attached_ms = ot_ms + attach
+                    adv_times = sorted(int(scan_ms + p + j * 1000 / args.rate) for p in phases for j in range(64))
+                    firsts[sequence] = first_delivered(sequence, attached_ms, adv_times, dll)
+                    results[sequence]["first_sample"].append(firsts[sequence])
+                    results[sequence]["attached"].append(attached_ms)
+                slower += any(firsts["parallel"] > first for first in firsts.values())
+            failed |= slower > 0
+            print(json.dumps({"scenario": scenario, "runs": args.runs, "attach_ms": [attach_lo, attach_hi],
+                              **{sequence: {"scan_started_ms": boots[sequence][0],
+                                            "ot_started_ms": boots[sequence][1],
+                                            "boot_to_first_sample": percentiles(r["first_sample"]),
+                                            "after_attach": percentiles([f - a for f, a in
+                                                                         zip(r["first_sample"], r["attached"])])}
+                                 for sequence, r in results.items()},
+                              "parallel_slower_runs": slower, "ok": slower == 0}))
+    sys.exit(1 if failed else 0)
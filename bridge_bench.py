@@ -0,0 +1,392 @@
+import argparse
+import glob
+import heapq
+import json
+import multiprocessing as mp
+import os
+import random
+import resource
+import selectors
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+from bridge_msg import encode_range
+from bridge_trace import GatewayModel
+
+# End-to-end load benchmark: synthetic tags -> gateway model -> lossy mesh -> mqttconnection.py -> broker stand-in.
+# Every stage runs in its own process so that CPU time and peak memory can be reported per component.
+# Sample j of tag k is due at t0 + phase_k + j / rate, so any stage can tell when a sample it sees was produced.
+
+UDP_FRAME_LEN = 384         # As in main.c: the samples of one TX window share a datagram
+TX_WINDOW_S = 0.02
+MESH_DELAY_S = 0.01
+SAMPLE_EVERY = 8            # Latency is joined across stages for 1 in SAMPLE_EVERY samples per tag
+DRAIN_S = 2.0               # Past the merge window and the jitter hold
+DRAIN_IDLE_S = 1.0          # Then until the broker has been idle this long, so an overloaded bridge can catch up
+DRAIN_MAX_S = 60.0
+
+
+def percentiles(values):
+    if not values:
+        return None
+    values = sorted(values)
+    pick = lambda q: round(values[min(len(values) - 1, int(q * len(values)))] * 1000, 3)
+    return {"count": len(values), "p50_ms": pick(0.5), "p90_ms": pick(0.9), "p99_ms": pick(0.99),
+            "max_ms": round(values[-1] * 1000, 3)}
+
+
+def own_usage():
+    usage = resource.getrusage(resource.RUSAGE_SELF)
+    return {"cpu_s": round(usage.ru_utime + usage.ru_stime, 3), "max_rss_kb": usage.ru_maxrss}
+
+
+def proc_usage(pid):
+    """CPU time and peak RSS of another process, from /proc."""
+    with open(f"/proc/{pid}/stat") as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    cpu_s = (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+    max_rss_kb = 0
+    with open(f"/proc/{pid}/status") as f:
+        for line in f:
+            if line.startswith("VmHWM:"):
+                max_rss_kb = int(line.split()[1])
+    return {"cpu_s": round(cpu_s, 3), "max_rss_kb": max_rss_kb}
+
+
+def tree_usage(pid):
+    """proc_usage() of a process and its children added up: the bridge supervisor and its workers."""
+    pids = [pid]
+    for entry in os.listdir("/proc"):
+        if entry.isdigit():
+            try:
+                with open(f"/proc/{entry}/stat") as f:
+                    if int(f.read().rsplit(")", 1)[1].split()[1]) == pid:
+                        pids.append(int(entry))
+            except OSError:
+                pass
+    usages = [proc_usage(p) for p in pids]
+    return {"cpu_s": round(sum(u["cpu_s"] for u in usages), 3),
+            "max_rss_kb": sum(u["max_rss_kb"] for u in usages), "processes": len(usages)}
+
+
+class Schedule:
+    def __init__(self, cfg):
+        rng = random.Random(cfg["seed"])
+        self.rate = cfg["rate"]
+        self.t0 = cfg["t0"]
+        self.phases = [rng.random() / self.rate for _ in range(cfg["tags"])]
+        self.addrs = [bytes((0xc0, 0xde)) + k.to_bytes(4, "big") for k in range(cfg["tags"])]
+        self.index = {addr.hex(): k for k, addr in enumerate(self.addrs)}
+
+    def due(self, k, j):
+        return self.t0 + self.phases[k] + j / self.rate
+
+    def sample_index(self, k, seq, now):
+        """The latest sample of tag k with this 8-bit sequence number that was due by now."""
+        j = int((now - self.t0 - self.phases[k]) * self.rate)
+        return j - ((j - seq) % 256)
+
+
+def tag_adv(dist_cm, seq):
+    # As uwb_tag.ino advertises it
+    mfg = encode_range(dist_cm, seq)
+    return bytes((len(mfg) + 1, 0xFF)) + mfg
+
+
+def run_generator(cfg, results):
+    """Tags, gateways and mesh: offers the load and sends the datagrams that survive the mesh to the bridge."""
+    schedule = Schedule(cfg)
+    rng = random.Random(cfg["seed"] + 1)
+    gateways = [GatewayModel() for _ in range(cfg["gateways"])]
+    # One socket per gateway: the bridge workers are picked by source address and port
+    socks = [socket.socket(socket.AF_INET, socket.SOCK_DGRAM) for _ in gateways]
+    for sock in socks:
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, 1 << 21)
+    bridge = ("127.0.0.1", cfg["bridge_port"])
+    end = cfg["t0"] + cfg["duration"]
+    next_j = [0] * cfg["tags"]
+    owners = [max(range(len(gateways)), key=lambda g: -((k + 7 * g) % 40)) for k in range(cfg["tags"])]
+    frames = [[] for _ in gateways]
+    in_flight = []            # (delivery time, tie, datagram, sampled keys)
+    tie = 0
+    stats = {"offered": 0, "forwarded": 0, "datagrams": 0, "mesh_dropped": 0, "mesh_reordered": 0}
+    gateway_latency = []
+    delivered = {}            # (tag, j) -> first delivery time, sampled keys only
+
+    def send_frame(g, now):
+        nonlocal tie
+        lines = frames[g]
+        frames[g] = []
+        if not lines:
+            return
+        packed, keys, size = [], [], 0
+        for text, key in lines + [(None, None)]:
+            if text is None or size + len(text) + 1 > UDP_FRAME_LEN:
+                stats["datagrams"] += 1
+                if rng.random() < cfg["loss"]:
+                    stats["mesh_dropped"] += 1
+                else:
+                    delay = MESH_DELAY_S
+                    if rng.random() < cfg["reorder"]:
+                        delay += rng.random() * cfg["reorder_ms"] / 1000
+                        stats["mesh_reordered"] += 1
+                    heapq.heappush(in_flight, (now + delay, tie, g, "\n".join(packed).encode(), keys))
+                    tie += 1
+                packed, keys, size = [], [], 0
+            if text is not None:
+                packed.append(text)
+                size += len(text) + 1
+                if key is not None:
+                    keys.append(key)
+
+    while True:
+        now = time.monotonic()
+        if now >= end and not in_flight and not any(frames):
+            break
+        # Tags: every sample due by now is heard by every gateway, at a per-gateway RSSI. With ownership, as
+        # gw_owner.c settles, only the gateway hearing the tag strongest forwards it
+        if now < end:
+            for k in range(cfg["tags"]):
+                while schedule.due(k, next_j[k]) <= now:
+                    j = next_j[k]
+                    next_j[k] += 1
+                    stats["offered"] += 1
+                    adv = tag_adv(100 + (j % 500), j % 256)
+                    for g, gateway in enumerate(gateways):
+                        rssi = -50 - ((k + 7 * g) % 40)
+                        if cfg["owner"] and g != owners[k]:
+                            continue
+                        scan = schedule.addrs[k] + struct.pack("<bB", rssi, len(adv)) + adv
+                        text = gateway.process(int(now * 1e6), scan)
+                        if text is not None:
+                            stats["forwarded"] += 1
+                            key = (k, j) if j % SAMPLE_EVERY == 0 else None
+                            frames[g].append((text, key))
+                            if key is not None:
+                                gateway_latency.append(now - schedule.due(k, j))
+        # Gateways: each TX window goes out as datagrams of up to UDP_FRAME_LEN
+        for g in range(len(gateways)):
+            send_frame(g, now)
+        # Mesh: deliver what is due, late ones overtake nothing, delayed ones are overtaken
+        while in_flight and in_flight[0][0] <= now:
+            _, _, g, datagram, keys = heapq.heappop(in_flight)
+            socks[g].sendto(datagram, bridge)
+            for key in keys:
+                delivered.setdefault(key, now)
+        time.sleep(TX_WINDOW_S)
+
+    stats["gateway_latency"] = percentiles(gateway_latency)
+    stats["usage"] = own_usage()
+    results.put(("generator", stats, delivered))
+
+
+def read_mqtt_packet(buf):
+    """Take one complete MQTT packet (first byte, body) off the front of buf, or None."""
+    length, shift, pos = 0, 0, 1
+    while pos < len(buf):
+        byte = buf[pos]
+        length |= (byte & 0x7F) << shift
+        shift += 7
+        pos += 1
+        if not byte & 0x80:
+            break
+    else:
+        return None
+    if len(buf) < pos + length:
+        return None
+    packet = (buf[0], bytes(buf[pos:pos + length]))
+    del buf[:pos + length]
+    return packet
+
+
+def run_broker(cfg, listener, results, connected, stop, t0, last_rx):
+    """MQTT 3.1.1 stand-in: acknowledges CONNECT and QoS 1 PUBLISH, records when each range arrives.
+
+    Serves any number of connections: one per bridge worker, plus the supervisor's.
+    """
+    schedule = None          # Built on the first range, once the parent has fixed t0
+    sel = selectors.DefaultSelector()
+    listener.setblocking(False)
+    sel.register(listener, selectors.EVENT_READ)
+    stats = {"publishes": 0, "ranges": 0, "duplicates": 0, "gap_markers": 0, "gap_samples": 0, "other": 0}
+    received = {}            # (tag, j) -> arrival, sampled keys only
+    seen = set()
+    while not stop.is_set():
+        for key, _ in sel.select(0.2):
+            if key.fileobj is listener:
+                conn, _ = listener.accept()
+                conn.setblocking(True)
+                sel.register(conn, selectors.EVENT_READ, bytearray())
+                continue
+            conn, buf = key.fileobj, key.data
+            data = conn.recv(65536)
+            if not data:
+                sel.unregister(conn)
+                conn.close()
+                continue
+            buf += data
+            now = time.monotonic()
+            last_rx.value = now
+            while True:
+                packet = read_mqtt_packet(buf)
+                if packet is None:
+                    break
+                kind, body = packet
+                if kind >> 4 == 1:                                  # CONNECT
+                    conn.sendall(b"\x20\x02\x00\x00")
+                    with connected.get_lock():
+                        connected.value += 1
+                elif kind >> 4 == 3:                                # PUBLISH
+                    qos = (kind >> 1) & 3
+                    topic_len = struct.unpack_from(">H", body)[0]
+                    topic = body[2:2 + topic_len].decode()
+                    pos = 2 + topic_len
+                    if qos:
+                        conn.sendall(b"\x40\x02" + body[pos:pos + 2])
+                        pos += 2
+                    stats["publishes"] += 1
+                    payload = body[pos:].decode(errors="replace")
+                    fields = payload.split(",")
+                    if topic != "test/topic":
+                        stats["other"] += 1
+                    elif fields[0] == "gap":
+                        stats["gap_markers"] += 1
+                        stats["gap_samples"] += int(fields[3])
+                    else:
+                        schedule = schedule or Schedule(dict(cfg, t0=t0.value))
+                        k = schedule.index.get(fields[0])
+                        if k is None:
+                            stats["other"] += 1
+                            continue
+                        key = (k, schedule.sample_index(k, int(fields[1]), now))
+                        if key in seen:
+                            stats["duplicates"] += 1
+                            continue
+                        seen.add(key)
+                        stats["ranges"] += 1
+                        if key[1] % SAMPLE_EVERY == 0:
+                            received[key] = now
+                elif kind >> 4 == 12:                               # PINGREQ
+                    conn.sendall(b"\xd0\x00")
+    stats["usage"] = own_usage()
+    results.put(("broker", stats, received))
+
+
+def run_case(cfg, repo_dir):
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.bind(("127.0.0.1", 0))
+    listener.listen(16)
+    probe = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    probe.bind(("127.0.0.1", 0))
+    cfg["bridge_port"] = probe.getsockname()[1]
+    probe.close()
+
+    ctx = mp.get_context("fork")    # The broker inherits the listening socket
+    results, connected, stop = ctx.Queue(), ctx.Value("i", 0), ctx.Event()
+    t0, last_rx = ctx.Value("d", 0.0, lock=False), ctx.Value("d", 0.0, lock=False)
+    broker = ctx.Process(target=run_broker, args=(cfg, listener, results, connected, stop, t0, last_rx))
+    broker.start()
+
+    workdir = tempfile.mkdtemp(prefix="uwb_bench_")
+    env = dict(os.environ, BRIDGE_UDP_IP='"127.0.0.1"', BRIDGE_UDP_PORT=str(cfg["bridge_port"]),
+               BRIDGE_MQTT_BROKER='"127.0.0.1"', BRIDGE_MQTT_PORT=str(listener.getsockname()[1]),
+               BRIDGE_STATE_SOCKET=json.dumps(os.path.join(workdir, "state.sock")),
+               BRIDGE_SHM_RING=json.dumps(f"/dev/shm/uwb_bench_{os.getpid()}"),
+               BRIDGE_METRICS_INTERVAL_S="3600", BRIDGE_WORKERS=str(cfg["workers"]), PYTHONPATH=repo_dir)
+    bridge = subprocess.Popen([sys.executable, os.path.join(repo_dir, "mqttconnection.py")], cwd=workdir, env=env,
+                              stdout=subprocess.DEVNULL)
+    # The bridge binds its UDP socket right after connecting to the broker; with workers, the supervisor connects too
+    expected = cfg["workers"] + 1 if cfg["workers"] > 1 else 1
+    deadline = time.monotonic() + 30
+    while connected.value < expected:
+        if time.monotonic() > deadline:
+            raise RuntimeError("bridge did not connect to the broker stand-in")
+        time.sleep(0.05)
+    time.sleep(0.5)
+
+    cfg["t0"] = t0.value = time.monotonic() + 0.2
+    generator = ctx.Process(target=run_generator, args=(cfg, results))
+    generator.start()
+    collected = {}
+    collected["generator"] = results.get()[1:]
+    drain_start = time.monotonic()
+    time.sleep(DRAIN_S)
+    while time.monotonic() - last_rx.value < DRAIN_IDLE_S and time.monotonic() - drain_start < DRAIN_MAX_S:
+        time.sleep(0.1)
+    drain_s = time.monotonic() - drain_start
+    bridge_usage = tree_usage(bridge.pid)
+    stop.set()
+    collected["broker"] = results.get()[1:]
+    bridge.terminate()
+    bridge.wait()
+    generator.join()
+    broker.join()
+    subprocess.run(["rm", "-rf", workdir] + glob.glob(f"/dev/shm/uwb_bench_{os.getpid()}*"))
+
+    gen, delivered = collected["generator"]
+    brk, received = collected["broker"]
+    schedule = Schedule(cfg)
+    end_to_end = [t - schedule.due(*key) for key, t in received.items()]
+    ingress = [t - schedule.due(*key) for key, t in delivered.items()]
+    bridge_latency = [t - delivered[key] for key, t in received.items() if key in delivered]
+    offered = gen["offered"]
+    return {
+        "config": {k: cfg[k] for k in ("tags", "rate", "gateways", "owner", "workers", "loss", "reorder",
+                                       "reorder_ms", "duration", "seed")},
+        "offered": offered,
+        "offered_per_s": round(offered / cfg["duration"], 1),
+        "published_ranges": brk["ranges"],
+        "throughput_per_s": round(brk["ranges"] / cfg["duration"], 1),
+        "drain_s": round(drain_s, 2),
+        "drops": {"mesh_datagrams": gen["mesh_dropped"], "datagrams": gen["datagrams"],
+                  "gap_marked": brk["gap_samples"], "missing": offered - brk["ranges"],
+                  "missing_rate": round((offered - brk["ranges"]) / offered, 5) if offered else 0.0,
+                  "duplicates_published": brk["duplicates"]},
+        "latency": {"gateway": gen["gateway_latency"], "gateway_to_bridge": percentiles(ingress),
+                    "bridge_to_broker": percentiles(bridge_latency), "end_to_end": percentiles(end_to_end)},
+        "usage": {"generator": gen["usage"], "bridge": bridge_usage, "broker": brk["usage"]},
+    }
+
+
+def git_commit(repo_dir):
+    try:
+        return subprocess.run(["git", "-C", repo_dir, "rev-parse", "--short", "HEAD"], capture_output=True,
+                              text=True).stdout.strip() or None
+    except OSError:
+        return None
+
+
+# python3 bridge_bench.py --tags 10,100,1000 --rate 1,10 --loss 0.01 --reorder 0.05 --output results.jsonl
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="End-to-end load benchmark of the gateway model and the bridge")
+    parser.add_argument("--tags", default="10,100,1000", help="comma separated tag counts")
+    parser.add_argument("--rate", default="1,10", help="comma separated per-tag rates, Hz")
+    parser.add_argument("--gateways", type=int, default=2, help="gateways hearing every tag")
+    parser.add_argument("--owner", action="store_true", help="only the gateway hearing a tag strongest forwards it")
+    parser.add_argument("--workers", default="1", help="comma separated bridge worker counts (WORKERS)")
+    parser.add_argument("--loss", type=float, default=0.0, help="mesh datagram loss probability")
+    parser.add_argument("--reorder", type=float, default=0.0, help="probability that a datagram is delayed")
+    parser.add_argument("--reorder-ms", type=float, default=100.0, help="maximum extra delay of a delayed datagram")
+    parser.add_argument("--duration", type=float, default=10.0, help="seconds of load per case")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--output", help="append one JSON line per case to this file")
+    args = parser.parse_args()
+
+    repo_dir = os.path.dirname(os.path.abspath(__file__))
+    commit = git_commit(repo_dir)
+    for tags in [int(v) for v in args.tags.split(",")]:
+        for rate in [float(v) for v in args.rate.split(",")]:
+            for workers in [int(v) for v in args.workers.split(",")]:
+                cfg = {"tags": tags, "rate": rate, "gateways": args.gateways, "owner": args.owner,
+                       "workers": workers, "loss": args.loss, "reorder": args.reorder,
+                       "reorder_ms": args.reorder_ms, "duration": args.duration, "seed": args.seed}
+                result = dict(run_case(cfg, repo_dir), commit=commit, timestamp=int(time.time()))
+                line = json.dumps(result)
+                print(line)
+                if args.output:
+                    with open(args.output, "a") as f:
+                        f.write(line + "\n")
@@ -0,0 +1,371 @@
+import argparse
+import ctypes
+import json
+import math
+import os
+import random
+import shutil
+import struct
+import subprocess
+import tempfile
+import time
+
+import bridge_msg
+
+# Decoder of the gateway's compressed range stream (stream_codec.c, "config set codec 1"): per-tag keyframes,
+# then zig-zag varint residuals against a linear prediction of time and distance. See stream_codec.h for the
+# frame layout. A skipped frame seq makes the decoder forget every tag until its next keyframe, so a lost
+# datagram costs at most one resync interval and never yields a wrong sample. The reset has to cover every slot:
+# the encoder advances a tag's state with each record it sends, and nothing in the frames that follow tells which
+# slots the lost one carried. A delta decoded against a state one record behind still gives a plausible sample,
+# with the seq, time and distance of the missing record folded in, so no slot can be trusted to be unaffected.
+
+MAGIC = 0xC5
+VERSION = 1
+HDR = struct.Struct("<BBHI")
+MAX_TAGS = 64
+SAMPLE_BIN = struct.Struct("<6sBIHb")   # The same sample uncompressed, STREAM_CODEC_SAMPLE_BIN_LEN
+FRAME_MAX = 384
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def _varint(data, pos):
+    value = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        if b < 0x80:
+            return value, pos
+        shift += 7
+        if shift > 28:
+            raise ValueError("varint too long")
+
+
+def _zigzag(data, pos):
+    value, pos = _varint(data, pos)
+    return (value >> 1) ^ -(value & 1), pos
+
+
+def _s32(value):
+    value &= 0xFFFFFFFF
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+class StreamDecoder:
+    """State of one gateway's stream. decode() returns [(tag, seq, time_ms, dist_cm, rssi)] per frame."""
+
+    def __init__(self):
+        # slot -> [addr, seq, rssi, dist_cm, dist_step, time_ms, time_step], None until its keyframe
+        self.slots = [None] * MAX_TAGS
+        self.expected = None
+        self.frames = 0
+        self.samples = 0
+        self.keyframes = 0
+        self.lost_frames = 0
+        self.stale_frames = 0
+        self.unsynced = 0       # Deltas dropped for want of their tag's keyframe
+        self.bad_frames = 0
+
+    def decode(self, data):
+        _, version, frame_seq, base_ms = HDR.unpack_from(data)
+        if version != VERSION:
+            self.bad_frames += 1
+            return []
+        if self.expected is not None and frame_seq != self.expected:
+            gap = (frame_seq - self.expected) & 0xFFFF
+            if gap >= 0x8000:
+                # Older than one already decoded: the tags it would update have moved on
+                self.stale_frames += 1
+                return []
+            self.lost_frames += gap
+            # Any slot may have had a record in the lost frames, see above
+            self.slots = [None] * MAX_TAGS
+        self.expected = (frame_seq + 1) & 0xFFFF
+        self.frames += 1
+
+        out = []
+        pos = HDR.size
+        try:
+            while pos < len(data):
+                head, pos = _varint(data, pos)
+                slot = head >> 1
+                if slot >= MAX_TAGS:
+                    raise ValueError("slot out of range")
+                if head & 1:
+                    addr = data[pos:pos + 6].hex()
+                    seq = data[pos + 6]
+                    offset, pos = _zigzag(data, pos + 7)
+                    time_step, pos = _zigzag(data, pos)
+                    dist, pos = _varint(data, pos)
+                    dist_step, pos = _zigzag(data, pos)
+                    rssi = struct.unpack_from("<b", data, pos)[0]
+                    pos += 1
+                    time_ms = (base_ms + offset) & 0xFFFFFFFF
+                    self.keyframes += 1
+                else:
+                    r_seq, pos = _zigzag(data, pos)
+                    r_time, pos = _zigzag(data, pos)
+                    r_dist, pos = _zigzag(data, pos)
+                    r_rssi, pos = _zigzag(data, pos)
+                    tag = self.slots[slot]
+                    if tag is None:
+                        self.unsynced += 1
+                        continue
+                    addr, last_seq, last_rssi, last_dist, dist_step, last_time, time_step = tag
+                    seq = (last_seq + 1 + r_seq) & 0xFF
+                    time_ms = (last_time + time_step + r_time) & 0xFFFFFFFF
+                    dist = last_dist + dist_step + r_dist
+                    rssi = last_rssi + r_rssi
+                    time_step = _s32(time_ms - last_time)
+                    dist_step = dist - last_dist
+                if pos > len(data) or not 0 <= dist <= 0xFFFF:
+                    raise ValueError("record cut short")
+                self.slots[slot] = [addr, seq, rssi, dist, dist_step, time_ms, time_step]
+                out.append((addr, seq, time_ms, dist, rssi))
+        except (IndexError, ValueError, struct.error):
+            # Damaged frame: keep what decoded, the rest of the stream waits for keyframes
+            self.bad_frames += 1
+            self.slots = [None] * MAX_TAGS
+        self.samples += len(out)
+        return out
+
+
+class CodecReceiver:
+    """Picks the compressed frames out of the gateway datagrams, one decoder per gateway."""
+
+    def __init__(self):
+        self.streams = {}
+
+    def handle(self, data, addr):
+        """Returns the decoded samples, or None if the datagram is not a compressed frame."""
+        if len(data) < HDR.size or data[0] != MAGIC:
+            return None
+        stream = self.streams.get(addr)
+        if stream is None:
+            stream = self.streams[addr] = StreamDecoder()
+        return stream.decode(data)
+
+    def metrics(self):
+        streams = self.streams.values()
+        return {"codec_gateways": len(self.streams),
+                **{"codec_" + key: sum(getattr(s, key) for s in streams)
+                   for key in ("frames", "samples", "keyframes", "lost_frames", "stale_frames", "unsynced",
+                               "bad_frames")}}
+
+
+def range_lines(samples):
+    """Decoded samples as the gateway's text range lines, for the rest of the bridge."""
+    return [bridge_msg.format_line("range", tag, seq, dist, rssi) for tag, seq, _, dist, rssi in samples]
+
+
+# Benchmark: stream_codec.c compiled for the host, on the ranges the gateway would forward for recorded traces
+
+class _Sample(ctypes.Structure):
+    _fields_ = [("addr", ctypes.c_uint8 * 6), ("seq", ctypes.c_uint8), ("rssi", ctypes.c_int8),
+                ("dist_cm", ctypes.c_uint16), ("time_ms", ctypes.c_uint32)]
+
+
+SHIM = """
+#include <string.h>
+#include <time.h>
+#include "stream_codec.h"
+
+static void sim_emit(STREAM_ENCODER *enc, uint8_t *out, size_t *used, uint32_t *lens, size_t *frames)
+{
+    const uint8_t *frame;
+    size_t len = stream_encoder_flush(enc, &frame);
+    if (len > 0 && out != NULL) {
+        memcpy(out + *used, frame, len);
+        *used += len;
+        lens[(*frames)++] = len;
+    }
+}
+
+/* Encode samples in TX windows of window_ms, as the gateway's sender does; frames go to out unless it is NULL */
+unsigned long long sim_encode(const STREAM_SAMPLE *samples, size_t n, uint32_t window_ms, uint32_t resync_ms,
+                              uint16_t resync_samples, uint8_t *out, uint32_t *lens, size_t *frames)
+{
+    STREAM_CODEC_CONFIG config = {.resync_ms = resync_ms, .resync_samples = resync_samples};
+    STREAM_ENCODER enc;
+    struct timespec t0, t1;
+    size_t used = 0;
+
+    *frames = 0;
+    stream_encoder_init(&enc, &config, 0);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint32_t window_start = n > 0 ? samples[0].time_ms : 0;
+    for (size_t i = 0; i < n; i++) {
+        if (samples[i].time_ms - window_start >= window_ms) {
+            sim_emit(&enc, out, &used, lens, frames);
+            window_start = samples[i].time_ms;
+        }
+        if (!stream_encoder_add(&enc, &samples[i])) {
+            sim_emit(&enc, out, &used, lens, frames);
+            stream_encoder_add(&enc, &samples[i]);
+        }
+    }
+    sim_emit(&enc, out, &used, lens, frames);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+}
+"""
+
+
+def load_encoder(workdir):
+    """Build stream_codec.c into a shared library with the benchmark driver."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run stream_codec.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    lib = os.path.join(workdir, "stream_codec.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", lib, shim, os.path.join(HERE, "stream_codec.c")],
+                   check=True)
+    dll = ctypes.CDLL(lib)
+    dll.sim_encode.restype = ctypes.c_ulonglong
+    dll.sim_encode.argtypes = [ctypes.POINTER(_Sample), ctypes.c_size_t, ctypes.c_uint32, ctypes.c_uint32,
+                               ctypes.c_uint16, ctypes.c_void_p, ctypes.c_void_p, ctypes.POINTER(ctypes.c_size_t)]
+    return dll
+
+
+def trace_samples(path):
+    """Ranges the gateway forwards for a capture's scan results, with their receive time."""
+    from bridge_trace import SRC_BLE_ADV, GatewayModel, read_records
+    gateway = GatewayModel()
+    samples = []
+    for source, time_us, payload in read_records(path):
+        if source != SRC_BLE_ADV:
+            continue
+        line = gateway.process(time_us, payload)
+        parsed = bridge_msg.parse_line(line) if line is not None else None
+        if parsed is not None and parsed[0] == "range":
+            tag, seq, dist, rssi = parsed[1]
+            samples.append((tag, seq, (time_us // 1000) & 0xFFFFFFFF, dist, rssi))
+    return samples
+
+
+def synth_capture(path, tags, duration_s, seed):
+    """Write a capture of tags walking around one gateway: 10 Hz ranging, 4 adv copies per range."""
+    from bridge_trace import SRC_BLE_ADV, TraceWriter
+    from tag_rate_sim import Walker
+    rng = random.Random(seed)
+    cfg = {"room_m": 20.0, "still_s": 30.0, "speed_m_s": [0.5, 1.5]}
+    events = []
+    for k in range(tags):
+        walker = Walker(random.Random(seed * 1000 + k), cfg)
+        bda = bytes((0xC0, 0xFF, 0xEE, 0x00, k >> 8, k & 0xFF))
+        t, seq = rng.uniform(0, 0.1), rng.randrange(256)
+        while t < duration_s:
+            dist = max(0, int(walker.at(t) * 100 + rng.gauss(0, 3)))
+            rssi = max(-100, min(-30, int(-45 - 20 * math.log10(max(dist, 10) / 100) + rng.gauss(0, 2))))
+            mfg = bridge_msg.encode_range(dist, seq)
+            adv = bytes((2, 0x01, 0x06, len(mfg) + 1, 0xFF)) + mfg
+            for copy in range(4):
+                if rng.random() < 0.7:     # Copies the scanner catches
+                    rx = t + copy * 0.03 + rng.uniform(0, 0.01)
+                    events.append((int(rx * 1e6), bda + struct.pack("<bB", rssi, len(adv)) + adv))
+            t += 0.1 + rng.uniform(0, 0.001)
+            seq = (seq + 1) & 0xFF
+    events.sort(key=lambda e: e[0])
+    writer = TraceWriter(path)
+    for time_us, payload in events:
+        writer.write(SRC_BLE_ADV, time_us, payload)
+    writer.close()
+
+
+def text_frames(samples, window_ms):
+    """Payload sizes of the current text stream: lines joined by newlines, frames of up to FRAME_MAX bytes."""
+    sizes, cur, start = [], 0, None
+    for tag, seq, time_ms, dist, rssi in samples:
+        n = len(bridge_msg.format_line("range", tag, seq, dist, rssi))
+        if start is None or time_ms - start >= window_ms or cur + 1 + n > FRAME_MAX:
+            if cur:
+                sizes.append(cur)
+            cur, start = n, time_ms if start is None or time_ms - start >= window_ms else start
+        else:
+            cur += 1 + n
+    return sizes + ([cur] if cur else [])
+
+
+def bench(samples, dll, args):
+    n = len(samples)
+    arr = (_Sample * n)()
+    for i, (tag, seq, time_ms, dist, rssi) in enumerate(samples):
+        arr[i].addr[:] = bytes.fromhex(tag)
+        arr[i].seq, arr[i].time_ms, arr[i].dist_cm, arr[i].rssi = seq, time_ms, dist, rssi
+    frames = ctypes.c_size_t()
+    encode_ns = min(dll.sim_encode(arr, n, args.window_ms, args.resync_ms, args.resync_samples, None, None,
+                                   ctypes.byref(frames)) for _ in range(args.repeat))
+    out = ctypes.create_string_buffer(n * 32 + 4096)
+    lens = (ctypes.c_uint32 * (n + 1))()
+    dll.sim_encode(arr, n, args.window_ms, args.resync_ms, args.resync_samples, out, lens, ctypes.byref(frames))
+    blob, pos, stream = out.raw, 0, []
+    for i in range(frames.value):
+        stream.append(blob[pos:pos + lens[i]])
+        pos += lens[i]
+    codec_bytes = pos
+
+    # Round trip, then the same stream with datagrams lost: nothing decoded may differ from what was sent
+    decoder = StreamDecoder()
+    start = time.perf_counter()
+    per_frame = [decoder.decode(frame) for frame in stream]
+    decode_s = time.perf_counter() - start
+    decoded = [s for frame in per_frame for s in frame]
+    rng = random.Random(args.seed)
+    lost = [rng.random() < args.loss for _ in stream]
+    lossy = StreamDecoder()
+    lossy_out = [s for frame, drop in zip(stream, lost) if not drop for s in lossy.decode(frame)]
+    in_lost = sum(len(frame) for frame, drop in zip(per_frame, lost) if drop)
+    sent = set(samples)
+
+    text = text_frames(samples, args.window_ms)
+    text_bytes = sum(text)
+    binary_bytes = n * SAMPLE_BIN.size
+    return {
+        "samples": n,
+        "tags": len({s[0] for s in samples}),
+        "window_ms": args.window_ms,
+        "resync_ms": args.resync_ms,
+        "bytes_per_sample": {"text": round(text_bytes / n, 2), "binary": SAMPLE_BIN.size,
+                             "codec": round(codec_bytes / n, 2)},
+        "datagrams": {"text": len(text), "codec": len(stream)},
+        "ratio_vs_binary": round(binary_bytes / codec_bytes, 2),
+        "ratio_vs_text": round(text_bytes / codec_bytes, 2),
+        "keyframe_fraction": round(decoder.keyframes / n, 3),
+        "encode_ns_per_sample": round(encode_ns / n, 1),
+        "decode_us_per_sample": round(decode_s / n * 1e6, 2),
+        "round_trip_exact": decoded == samples,
+        "loss": {"frame_loss": args.loss, "frames_lost": sum(lost), "samples_in_lost_frames": in_lost,
+                 "decoded": len(lossy_out), "unsynced_dropped": lossy.unsynced,
+                 "wrong": sum(1 for s in lossy_out if s not in sent)},
+    }
+
+
+# python3 bridge_codec.py capture.utrc [...] or python3 bridge_codec.py --synth 20
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Compression ratio and encode cost of the gateway range codec")
+    parser.add_argument("captures", nargs="*", help="gateway trace captures (bridge_trace.py capture)")
+    parser.add_argument("--synth", type=int, metavar="TAGS", help="benchmark a synthetic capture of this many tags")
+    parser.add_argument("--duration", type=float, default=120.0, help="synthetic capture length, s")
+    parser.add_argument("--window-ms", type=int, default=200, help="TX window, as the send period")
+    parser.add_argument("--resync-ms", type=int, default=1000)
+    parser.add_argument("--resync-samples", type=int, default=64)
+    parser.add_argument("--loss", type=float, default=0.02, help="datagram loss for the resync check")
+    parser.add_argument("--repeat", type=int, default=5, help="encode runs, the fastest is reported")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_encoder(workdir)
+        captures = list(args.captures)
+        if args.synth:
+            path = os.path.join(workdir, "synth.utrc")
+            synth_capture(path, args.synth, args.duration, args.seed)
+            captures.append(path)
+        for path in captures:
+            samples = trace_samples(path)
+            if samples:
+                print(json.dumps({"capture": os.path.basename(path), **bench(samples, dll, args)}))
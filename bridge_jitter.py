@@ -0,0 +1,173 @@
+from collections import OrderedDict, deque
+
+from bridge_msg import format_line
+
+SEQ_MOD = 256           # Tags number their ranges with one byte
+SEQ_HALF = SEQ_MOD // 2
+
+
+def seq_diff(a, b):
+    """Signed distance a - b between two tag sequence numbers."""
+    return (a - b + SEQ_HALF) % SEQ_MOD - SEQ_HALF
+
+
+def gap_marker(tag, first_seq, count):
+    """Published in the sample stream where count samples starting at first_seq never arrived."""
+    return format_line("gap", tag, first_seq, count)
+
+
+class TagStream:
+    __slots__ = ("next_seq", "held", "last_seen", "received", "released", "reordered", "lost", "late", "duplicates",
+                 "resyncs")
+
+    def __init__(self, seq, now):
+        self.next_seq = seq
+        self.held = {}              # seq -> payload, samples waiting for an earlier one
+        self.last_seen = now
+        self.received = 0
+        self.released = 0
+        self.reordered = 0          # Released after waiting for an earlier sample
+        self.lost = 0               # Covered by gap markers
+        self.late = 0               # Arrived after their gap was declared, dropped
+        self.duplicates = 0
+        self.resyncs = 0            # Samples too far behind to be late, the stream restarted at them
+
+
+class JitterBuffer:
+    """Per-tag reorder buffer: publishes each tag's samples in sequence order.
+
+    A sample that arrives ahead of the expected sequence number is held for at most hold_s.
+    When it expires, the missing samples before it are declared lost with a gap marker and the
+    held samples are released in order. Samples arriving after their gap are dropped as late, as long as
+    they are at most max_held behind: further back, the tag jumped (a gateway restart, or more than half the
+    sequence space missed) and the stream resyncs to it, flushing what is held and marking the jump as a gap.
+    Every operation is O(1) amortised: deadlines expire in arrival order, so a FIFO replaces a
+    priority queue. At most max_tags tags are tracked, the least recently heard is forgotten.
+    """
+
+    def __init__(self, hold_s=0.2, stale_s=10.0, max_tags=20000, max_held=64):
+        self.hold_s = hold_s
+        self.stale_s = stale_s
+        self.max_tags = max_tags
+        self.max_held = max_held
+        self.tags = OrderedDict()   # tag -> TagStream, least recently heard first
+        self.deadlines = deque()    # (deadline, tag, seq) in arrival order
+        self.gaps = 0
+
+    def add(self, tag, seq, payload, now):
+        """Offer one sample. Returns the payloads and gap markers to publish now, in order."""
+        stream = self.tags.get(tag)
+        if stream is None or now - stream.last_seen > self.stale_s:
+            # A new or long-silent tag starts at whatever it sends: silence is not loss
+            stream = TagStream(seq, now)
+            self.tags[tag] = stream
+            if len(self.tags) > self.max_tags:
+                self.tags.popitem(last=False)
+        self.tags.move_to_end(tag)
+        stream.last_seen = now
+        stream.received += 1
+
+        ahead = seq_diff(seq, stream.next_seq)
+        if ahead < -self.max_held:
+            out = []
+            self._resync(tag, stream, seq, out)
+            out.append(payload)
+            stream.released += 1
+            self._drain(stream, out)
+            return out
+        if ahead < 0:
+            stream.late += 1
+            return []
+        if seq in stream.held:
+            stream.duplicates += 1
+            return []
+        if ahead == 0:
+            out = [payload]
+            stream.released += 1
+            stream.next_seq = (seq + 1) % SEQ_MOD
+            self._drain(stream, out)
+            return out
+
+        stream.held[seq] = payload
+        self.deadlines.append((now + self.hold_s, tag, seq))
+        if len(stream.held) > self.max_held:
+            # Far too much out of order: give up on the oldest gap right away
+            out = []
+            self._skip_to_first_held(tag, stream, out)
+            return out
+        return []
+
+    def flush(self, now):
+        """Release the samples whose hold time expired, with gap markers for what is still missing."""
+        out = []
+        while self.deadlines and self.deadlines[0][0] <= now:
+            _, tag, seq = self.deadlines.popleft()
+            stream = self.tags.get(tag)
+            if stream is None or seq not in stream.held:
+                continue    # Released in order meanwhile, or the tag was forgotten
+            self._skip_to(tag, stream, seq, out)
+        return out
+
+    def metrics(self):
+        totals = {"received": 0, "released": 0, "reordered": 0, "lost": 0, "late": 0, "duplicates": 0,
+                  "resyncs": 0}
+        held = 0
+        for stream in self.tags.values():
+            for name in totals:
+                totals[name] += getattr(stream, name)
+            held += len(stream.held)
+        totals.update({"tags": len(self.tags), "held": held, "gaps": self.gaps})
+        return totals
+
+    def tag_stats(self):
+        """Per-tag loss and reorder counters."""
+        return {tag: {"received": s.received, "reordered": s.reordered, "lost": s.lost, "late": s.late,
+                      "resyncs": s.resyncs,
+                      "loss_ratio": s.lost / (s.released + s.lost) if s.released + s.lost else 0.0}
+                for tag, s in self.tags.items()}
+
+    def _skip_to_first_held(self, tag, stream, out):
+        first = min(stream.held, key=lambda s: seq_diff(s, stream.next_seq))
+        self._skip_to(tag, stream, first, out)
+
+    def _resync(self, tag, stream, seq, out):
+        if stream.held:
+            last = max(stream.held, key=lambda s: seq_diff(s, stream.next_seq))
+            self._skip_to(tag, stream, last, out)
+        # Counted forward from the last sample released: the fewest samples the jump can have skipped
+        missing = (seq - stream.next_seq) % SEQ_MOD
+        if missing:
+            out.append(gap_marker(tag, stream.next_seq, missing))
+            stream.lost += missing
+            self.gaps += 1
+        stream.next_seq = (seq + 1) % SEQ_MOD
+        stream.resyncs += 1
+
+    def _skip_to(self, tag, stream, seq, out):
+        missing = seq_diff(seq, stream.next_seq)
+        # Held samples before seq are released on the way, each remaining hole becomes a gap
+        while missing > 0:
+            first_seq = stream.next_seq
+            count = 0
+            while count < missing and (first_seq + count) % SEQ_MOD not in stream.held:
+                count += 1
+            if count:
+                out.append(gap_marker(tag, first_seq, count))
+                stream.lost += count
+                self.gaps += 1
+            stream.next_seq = (first_seq + count) % SEQ_MOD
+            missing -= count
+            if missing > 0:
+                self._release_next(stream, out)
+                missing -= 1
+        self._drain(stream, out)
+
+    def _release_next(self, stream, out):
+        out.append(stream.held.pop(stream.next_seq))
+        stream.released += 1
+        stream.reordered += 1
+        stream.next_seq = (stream.next_seq + 1) % SEQ_MOD
+
+    def _drain(self, stream, out):
+        while stream.next_seq in stream.held:
+            self._release_next(stream, out)
@@ -0,0 +1,114 @@
+from collections import OrderedDict
+
+# Keep the copy heard with the best RSSI, or publish the first copy straight away
+POLICY_BEST_RSSI = "rssi"
+POLICY_FIRST_ARRIVAL = "first"
+
+
+class MergeStage:
+    """Merges the copies of one sample forwarded by overlapping gateways.
+
+    Samples are keyed by (tag, seq). With the best-RSSI policy every key is held for window_s
+    after its first copy and the strongest copy is published. With the first-arrival policy the
+    first copy is published at once. In both cases keys are remembered for seen_s so that late
+    copies are dropped, not published twice. Memory is bounded by max_pending held keys and
+    max_seen remembered keys; the oldest entries are forced out first.
+    """
+
+    def __init__(self, window_s=0.05, policy=POLICY_BEST_RSSI, seen_s=5.0, max_pending=20000, max_seen=200000):
+        self.window_s = window_s
+        self.policy = policy
+        self.seen_s = seen_s
+        self.max_pending = max_pending
+        self.max_seen = max_seen
+        self.pending = OrderedDict()   # key -> [first_seen, best_rssi, payload, copies]
+        self.seen = OrderedDict()      # key -> publish time
+        self.received = 0
+        self.published = 0
+        self.duplicates = 0
+        self.late_duplicates = 0
+        self.latency_sum = 0.0
+        self.latency_max = 0.0
+
+    def add(self, key, rssi, payload, now):
+        """Offer one copy. Returns the payloads to publish now."""
+        self.received += 1
+        held = self.pending.get(key)
+        if held is not None:
+            self.duplicates += 1
+            held[3] += 1
+            if rssi is not None and (held[1] is None or rssi > held[1]):
+                held[1] = rssi
+                held[2] = payload
+            return []
+        if key in self.seen:
+            self.duplicates += 1
+            self.late_duplicates += 1
+            return []
+
+        if self.policy == POLICY_FIRST_ARRIVAL:
+            self._remember(key, now)
+            self._account(0.0)
+            return [payload]
+
+        self.pending[key] = [now, rssi, payload, 1]
+        out = []
+        while len(self.pending) > self.max_pending:
+            out.append(self._release(now))
+        return out
+
+    def flush(self, now):
+        """Publish every held key whose window has expired."""
+        out = []
+        while self.pending:
+            first_seen = next(iter(self.pending.values()))[0]
+            if now - first_seen < self.window_s:
+                break
+            out.append(self._release(now))
+        while self.seen and now - next(iter(self.seen.values())) > self.seen_s:
+            self.seen.popitem(last=False)
+        return out
+
+    def metrics(self):
+        return {
+            "received": self.received,
+            "published": self.published,
+            "duplicates": self.duplicates,
+            "late_duplicates": self.late_duplicates,
+            "duplicate_ratio": self.duplicates / self.received if self.received else 0.0,
+            "merge_latency_avg_ms": 1000.0 * self.latency_sum / self.published if self.published else 0.0,
+            "merge_latency_max_ms": 1000.0 * self.latency_max,
+            "pending": len(self.pending),
+            "remembered": len(self.seen),
+        }
+
+    def _release(self, now):
+        key, (first_seen, rssi, payload, copies) = self.pending.popitem(last=False)
+        self._remember(key, now)
+        self._account(now - first_seen)
+        return payload
+
+    def _remember(self, key, now):
+        self.seen[key] = now
+        if len(self.seen) > self.max_seen:
+            self.seen.popitem(last=False)
+
+    def _account(self, latency):
+        self.published += 1
+        self.latency_sum += latency
+        if latency > self.latency_max:
+            self.latency_max = latency
+
+
+def parse_range(text):
+    """Split a gateway range line "<tag>,<seq>,<distance cm>[,<rssi>]" into (key, rssi), or None."""
+    fields = text.split(",")
+    if len(fields) not in (3, 4):
+        return None
+    try:
+        seq = int(fields[1])
+        int(fields[2])
+        rssi = int(fields[3]) if len(fields) == 4 else None
+    except ValueError:
+        return None
+    return (fields[0], seq), rssi
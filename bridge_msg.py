@@ -0,0 +1,106 @@
+# Generated by uwb_schema.py, edit the schema and regenerate instead of this file.
+import struct
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+MANUFACTURER_ID = 0x1234
+TYPE_IDX = 3
+
+TYPE_RANGE = 0x00
+RANGE_LEN = 4
+RANGE_FIELDS = ('dist_cm', 'seq', 'type')
+RANGE_STRUCT = struct.Struct('<HBB')
+RANGE_DTYPE = None if numpy is None else numpy.dtype([('dist_cm', '<u2'), ('seq', '<u1'), ('type', '<u1')])
+TYPE_TDOA_REPORT = 0x01
+TDOA_REPORT_LEN = 15
+TDOA_REPORT_FIELDS = ('tag_id', 'seq', 'type', 'sync_seq', 'rx_ts', 'sync_ts')
+TDOA_REPORT_STRUCT = struct.Struct('<HBBB5s5s')
+
+
+def _u40(raw):
+    return int.from_bytes(raw, "little")
+
+
+def decode_range(payload):
+    """(dist_cm, seq) of one payload after the manufacturer ID, or None."""
+    if len(payload) < RANGE_LEN or payload[TYPE_IDX] != TYPE_RANGE:
+        return None
+    dist_cm, seq, _type = RANGE_STRUCT.unpack_from(payload)
+    return (dist_cm, seq)
+
+
+def encode_range(dist_cm, seq):
+    """Manufacturer ID and payload, as the sketch advertises them."""
+    return struct.pack("<H", MANUFACTURER_ID) + RANGE_STRUCT.pack(dist_cm, seq, TYPE_RANGE)
+
+
+def decode_tdoa_report(payload):
+    """(tag_id, seq, sync_seq, rx_ts, sync_ts) of one payload after the manufacturer ID, or None."""
+    if len(payload) < TDOA_REPORT_LEN or payload[TYPE_IDX] != TYPE_TDOA_REPORT:
+        return None
+    tag_id, seq, _type, sync_seq, rx_ts, sync_ts = TDOA_REPORT_STRUCT.unpack_from(payload)
+    return (tag_id, seq, sync_seq, _u40(rx_ts), _u40(sync_ts))
+
+
+def encode_tdoa_report(tag_id, seq, sync_seq, rx_ts, sync_ts):
+    """Manufacturer ID and payload, as the sketch advertises them."""
+    return struct.pack("<H", MANUFACTURER_ID) + TDOA_REPORT_STRUCT.pack(tag_id, seq, TYPE_TDOA_REPORT, sync_seq, rx_ts.to_bytes(5, "little"), sync_ts.to_bytes(5, "little"))
+
+
+def decode_range_batch(buf):
+    """Decode back-to-back RANGE_LEN-byte payloads: a numpy record array when numpy is
+    available, else a list of tuples from struct.iter_unpack."""
+    if numpy is not None:
+        return numpy.frombuffer(buf, dtype=RANGE_DTYPE)
+    return list(RANGE_STRUCT.iter_unpack(buf))
+
+
+def decode_adv(payload):
+    """(message name, fields) of one payload after the manufacturer ID, or None."""
+    if len(payload) <= TYPE_IDX:
+        return None
+    if payload[TYPE_IDX] == TYPE_RANGE:
+        fields = decode_range(payload)
+        return None if fields is None else ('range', fields)
+    if payload[TYPE_IDX] == TYPE_TDOA_REPORT:
+        fields = decode_tdoa_report(payload)
+        return None if fields is None else ('tdoa_report', fields)
+    return None
+
+
+# UDP frame records: name -> (prefix or None, field names, field kinds)
+LINES = {
+    'range': (None, ('addr', 'seq', 'dist_cm', 'rssi'), ('bda', 'u', 'u', 'i')),
+    'tdoa': ('tdoa', ('anchor', 'tag_id', 'seq', 'sync_seq', 'rx_ts', 'sync_ts'), ('bda', 'u', 'u', 'u', 'x40', 'x40')),
+    'zone': ('zone', ('addr', 'event', 'zone_id', 'inside_ms'), ('bda', 's', 'u', 'u32')),
+    'agg': ('agg', ('addr', 'window_ms', 'count', 'min', 'max', 'mean', 'variance', 'last'), ('bda', 'u32', 'u32', 'i32', 'i32', 'i32', 'u32', 'i32')),
+    'gap': ('gap', ('tag', 'first_seq', 'count'), ('s', 'u', 'u')),
+}
+_PREFIXES = {prefix: name for name, (prefix, _, _) in LINES.items() if prefix}
+_CONVERT = {"bda": str, "s": str, "u": int, "i": int, "u32": int, "i32": int, "x40": lambda v: int(v, 16)}
+
+
+def parse_line(text):
+    """(record name, field values) of one UDP frame line, or None if it matches no record."""
+    fields = text.split(",")
+    name = _PREFIXES.get(fields[0])
+    if name is None:
+        name = "range"
+    else:
+        fields = fields[1:]
+    _, _, kinds = LINES[name]
+    if len(fields) != len(kinds):
+        return None
+    try:
+        return name, tuple(_CONVERT[kind](value) for kind, value in zip(kinds, fields))
+    except ValueError:
+        return None
+
+
+def format_line(name, *values):
+    prefix, _, kinds = LINES[name]
+    text = ",".join(f"{v:010x}" if kind == "x40" else str(v) for kind, v in zip(kinds, values))
+    return text if prefix is None else prefix + "," + text
@@ -0,0 +1,79 @@
+import struct
+
+# Framing of rel_link.h: reliable frames carry a 6-byte header, best-effort frames are plain text
+REL_MAGIC = 0xA5
+REL_TYPE_DATA = 0x01
+REL_TYPE_ACK = 0x02
+REL_HDR = struct.Struct("<BBHH")
+REL_ACK = struct.Struct("<BBHI")
+SACK_BITS = 32
+RESYNC_DISTANCE = 1024   # A sequence number this far off means the gateway restarted
+
+
+def seq_diff(a, b):
+    """Signed distance a - b between two 16-bit sequence numbers."""
+    return ((a - b + 0x8000) & 0xFFFF) - 0x8000
+
+
+class ReliableStream:
+    """Receive side of one gateway's reliable stream: duplicate filtering and ACK generation.
+
+    Payloads are delivered on first arrival, in arrival order; the cumulative ACK plus the
+    selective ACK bitmap tell the gateway which frames to retransmit.
+    """
+
+    def __init__(self, first_seq):
+        self.expected = first_seq      # Every sequence number before this one was received
+        self.above = set()             # Received sequence numbers after expected
+
+    def receive(self, seq, base):
+        """Record a frame. Returns True if it is new."""
+        if abs(seq_diff(seq, self.expected)) >= RESYNC_DISTANCE:
+            self.expected = base
+            self.above.clear()
+        # The gateway gave up on everything before base: stop waiting for it
+        if seq_diff(base, self.expected) > 0:
+            self.above = {s for s in self.above if seq_diff(s, base) >= 0}
+            self.expected = base
+        new = seq_diff(seq, self.expected) >= 0 and seq not in self.above
+        if new:
+            self.above.add(seq)
+        while self.expected in self.above:
+            self.above.discard(self.expected)
+            self.expected = (self.expected + 1) & 0xFFFF
+        return new
+
+    def ack(self):
+        sack = 0
+        for seq in self.above:
+            offset = seq_diff(seq, self.expected)
+            if 1 <= offset <= SACK_BITS:
+                sack |= 1 << (offset - 1)
+        return REL_ACK.pack(REL_MAGIC, REL_TYPE_ACK, self.expected, sack)
+
+
+class ReliableReceiver:
+    """Demultiplexes gateway datagrams into reliable and best-effort payloads."""
+
+    def __init__(self):
+        self.streams = {}   # gateway address -> ReliableStream
+        self.received = 0
+        self.duplicates = 0
+
+    def handle(self, data, addr):
+        """Returns (payload bytes or None for a duplicate, ACK datagram or None for best-effort)."""
+        if len(data) < REL_HDR.size or data[0] != REL_MAGIC or data[1] != REL_TYPE_DATA:
+            return data, None
+        _, _, seq, base = REL_HDR.unpack_from(data)
+        stream = self.streams.get(addr)
+        if stream is None:
+            stream = self.streams[addr] = ReliableStream(base)
+        self.received += 1
+        if not stream.receive(seq, base):
+            self.duplicates += 1
+            return None, stream.ack()
+        return data[REL_HDR.size:], stream.ack()
+
+    def metrics(self):
+        return {"reliable_received": self.received, "reliable_duplicates": self.duplicates,
+                "reliable_gateways": len(self.streams)}
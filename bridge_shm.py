@@ -0,0 +1,233 @@
+import ctypes
+import ctypes.util
+import errno
+import fcntl
+import mmap
+import os
+import platform
+import struct
+import sys
+import time
+
+# Shared file layout: header, reader table, then a power-of-two array of fixed-size slots.
+# One writer (the bridge); any number of readers, each with its own cursor. The writer never waits
+# for readers: a reader that falls more than the capacity behind loses the overwritten records
+# and counts them as overruns.
+RING_MAGIC = b"URNG"
+RING_VERSION = 1
+RING_HDR = struct.Struct("<4sHHIQI")      # magic, version, slot size, capacity, head (next seq), wake word
+HEAD_OFFSET = 12
+WAKE_OFFSET = 20                          # u32 futex word, bumped on every notify
+READER_TABLE = 64
+READER = struct.Struct("<IIQQ")           # pid (0 for a free entry), reserved, cursor, overruns
+MAX_READERS = 16
+SLOTS_OFFSET = READER_TABLE + MAX_READERS * READER.size
+
+# Slot: stamp (seq + 1 once the record is complete, 0 while it is written), then the record
+SLOT_STAMP = struct.Struct("<Q")
+RECORD = struct.Struct("<qIiihBB16s")     # t_ms, seq, a, b, quality, kind, tag length, tag
+SLOT_SIZE = 48
+
+KIND_RANGE = 1      # a: distance cm, quality: RSSI dBm
+KIND_GAP = 2        # seq: first missing seq, a: count
+KIND_POSITION = 3   # a, b: x, y mm, quality: solver residual mm
+
+RING_CAPACITY = 1 << 16
+
+_FUTEX_WAIT = 0
+_FUTEX_WAKE = 1
+_SYS_FUTEX = {"x86_64": 202, "aarch64": 98, "armv7l": 240, "i686": 240}.get(platform.machine())
+_libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True) if _SYS_FUTEX else None
+
+
+class _Timespec(ctypes.Structure):
+    _fields_ = [("tv_sec", ctypes.c_long), ("tv_nsec", ctypes.c_long)]
+
+
+def _futex(word, op, value, timeout=None):
+    """Shared (not process-private) futex on a word in the mapping. Returns False where futexes are missing."""
+    if _libc is None:
+        return False
+    ts = None
+    if timeout is not None:
+        ts = _Timespec(int(timeout), int((timeout % 1) * 1e9))
+    res = _libc.syscall(_SYS_FUTEX, ctypes.byref(word), op, value, ctypes.byref(ts) if ts else None, None, 0)
+    if res < 0 and ctypes.get_errno() not in (errno.EAGAIN, errno.ETIMEDOUT, errno.EINTR):
+        raise OSError(ctypes.get_errno(), os.strerror(ctypes.get_errno()))
+    return True
+
+
+class SampleRing:
+    """Writer side, owned by mqttconnection.py.
+
+    write() fills one slot and advances the head; notify() wakes the blocked readers once per
+    batch. An existing file with the same geometry is reused so readers survive a bridge restart.
+    """
+
+    def __init__(self, path, capacity=RING_CAPACITY):
+        if capacity & (capacity - 1):
+            raise ValueError("capacity must be a power of two")
+        size = SLOTS_OFFSET + capacity * SLOT_SIZE
+        fd = os.open(path, os.O_RDWR | os.O_CREAT, 0o644)
+        self.file = os.fdopen(fd, "r+b")
+        fcntl.flock(fd, fcntl.LOCK_EX)
+        header = self.file.read(RING_HDR.size)
+        if os.fstat(fd).st_size != size or header[:12] != RING_HDR.pack(RING_MAGIC, RING_VERSION, SLOT_SIZE,
+                                                                         capacity, 0, 0)[:12]:
+            self.file.truncate(0)
+            self.file.truncate(size)
+            self.map = mmap.mmap(fd, size)
+            RING_HDR.pack_into(self.map, 0, RING_MAGIC, RING_VERSION, SLOT_SIZE, capacity, 0, 0)
+        else:
+            self.map = mmap.mmap(fd, size)
+        fcntl.flock(fd, fcntl.LOCK_UN)
+        self.capacity = capacity
+        self.mask = capacity - 1
+        self.head = struct.unpack_from("<Q", self.map, HEAD_OFFSET)[0]
+        self.wake = ctypes.c_uint32.from_buffer(self.map, WAKE_OFFSET)
+        self.notified = self.head
+        self.written = 0
+
+    def write(self, kind, tag, seq, t_ms, a, b=0, quality=0):
+        seq_no = self.head
+        offset = SLOTS_OFFSET + (seq_no & self.mask) * SLOT_SIZE
+        tag_bytes = tag.encode()[:16]
+        # Stamp cleared first and set last, so a reader never takes a half-written record as complete
+        SLOT_STAMP.pack_into(self.map, offset, 0)
+        RECORD.pack_into(self.map, offset + SLOT_STAMP.size, t_ms, seq & 0xFFFFFFFF, a, b, quality, kind,
+                         len(tag_bytes), tag_bytes)
+        SLOT_STAMP.pack_into(self.map, offset, seq_no + 1)
+        self.head = seq_no + 1
+        struct.pack_into("<Q", self.map, HEAD_OFFSET, self.head)
+        self.written += 1
+
+    def notify(self):
+        """Wake readers blocked in wait(); call once after a batch of writes."""
+        if self.notified == self.head:
+            return
+        self.notified = self.head
+        self.wake.value = (self.wake.value + 1) & 0xFFFFFFFF
+        _futex(self.wake, _FUTEX_WAKE, 0x7FFFFFFF)
+
+    def metrics(self):
+        readers, max_lag, overruns = 0, 0, 0
+        for i in range(MAX_READERS):
+            pid, _, cursor, lost = READER.unpack_from(self.map, READER_TABLE + i * READER.size)
+            if pid:
+                readers += 1
+                max_lag = max(max_lag, self.head - cursor)
+                overruns += lost
+        return {"written": self.written, "head": self.head, "readers": readers, "max_lag": max_lag,
+                "overruns": overruns}
+
+    def close(self):
+        del self.wake
+        self.map.close()
+        self.file.close()
+
+
+class RingReader:
+    """Reader side. Starts at the current head (or the oldest record kept with from_start).
+
+    read() decodes records straight from the shared slots, without an intermediate copy, and
+    re-checks each slot's stamp afterwards: a slot overwritten while it was read counts as an
+    overrun and the cursor jumps to the oldest record still in the ring.
+    """
+
+    def __init__(self, path, from_start=False):
+        fd = os.open(path, os.O_RDWR)
+        self.file = os.fdopen(fd, "r+b")
+        self.map = mmap.mmap(fd, 0)
+        magic, version, slot_size, capacity, head, _ = RING_HDR.unpack_from(self.map, 0)
+        if magic != RING_MAGIC or version != RING_VERSION or slot_size != SLOT_SIZE:
+            raise ValueError(f"{path} is not a sample ring")
+        self.capacity = capacity
+        self.mask = capacity - 1
+        self.wake = ctypes.c_uint32.from_buffer(self.map, WAKE_OFFSET)
+        self.cursor = max(0, head - capacity) if from_start else head
+        self.overruns = 0
+        self.entry = self._register(fd)
+
+    def head(self):
+        return struct.unpack_from("<Q", self.map, HEAD_OFFSET)[0]
+
+    def read(self, max_records=1024):
+        """Returns up to max_records (kind, tag, seq, t_ms, a, b, quality) tuples, oldest first."""
+        out = []
+        head = self.head()
+        if head - self.cursor > self.capacity:
+            self._overrun(head)
+        while self.cursor < head and len(out) < max_records:
+            offset = SLOTS_OFFSET + (self.cursor & self.mask) * SLOT_SIZE
+            expected = self.cursor + 1
+            if SLOT_STAMP.unpack_from(self.map, offset)[0] != expected:
+                self._overrun(self.head())
+                continue
+            t_ms, seq, a, b, quality, kind, tag_len, tag = RECORD.unpack_from(self.map, offset + SLOT_STAMP.size)
+            if SLOT_STAMP.unpack_from(self.map, offset)[0] != expected:
+                self._overrun(self.head())
+                continue
+            out.append((kind, tag[:tag_len].decode(), seq, t_ms, a, b, quality))
+            self.cursor += 1
+        READER.pack_into(self.map, self.entry, os.getpid(), 0, self.cursor, self.overruns)
+        return out
+
+    def wait(self, timeout=None):
+        """Block until the head moves past the cursor. Returns False on timeout."""
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while True:
+            word = self.wake.value
+            if self.head() > self.cursor:
+                return True
+            remaining = None if deadline is None else deadline - time.monotonic()
+            if remaining is not None and remaining <= 0:
+                return False
+            # The writer bumps the word before waking, so a notify between the head check and the
+            # wait makes the wait return at once instead of being lost
+            if not _futex(self.wake, _FUTEX_WAIT, word, remaining):
+                time.sleep(0.001 if remaining is None else min(0.001, remaining))
+
+    def close(self):
+        READER.pack_into(self.map, self.entry, 0, 0, 0, 0)
+        del self.wake
+        self.map.close()
+        self.file.close()
+
+    def _overrun(self, head):
+        oldest = head - self.capacity + 1   # The slot at head - capacity may be under rewrite
+        if oldest > self.cursor:
+            self.overruns += oldest - self.cursor
+            self.cursor = oldest
+
+    def _register(self, fd):
+        fcntl.flock(fd, fcntl.LOCK_EX)
+        try:
+            for i in range(MAX_READERS):
+                offset = READER_TABLE + i * READER.size
+                pid = READER.unpack_from(self.map, offset)[0]
+                if pid and _alive(pid):
+                    continue
+                READER.pack_into(self.map, offset, os.getpid(), 0, self.cursor, 0)
+                return offset
+        finally:
+            fcntl.flock(fd, fcntl.LOCK_UN)
+        raise RuntimeError("no free reader entry")
+
+
+def _alive(pid):
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError:
+        return False
+    except PermissionError:
+        pass
+    return True
+
+
+# Tail the ring: python3 bridge_shm.py [path]
+if __name__ == "__main__":
+    reader = RingReader(sys.argv[1] if len(sys.argv) > 1 else "/dev/shm/uwb_samples")
+    while True:
+        reader.wait()
+        for record in reader.read():
+            print(",".join(str(v) for v in record))
@@ -0,0 +1,367 @@
+import os
+import selectors
+import socket
+import struct
+import threading
+import time
+
+# Frames in both directions: type (u8), payload length (u16 LE), payload. Tags are length-prefixed strings.
+FRAME_HDR = struct.Struct("<BH")
+REQ_GET = 0x01          # tag
+REQ_SUBSCRIBE = 0x02    # min change (u16, cm), zone (u8, 0 for any), tag count (u16), tags; no tags for all
+REQ_UNSUBSCRIBE = 0x03
+RSP_STATE = 0x81        # record
+RSP_NOT_FOUND = 0x82    # tag
+RSP_UPDATE = 0x83       # record, pushed to subscribers
+
+# Record after the tag: age (u32, ms), range (i32, cm), x, y (i32, mm), quality (i16: RSSI in dBm for ranges,
+# solver residual in mm for positions), flags (u8), zone count (u8), zone ids (u8 each)
+RECORD = struct.Struct("<IiiihBB")
+FLAG_RANGE = 0x01
+FLAG_POSITION = 0x02
+
+MAX_OUTBOX = 1 << 20    # Bytes queued for one client before it is dropped as too slow
+NO_VALUE = -0x80000000
+
+
+def pack_tag(tag):
+    raw = tag.encode()
+    return bytes((len(raw),)) + raw
+
+
+def unpack_tag(buf, pos):
+    length = buf[pos]
+    return bytes(buf[pos + 1:pos + 1 + length]).decode(), pos + 1 + length
+
+
+def frame(frame_type, payload):
+    return FRAME_HDR.pack(frame_type, len(payload)) + payload
+
+
+class TagState:
+    __slots__ = ("range_cm", "x_mm", "y_mm", "quality", "flags", "zones", "updated")
+
+    def __init__(self):
+        self.range_cm = NO_VALUE
+        self.x_mm = NO_VALUE
+        self.y_mm = NO_VALUE
+        self.quality = 0
+        self.flags = 0
+        self.zones = set()
+        self.updated = 0.0
+
+    def pack(self, tag, now):
+        age_ms = min(int((now - self.updated) * 1000), 0xFFFFFFFF)
+        zones = sorted(self.zones)[:255]
+        return (pack_tag(tag) + RECORD.pack(age_ms, self.range_cm, self.x_mm, self.y_mm, self.quality, self.flags,
+                                            len(zones)) + bytes(zones))
+
+
+class Subscription:
+    __slots__ = ("tags", "zone", "min_change", "sent")
+
+    def __init__(self, tags, zone, min_change):
+        self.tags = tags            # Empty for every tag
+        self.zone = zone            # 0 for any zone
+        self.min_change = min_change
+        self.sent = {}              # tag -> (range, x, y, zones) last pushed
+
+    def wants(self, tag, state):
+        last = self.sent.get(tag)
+        if self.zone and self.zone not in state.zones:
+            # Still push the exit from the zone, then stay quiet until the tag is back
+            if last is None or self.zone not in last[3]:
+                return False
+        elif last is not None and last[3] == state.zones and self.min_change:
+            # Positions are in mm, the threshold in cm
+            moved = max(abs(state.range_cm - last[0]) if state.flags & FLAG_RANGE else 0,
+                        (abs(state.x_mm - last[1]) + abs(state.y_mm - last[2])) // 10
+                        if state.flags & FLAG_POSITION else 0)
+            if moved < self.min_change:
+                return False
+        self.sent[tag] = (state.range_cm, state.x_mm, state.y_mm, frozenset(state.zones))
+        return True
+
+
+class Client:
+    __slots__ = ("sock", "inbox", "outbox", "subscription")
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.inbox = bytearray()
+        self.outbox = bytearray()
+        self.subscription = None
+
+
+class StateServer:
+    """Latest state per tag, served over a local socket.
+
+    update_*() are called from the bridge loop; a background thread answers point lookups and
+    pushes an update frame to every subscriber whose filter (tag set, zone, minimum change)
+    accepts the change. Subscribers to given tags are indexed by tag, so the cost of an update
+    grows with its interested subscribers, not with all of them.
+    """
+
+    def __init__(self, unix_path=None, tcp_port=None):
+        self.lock = threading.Lock()
+        self.states = {}
+        self.clients = {}           # socket -> Client
+        self.by_tag = {}            # tag -> set of Clients subscribed to it by name
+        self.all_tags = set()       # Clients subscribed to every tag
+        self.lookups = 0
+        self.pushed = 0
+        self.dropped_clients = 0
+        self.selector = selectors.DefaultSelector()
+        self.wake_r, self.wake_w = socket.socketpair()
+        self.wake_r.setblocking(False)
+        self.wake_w.setblocking(False)
+        self.selector.register(self.wake_r, selectors.EVENT_READ, None)
+        self.listeners = []
+        if unix_path:
+            if os.path.exists(unix_path):
+                os.unlink(unix_path)
+            self._listen(socket.socket(socket.AF_UNIX, socket.SOCK_STREAM), unix_path)
+        if tcp_port:
+            listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            self._listen(listener, ("127.0.0.1", tcp_port))
+        threading.Thread(target=self._serve, name="state-server", daemon=True).start()
+
+    def update_range(self, tag, range_cm, rssi, now):
+        with self.lock:
+            state = self._state(tag)
+            state.range_cm = range_cm
+            state.quality = rssi if rssi is not None else 0
+            state.flags |= FLAG_RANGE
+            self._changed(tag, state, now)
+
+    def update_position(self, tag, x_m, y_m, rms_m, now):
+        with self.lock:
+            state = self._state(tag)
+            state.x_mm = int(x_m * 1000)
+            state.y_mm = int(y_m * 1000)
+            state.quality = min(int(rms_m * 1000), 0x7FFF)
+            state.flags |= FLAG_POSITION
+            self._changed(tag, state, now)
+
+    def update_zone(self, tag, zone, inside, now):
+        with self.lock:
+            state = self._state(tag)
+            if inside:
+                state.zones.add(zone)
+            else:
+                state.zones.discard(zone)
+            self._changed(tag, state, now)
+
+    def metrics(self):
+        with self.lock:
+            return {"tags": len(self.states), "clients": len(self.clients),
+                    "subscribers": sum(1 for c in self.clients.values() if c.subscription), "lookups": self.lookups,
+                    "pushed": self.pushed, "dropped_clients": self.dropped_clients}
+
+    def _state(self, tag):
+        state = self.states.get(tag)
+        if state is None:
+            state = self.states[tag] = TagState()
+        return state
+
+    def _changed(self, tag, state, now):
+        # Call with the lock held
+        state.updated = now
+        record = None
+        for client in self.all_tags.union(self.by_tag.get(tag, ())):
+            if client.subscription.wants(tag, state):
+                record = record or frame(RSP_UPDATE, state.pack(tag, now))
+                self._queue(client, record)
+        if record is not None:
+            try:
+                self.wake_w.send(b"\0")
+            except BlockingIOError:
+                pass    # Already woken
+
+    def _listen(self, listener, address):
+        listener.bind(address)
+        listener.listen(128)
+        listener.setblocking(False)
+        self.selector.register(listener, selectors.EVENT_READ, "listener")
+        self.listeners.append(listener)
+
+    def _serve(self):
+        while True:
+            for key, mask in self.selector.select():
+                if key.fileobj is self.wake_r:
+                    try:
+                        while self.wake_r.recv(4096):
+                            pass
+                    except BlockingIOError:
+                        pass
+                elif key.data == "listener":
+                    sock, _ = key.fileobj.accept()
+                    sock.setblocking(False)
+                    with self.lock:
+                        self.clients[sock] = Client(sock)
+                    self.selector.register(sock, selectors.EVENT_READ, "client")
+                elif mask & selectors.EVENT_READ:
+                    self._on_readable(key.fileobj)
+            self._flush_outboxes()
+
+    def _on_readable(self, sock):
+        client = self.clients.get(sock)
+        try:
+            data = sock.recv(65536)
+        except (BlockingIOError, InterruptedError):
+            return
+        except OSError:
+            data = b""
+        if not data:
+            self._drop(client)
+            return
+        client.inbox += data
+        while len(client.inbox) >= FRAME_HDR.size:
+            frame_type, length = FRAME_HDR.unpack_from(client.inbox)
+            if len(client.inbox) < FRAME_HDR.size + length:
+                break
+            payload = bytes(client.inbox[FRAME_HDR.size:FRAME_HDR.size + length])
+            del client.inbox[:FRAME_HDR.size + length]
+            try:
+                self._on_request(client, frame_type, payload)
+            except (struct.error, IndexError, UnicodeDecodeError):
+                self._drop(client)     # Malformed request
+                return
+
+    def _on_request(self, client, frame_type, payload):
+        now = time.monotonic()
+        with self.lock:
+            if frame_type == REQ_GET:
+                tag, _ = unpack_tag(payload, 0)
+                state = self.states.get(tag)
+                self.lookups += 1
+                if state is None:
+                    self._queue(client, frame(RSP_NOT_FOUND, pack_tag(tag)))
+                else:
+                    self._queue(client, frame(RSP_STATE, state.pack(tag, now)))
+            elif frame_type == REQ_SUBSCRIBE:
+                self._unsubscribe(client)
+                min_change, zone, count = struct.unpack_from("<HBH", payload)
+                pos, tags = 5, set()
+                for _ in range(count):
+                    tag, pos = unpack_tag(payload, pos)
+                    tags.add(tag)
+                client.subscription = Subscription(tags, zone, min_change)
+                if tags:
+                    for tag in tags:
+                        self.by_tag.setdefault(tag, set()).add(client)
+                else:
+                    self.all_tags.add(client)
+                # Start with the current state of every matching tag
+                for tag in (tags or self.states.keys()):
+                    state = self.states.get(tag)
+                    if state is not None and client.subscription.wants(tag, state):
+                        self._queue(client, frame(RSP_UPDATE, state.pack(tag, now)))
+            elif frame_type == REQ_UNSUBSCRIBE:
+                self._unsubscribe(client)
+
+    def _queue(self, client, data):
+        # Call with the lock held
+        if len(client.outbox) + len(data) > MAX_OUTBOX:
+            client.outbox.clear()
+            client.inbox.clear()
+            self._unsubscribe(client)
+            self.dropped_clients += 1
+            try:
+                client.sock.shutdown(socket.SHUT_RDWR)     # The reader sees the EOF and drops the client
+            except OSError:
+                pass
+            return
+        client.outbox += data
+        self.pushed += data[0] == RSP_UPDATE
+
+    def _flush_outboxes(self):
+        with self.lock:
+            for client in list(self.clients.values()):
+                if not client.outbox:
+                    continue
+                try:
+                    sent = client.sock.send(client.outbox)
+                    del client.outbox[:sent]
+                except (BlockingIOError, InterruptedError):
+                    pass
+                except OSError:
+                    client.outbox.clear()
+                # Wait for a slow reader to drain instead of spinning on it
+                events = selectors.EVENT_READ | (selectors.EVENT_WRITE if client.outbox else 0)
+                if self.selector.get_key(client.sock).events != events:
+                    self.selector.modify(client.sock, events, "client")
+
+    def _unsubscribe(self, client):
+        # Call with the lock held
+        if client.subscription is None:
+            return
+        for tag in client.subscription.tags:
+            subscribers = self.by_tag.get(tag)
+            if subscribers is not None:
+                subscribers.discard(client)
+                if not subscribers:
+                    del self.by_tag[tag]
+        self.all_tags.discard(client)
+        client.subscription = None
+
+    def _drop(self, client):
+        self.selector.unregister(client.sock)
+        with self.lock:
+            self._unsubscribe(client)
+            del self.clients[client.sock]
+        client.sock.close()
+
+
+class StateClient:
+    """Blocking client of StateServer."""
+
+    def __init__(self, unix_path=None, tcp_port=None):
+        if unix_path:
+            self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            self.sock.connect(unix_path)
+        else:
+            self.sock = socket.create_connection(("127.0.0.1", tcp_port))
+        self.buf = bytearray()
+
+    def get(self, tag):
+        """Returns the tag's record as a dict, or None when the tag is unknown."""
+        self.sock.sendall(frame(REQ_GET, pack_tag(tag)))
+        frame_type, payload = self.read_frame()
+        return parse_record(payload) if frame_type == RSP_STATE else None
+
+    def subscribe(self, tags=(), zone=0, min_change_cm=0):
+        payload = struct.pack("<HBH", min_change_cm, zone, len(tags)) + b"".join(pack_tag(t) for t in tags)
+        self.sock.sendall(frame(REQ_SUBSCRIBE, payload))
+
+    def read_frame(self):
+        while True:
+            if len(self.buf) >= FRAME_HDR.size:
+                frame_type, length = FRAME_HDR.unpack_from(self.buf)
+                if len(self.buf) >= FRAME_HDR.size + length:
+                    payload = bytes(self.buf[FRAME_HDR.size:FRAME_HDR.size + length])
+                    del self.buf[:FRAME_HDR.size + length]
+                    return frame_type, payload
+            data = self.sock.recv(65536)
+            if not data:
+                raise ConnectionError("state server closed the connection")
+            self.buf += data
+
+    def updates(self):
+        """Yield the records pushed to this subscriber."""
+        while True:
+            frame_type, payload = self.read_frame()
+            if frame_type == RSP_UPDATE:
+                yield parse_record(payload)
+
+
+def parse_record(payload):
+    tag, pos = unpack_tag(payload, 0)
+    age_ms, range_cm, x_mm, y_mm, quality, flags, zone_count = RECORD.unpack_from(payload, pos)
+    pos += RECORD.size
+    return {"tag": tag, "age_ms": age_ms,
+            "range_cm": range_cm if flags & FLAG_RANGE else None,
+            "x_m": x_mm / 1000 if flags & FLAG_POSITION else None,
+            "y_m": y_mm / 1000 if flags & FLAG_POSITION else None,
+            "quality": quality, "zones": list(payload[pos:pos + zone_count])}
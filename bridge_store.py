@@ -0,0 +1,245 @@
+import bisect
+import mmap
+import os
+import struct
+import sys
+from array import array
+from itertools import accumulate
+
+# Block layout in a segment file: header, tag, timestamp deltas, distance deltas.
+# Each column stores its first value in the header and the deltas at the narrowest width that fits.
+BLOCK_MAGIC = b"RBLK"
+BLOCK_HDR = struct.Struct("<4sBBHIqqi")   # magic, ts width, dist width, tag length, count, t_first, t_last, d_first
+WIDTH_CODES = ((1, "b"), (2, "h"), (4, "i"), (8, "q"))
+
+SEGMENT_BYTES = 64 << 20
+BLOCK_SAMPLES = 1024                    # Samples per tag buffered before a block is written
+
+
+def _pick_width(deltas):
+    lo, hi = (min(deltas), max(deltas)) if deltas else (0, 0)
+    for width, code in WIDTH_CODES:
+        limit = 1 << (8 * width - 1)
+        if -limit <= lo and hi < limit:
+            return width, code
+    raise ValueError("delta out of range")
+
+
+def _deltas(values):
+    return [b - a for a, b in zip(values, values[1:])]
+
+
+def encode_block(tag, times, dists):
+    """One block of a tag: times in ms (non-decreasing), distances in cm."""
+    tag_bytes = tag.encode()
+    ts_deltas = _deltas(times)
+    dist_deltas = _deltas(dists)
+    ts_width, ts_code = _pick_width(ts_deltas)
+    dist_width, dist_code = _pick_width(dist_deltas)
+    body = tag_bytes + array(ts_code, ts_deltas).tobytes() + array(dist_code, dist_deltas).tobytes()
+    header = BLOCK_HDR.pack(BLOCK_MAGIC, ts_width, dist_width, len(tag_bytes), len(times), times[0], times[-1],
+                            dists[0])
+    return header + body
+
+
+def decode_block(buf, pos):
+    """Returns (tag, times, dists, block length) of the block at pos."""
+    _, ts_width, dist_width, tag_len, count, t_first, _, d_first = BLOCK_HDR.unpack_from(buf, pos)
+    pos += BLOCK_HDR.size
+    tag = bytes(buf[pos:pos + tag_len]).decode()
+    pos += tag_len
+    ts_deltas = array(dict(WIDTH_CODES)[ts_width])
+    ts_deltas.frombytes(buf[pos:pos + (count - 1) * ts_width])
+    pos += (count - 1) * ts_width
+    dist_deltas = array(dict(WIDTH_CODES)[dist_width])
+    dist_deltas.frombytes(buf[pos:pos + (count - 1) * dist_width])
+    length = BLOCK_HDR.size + tag_len + (count - 1) * (ts_width + dist_width)
+    return tag, list(accumulate(ts_deltas, initial=t_first)), list(accumulate(dist_deltas, initial=d_first)), length
+
+
+class Segment:
+    """One pre-allocated, memory-mapped segment file. Blocks are appended, never rewritten."""
+
+    def __init__(self, path, size):
+        new = not os.path.exists(path)
+        self.path = path
+        self.file = open(path, "w+b" if new else "r+b")
+        if new:
+            self.file.truncate(size)
+        self.map = mmap.mmap(self.file.fileno(), 0)
+        self.size = len(self.map)
+        self.pos = 0
+
+    def scan(self):
+        """Yield (offset, tag, count, t_first, t_last) of every complete block, and find the end."""
+        pos = 0
+        while pos + BLOCK_HDR.size <= self.size and self.map[pos:pos + 4] == BLOCK_MAGIC:
+            _, ts_width, dist_width, tag_len, count, t_first, t_last, _ = BLOCK_HDR.unpack_from(self.map, pos)
+            tag = bytes(self.map[pos + BLOCK_HDR.size:pos + BLOCK_HDR.size + tag_len]).decode()
+            yield pos, tag, count, t_first, t_last
+            pos += BLOCK_HDR.size + tag_len + (count - 1) * (ts_width + dist_width)
+        self.pos = pos
+
+    def append(self, block):
+        """Returns the block offset, or None when the segment is full."""
+        if self.pos + len(block) > self.size:
+            return None
+        offset = self.pos
+        # Magic last, so that a crash mid-write leaves the end of the segment where it was
+        self.map[offset + 4:offset + len(block)] = block[4:]
+        self.map[offset:offset + 4] = block[:4]
+        self.pos += len(block)
+        return offset
+
+    def close(self):
+        self.map.flush()
+        self.map.close()
+        self.file.close()
+
+
+class TagIndex:
+    """Sparse time index of one tag: one entry per block, blocks in time order."""
+
+    __slots__ = ("t_last", "blocks", "times", "dists")
+
+    def __init__(self):
+        self.t_last = []            # t_last of each block, for bisect
+        self.blocks = []            # (segment number, offset, t_first, count)
+        self.times = []             # Samples not written to a block yet
+        self.dists = []
+
+
+class RangeStore:
+    """Append-only columnar store of tag ranges in memory-mapped segment files.
+
+    Samples are buffered per tag and written as delta-encoded blocks of BLOCK_SAMPLES. The time
+    index keeps one entry per block in memory and is rebuilt from the block headers on open.
+    Timestamps of one tag must not go backwards: an earlier one, e.g. after the wall clock was
+    stepped back, is stored as the tag's latest time, buffered, written or from a previous run.
+    """
+
+    def __init__(self, directory, segment_bytes=SEGMENT_BYTES, block_samples=BLOCK_SAMPLES):
+        self.directory = directory
+        self.segment_bytes = segment_bytes
+        self.block_samples = block_samples
+        self.tags = {}
+        self.segments = []
+        self.samples = 0
+        self.bytes_written = 0
+        os.makedirs(directory, exist_ok=True)
+        for name in sorted(os.listdir(directory)):
+            if name.startswith("seg-") and name.endswith(".dat"):
+                self._open_segment(os.path.join(directory, name))
+        if not self.segments:
+            self._new_segment()
+
+    def append(self, tag, t_ms, dist_cm):
+        index = self.tags.get(tag)
+        if index is None:
+            index = self.tags[tag] = TagIndex()
+        latest = index.times[-1] if index.times else index.t_last[-1] if index.t_last else t_ms
+        if t_ms < latest:
+            t_ms = latest
+        index.times.append(t_ms)
+        index.dists.append(dist_cm)
+        self.samples += 1
+        if len(index.times) >= self.block_samples:
+            self._write_block(tag, index)
+
+    def flush(self):
+        """Write every buffered sample, e.g. before shutting down or at a checkpoint."""
+        for tag, index in self.tags.items():
+            if index.times:
+                self._write_block(tag, index)
+        for segment in self.segments[-1:]:
+            segment.map.flush()
+
+    def query(self, tag, t0, t1):
+        """Samples (t_ms, dist_cm) of a tag with t0 <= t_ms <= t1, in time order."""
+        index = self.tags.get(tag)
+        if index is None:
+            return []
+        out = []
+        first = bisect.bisect_left(index.t_last, t0)
+        for seg_no, offset, t_first, _ in index.blocks[first:]:
+            if t_first > t1:
+                break
+            _, times, dists, _ = decode_block(self.segments[seg_no].map, offset)
+            lo = bisect.bisect_left(times, t0)
+            hi = bisect.bisect_right(times, t1)
+            out.extend(zip(times[lo:hi], dists[lo:hi]))
+        lo = bisect.bisect_left(index.times, t0)
+        hi = bisect.bisect_right(index.times, t1)
+        out.extend(zip(index.times[lo:hi], index.dists[lo:hi]))
+        return out
+
+    def query_downsampled(self, tag, t0, t1, bucket_ms):
+        """One (bucket start, count, min, max, mean) row per non-empty bucket of bucket_ms."""
+        rows = []
+        current = None
+        for t_ms, dist in self.query(tag, t0, t1):
+            start = t_ms - (t_ms - t0) % bucket_ms
+            if current is None or current[0] != start:
+                if current is not None:
+                    rows.append((current[0], current[1], current[2], current[3], current[4] / current[1]))
+                current = [start, 0, dist, dist, 0]
+            current[1] += 1
+            current[2] = min(current[2], dist)
+            current[3] = max(current[3], dist)
+            current[4] += dist
+        if current is not None:
+            rows.append((current[0], current[1], current[2], current[3], current[4] / current[1]))
+        return rows
+
+    def metrics(self):
+        return {"samples": self.samples, "tags": len(self.tags), "segments": len(self.segments),
+                "bytes_written": self.bytes_written,
+                "bytes_per_sample": self.bytes_written / self.samples if self.samples else 0.0}
+
+    def close(self):
+        self.flush()
+        for segment in self.segments:
+            segment.close()
+
+    def _open_segment(self, path):
+        seg_no = len(self.segments)
+        segment = Segment(path, self.segment_bytes)
+        self.segments.append(segment)
+        for offset, tag, count, t_first, t_last in segment.scan():
+            index = self.tags.get(tag)
+            if index is None:
+                index = self.tags[tag] = TagIndex()
+            index.t_last.append(t_last)
+            index.blocks.append((seg_no, offset, t_first, count))
+            self.samples += count
+        return segment
+
+    def _new_segment(self):
+        path = os.path.join(self.directory, f"seg-{len(self.segments):06d}.dat")
+        return self._open_segment(path)
+
+    def _write_block(self, tag, index):
+        block = encode_block(tag, index.times, index.dists)
+        segment = self.segments[-1]
+        offset = segment.append(block)
+        if offset is None:
+            segment.map.flush()
+            segment = self._new_segment()
+            offset = segment.append(block)
+        index.t_last.append(index.times[-1])
+        index.blocks.append((len(self.segments) - 1, offset, index.times[0], len(index.times)))
+        self.bytes_written += len(block)
+        index.times = []
+        index.dists = []
+
+
+# Ad-hoc reads: python3 bridge_store.py <directory> <tag> <t0 ms> <t1 ms> [bucket ms]
+if __name__ == "__main__":
+    store = RangeStore(sys.argv[1])
+    tag, t0, t1 = sys.argv[2], int(sys.argv[3]), int(sys.argv[4])
+    if len(sys.argv) > 5:
+        for row in store.query_downsampled(tag, t0, t1, int(sys.argv[5])):
+            print(",".join(str(v) for v in row))
+    else:
+        for t_ms, dist in store.query(tag, t0, t1):
+            print(f"{t_ms},{dist}")
@@ -0,0 +1,306 @@
+import argparse
+import socket
+import struct
+import sys
+import time
+from collections import OrderedDict, deque
+
+import bridge_msg
+
+# Capture format shared with trace_capture.c: file header, then records of
+# source (u8), payload length (u16 LE), microseconds since the previous record (u32 LE), payload.
+# SYNC records set the clock; DROP records count records the capturing side could not buffer.
+TRACE_FILE_MAGIC = b"UTRC"
+TRACE_VERSION = 1
+FILE_HDR = struct.Struct("<4sB3x")
+RECORD_HDR = struct.Struct("<BHI")
+CHUNK_HDR = struct.Struct("<BBH")         # 0xA5, 0x5A, records length, as streamed by the gateway
+CHUNK_MAGIC = (0xA5, 0x5A)
+
+SRC_SYNC = 0        # u64 absolute time, us
+SRC_DROP = 1        # u32 records lost
+SRC_BLE_ADV = 2     # tag address (6), rssi (i8), adv data length (u8), adv + scan response data
+SRC_UDP_RX = 3      # address length (u8), address text, port (u16), datagram
+
+# Tag advertisement, as parsed by tag_adv_handler() in main.c; payloads and lines follow uwb_schema.py
+AD_TYPE_MANUFACTURER = 0xFF
+SEQ_WINDOW = 32
+SEQ_STALE_US = 10_000_000
+
+
+class TraceWriter:
+    """Appends records to a capture file; the bridge records every datagram it receives."""
+
+    def __init__(self, path):
+        self.file = open(path, "wb")
+        self.file.write(FILE_HDR.pack(TRACE_FILE_MAGIC, TRACE_VERSION))
+        self.last_us = None
+        self.records = 0
+
+    def write(self, source, time_us, payload):
+        if self.last_us is None or not 0 <= time_us - self.last_us <= 0xFFFFFFFF:
+            self.file.write(RECORD_HDR.pack(SRC_SYNC, 8, 0) + struct.pack("<Q", time_us))
+            self.last_us = time_us
+        self.file.write(RECORD_HDR.pack(source, len(payload), time_us - self.last_us) + payload)
+        self.last_us = time_us
+        self.records += 1
+
+    def udp_rx(self, addr, data, time_us):
+        host = addr[0].encode()
+        self.write(SRC_UDP_RX, time_us, bytes((len(host),)) + host + struct.pack("<H", addr[1]) + data)
+
+    def write_chunk(self, chunk):
+        """Append a chunk streamed by a gateway. Returns False if it is not one."""
+        if len(chunk) < CHUNK_HDR.size:
+            return False
+        magic0, magic1, length = CHUNK_HDR.unpack_from(chunk)
+        if (magic0, magic1) != CHUNK_MAGIC or len(chunk) < CHUNK_HDR.size + length:
+            return False
+        # Every chunk starts with its own SYNC, so the records go in as they are
+        self.file.write(chunk[CHUNK_HDR.size:CHUNK_HDR.size + length])
+        self.last_us = None
+        return True
+
+    def flush(self):
+        self.file.flush()
+
+    def close(self):
+        self.file.close()
+
+
+def read_records(path):
+    """Yield (source, time_us, payload) from a capture file, in file order."""
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, version = FILE_HDR.unpack_from(data)
+    if magic != TRACE_FILE_MAGIC or version != TRACE_VERSION:
+        raise ValueError(f"{path} is not a trace capture")
+    pos, clock = FILE_HDR.size, 0
+    while pos + RECORD_HDR.size <= len(data):
+        source, length, delta = RECORD_HDR.unpack_from(data, pos)
+        payload = data[pos + RECORD_HDR.size:pos + RECORD_HDR.size + length]
+        if len(payload) < length:
+            break   # Capture cut mid-record
+        pos += RECORD_HDR.size + length
+        clock = struct.unpack("<Q", payload)[0] if source == SRC_SYNC else clock + delta
+        yield source, clock, payload
+
+
+def parse_udp_rx(payload):
+    host_len = payload[0]
+    host = payload[1:1 + host_len].decode()
+    port = struct.unpack_from("<H", payload, 1 + host_len)[0]
+    return (host, port), payload[3 + host_len:]
+
+
+class GatewayModel:
+    """Host model of the gateway forwarding path: tag advertisements in, forwarded lines out.
+
+    Follows tag_adv_handler(): manufacturer data parsing, the per-tag sequence window and the
+    range / TDoA line formats. Ownership, zones, aggregation and shaping are left out, as if
+    the gateway ran with their defaults and a single gateway in range.
+    """
+
+    def __init__(self):
+        self.seen = OrderedDict()   # key -> (last time_us, recent seqs)
+
+    def process(self, time_us, payload):
+        """Returns the line the gateway would forward for one captured scan result, or None."""
+        bda, rssi = payload[:6], struct.unpack_from("<b", payload, 6)[0]
+        data = payload[8:]
+        i = 0
+        while i + 1 < len(data):
+            field_len = data[i]
+            if field_len == 0 or i + field_len >= len(data):
+                return None
+            if data[i + 1] == AD_TYPE_MANUFACTURER and field_len > 2 and \
+                    data[i + 2] | (data[i + 3] << 8) == bridge_msg.MANUFACTURER_ID and \
+                    field_len - 3 >= bridge_msg.RANGE_LEN:
+                return self._tag_payload(time_us, bda, rssi, data[i + 4:i + 1 + field_len])
+            i += field_len + 1
+        return None
+
+    def _tag_payload(self, time_us, bda, rssi, p):
+        addr = bda.hex()
+        report = bridge_msg.decode_tdoa_report(p)
+        if report is not None:
+            if not self._accept(bda[2:] + p[0:2], report[1], time_us):
+                return None
+            return bridge_msg.format_line("tdoa", addr, *report)
+        range_msg = bridge_msg.decode_range(p)
+        if range_msg is None or not self._accept(bytes(bda), range_msg[1], time_us):
+            return None
+        dist_cm, seq = range_msg
+        return bridge_msg.format_line("range", addr, seq, dist_cm, rssi)
+
+    def _accept(self, key, seq, time_us):
+        entry = self.seen.get(key)
+        if entry is None or time_us - entry[0] > SEQ_STALE_US:
+            entry = (time_us, deque(maxlen=SEQ_WINDOW))
+        if seq in entry[1]:
+            self.seen[key] = (time_us, entry[1])
+            return False
+        entry[1].append(seq)
+        self.seen[key] = (time_us, entry[1])
+        self.seen.move_to_end(key)
+        if len(self.seen) > 64:
+            self.seen.popitem(last=False)
+        return True
+
+
+def replay(records, deliver, speed):
+    """Call deliver(source, time_us, payload) for each record, paced at speed x (0 for as fast as possible)."""
+    start_wall = start_trace = None
+    count = 0
+    for source, time_us, payload in records:
+        if speed > 0:
+            if start_wall is None:
+                start_wall, start_trace = time.monotonic(), time_us
+            delay = start_wall + (time_us - start_trace) / 1e6 / speed - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+        deliver(source, time_us, payload)
+        count += 1
+    return count
+
+
+def run_pipeline(records, out):
+    """Run the bridge's decode stages in-process on trace time, writing every output line to out.
+
+    The stages only see the capture's clock, so the output is the same on every run and any change
+    to them can be compared line by line against the same workload.
+    """
+    from bridge_jitter import JitterBuffer
+    from bridge_merge import MergeStage, parse_range
+    from bridge_codec import CodecReceiver, range_lines
+    from bridge_reliable import ReliableReceiver
+
+    merge, jitter, reliable, gateway = MergeStage(), JitterBuffer(), ReliableReceiver(), GatewayModel()
+    codec = CodecReceiver()
+    lines = 0
+
+    def emit(payloads):
+        nonlocal lines
+        for payload in payloads:
+            out.write(payload + "\n")
+            lines += 1
+
+    def ranges(payloads, now):
+        for payload in payloads:
+            (tag, seq), _ = parse_range(payload)
+            emit(jitter.add(tag, seq, payload, now))
+
+    def handle(text, now):
+        parsed = parse_range(text)
+        if parsed is None:
+            emit([text])
+        else:
+            ranges(merge.add(parsed[0], parsed[1], text, now), now)
+
+    now = 0.0
+    for source, time_us, payload in records:
+        now = time_us / 1e6
+        if source == SRC_UDP_RX:
+            addr, data = parse_udp_rx(payload)
+            data, _ = reliable.handle(data, addr)
+            samples = codec.handle(data, addr) if data else None
+            if samples is not None:
+                data = None
+                for text in range_lines(samples):
+                    handle(text, now)
+            for text in (data.decode().splitlines() if data else ()):
+                handle(text, now)
+        elif source == SRC_BLE_ADV:
+            text = gateway.process(time_us, payload)
+            if text is not None:
+                handle(text, now)
+        elif source == SRC_DROP:
+            emit([f"# capture dropped {struct.unpack('<I', payload)[0]} records"])
+        ranges(merge.flush(now), now)
+        emit(jitter.flush(now))
+    # Release everything still held once the capture ends
+    ranges(merge.flush(now + 60), now + 60)
+    emit(jitter.flush(now + 60))
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Capture and replay gateway / bridge traces")
+    sub = parser.add_subparsers(dest="command", required=True)
+    cap = sub.add_parser("capture", help="write a gateway's trace stream to a file")
+    cap.add_argument("output")
+    cap.add_argument("--udp", type=int, metavar="PORT", help="receive chunks on this UDP port (\"trace udp\")")
+    cap.add_argument("--serial", metavar="DEVICE", help="read chunks from a raw tty (\"trace uart\", set the baud "
+                                                        "rate with stty first)")
+    rep = sub.add_parser("replay", help="send a capture to a running bridge")
+    rep.add_argument("input")
+    rep.add_argument("--to", default="127.0.0.1:12345", help="bridge UDP address, host:port")
+    rep.add_argument("--speed", type=float, default=1.0, help="time scale, 0 for as fast as possible")
+    pipe = sub.add_parser("pipeline", help="run the bridge stages on a capture, deterministically")
+    pipe.add_argument("input")
+    args = parser.parse_args()
+
+    if args.command == "capture":
+        writer = TraceWriter(args.output)
+        if args.udp:
+            sock = socket.socket(socket.AF_INET6, socket.SOCK_DGRAM)
+            sock.bind(("::", args.udp))
+            chunks = iter(lambda: sock.recv(2048), None)
+        else:
+            chunks = _serial_chunks(open(args.serial, "rb", buffering=0))
+        try:
+            for chunk in chunks:
+                writer.write_chunk(chunk)
+                writer.flush()
+        except KeyboardInterrupt:
+            writer.close()
+    elif args.command == "replay":
+        host, port = args.to.rsplit(":", 1)
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        gateway = GatewayModel()
+
+        def deliver(source, time_us, payload):
+            if source == SRC_UDP_RX:
+                sock.sendto(parse_udp_rx(payload)[1], (host, int(port)))
+            elif source == SRC_BLE_ADV:
+                text = gateway.process(time_us, payload)
+                if text is not None:
+                    sock.sendto(text.encode(), (host, int(port)))
+
+        start = time.monotonic()
+        count = replay(read_records(args.input), deliver, args.speed)
+        print(f"{count} records in {time.monotonic() - start:.3f} s", file=sys.stderr)
+    else:
+        start = time.monotonic()
+        lines = run_pipeline(read_records(args.input), sys.stdout)
+        print(f"{lines} lines in {time.monotonic() - start:.3f} s", file=sys.stderr)
+
+
+def _serial_chunks(tty):
+    buf = bytearray()
+    while True:
+        data = tty.read(4096)
+        if not data:
+            return
+        buf += data
+        while len(buf) >= CHUNK_HDR.size:
+            start = buf.find(bytes(CHUNK_MAGIC))
+            if start < 0:
+                del buf[:-1]
+                break
+            del buf[:start]
+            if len(buf) < CHUNK_HDR.size + 1:
+                break
+            if buf[CHUNK_HDR.size] != SRC_SYNC:
+                del buf[:1]     # Not a chunk start, every chunk opens with a SYNC record
+                continue
+            length = CHUNK_HDR.unpack_from(buf)[2]
+            if len(buf) < CHUNK_HDR.size + length:
+                break
+            yield bytes(buf[:CHUNK_HDR.size + length])
+            del buf[:CHUNK_HDR.size + length]
+
+
+# python3 bridge_trace.py capture|replay|pipeline ...
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,166 @@
+import json
+import os
+import selectors
+import signal
+import subprocess
+import sys
+import time
+
+import paho.mqtt.client as mqtt
+
+# Multi-worker bridge: the supervisor starts WORKERS copies of mqttconnection.py that all bind the UDP port with
+# SO_REUSEPORT. The kernel picks the worker by hashing the datagram's source address and port, so every datagram of
+# one gateway reaches the same worker, and with tag ownership on the gateways, so does every range of one tag.
+# Each worker keeps its own merge, jitter and dedup state and MQTT connection; the supervisor only collects the
+# workers' metrics and publishes them combined.
+
+RESTART_DELAY_S = 1.0
+
+# Combined metrics: counters add up, these take the largest value...
+MAX_KEYS = ("merge_latency_max_ms", "max_lag")
+# ...and these are averages weighted by another counter of the same group
+WEIGHTED_KEYS = {"duplicate_ratio": "received", "merge_latency_avg_ms": "published",
+                 "bytes_per_sample": "samples", "loss_ratio": "received"}
+
+
+def combine(groups):
+    """Combine the same metrics group from several workers."""
+    groups = [g for g in groups if g is not None]
+    if not groups:
+        return None
+    out = {}
+    for key in groups[0]:
+        values = [g[key] for g in groups if key in g]
+        if isinstance(values[0], dict):
+            out[key] = combine(values)
+        elif key in MAX_KEYS:
+            out[key] = max(values)
+        elif key in WEIGHTED_KEYS:
+            weights = [g.get(WEIGHTED_KEYS[key], 0) for g in groups if key in g]
+            total = sum(weights)
+            out[key] = sum(v * w for v, w in zip(values, weights)) / total if total else 0.0
+        elif isinstance(values[0], (int, float)) and not isinstance(values[0], bool):
+            out[key] = sum(values)
+        else:
+            out[key] = values[0]
+    return out
+
+
+def combine_tags(tag_stats):
+    """Union of the workers' per-tag counters; a tag seen by two workers (ownership handover) is combined."""
+    seen = {}
+    for stats in tag_stats:
+        for tag, counters in stats.items():
+            seen.setdefault(tag, []).append(counters)
+    return {tag: counters[0] if len(counters) == 1 else combine(counters) for tag, counters in seen.items()}
+
+
+class Worker:
+    def __init__(self, index):
+        self.index = index
+        self.proc = None
+        self.pipe = None
+        self.buf = b""
+        self.report = None          # Latest {"metrics": ..., "tags": ...}
+        self.fresh = False
+        self.restarts = 0
+        self.restart_at = 0.0
+
+
+class Supervisor:
+    def __init__(self, script, workers, interval_s):
+        self.script = script
+        self.interval_s = interval_s
+        self.workers = [Worker(i) for i in range(workers)]
+        self.sel = selectors.DefaultSelector()
+
+    def start(self, worker):
+        read_fd, write_fd = os.pipe()
+        env = dict(os.environ, BRIDGE_WORKER_INDEX=str(worker.index), BRIDGE_WORKER_METRICS_FD=str(write_fd))
+        worker.proc = subprocess.Popen([sys.executable, self.script], env=env, pass_fds=(write_fd,))
+        os.close(write_fd)
+        worker.pipe = os.fdopen(read_fd, "rb", buffering=0)
+        worker.buf = b""
+        self.sel.register(worker.pipe, selectors.EVENT_READ, worker)
+
+    def stop(self):
+        for worker in self.workers:
+            if worker.proc is not None and worker.proc.poll() is None:
+                worker.proc.terminate()
+        for worker in self.workers:
+            if worker.proc is not None:
+                worker.proc.wait()
+
+    def poll(self, timeout):
+        for key, _ in self.sel.select(timeout):
+            worker = key.data
+            data = worker.pipe.read(65536)
+            if not data:
+                # Worker gone: its pipe closes with it
+                self.sel.unregister(worker.pipe)
+                worker.pipe.close()
+                worker.proc.wait()
+                worker.restarts += 1
+                worker.restart_at = time.monotonic() + RESTART_DELAY_S
+                worker.report = None
+                print(f"Worker {worker.index} exited with {worker.proc.returncode}, restarting")
+                continue
+            worker.buf += data
+            *lines, worker.buf = worker.buf.split(b"\n")
+            for line in lines:
+                worker.report = json.loads(line)
+                worker.fresh = True
+        now = time.monotonic()
+        for worker in self.workers:
+            if worker.pipe is None or worker.pipe.closed:
+                if now >= worker.restart_at:
+                    self.start(worker)
+
+    def combined(self):
+        reports = [w.report for w in self.workers if w.report is not None]
+        groups = {}
+        for report in reports:
+            for name, group in report["metrics"].items():
+                groups.setdefault(name, []).append(group)
+        metrics = {name: combine(values) for name, values in groups.items()}
+        metrics["workers"] = {"configured": len(self.workers), "reporting": len(reports),
+                              "restarts": sum(w.restarts for w in self.workers),
+                              "per_worker": {w.index: w.report["metrics"] for w in self.workers if w.report}}
+        for worker in self.workers:
+            worker.fresh = False
+        return metrics, combine_tags(r["tags"] for r in reports)
+
+    def run(self, publish, metrics_topic, tags_topic):
+        for worker in self.workers:
+            self.start(worker)
+        next_publish = time.monotonic() + self.interval_s
+        while True:
+            self.poll(1.0)
+            # Publish once every worker has reported this round, or when the slowest one is overdue
+            all_fresh = all(w.fresh for w in self.workers)
+            if all_fresh or (time.monotonic() >= next_publish + self.interval_s / 2 and
+                             any(w.fresh for w in self.workers)):
+                metrics, tags = self.combined()
+                publish(metrics_topic, json.dumps(metrics))
+                publish(tags_topic, json.dumps(tags))
+                next_publish = time.monotonic() + self.interval_s
+
+
+def supervise(script, workers, broker, port, credentials, interval_s, metrics_topic, tags_topic):
+    """Run the workers until terminated, publishing their combined metrics. Never returns."""
+    client = mqtt.Client()
+    client.username_pw_set(*credentials)
+    client.connect(broker, port)
+    client.loop_start()
+
+    def terminate(signum, frame):
+        raise SystemExit(0)
+
+    signal.signal(signal.SIGTERM, terminate)
+    supervisor = Supervisor(script, workers, interval_s)
+    try:
+        supervisor.run(lambda topic, payload: client.publish(topic, payload, qos=1), metrics_topic, tags_topic)
+    finally:
+        supervisor.stop()
+        client.disconnect()
+        client.loop_stop()
@@ -0,0 +1,299 @@
+import argparse
+import ctypes
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+from collections import defaultdict
+
+from bridge_trace import AD_TYPE_MANUFACTURER, SRC_BLE_ADV, read_records
+import bridge_msg
+
+# Trace replay of the BLE scan / Thread TX time share (radio_coex_policy.c, compiled for the host) in 1 ms steps.
+# Tag advertisements, from a capture (SRC_BLE_ADV records, "trace" on the gateway) or from synthetic phases of
+# tags advertising, are only heard inside the scan window of each scan interval and outside TX windows. Every
+# RADIO_COEX_UPDATE_PERIOD_MS the policy gets the advertisements heard and the sample queue depth, as
+# radio_coex.c does, and the sender opens a TX window whenever the policy wants one, as udp_socket_client_task()
+# does. Next to the firmware policy, a model of the original estimate (advertisements per second of wall clock)
+# shows the feedback through the window: hearing fewer advertisements through a narrow window, it keeps the window
+# narrow, and after a quiet period it stays near the floor when the tags come back.
+# The check fails if, in the second half of a phase, the firmware's rate estimate is off the rate sent outside TX
+# windows by more than RATE_TOLERANCE, or if the window takes more than RECOVER_PERIODS updates to open to
+# RECOVER_SHARE of what that rate and the queue depth call for once tags come back after a quiet phase.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+UPDATE_PERIOD_MS = 1000     # RADIO_COEX_UPDATE_PERIOD_MS
+TX_WINDOW_MS = 20           # Exclusive TX window per batch, as bridge_bench.py
+SCAN_UNIT_MS = 0.625
+RATE_TOLERANCE = 0.25
+RECOVER_SHARE = 0.8         # Of the window above the floor that the rate calls for
+RECOVER_PERIODS = 8
+
+SHIM = """
+#include <stdlib.h>
+#include "radio_coex_policy.h"
+
+RADIO_COEX_POLICY *sim_policy_new(void)
+{
+    static const RADIO_COEX_CONFIG config = RADIO_COEX_CONFIG_DEFAULT();
+    RADIO_COEX_POLICY *policy = malloc(sizeof(*policy));
+    radio_coex_policy_init(policy, &config, 0);
+    return policy;
+}
+
+const RADIO_COEX_CONFIG *sim_config(const RADIO_COEX_POLICY *policy)
+{
+    return &policy->config;
+}
+
+uint32_t sim_rate_x100(const RADIO_COEX_POLICY *policy)
+{
+    return policy->adv_rate_x100;
+}
+"""
+
+
+class CoexConfig(ctypes.Structure):
+    _fields_ = [("scan_interval", ctypes.c_uint16), ("min_window", ctypes.c_uint16),
+                ("max_window", ctypes.c_uint16), ("advs_per_window_unit", ctypes.c_uint32),
+                ("queue_high", ctypes.c_uint32), ("tx_batch_min", ctypes.c_uint32),
+                ("tx_max_wait_ms", ctypes.c_uint32), ("rate_alpha_pct", ctypes.c_uint32)]
+
+
+def load_coex(workdir):
+    """Build radio_coex_policy.c with its default configuration into a shared library."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run radio_coex_policy.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    lib = os.path.join(workdir, "radio_coex_policy.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", lib, shim,
+                    os.path.join(HERE, "radio_coex_policy.c")], check=True)
+    dll = ctypes.CDLL(lib)
+    dll.sim_policy_new.restype = ctypes.c_void_p
+    dll.sim_config.restype = ctypes.POINTER(CoexConfig)
+    dll.sim_config.argtypes = [ctypes.c_void_p]
+    dll.sim_rate_x100.restype = ctypes.c_uint32
+    dll.sim_rate_x100.argtypes = [ctypes.c_void_p]
+    dll.radio_coex_policy_update.restype = ctypes.c_uint16
+    dll.radio_coex_policy_update.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint32, ctypes.c_uint32]
+    dll.radio_coex_policy_want_tx.restype = ctypes.c_bool
+    dll.radio_coex_policy_want_tx.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint32]
+    dll.radio_coex_policy_tx_begin.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    dll.radio_coex_policy_tx_end.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    return dll
+
+
+class FirmwarePolicy:
+    def __init__(self, dll):
+        self.dll, self.policy = dll, dll.sim_policy_new()
+        self.config = dll.sim_config(self.policy).contents
+        self.window = self.config.max_window
+
+    def update(self, now_ms, advs, depth):
+        self.window = self.dll.radio_coex_policy_update(self.policy, now_ms, advs, depth)
+        return self.window
+
+    def rate(self):
+        return self.dll.sim_rate_x100(self.policy) / 100
+
+    def want_tx(self, depth, age_ms):
+        return self.dll.radio_coex_policy_want_tx(self.policy, depth, age_ms)
+
+    def tx_begin(self, now_ms):
+        self.dll.radio_coex_policy_tx_begin(self.policy, now_ms)
+
+    def tx_end(self, now_ms):
+        self.dll.radio_coex_policy_tx_end(self.policy, now_ms)
+
+
+class WallClockPolicy:
+    """The original estimate: advertisements heard per second of wall clock size the window."""
+
+    def __init__(self, config):
+        self.config = config
+        self.window = config.max_window
+        self.rate_x100 = 0
+        self.last_ms = 0
+        self.tx_open = False
+
+    def update(self, now_ms, advs, depth):
+        c = self.config
+        elapsed, self.last_ms = now_ms - self.last_ms, now_ms
+        self.rate_x100 = (self.rate_x100 * (100 - c.rate_alpha_pct) +
+                          advs * 100000 // elapsed * c.rate_alpha_pct) // 100
+        window = min(c.min_window + self.rate_x100 // c.advs_per_window_unit, c.max_window)
+        self.window = squeeze(c, window, depth)
+        return self.window
+
+    def rate(self):
+        return self.rate_x100 / 100
+
+    def want_tx(self, depth, age_ms):
+        c = self.config
+        return depth > 0 and not self.tx_open and (depth >= c.tx_batch_min or age_ms >= c.tx_max_wait_ms)
+
+    def tx_begin(self, now_ms):
+        self.tx_open = True
+
+    def tx_end(self, now_ms):
+        self.tx_open = False
+
+
+def squeeze(config, window, depth):
+    """The window a TX backlog leaves to scanning, as radio_coex_policy_update()."""
+    if depth >= config.queue_high:
+        return config.min_window
+    return window - (window - config.min_window) * depth // config.queue_high
+
+
+def demand(config, rate, depth):
+    """The window the offered rate and the queue depth call for."""
+    window = min(config.min_window + int(rate * 100) // config.advs_per_window_unit, config.max_window)
+    return squeeze(config, window, depth)
+
+
+def synthetic(phases, adv_rate, range_rate, rng):
+    """Advertisements {ms: [(tag, seq)]} of phases of tags advertising, and (start_ms, end_ms, offered/s)."""
+    advs, spans, t0 = defaultdict(list), [], 0
+    for tags, seconds in phases:
+        end = t0 + int(seconds * 1000)
+        for tag in range(tags):
+            t = t0 + rng.uniform(0, 1000 / adv_rate)
+            while t < end:
+                seq = int(t * range_rate / 1000) & 0xff
+                advs[int(t)].append((tag, seq))
+                # advDelay: 0 to 10 ms added to every advertising interval, so the phase drifts against the scan
+                t += 1000 / adv_rate + rng.uniform(0, 10)
+        spans.append((t0, end, tags * adv_rate))
+        t0 = end
+    return advs, spans
+
+
+def captured(path, seconds):
+    """Tag advertisements {ms: [(tag, seq)]} of a capture, as one phase per --phase-s seconds."""
+    advs, t0, last = defaultdict(list), None, 0
+    for source, time_us, payload in read_records(path):
+        if source != SRC_BLE_ADV:
+            continue
+        data, i = payload[8:], 0
+        while i + 1 < len(data):
+            field_len = data[i]
+            if field_len == 0 or i + field_len >= len(data):
+                break
+            if data[i + 1] == AD_TYPE_MANUFACTURER and field_len > 2 and \
+                    data[i + 2] | (data[i + 3] << 8) == bridge_msg.MANUFACTURER_ID:
+                t0 = time_us if t0 is None else t0
+                last = (time_us - t0) // 1000
+                range_msg = bridge_msg.decode_range(data[i + 4:i + 1 + field_len])
+                advs[last].append((bytes(payload[:6]), range_msg[1] if range_msg else 0))
+                break
+            i += field_len + 1
+    step = int(seconds * 1000)
+    spans = [(s, min(s + step, last + 1), sum(len(advs[t]) for t in range(s, min(s + step, last + 1))) * 1000 /
+              (min(s + step, last + 1) - s)) for s in range(0, last + 1, step)]
+    return advs, spans
+
+
+def replay(policy, advs, spans):
+    config = policy.config
+    interval_ms = config.scan_interval * SCAN_UNIT_MS
+    end_ms = spans[-1][1]
+    queue, last_seq = [], {}
+    heard, free_advs, free_ms, tx_until = 0, 0, 0, None
+    # (time, window, rate estimate, queue depth, advertisements and ms outside TX windows in the period)
+    updates = []
+    for t in range(end_ms):
+        if tx_until is not None and t >= tx_until:
+            policy.tx_end(t)
+            tx_until = None
+        if tx_until is None:
+            free_advs += len(advs.get(t, ()))
+            free_ms += 1
+        if tx_until is None and t % interval_ms < policy.window * SCAN_UNIT_MS:
+            for tag, seq in advs.get(t, ()):
+                heard += 1
+                if last_seq.get(tag) != seq:
+                    last_seq[tag] = seq
+                    queue.append(t)
+        if t > 0 and t % UPDATE_PERIOD_MS == 0:
+            depth = len(queue)
+            updates.append((t, policy.update(t, heard, depth), policy.rate(), depth, free_advs, free_ms))
+            heard, free_advs, free_ms = 0, 0, 0
+        if tx_until is None and queue and policy.want_tx(len(queue), t - queue[0]):
+            policy.tx_begin(t)
+            tx_until = t + TX_WINDOW_MS
+            queue.clear()
+    return updates
+
+
+def check(config, updates, spans):
+    """Rate estimate error per phase and window recovery after each quiet phase.
+
+    The target is the rate outside TX windows: advertisements sent during one are lost at any scan window.
+    """
+    phases = []
+    for k, (start, end, offered) in enumerate(spans):
+        tail = [u for u in updates if (start + end) / 2 <= u[0] < end]
+        estimate = sum(u[2] for u in tail) / len(tail) if tail else 0
+        free_ms = sum(u[5] for u in tail)
+        target = sum(u[4] for u in tail) * 1000 / free_ms if free_ms else 0
+        error = abs(estimate - target) / target if target else estimate
+        phase = {"start_s": start / 1000, "offered_advs_s": round(offered, 1), "outside_tx_advs_s": round(target, 1),
+                 "estimate_advs_s": round(estimate, 1),
+                 "mean_window": round(sum(u[1] for u in tail) / len(tail), 1) if tail else None,
+                 "demand_window": demand(config, target, 0), "rate_error": round(error, 3)}
+        if k > 0 and spans[k - 1][2] == 0 and offered > 0:
+            # Updates until the window covers most of what the rate and the queue at that update call for
+            phase_updates = [u for u in updates if start < u[0] < end]
+            reached = next((i for i, u in enumerate(phase_updates)
+                            if u[1] - config.min_window >= RECOVER_SHARE * (demand(config, target, u[3]) -
+                                                                            config.min_window)), None)
+            phase["recover_periods"] = reached + 1 if reached is not None else None
+        phases.append(phase)
+    return phases
+
+
+def phase_ok(phase):
+    recover = phase.get("recover_periods", 0)
+    return phase["rate_error"] <= RATE_TOLERANCE and recover is not None and recover <= RECOVER_PERIODS
+
+
+def parse_phases(text):
+    return [(int(tags), float(seconds)) for tags, seconds in (p.split(":") for p in text.split(",") if p)]
+
+
+# python3 coex_sim.py --phases 2:60,0:60,4:60 --adv-rate 5
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Trace replay of the BLE scan / Thread TX time-share policy")
+    parser.add_argument("--phases", default="2:60,0:60,4:60,1:60,0:30,3:60",
+                        help="comma separated <tags>:<seconds> phases of synthetic tags")
+    parser.add_argument("--adv-rate", type=float, default=5.0, help="advertisements per second per tag")
+    parser.add_argument("--rate", type=float, default=2.0, help="ranges per second per tag")
+    parser.add_argument("--trace", help="replay the tag advertisements of a capture file instead")
+    parser.add_argument("--phase-s", type=float, default=30.0, help="capture seconds reported as one phase")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    if args.trace:
+        advs, spans = captured(args.trace, args.phase_s)
+    else:
+        advs, spans = synthetic(parse_phases(args.phases), args.adv_rate, args.rate, random.Random(args.seed))
+    failed = False
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_coex(workdir)
+        for name, policy in (("wall_clock", WallClockPolicy(FirmwarePolicy(dll).config)),
+                             ("firmware", FirmwarePolicy(dll))):
+            phases = check(policy.config, replay(policy, advs, spans), spans)
+            result = {"policy": name, "phases": phases}
+            if name == "firmware":
+                result["ok"] = all(phase_ok(p) for p in phases)
+                failed |= not result["ok"]
+            print(json.dumps(result))
+    sys.exit(1 if failed else 0)
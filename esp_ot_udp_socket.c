@@ -5,6 +5,7 @@
  */
 
  #include "esp_ot_udp_socket.h"
+ #include "mem_budget.h"
 
  #include "cc.h"
  #include "esp_check.h"
@@ -31,7 +32,7 @@
  {
      char rx_buffer[128];
      int len = 0;
-     char addr_str[128];
+     char addr_str[UDP_IPADDR_STRLEN];
      int port = 0;
      struct sockaddr_storage source_addr;
      UDP_SERVER *udp_server_member = (UDP_SERVER *)pvParameters;
@@ -56,6 +57,7 @@
          }
      }
      ESP_LOGI(OT_EXT_CLI_TAG, "UDP server receive task exiting");
+     mem_budget_unregister_task(xTaskGetCurrentTaskHandle());
      vTaskDelete(NULL);
  }
  
@@ -86,7 +88,8 @@
      ESP_LOGI(OT_EXT_CLI_TAG, "Socket bound, ipaddr %s, port %d", udp_server_member->local_ipaddr,
               udp_server_member->local_port);
  
-     if (pdPASS != xTaskCreate(udp_server_receive_task, "udp_server_receive", 4096, udp_server_member, 4, NULL)) {
+     if (ESP_OK != gateway_task_create(udp_server_receive_task, "udp_server_receive", 4096, udp_server_member, 4, NULL,
+                                       NULL, NULL)) {
          err = -1;
      }
      ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "The UDP server is unable to receive: errno %d",
@@ -157,6 +160,7 @@
      }
      ESP_LOGI(OT_EXT_CLI_TAG, "Closed UDP server successfully");
      vEventGroupDelete(udp_server_event_group);
+     mem_budget_unregister_task(xTaskGetCurrentTaskHandle());
      vTaskDelete(NULL);
  }
  
@@ -200,9 +204,8 @@
              udp_server_event_group = xEventGroupCreate();
              ESP_RETURN_ON_FALSE(udp_server_event_group != NULL, OT_ERROR_FAILED, OT_EXT_CLI_TAG,
                                  "Fail to open udp server");
-             if (pdPASS !=
-                 xTaskCreate(udp_socket_server_task, "udp_socket_server", 4096, &udp_server_member, 4,
-                             &udp_server_handle)) {
+             if (ESP_OK != gateway_task_create(udp_socket_server_task, "udp_socket_server", 4096, &udp_server_member,
+                                               4, NULL, NULL, &udp_server_handle)) {
                  udp_server_handle = NULL;
                  vEventGroupDelete(udp_server_event_group);
                  udp_server_event_group = NULL;
@@ -267,7 +270,7 @@
  {
      char rx_buffer[128];
      int len = 0;
-     char addr_str[128];
+     char addr_str[UDP_IPADDR_STRLEN];
      int port = 0;
      struct sockaddr_storage source_addr;
      UDP_CLIENT *udp_client_member = (UDP_CLIENT *)pvParameters;
@@ -292,6 +295,7 @@
          }
      }
      ESP_LOGI(OT_EXT_CLI_TAG, "UDP client receive task exiting");
+     mem_budget_unregister_task(xTaskGetCurrentTaskHandle());
      vTaskDelete(NULL);
  }
  
@@ -351,7 +355,8 @@
          ESP_LOGI(OT_EXT_CLI_TAG, "Socket bound, port %d", udp_client_member->local_port);
      }
  
-     if (pdPASS != xTaskCreate(udp_client_receive_task, "udp_client_receive", 4096, udp_client_member, 4, NULL)) {
+     if (ESP_OK != gateway_task_create(udp_client_receive_task, "udp_client_receive", 4096, udp_client_member, 4, NULL,
+                                       NULL, NULL)) {
          err = -1;
      }
      ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "The UDP client is unable to receive: errno %d",
@@ -385,6 +390,7 @@
          ESP_LOGI(OT_EXT_CLI_TAG, "Fail to create a UDP client");
      }
      vEventGroupDelete(udp_client_event_group);
+     mem_budget_unregister_task(xTaskGetCurrentTaskHandle());
      vTaskDelete(NULL);
  }
  
@@ -435,9 +441,8 @@
              udp_client_event_group = xEventGroupCreate();
              ESP_RETURN_ON_FALSE(udp_client_event_group != NULL, OT_ERROR_FAILED, OT_EXT_CLI_TAG,
                                  "Fail to open udp client");
-             if (pdPASS !=
-                 xTaskCreate(udp_socket_client_task, "udp_socket_client", 4096, &udp_client_member, 4,
-                             &udp_client_handle)) {
+             if (ESP_OK != gateway_task_create(udp_socket_client_task, "udp_socket_client", 4096, &udp_client_member,
+                                               4, NULL, NULL, &udp_client_handle)) {
                  udp_client_handle = NULL;
                  udp_client_member.local_port = -1;
                  vEventGroupDelete(udp_client_event_group);
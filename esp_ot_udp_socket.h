@@ -21,6 +21,9 @@ extern "C" {
 #define UDP_SERVER_SEND_BIT BIT1
 #define UDP_SERVER_CLOSE_BIT BIT2
 
+#define UDP_IPADDR_STRLEN 48      // Longest IPv6 text address plus terminator, rounded up
+#define UDP_MESSAGE_LEN 128
+
 /**
  * @brief User command "mcast" process.
  *
@@ -41,7 +44,8 @@ otError esp_ot_process_udp_client(void *aContext, uint8_t aArgsLength, char *aAr
 
 typedef struct send_meaasge {
     int port;
-    char ipaddr[128];
+    char ipaddr[UDP_IPADDR_STRLEN];
+    char message[UDP_MESSAGE_LEN];
     int simulated_data;   // Change to simulated data
 } SEND_MESSAGE;
 
@@ -49,7 +53,7 @@ typedef struct udp_server {
     int exist;
     int sock;
     int local_port;
-    char local_ipaddr[128];
+    char local_ipaddr[UDP_IPADDR_STRLEN];
     struct ifreq ifr;
     SEND_MESSAGE messagesend;
 } UDP_SERVER;
@@ -58,11 +62,31 @@ typedef struct udp_client {
     int exist;
     int sock;
     int local_port;
-    char local_ipaddr[128];
+    char local_ipaddr[UDP_IPADDR_STRLEN];
     struct ifreq ifr;
     SEND_MESSAGE messagesend;
 } UDP_CLIENT;
 
+/**
+ * @brief Join an IPv6 multicast group on the OpenThread interface. Run it with esp_netif_tcpip_exec().
+ *
+ * @param[in] ctx   The group address (ip6_addr_t *).
+ *
+ * @return
+ *      - ESP_OK on success in joining the group.
+ */
+esp_err_t join_ip6_mcast(void *ctx);
+
+/**
+ * @brief Leave an IPv6 multicast group on the OpenThread interface. Run it with esp_netif_tcpip_exec().
+ *
+ * @param[in] ctx   The group address (ip6_addr_t *).
+ *
+ * @return
+ *      - ESP_OK on success in leaving the group.
+ */
+esp_err_t leave_ip6_mcast(void *ctx);
+
 /**
  * @brief Get the Interface name struct.
  *
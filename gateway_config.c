@@ -0,0 +1,70 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "gateway_config.h"
+
+#include <string.h>
+
+void gateway_config_store_init(GATEWAY_CONFIG_STORE *store, const GATEWAY_CONFIG *config)
+{
+    memset(store, 0, sizeof(*store));
+    store->slots[0] = *config;
+    if (store->slots[0].version == 0) {
+        store->slots[0].version = 1;
+    }
+    atomic_init(&store->readers[0], 0);
+    atomic_init(&store->readers[1], 0);
+    atomic_init(&store->current, 0);
+}
+
+bool gateway_config_valid(const GATEWAY_CONFIG *config)
+{
+    return config->layout == GATEWAY_CONFIG_LAYOUT &&
+           memchr(config->dest_ipaddr, '\0', sizeof(config->dest_ipaddr)) != NULL &&
+           config->dest_port != 0 && config->send_period_ms > 0 && config->send_period_ms <= 60000 &&
+           config->codec_resync_ms > 0 && config->backend <= GATEWAY_BACKEND_MQTTSN &&
+           memchr(config->mqttsn_ipaddr, '\0', sizeof(config->mqttsn_ipaddr)) != NULL && config->mqttsn_port != 0 &&
+           config->mqttsn_qos >= -1 && config->mqttsn_qos <= 1;
+}
+
+const GATEWAY_CONFIG *gateway_config_read_lock(GATEWAY_CONFIG_STORE *store)
+{
+    while (true) {
+        unsigned slot = atomic_load(&store->current);
+        atomic_fetch_add(&store->readers[slot], 1);
+        // Still current once counted: a publish can no longer overwrite it. Otherwise a publish may be writing
+        // this copy right now, so step back and take the one it just made current.
+        if (atomic_load(&store->current) == slot) {
+            return &store->slots[slot];
+        }
+        atomic_fetch_sub(&store->readers[slot], 1);
+    }
+}
+
+void gateway_config_read_unlock(GATEWAY_CONFIG_STORE *store, const GATEWAY_CONFIG *config)
+{
+    atomic_fetch_sub(&store->readers[config - store->slots], 1);
+}
+
+uint32_t gateway_config_publish(GATEWAY_CONFIG_STORE *store, const GATEWAY_CONFIG *config, void (*wait)(void))
+{
+    unsigned old = atomic_load(&store->current);
+    unsigned next = old ^ 1;
+    bool waited = false;
+
+    // Grace period: readers that got the spare copy before the previous publish must be done with it
+    while (atomic_load(&store->readers[next]) != 0) {
+        waited = true;
+        wait();
+    }
+    store->slots[next] = *config;
+    store->slots[next].version = store->slots[old].version + 1;
+    atomic_store(&store->current, next);
+
+    store->publishes++;
+    store->grace_waits += waited;
+    return store->slots[next].version;
+}
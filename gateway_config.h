@@ -0,0 +1,124 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "uwb_msg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GATEWAY_CONFIG_LAYOUT 3             // Bump when GATEWAY_CONFIG changes, stored copies are then discarded
+#define GATEWAY_CONFIG_IPADDR_STRLEN 48     // As UDP_IPADDR_STRLEN
+
+typedef enum {
+    GATEWAY_BACKEND_UDP = 0,                // Lines and frames to the bridge (mqttconnection.py)
+    GATEWAY_BACKEND_MQTTSN = 1,             // Lines published straight to an MQTT-SN gateway (gw_mqttsn.c)
+} gateway_backend_t;
+
+/**
+ * @brief Runtime settings of the gateway. Persisted as is, so only fixed-size fields.
+ *
+ */
+typedef struct gateway_config {
+    uint16_t layout;                                // GATEWAY_CONFIG_LAYOUT
+    uint32_t version;                               // Incremented by every change, 0 until the first publish
+    char dest_ipaddr[GATEWAY_CONFIG_IPADDR_STRLEN]; // Bridge address as entered
+    uint8_t dest_addr[16];                          // The same, parsed once by whoever sets it
+    uint16_t dest_port;
+    uint16_t local_port;                            // Source port of the UDP socket, rebound on change
+    uint32_t send_period_ms;                        // Longest time a pending sample waits for its TX window
+    uint16_t manufacturer_id;                       // Tag and anchor advertisements
+    int8_t min_rssi;                                // Weaker advertisements are filtered out in the GAP callback
+    uint8_t stream_codec;                           // Ranges go out compressed (stream_codec.c), not as text lines
+    uint16_t codec_resync_ms;                       // Keyframe interval of the compressed stream
+    uint8_t backend;                                // gateway_backend_t
+    char mqttsn_ipaddr[GATEWAY_CONFIG_IPADDR_STRLEN];
+    uint8_t mqttsn_addr[16];
+    uint16_t mqttsn_port;
+    uint16_t mqttsn_keepalive_s;
+    int8_t mqttsn_qos;                              // Samples at 0, 1 or -1; events always go at QoS 1
+} GATEWAY_CONFIG;
+
+#define GATEWAY_CONFIG_DEFAULT() {                                                                  \
+    .layout = GATEWAY_CONFIG_LAYOUT,                                                                \
+    .dest_ipaddr = "fd40:e3e2:5852:4d1:a433:cd2c:20c8:fb4b",                                        \
+    .dest_addr = {0xfd, 0x40, 0xe3, 0xe2, 0x58, 0x52, 0x04, 0xd1,                                   \
+                  0xa4, 0x33, 0xcd, 0x2c, 0x20, 0xc8, 0xfb, 0x4b},                                  \
+    .dest_port = 20617,                                                                             \
+    .local_port = 12345,                                                                            \
+    .send_period_ms = 200,                                                                          \
+    .manufacturer_id = UWB_MSG_MANUFACTURER_ID,                                                     \
+    .min_rssi = -127,                                                                               \
+    .stream_codec = 0,                                                                              \
+    .codec_resync_ms = 1000,                                                                        \
+    .backend = GATEWAY_BACKEND_UDP,                                                                 \
+    .mqttsn_ipaddr = "fd40:e3e2:5852:4d1:a433:cd2c:20c8:fb4b",                                      \
+    .mqttsn_addr = {0xfd, 0x40, 0xe3, 0xe2, 0x58, 0x52, 0x04, 0xd1,                                 \
+                    0xa4, 0x33, 0xcd, 0x2c, 0x20, 0xc8, 0xfb, 0x4b},                                \
+    .mqttsn_port = 10000,                                                                           \
+    .mqttsn_keepalive_s = 60,                                                                       \
+    .mqttsn_qos = 0,                                                                                \
+}
+
+/**
+ * @brief Two copies of the settings and the index of the current one. Readers never block or retry more than
+ *        once per publish; a publish waits until the readers of the copy it overwrites are gone.
+ *
+ */
+typedef struct gateway_config_store {
+    GATEWAY_CONFIG slots[2];
+    atomic_uint readers[2];     // Readers holding each copy, or about to check that it is still current
+    atomic_uint current;        // Index of the copy new readers get
+    uint32_t publishes;
+    uint32_t grace_waits;       // Times a publish had to wait for readers of the old copy
+} GATEWAY_CONFIG_STORE;
+
+/**
+ * @brief Initialise the store with its first settings, as version 1 unless they carry a version.
+ *
+ */
+void gateway_config_store_init(GATEWAY_CONFIG_STORE *store, const GATEWAY_CONFIG *config);
+
+/**
+ * @brief Check a configuration before it is published or after it is loaded.
+ *
+ * @return
+ *      - true if every field is in range.
+ */
+bool gateway_config_valid(const GATEWAY_CONFIG *config);
+
+/**
+ * @brief Get the current settings. They stay unchanged until gateway_config_read_unlock(), keep it short.
+ *
+ */
+const GATEWAY_CONFIG *gateway_config_read_lock(GATEWAY_CONFIG_STORE *store);
+
+/**
+ * @brief Release the settings returned by gateway_config_read_lock().
+ *
+ */
+void gateway_config_read_unlock(GATEWAY_CONFIG_STORE *store, const GATEWAY_CONFIG *config);
+
+/**
+ * @brief Make new settings current, with the next version. Publishers must be serialised by the caller.
+ *
+ * @param[in] store     The store.
+ * @param[in] config    The new settings, their version is ignored.
+ * @param[in] wait      Called while readers still hold the copy being replaced, e.g. to sleep one tick.
+ *
+ * @return
+ *      - The version of the published settings.
+ */
+uint32_t gateway_config_publish(GATEWAY_CONFIG_STORE *store, const GATEWAY_CONFIG *config, void (*wait)(void));
+
+#ifdef __cplusplus
+}
+#endif
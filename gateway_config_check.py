@@ -0,0 +1,325 @@
+import argparse
+import ctypes
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+# Host hammer test of the double-buffered settings (gateway_config.c): one thread publishes new settings back to
+# back while a sender takes a snapshot per datagram at full rate, copies it and sends it to a loopback receiver,
+# as udp_socket_client_task() does, and reader threads take snapshots as the GAP callback and the adv worker do.
+# Every field of the settings is derived from their version, so each snapshot, and each datagram once received,
+# shows whether it was torn. A snapshot older than the last publish that had returned when it was taken is stale.
+# With --tsan the same harness is built as a ThreadSanitizer executable and must run without a report.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+SHIM = r"""
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "gateway_config.h"
+
+#define CHECK_MAX_READERS 16
+
+typedef struct check_result {
+    uint64_t publishes;
+    uint64_t grace_waits;
+    uint64_t reads;
+    uint64_t sends;
+    uint64_t received;
+    uint64_t torn;
+    uint64_t stale;
+    uint64_t max_lock_ns;
+} CHECK_RESULT;
+
+static GATEWAY_CONFIG_STORE store;
+static atomic_uint published;
+static atomic_bool stop;
+static atomic_ullong reads, sends, received, torn, stale, max_lock_ns;
+static int tx_sock, rx_sock;
+static struct sockaddr_in rx_addr;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void check_fill(GATEWAY_CONFIG *c, uint32_t v)
+{
+    memset(c, 0, sizeof(*c));
+    c->layout = GATEWAY_CONFIG_LAYOUT;
+    c->version = v;
+    snprintf(c->dest_ipaddr, sizeof(c->dest_ipaddr), "fd00::%x:%x", v >> 16, v & 0xFFFF);
+    memset(c->dest_addr, v & 0xFF, sizeof(c->dest_addr));
+    c->dest_port = 1 + v % 65535;
+    c->local_port = 1 + (v * 7) % 65535;
+    c->send_period_ms = 1 + v % 60000;
+    c->manufacturer_id = (v & 0xFFFF) ^ 0x5A5A;
+    c->min_rssi = -(int)(v % 128);
+    c->stream_codec = v & 1;
+    c->codec_resync_ms = 1 + v % 65535;
+    c->backend = v & 1;
+    memcpy(c->mqttsn_ipaddr, c->dest_ipaddr, sizeof(c->mqttsn_ipaddr));
+    memset(c->mqttsn_addr, ~v & 0xFF, sizeof(c->mqttsn_addr));
+    c->mqttsn_port = 1 + (v * 3) % 65535;
+    c->mqttsn_keepalive_s = v & 0xFFFF;
+    c->mqttsn_qos = (int)(v % 3) - 1;
+}
+
+static bool check_consistent(const GATEWAY_CONFIG *c)
+{
+    GATEWAY_CONFIG e;
+
+    check_fill(&e, c->version);
+    return c->layout == e.layout && strcmp(c->dest_ipaddr, e.dest_ipaddr) == 0 &&
+           memcmp(c->dest_addr, e.dest_addr, sizeof(e.dest_addr)) == 0 && c->dest_port == e.dest_port &&
+           c->local_port == e.local_port && c->send_period_ms == e.send_period_ms &&
+           c->manufacturer_id == e.manufacturer_id && c->min_rssi == e.min_rssi &&
+           c->stream_codec == e.stream_codec && c->codec_resync_ms == e.codec_resync_ms && c->backend == e.backend &&
+           strcmp(c->mqttsn_ipaddr, e.mqttsn_ipaddr) == 0 &&
+           memcmp(c->mqttsn_addr, e.mqttsn_addr, sizeof(e.mqttsn_addr)) == 0 && c->mqttsn_port == e.mqttsn_port &&
+           c->mqttsn_keepalive_s == e.mqttsn_keepalive_s && c->mqttsn_qos == e.mqttsn_qos;
+}
+
+static void check_wait(void)
+{
+    sched_yield();
+}
+
+static void *publisher(void *arg)
+{
+    GATEWAY_CONFIG next;
+
+    while (!atomic_load(&stop)) {
+        check_fill(&next, store.slots[atomic_load(&store.current)].version + 1);
+        atomic_store(&published, gateway_config_publish(&store, &next, check_wait));
+    }
+    return NULL;
+}
+
+// One snapshot: counts it, checks it, and copies it out when asked
+static void check_snapshot(uint32_t *last_version, GATEWAY_CONFIG *copy)
+{
+    uint32_t floor = atomic_load(&published);
+    uint64_t start = now_ns();
+    const GATEWAY_CONFIG *config = gateway_config_read_lock(&store);
+    uint64_t lock_ns = now_ns() - start;
+
+    bool ok = check_consistent(config);
+    uint32_t version = config->version;
+    if (copy != NULL) {
+        *copy = *config;
+    }
+    gateway_config_read_unlock(&store, config);
+
+    atomic_fetch_add(&reads, 1);
+    atomic_fetch_add(&torn, !ok);
+    atomic_fetch_add(&stale, version < floor || version < *last_version);
+    *last_version = version;
+    uint64_t max = atomic_load(&max_lock_ns);
+    while (lock_ns > max && !atomic_compare_exchange_weak(&max_lock_ns, &max, lock_ns)) {
+    }
+}
+
+static void *reader(void *arg)
+{
+    uint32_t last_version = 0;
+
+    while (!atomic_load(&stop)) {
+        check_snapshot(&last_version, NULL);
+    }
+    return NULL;
+}
+
+static void *sender(void *arg)
+{
+    uint32_t last_version = 0;
+    GATEWAY_CONFIG copy;
+
+    while (!atomic_load(&stop)) {
+        check_snapshot(&last_version, &copy);
+        // The datagram is built from the copy after the snapshot is released, as the send path does
+        if (sendto(tx_sock, &copy, sizeof(copy), 0, (struct sockaddr *)&rx_addr, sizeof(rx_addr)) ==
+                sizeof(copy)) {
+            atomic_fetch_add(&sends, 1);
+        }
+    }
+    return NULL;
+}
+
+static void *receiver(void *arg)
+{
+    GATEWAY_CONFIG copy;
+
+    while (true) {
+        ssize_t len = recv(rx_sock, &copy, sizeof(copy), 0);
+        if (len < 0) {
+            if (atomic_load(&stop)) {
+                break;
+            }
+            continue;
+        }
+        atomic_fetch_add(&received, 1);
+        atomic_fetch_add(&torn, len != sizeof(copy) || !check_consistent(&copy));
+    }
+    return NULL;
+}
+
+int check_run(int n_readers, uint32_t duration_ms, CHECK_RESULT *result)
+{
+    pthread_t pub, snd, rcv, rd[CHECK_MAX_READERS];
+    GATEWAY_CONFIG first;
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = 100000};
+    socklen_t addr_len = sizeof(rx_addr);
+
+    if (n_readers > CHECK_MAX_READERS) {
+        return -1;
+    }
+    check_fill(&first, 1);
+    gateway_config_store_init(&store, &first);
+    atomic_store(&published, 1);
+    atomic_store(&stop, false);
+    atomic_store(&reads, 0);
+    atomic_store(&sends, 0);
+    atomic_store(&received, 0);
+    atomic_store(&torn, 0);
+    atomic_store(&stale, 0);
+    atomic_store(&max_lock_ns, 0);
+
+    rx_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    tx_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&rx_addr, 0, sizeof(rx_addr));
+    rx_addr.sin_family = AF_INET;
+    rx_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(rx_sock, (struct sockaddr *)&rx_addr, sizeof(rx_addr)) != 0 ||
+            getsockname(rx_sock, (struct sockaddr *)&rx_addr, &addr_len) != 0) {
+        return -1;
+    }
+    setsockopt(rx_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    pthread_create(&rcv, NULL, receiver, NULL);
+    pthread_create(&snd, NULL, sender, NULL);
+    for (int i = 0; i < n_readers; i++) {
+        pthread_create(&rd[i], NULL, reader, NULL);
+    }
+    pthread_create(&pub, NULL, publisher, NULL);
+    usleep(duration_ms * 1000u);
+    atomic_store(&stop, true);
+    pthread_join(pub, NULL);
+    pthread_join(snd, NULL);
+    for (int i = 0; i < n_readers; i++) {
+        pthread_join(rd[i], NULL);
+    }
+    pthread_join(rcv, NULL);
+    close(tx_sock);
+    close(rx_sock);
+
+    result->publishes = store.publishes;
+    result->grace_waits = store.grace_waits;
+    result->reads = atomic_load(&reads);
+    result->sends = atomic_load(&sends);
+    result->received = atomic_load(&received);
+    result->torn = atomic_load(&torn);
+    result->stale = atomic_load(&stale);
+    result->max_lock_ns = atomic_load(&max_lock_ns);
+    return 0;
+}
+
+#ifdef CHECK_MAIN
+int main(int argc, char *argv[])
+{
+    CHECK_RESULT r;
+
+    if (argc < 3 || check_run(atoi(argv[1]), (uint32_t)atoi(argv[2]), &r) != 0) {
+        return 2;
+    }
+    printf("%llu %llu %llu %llu %llu %llu %llu %llu\n", (unsigned long long)r.publishes,
+           (unsigned long long)r.grace_waits, (unsigned long long)r.reads, (unsigned long long)r.sends,
+           (unsigned long long)r.received, (unsigned long long)r.torn, (unsigned long long)r.stale,
+           (unsigned long long)r.max_lock_ns);
+    return r.torn || r.stale;
+}
+#endif
+"""
+
+
+class CheckResult(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_uint64) for name in ("publishes", "grace_waits", "reads", "sends", "received",
+                                                     "torn", "stale", "max_lock_ns")]
+
+
+def build(workdir, tsan=False):
+    """Build gateway_config.c with the harness, as a shared library or as a ThreadSanitizer executable."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run gateway_config.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    sources = [shim, os.path.join(HERE, "gateway_config.c")]
+    if tsan:
+        out = os.path.join(workdir, "gateway_config_tsan")
+        subprocess.run([cc, "-O1", "-g", "-fsanitize=thread", "-DCHECK_MAIN", "-I", HERE, "-o", out, *sources,
+                        "-lpthread"], check=True)
+        return out
+    out = os.path.join(workdir, "gateway_config.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", out, *sources, "-lpthread"], check=True)
+    dll = ctypes.CDLL(out)
+    dll.check_run.restype = ctypes.c_int
+    dll.check_run.argtypes = [ctypes.c_int, ctypes.c_uint32, ctypes.POINTER(CheckResult)]
+    return dll
+
+
+def summarise(case, readers, values, duration_ms):
+    result = {"case": case, "readers": readers, "duration_ms": duration_ms}
+    result.update(values)
+    result["max_lock_us"] = round(result.pop("max_lock_ns") / 1000, 1)
+    result["ok"] = result["torn"] == 0 and result["stale"] == 0 and result["publishes"] > 0 and \
+        result["sends"] > 0 and result["received"] > 0
+    return result
+
+
+# python3 gateway_config_check.py --readers 1,4 --duration 5 --tsan
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Concurrent reconfiguration against a full-rate sender")
+    parser.add_argument("--readers", default="1,4", help="comma separated counts of snapshot readers besides the "
+                                                         "sender, at most 16")
+    parser.add_argument("--duration", type=float, default=5.0, help="seconds per case")
+    parser.add_argument("--tsan", action="store_true", help="also run a ThreadSanitizer build with 3 readers")
+    args = parser.parse_args()
+
+    failed = False
+    duration_ms = int(args.duration * 1000)
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = build(workdir)
+        for readers in [int(v) for v in args.readers.split(",")]:
+            values = CheckResult()
+            if dll.check_run(readers, duration_ms, ctypes.byref(values)) != 0:
+                raise SystemExit("harness setup failed")
+            result = summarise("hammer", readers, {name: getattr(values, name) for name, _ in values._fields_},
+                               duration_ms)
+            failed |= not result["ok"]
+            print(json.dumps(result))
+        if args.tsan:
+            exe = build(workdir, tsan=True)
+            proc = subprocess.run([exe, "3", str(duration_ms)], capture_output=True, text=True)
+            fields = proc.stdout.split()
+            result = summarise("tsan", 3, dict(zip((name for name, _ in CheckResult._fields_), map(int, fields))),
+                               duration_ms) if len(fields) == 8 else {"case": "tsan", "ok": False}
+            result["race_reports"] = proc.stderr.count("WARNING: ThreadSanitizer")
+            result["ok"] &= proc.returncode == 0 and result["race_reports"] == 0
+            failed |= not result["ok"]
+            print(json.dumps(result))
+    sys.exit(1 if failed else 0)
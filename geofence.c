@@ -0,0 +1,269 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "geofence.h"
+
+#include <string.h>
+
+static void geofence_emit(GEOFENCE *fence, GEOFENCE_TAG *tag, const GEOFENCE_ZONE *zone, geofence_event_type_t type,
+                          uint32_t inside_ms, geofence_event_cb_t cb, void *ctx)
+{
+    GEOFENCE_EVENT event;
+
+    if (!tag->report || cb == NULL) {
+        return;
+    }
+    memcpy(event.addr, tag->addr, TAG_ADDR_LEN);
+    event.zone_id = zone->id;
+    event.type = type;
+    event.inside_ms = inside_ms;
+    fence->events++;
+    cb(&event, ctx);
+}
+
+static void geofence_clear_zone_bit(GEOFENCE *fence, int index)
+{
+    uint16_t mask = (uint16_t)~(1u << index);
+
+    for (int i = 0; i < GEOFENCE_TABLE_SIZE; i++) {
+        fence->tags[i].inside &= mask;
+        fence->tags[i].dwelled &= mask;
+    }
+}
+
+static bool geofence_point_in_polygon(const GEOFENCE_ZONE *zone, GEOFENCE_POINT p)
+{
+    bool inside = false;
+
+    for (int i = 0, j = zone->vertex_count - 1; i < zone->vertex_count; j = i++) {
+        const GEOFENCE_POINT *a = &zone->vertices[i];
+        const GEOFENCE_POINT *b = &zone->vertices[j];
+        if ((a->y_cm > p.y_cm) != (b->y_cm > p.y_cm)) {
+            // Crossing of the horizontal ray to +x, compared without division
+            int64_t lhs = (int64_t)(p.x_cm - a->x_cm) * (b->y_cm - a->y_cm);
+            int64_t rhs = (int64_t)(b->x_cm - a->x_cm) * (p.y_cm - a->y_cm);
+            if ((b->y_cm > a->y_cm) ? (lhs < rhs) : (lhs > rhs)) {
+                inside = !inside;
+            }
+        }
+    }
+    return inside;
+}
+
+// True if p is within margin_cm of an edge of the polygon
+static bool geofence_near_polygon(const GEOFENCE_ZONE *zone, GEOFENCE_POINT p, uint16_t margin_cm)
+{
+    float margin2 = (float)margin_cm * margin_cm;
+
+    for (int i = 0, j = zone->vertex_count - 1; i < zone->vertex_count; j = i++) {
+        float ax = zone->vertices[j].x_cm, ay = zone->vertices[j].y_cm;
+        float dx = zone->vertices[i].x_cm - ax, dy = zone->vertices[i].y_cm - ay;
+        float px = p.x_cm - ax, py = p.y_cm - ay;
+        float len2 = dx * dx + dy * dy;
+        float t = len2 > 0 ? (px * dx + py * dy) / len2 : 0;
+        t = t < 0 ? 0 : (t > 1 ? 1 : t);
+        float ex = px - t * dx, ey = py - t * dy;
+        if (ex * ex + ey * ey <= margin2) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 1 inside, 0 outside, -1 when the sample says nothing about this zone
+static int geofence_zone_test(const GEOFENCE_ZONE *zone, const GEOFENCE_SAMPLE *sample, bool was_inside)
+{
+    if (zone->type == GEOFENCE_ZONE_RANGE) {
+        if (sample->anchor != zone->anchor) {
+            return -1;
+        }
+        return sample->dist_cm <= (was_inside ? zone->exit_cm : zone->enter_cm);
+    }
+    if (!sample->has_pos) {
+        return -1;
+    }
+    if (geofence_point_in_polygon(zone, sample->pos)) {
+        return 1;
+    }
+    return was_inside && zone->margin_cm > 0 && geofence_near_polygon(zone, sample->pos, zone->margin_cm);
+}
+
+static void geofence_check_dwell(GEOFENCE *fence, GEOFENCE_TAG *tag, int index, uint32_t now_ms,
+                                 geofence_event_cb_t cb, void *ctx)
+{
+    const GEOFENCE_ZONE *zone = &fence->zones[index];
+    uint16_t bit = 1u << index;
+    uint32_t inside_ms = now_ms - tag->enter_ms[index];
+
+    if (zone->dwell_ms > 0 && !(tag->dwelled & bit) && inside_ms >= zone->dwell_ms) {
+        tag->dwelled |= bit;
+        geofence_emit(fence, tag, zone, GEOFENCE_DWELL, inside_ms, cb, ctx);
+    }
+}
+
+static GEOFENCE_TAG *geofence_lookup(GEOFENCE *fence, const uint8_t addr[TAG_ADDR_LEN], bool *created, uint32_t now_ms)
+{
+    GEOFENCE_TAG *victim = NULL;
+
+    *created = false;
+    for (int i = 0; i < GEOFENCE_TABLE_SIZE; i++) {
+        GEOFENCE_TAG *tag = &fence->tags[i];
+        if (!tag->used) {
+            if (victim == NULL || victim->used) {
+                victim = tag;
+            }
+            continue;
+        }
+        if (memcmp(tag->addr, addr, TAG_ADDR_LEN) == 0) {
+            return tag;
+        }
+        if (victim == NULL || (victim->used && (now_ms - tag->last_ms) > (now_ms - victim->last_ms))) {
+            victim = tag;
+        }
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    memcpy(victim->addr, addr, TAG_ADDR_LEN);
+    victim->used = true;
+    *created = true;
+    return victim;
+}
+
+void geofence_init(GEOFENCE *fence)
+{
+    memset(fence, 0, sizeof(*fence));
+}
+
+bool geofence_zone_set(GEOFENCE *fence, const GEOFENCE_ZONE *zone)
+{
+    int slot = -1;
+
+    if (zone->id == 0) {
+        return false;
+    }
+    if (zone->type == GEOFENCE_ZONE_RANGE && zone->exit_cm < zone->enter_cm) {
+        return false;
+    }
+    if (zone->type == GEOFENCE_ZONE_POLYGON && (zone->vertex_count < 3 || zone->vertex_count > GEOFENCE_MAX_VERTICES)) {
+        return false;
+    }
+    for (int i = 0; i < GEOFENCE_MAX_ZONES; i++) {
+        if (fence->zones[i].id == zone->id) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && fence->zones[i].id == 0) {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        return false;
+    }
+    fence->zones[slot] = *zone;
+    geofence_clear_zone_bit(fence, slot);
+    return true;
+}
+
+bool geofence_zone_remove(GEOFENCE *fence, uint8_t id)
+{
+    for (int i = 0; i < GEOFENCE_MAX_ZONES; i++) {
+        if (id != 0 && fence->zones[i].id == id) {
+            memset(&fence->zones[i], 0, sizeof(fence->zones[i]));
+            geofence_clear_zone_bit(fence, i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void geofence_zone_clear(GEOFENCE *fence)
+{
+    memset(fence->zones, 0, sizeof(fence->zones));
+    for (int i = 0; i < GEOFENCE_TABLE_SIZE; i++) {
+        fence->tags[i].inside = 0;
+        fence->tags[i].dwelled = 0;
+    }
+}
+
+int geofence_zone_count(const GEOFENCE *fence)
+{
+    int count = 0;
+
+    for (int i = 0; i < GEOFENCE_MAX_ZONES; i++) {
+        count += fence->zones[i].id != 0;
+    }
+    return count;
+}
+
+bool geofence_evaluate(GEOFENCE *fence, const uint8_t addr[TAG_ADDR_LEN], const GEOFENCE_SAMPLE *sample,
+                       uint32_t now_ms, bool report, geofence_event_cb_t cb, void *ctx)
+{
+    bool created;
+    bool any_zone = false;
+    GEOFENCE_TAG *tag = geofence_lookup(fence, addr, &created, now_ms);
+
+    fence->samples++;
+    tag->last_ms = now_ms;
+    tag->report = report;
+
+    for (int i = 0; i < GEOFENCE_MAX_ZONES; i++) {
+        const GEOFENCE_ZONE *zone = &fence->zones[i];
+        uint16_t bit = 1u << i;
+        if (zone->id == 0) {
+            continue;
+        }
+        any_zone = true;
+
+        int in = geofence_zone_test(zone, sample, tag->inside & bit);
+        if (in > 0 && !(tag->inside & bit)) {
+            tag->inside |= bit;
+            tag->dwelled &= ~bit;
+            tag->enter_ms[i] = now_ms;
+            geofence_emit(fence, tag, zone, GEOFENCE_ENTER, 0, cb, ctx);
+        } else if (in == 0 && (tag->inside & bit)) {
+            tag->inside &= ~bit;
+            geofence_emit(fence, tag, zone, GEOFENCE_EXIT, now_ms - tag->enter_ms[i], cb, ctx);
+        }
+        if (tag->inside & bit) {
+            geofence_check_dwell(fence, tag, i, now_ms, cb, ctx);
+        }
+    }
+
+    if (!any_zone) {
+        return true;
+    }
+    if (fence->raw_interval_ms > 0 && (created || now_ms - tag->last_raw_ms >= fence->raw_interval_ms)) {
+        tag->last_raw_ms = now_ms;
+        fence->raw_forwarded++;
+        return true;
+    }
+    return false;
+}
+
+void geofence_tick(GEOFENCE *fence, uint32_t now_ms, geofence_event_cb_t cb, void *ctx)
+{
+    for (int t = 0; t < GEOFENCE_TABLE_SIZE; t++) {
+        GEOFENCE_TAG *tag = &fence->tags[t];
+        if (!tag->used) {
+            continue;
+        }
+        bool lost = now_ms - tag->last_ms > GEOFENCE_LOST_MS;
+        for (int i = 0; i < GEOFENCE_MAX_ZONES; i++) {
+            if (!(tag->inside & (1u << i))) {
+                continue;
+            }
+            if (lost) {
+                geofence_emit(fence, tag, &fence->zones[i], GEOFENCE_EXIT, tag->last_ms - tag->enter_ms[i], cb, ctx);
+            } else {
+                geofence_check_dwell(fence, tag, i, now_ms, cb, ctx);
+            }
+        }
+        if (lost) {
+            tag->used = false;
+            tag->inside = 0;
+        }
+    }
+}
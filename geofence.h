@@ -0,0 +1,153 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "tag_seq_filter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GEOFENCE_MAX_ZONES 16           // One bit per zone in the per-tag state
+#define GEOFENCE_MAX_VERTICES 8
+#define GEOFENCE_TABLE_SIZE 64          // Tags tracked at once, least recently heard is evicted
+#define GEOFENCE_LOST_MS 5000           // A tag silent for this long leaves every zone
+
+typedef enum {
+    GEOFENCE_ZONE_RANGE = 0,        // Distance to one anchor below a threshold
+    GEOFENCE_ZONE_POLYGON,          // Position inside a polygon
+} geofence_zone_type_t;
+
+typedef enum {
+    GEOFENCE_ENTER = 0,
+    GEOFENCE_EXIT,
+    GEOFENCE_DWELL,                 // Inside for the zone's dwell time, reported once per visit
+} geofence_event_type_t;
+
+typedef struct geofence_point {
+    int16_t x_cm;
+    int16_t y_cm;
+} GEOFENCE_POINT;
+
+/**
+ * @brief Zone definition.
+ *
+ * Range zones are entered at or below enter_cm and left above exit_cm (exit_cm >= enter_cm).
+ * Polygon zones are entered inside the polygon and left once more than margin_cm outside of it.
+ *
+ */
+typedef struct geofence_zone {
+    uint8_t id;                     // 1..255, 0 marks a free slot
+    uint8_t type;                   // geofence_zone_type_t
+    uint8_t anchor;                 // Range zones: anchor the distance is measured to
+    uint8_t vertex_count;
+    uint16_t enter_cm;
+    uint16_t exit_cm;
+    uint16_t margin_cm;
+    uint32_t dwell_ms;              // 0: no dwell event
+    GEOFENCE_POINT vertices[GEOFENCE_MAX_VERTICES];
+} GEOFENCE_ZONE;
+
+typedef struct geofence_sample {
+    uint8_t anchor;
+    uint16_t dist_cm;
+    bool has_pos;
+    GEOFENCE_POINT pos;
+} GEOFENCE_SAMPLE;
+
+typedef struct geofence_event {
+    uint8_t addr[TAG_ADDR_LEN];
+    uint8_t zone_id;
+    geofence_event_type_t type;
+    uint32_t inside_ms;             // Time spent inside the zone so far, 0 on enter
+} GEOFENCE_EVENT;
+
+typedef void (*geofence_event_cb_t)(const GEOFENCE_EVENT *event, void *ctx);
+
+typedef struct geofence_tag {
+    uint8_t addr[TAG_ADDR_LEN];
+    bool used;
+    bool report;                    // Events of this tag are reported (see geofence_evaluate)
+    uint16_t inside;                // Bit n: inside zones[n]
+    uint16_t dwelled;               // Bit n: dwell event already sent for this visit
+    uint32_t last_ms;
+    uint32_t last_raw_ms;
+    uint32_t enter_ms[GEOFENCE_MAX_ZONES];
+} GEOFENCE_TAG;
+
+typedef struct geofence {
+    GEOFENCE_ZONE zones[GEOFENCE_MAX_ZONES];
+    uint32_t raw_interval_ms;       // Raw samples still forwarded per tag while zones are set, 0 for none
+    GEOFENCE_TAG tags[GEOFENCE_TABLE_SIZE];
+    uint32_t samples;
+    uint32_t events;
+    uint32_t raw_forwarded;
+} GEOFENCE;
+
+/**
+ * @brief Reset the engine: no zones, no tags.
+ *
+ */
+void geofence_init(GEOFENCE *fence);
+
+/**
+ * @brief Add a zone, or replace the zone with the same id. Tags re-enter the replaced zone from scratch.
+ *
+ * @return
+ *      - false if the zone is invalid or the table is full.
+ */
+bool geofence_zone_set(GEOFENCE *fence, const GEOFENCE_ZONE *zone);
+
+/**
+ * @brief Remove a zone, without exit events.
+ *
+ * @return
+ *      - false if no zone has this id.
+ */
+bool geofence_zone_remove(GEOFENCE *fence, uint8_t id);
+
+/**
+ * @brief Remove every zone.
+ *
+ */
+void geofence_zone_clear(GEOFENCE *fence);
+
+/**
+ * @brief Number of zones set.
+ *
+ */
+int geofence_zone_count(const GEOFENCE *fence);
+
+/**
+ * @brief Evaluate one tag sample against every zone.
+ *
+ * @param[in] fence     The engine. Not thread safe, callers serialise access.
+ * @param[in] addr      Tag address.
+ * @param[in] sample    Range and, when known, position of the tag.
+ * @param[in] now_ms    Current time in milliseconds.
+ * @param[in] report    Report this tag's events. Gateways not forwarding the tag still track it, so they take
+ *                      over with an up to date state.
+ * @param[in] cb        Called for each event.
+ * @param[in] ctx       Passed to cb.
+ *
+ * @return
+ *      - true if the raw sample must be forwarded as well: no zone is set, or the tag's raw interval is due.
+ */
+bool geofence_evaluate(GEOFENCE *fence, const uint8_t addr[TAG_ADDR_LEN], const GEOFENCE_SAMPLE *sample,
+                       uint32_t now_ms, bool report, geofence_event_cb_t cb, void *ctx);
+
+/**
+ * @brief Fire due dwell events and let tags not heard for GEOFENCE_LOST_MS exit their zones.
+ *
+ */
+void geofence_tick(GEOFENCE *fence, uint32_t now_ms, geofence_event_cb_t cb, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,272 @@
+import argparse
+import ctypes
+import json
+import math
+import os
+import random
+import shutil
+import struct
+import subprocess
+import tempfile
+
+import bridge_msg
+from bridge_bench import tag_adv
+from bridge_trace import SRC_BLE_ADV, GatewayModel, TraceWriter, read_records
+from tag_rate_sim import Walker
+
+# Host benchmark of geofence.c: evaluation cost per sample, and the traffic the gateway sends with zones set
+# against forwarding every range. The input is a capture of tag advertisements ("trace" on the gateway, see
+# bridge_trace.py), or a synthetic one of tags walking around the anchor. Advertisements go through the host
+# model of the gateway forwarding path first, so only the ranges the gateway would forward reach the engine.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+TICK_MS = 1000              # GW_GEOFENCE_TICK_PERIOD_MS
+
+SHIM = """
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "geofence.h"
+#include "uwb_msg.h"
+
+typedef struct bench_result {
+    uint64_t elapsed_ns;
+    uint32_t events;
+    uint32_t event_bytes;
+    uint32_t raw;
+} BENCH_RESULT;
+
+static void bench_event_cb(const GEOFENCE_EVENT *event, void *ctx)
+{
+    static const char *const event_names[] = {"enter", "exit", "dwell"};
+    BENCH_RESULT *result = ctx;
+    char line[64];
+
+    result->events++;
+    result->event_bytes += snprintf(line, sizeof(line), UWB_LINE_ZONE_FMT, UWB_LINE_BDA_ARGS(event->addr),
+                                    event_names[event->type], event->zone_id, event->inside_ms) + 1;
+}
+
+static void bench_count_cb(const GEOFENCE_EVENT *event, void *ctx)
+{
+    ((BENCH_RESULT *)ctx)->events++;
+}
+
+GEOFENCE *bench_fence_new(void)
+{
+    GEOFENCE *fence = malloc(sizeof(*fence));
+    geofence_init(fence);
+    return fence;
+}
+
+bool bench_zone_range(GEOFENCE *fence, uint8_t id, uint16_t enter_cm, uint16_t exit_cm, uint32_t dwell_ms)
+{
+    GEOFENCE_ZONE zone = {.id = id, .type = GEOFENCE_ZONE_RANGE, .anchor = 0, .enter_cm = enter_cm,
+                          .exit_cm = exit_cm, .dwell_ms = dwell_ms};
+    return geofence_zone_set(fence, &zone);
+}
+
+bool bench_zone_polygon(GEOFENCE *fence, uint8_t id, const int16_t *xy, uint8_t count, uint16_t margin_cm)
+{
+    GEOFENCE_ZONE zone = {.id = id, .type = GEOFENCE_ZONE_POLYGON, .vertex_count = count, .margin_cm = margin_cm};
+    for (int i = 0; i < count; i++) {
+        zone.vertices[i] = (GEOFENCE_POINT) {xy[2 * i], xy[2 * i + 1]};
+    }
+    return geofence_zone_set(fence, &zone);
+}
+
+// Every sample in order, with the tick timer every tick_ms of sample time; format sizes the event lines
+void bench_run(GEOFENCE *fence, uint32_t raw_interval_ms, const uint8_t *addrs, const uint16_t *dist_cm,
+               const int16_t *xy, const uint32_t *t_ms, uint32_t count, uint32_t tick_ms, bool format,
+               BENCH_RESULT *result)
+{
+    geofence_event_cb_t cb = format ? bench_event_cb : bench_count_cb;
+    struct timespec start, end;
+    uint32_t next_tick = count > 0 ? t_ms[0] + tick_ms : 0;
+
+    memset(fence->tags, 0, sizeof(fence->tags));
+    fence->raw_interval_ms = raw_interval_ms;
+    memset(result, 0, sizeof(*result));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < count; i++) {
+        GEOFENCE_SAMPLE sample = {.anchor = 0, .dist_cm = dist_cm[i], .has_pos = xy != NULL};
+        if (xy != NULL) {
+            sample.pos = (GEOFENCE_POINT) {xy[2 * i], xy[2 * i + 1]};
+        }
+        while (t_ms[i] >= next_tick) {
+            geofence_tick(fence, next_tick, cb, result);
+            next_tick += tick_ms;
+        }
+        result->raw += geofence_evaluate(fence, addrs + i * TAG_ADDR_LEN, &sample, t_ms[i], true, cb, result);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->elapsed_ns = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000u + end.tv_nsec - start.tv_nsec;
+}
+"""
+
+
+class BenchResult(ctypes.Structure):
+    _fields_ = [("elapsed_ns", ctypes.c_uint64), ("events", ctypes.c_uint32), ("event_bytes", ctypes.c_uint32),
+                ("raw", ctypes.c_uint32)]
+
+
+def load_geofence(workdir):
+    """Build geofence.c into a shared library."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run geofence.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    lib = os.path.join(workdir, "geofence.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", lib, shim, os.path.join(HERE, "geofence.c")],
+                   check=True)
+    dll = ctypes.CDLL(lib)
+    dll.bench_fence_new.restype = ctypes.c_void_p
+    dll.bench_zone_range.restype = ctypes.c_bool
+    dll.bench_zone_range.argtypes = [ctypes.c_void_p, ctypes.c_uint8, ctypes.c_uint16, ctypes.c_uint16,
+                                     ctypes.c_uint32]
+    dll.bench_zone_polygon.restype = ctypes.c_bool
+    dll.bench_zone_polygon.argtypes = [ctypes.c_void_p, ctypes.c_uint8, ctypes.c_void_p, ctypes.c_uint8,
+                                       ctypes.c_uint16]
+    dll.bench_run.restype = None
+    dll.bench_run.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p,
+                              ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint32, ctypes.c_bool,
+                              ctypes.POINTER(BenchResult)]
+    return dll
+
+
+def synth_capture(path, cfg):
+    """Tags walking and standing around the anchor, one advertisement per range at cfg["rate"] Hz."""
+    rng = random.Random(cfg["seed"])
+    walkers = [Walker(random.Random(cfg["seed"] * 1000 + k), cfg) for k in range(cfg["tags"])]
+    phases = [rng.uniform(0, 1 / cfg["rate"]) for _ in walkers]
+    writer = TraceWriter(path)
+    step, t = 1 / cfg["rate"], 0.0
+    seq = [0] * len(walkers)
+    while t < cfg["duration_s"]:
+        for k, walker in sorted(enumerate(walkers), key=lambda kw: phases[kw[0]]):
+            dist_cm = walker.at(t + phases[k]) * 100 + rng.gauss(0, cfg["noise_cm"])
+            adv = tag_adv(max(0, min(0xFFFF, int(dist_cm))), seq[k] % 256)
+            seq[k] += 1
+            addr = bytes((0xC0, 0xDE, 0, 0, k >> 8, k & 0xFF))
+            writer.write(SRC_BLE_ADV, int((t + phases[k]) * 1e6), addr + struct.pack("<bB", -60, len(adv)) + adv)
+        t += step
+    writer.close()
+
+
+def forwarded_ranges(path):
+    """(addr, dist_cm, time_ms, line) of every range the gateway forwards for the capture."""
+    gateway = GatewayModel()
+    for source, time_us, payload in read_records(path):
+        if source != SRC_BLE_ADV:
+            continue
+        line = gateway.process(time_us, payload)
+        parsed = bridge_msg.parse_line(line) if line is not None else None
+        if parsed is None or parsed[0] != "range":
+            continue
+        addr, _seq, dist_cm, _rssi = parsed[1]
+        yield bytes.fromhex(addr), dist_cm, time_us // 1000, line
+
+
+def polygon_table(dll, fence, room_cm):
+    """Worst case: every zone slot holds an 8-vertex polygon, spread over the room."""
+    side = int(math.ceil(math.sqrt(16)))
+    cell = room_cm // side
+    for i in range(16):
+        cx, cy = (i % side) * cell + cell // 2, (i // side) * cell + cell // 2
+        xy = []
+        for v in range(8):
+            a = 2 * math.pi * v / 8
+            xy += [int(cx + cell * 0.4 * math.cos(a)), int(cy + cell * 0.4 * math.sin(a))]
+        if not dll.bench_zone_polygon(fence, i + 1, (ctypes.c_int16 * 16)(*xy), 8, 50):
+            raise SystemExit(f"polygon zone {i + 1} rejected")
+
+
+def run(dll, samples, zones, raw_intervals, cfg):
+    addrs = b"".join(s[0] for s in samples)
+    count = len(samples)
+    dist = (ctypes.c_uint16 * count)(*(s[1] for s in samples))
+    t_ms = (ctypes.c_uint32 * count)(*(s[2] & 0xFFFFFFFF for s in samples))
+    baseline_bytes = sum(len(s[3]) + 1 for s in samples)
+    span_s = max((samples[-1][2] - samples[0][2]) / 1000, 1e-3)
+    result = BenchResult()
+
+    fence = dll.bench_fence_new()
+    for zone_id, enter_cm, exit_cm, dwell_s in zones:
+        if not dll.bench_zone_range(fence, zone_id, enter_cm, exit_cm, dwell_s * 1000):
+            raise SystemExit(f"range zone {zone_id} rejected")
+
+    for raw_ms in raw_intervals:
+        dll.bench_run(fence, raw_ms, addrs, dist, None, t_ms, count, TICK_MS, True, ctypes.byref(result))
+        # Raw ranges go out in the same line format as without zones
+        raw_bytes = result.raw * baseline_bytes / count
+        sent_bytes = result.event_bytes + raw_bytes
+        timed = []
+        for _ in range(cfg["repeat"]):
+            dll.bench_run(fence, raw_ms, addrs, dist, None, t_ms, count, TICK_MS, False, ctypes.byref(result))
+            timed.append(result.elapsed_ns / count)
+        print(json.dumps({
+            "case": "range_zones", "zones": len(zones), "raw_interval_ms": raw_ms, "samples": count,
+            "span_s": round(span_s, 1), "events": result.events, "raw_forwarded": result.raw,
+            "ns_per_sample": round(min(timed), 1),
+            "lines_per_s": {"without": round(count / span_s, 1),
+                            "with": round((result.events + result.raw) / span_s, 2)},
+            "bytes_per_s": {"without": round(baseline_bytes / span_s), "with": round(sent_bytes / span_s)},
+            "reduction": round(baseline_bytes / sent_bytes, 1) if sent_bytes else None,
+        }))
+
+    # Evaluation cost with the zone table full of polygons and a position in every sample
+    fence = dll.bench_fence_new()
+    polygon_table(dll, fence, int(cfg["room_m"] * 100))
+    rng = random.Random(cfg["seed"])
+    room_cm = int(cfg["room_m"] * 100)
+    xy = (ctypes.c_int16 * (2 * count))(*(rng.randrange(0, room_cm) for _ in range(2 * count)))
+    timed = []
+    for _ in range(cfg["repeat"]):
+        dll.bench_run(fence, 0, addrs, dist, xy, t_ms, count, TICK_MS, False, ctypes.byref(result))
+        timed.append(result.elapsed_ns / count)
+    print(json.dumps({"case": "polygon_zones", "zones": 16, "vertices": 8, "samples": count,
+                      "events": result.events, "ns_per_sample": round(min(timed), 1)}))
+
+
+def parse_zone(text):
+    zone_id, enter_cm, exit_cm, dwell_s = (int(v) for v in text.split(","))
+    return zone_id, enter_cm, exit_cm, dwell_s
+
+
+# python3 geofence_bench.py --tags 50 --rate 10 --duration 600
+# python3 geofence_bench.py --trace capture.utrc --zone 1,300,350,30
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Geofence evaluation cost and traffic reduction")
+    parser.add_argument("--trace", help="capture of tag advertisements (bridge_trace.py capture), else synthetic")
+    parser.add_argument("--tags", type=int, default=50)
+    parser.add_argument("--rate", type=float, default=10.0, help="ranges per tag per second")
+    parser.add_argument("--duration", type=float, default=600.0, help="synthetic capture length, s")
+    parser.add_argument("--still", type=float, default=60.0, help="mean time a tag stands still, s")
+    parser.add_argument("--speed", default="0.5,1.5", help="walking speed range, m/s")
+    parser.add_argument("--room", type=float, default=20.0, help="room side, m, anchor in a corner")
+    parser.add_argument("--noise", type=float, default=3.0, help="range noise standard deviation, cm")
+    parser.add_argument("--zone", action="append", type=parse_zone, metavar="ID,ENTER_CM,EXIT_CM,DWELL_S",
+                        help="range zone to anchor 0, as \"zone range\"; repeat for more")
+    parser.add_argument("--raw", default="0,10000", help="\"zone raw\" intervals to compare, ms")
+    parser.add_argument("--repeat", type=int, default=5, help="timed passes, the fastest is reported")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    cfg = {"tags": args.tags, "rate": args.rate, "duration_s": args.duration, "still_s": args.still,
+           "speed_m_s": [float(v) for v in args.speed.split(",")], "room_m": args.room, "noise_cm": args.noise,
+           "repeat": args.repeat, "seed": args.seed}
+    zones = args.zone or [(1, 300, 350, 30), (2, 1000, 1100, 0)]
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_geofence(workdir)
+        path = args.trace
+        if path is None:
+            path = os.path.join(workdir, "synthetic.utrc")
+            synth_capture(path, cfg)
+        samples = list(forwarded_ranges(path))
+        if not samples:
+            raise SystemExit(f"{path} holds no tag ranges")
+        run(dll, samples, zones, [int(v) for v in args.raw.split(",")], cfg)
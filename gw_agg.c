@@ -0,0 +1,159 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "gw_agg.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "openthread/cli.h"
+
+#define AGG_TAG "gw_agg"
+
+static TAG_WINDOW_AGG agg;
+static SemaphoreHandle_t agg_lock;     // Serialises the sample path, the pane timer and the CLI
+static bool agg_enabled = false;      // Configured with the CLI, raw ranges are replaced by summaries
+static bool agg_fallback = false;     // Turned on by the traffic shaper, summaries complete the decimated ranges
+static tag_agg_result_cb_t agg_result_cb;
+static esp_timer_handle_t agg_timer;
+static volatile bool agg_flush_due;   // A pane ended, flushed by whoever holds agg_lock next
+
+static void gw_agg_unlock(void)
+{
+    if (agg_flush_due) {
+        agg_flush_due = false;
+        if (agg_enabled || agg_fallback) {
+            tag_window_agg_flush(&agg, agg_result_cb, NULL);
+        }
+    }
+    xSemaphoreGive(agg_lock);
+}
+
+static void gw_agg_flush_cb(void *arg)
+{
+    // Never block the esp_timer task on the sample path or the CLI: mark the pane as ended, and flush it here
+    // only if the lock is free. Otherwise its holder flushes when it lets go, so the pane is not stretched
+    agg_flush_due = true;
+    if (xSemaphoreTake(agg_lock, 0) == pdTRUE) {
+        gw_agg_unlock();
+    }
+}
+
+esp_err_t gw_agg_start(tag_agg_result_cb_t result_cb)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = gw_agg_flush_cb,
+        .name = "tag_agg",
+    };
+
+    agg_result_cb = result_cb;
+    agg_lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(agg_lock != NULL, ESP_FAIL, AGG_TAG, "Fail to create aggregator lock");
+    return esp_timer_create(&timer_args, &agg_timer);
+}
+
+bool gw_agg_add(const uint8_t addr[TAG_ADDR_LEN], uint16_t dist_cm)
+{
+    if (!agg_enabled && !agg_fallback) {
+        return false;
+    }
+    xSemaphoreTake(agg_lock, portMAX_DELAY);
+    // A tag that finds the table full keeps its raw ranges until a slot frees up
+    bool added = tag_window_agg_add(&agg, addr, dist_cm);
+    gw_agg_unlock();
+    return agg_enabled && added;
+}
+
+void gw_agg_set_fallback(bool on)
+{
+    // A window configured with the CLI takes precedence
+    if (agg_lock == NULL || agg_enabled || on == agg_fallback) {
+        return;
+    }
+    xSemaphoreTake(agg_lock, portMAX_DELAY);
+    esp_timer_stop(agg_timer);
+    agg_flush_due = false;
+    agg_fallback = on && tag_window_agg_init(&agg, GW_AGG_FALLBACK_MS, 1) &&
+                   esp_timer_start_periodic(agg_timer, GW_AGG_FALLBACK_MS * 1000) == ESP_OK;
+    gw_agg_unlock();
+    ESP_LOGI(AGG_TAG, "Fallback aggregation %s", agg_fallback ? "on" : "off");
+}
+
+static esp_err_t gw_agg_configure(uint32_t pane_ms, uint8_t pane_count)
+{
+    esp_err_t ret = ESP_OK;
+
+    xSemaphoreTake(agg_lock, portMAX_DELAY);
+    esp_timer_stop(agg_timer);
+    agg_flush_due = false;
+    agg_enabled = false;
+    agg_fallback = false;
+    if (pane_ms > 0) {
+        ESP_GOTO_ON_FALSE(tag_window_agg_init(&agg, pane_ms, pane_count), ESP_ERR_INVALID_ARG, exit, AGG_TAG,
+                          "Invalid window");
+        ESP_GOTO_ON_ERROR(esp_timer_start_periodic(agg_timer, (uint64_t)pane_ms * 1000), exit, AGG_TAG,
+                          "Fail to start aggregator timer");
+        agg_enabled = true;
+    }
+exit:
+    gw_agg_unlock();
+    return ret;
+}
+
+otError esp_ot_process_agg(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    if (agg_lock == NULL) {
+        otCliOutputFormat("Aggregator is not started\n");
+        return OT_ERROR_INVALID_STATE;
+    }
+
+    if (aArgsLength == 0) {
+        otCliOutputFormat("---agg parameter---\n");
+        otCliOutputFormat("status                                   :     window settings and counters\n");
+        otCliOutputFormat("tumbling <window_ms>                     :     one summary per tag per window\n");
+        otCliOutputFormat("sliding <window_ms> <hop_ms>             :     summary of the last window every hop\n");
+        otCliOutputFormat("off                                      :     forward every range again\n");
+        otCliOutputFormat("---example---\n");
+        otCliOutputFormat("one-second summaries                     :     agg tumbling 1000\n");
+        otCliOutputFormat("4 s window refreshed every second        :     agg sliding 4000 1000\n");
+    } else if (strcmp(aArgs[0], "status") == 0) {
+        xSemaphoreTake(agg_lock, portMAX_DELAY);
+        if (agg_enabled || agg_fallback) {
+            otCliOutputFormat("window: %" PRIu32 " ms\thop: %" PRIu32 " ms\ttags: %d%s\n", agg.pane_ms * agg.pane_count,
+                              agg.pane_ms, tag_window_agg_count(&agg), agg_fallback ? " (traffic shaper fallback)" : "");
+        } else {
+            otCliOutputFormat("off\n");
+        }
+        otCliOutputFormat("samples: %" PRIu32 "\tsummaries: %" PRIu32 "\tforwarded raw (table full): %" PRIu32 "\n",
+                          agg.samples, agg.results, agg.unslotted);
+        gw_agg_unlock();
+    } else if (strcmp(aArgs[0], "off") == 0) {
+        gw_agg_configure(0, 0);
+    } else if (strcmp(aArgs[0], "tumbling") == 0 || strcmp(aArgs[0], "sliding") == 0) {
+        bool sliding = strcmp(aArgs[0], "sliding") == 0;
+        if (aArgsLength != (sliding ? 3 : 2)) {
+            ESP_LOGE(AGG_TAG, "Invalid arguments.");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        uint32_t window_ms = strtoul(aArgs[1], NULL, 0);
+        uint32_t hop_ms = sliding ? strtoul(aArgs[2], NULL, 0) : window_ms;
+        // The window is a whole number of hops, each hop one pane
+        if (hop_ms == 0 || window_ms % hop_ms != 0 || window_ms / hop_ms > TAG_AGG_MAX_PANES) {
+            otCliOutputFormat("Window must be 1 to %d hops\n", TAG_AGG_MAX_PANES);
+            return OT_ERROR_INVALID_ARGS;
+        }
+        ESP_RETURN_ON_FALSE(gw_agg_configure(hop_ms, window_ms / hop_ms) == ESP_OK, OT_ERROR_FAILED, AGG_TAG,
+                            "Fail to configure aggregator");
+    } else {
+        otCliOutputFormat("invalid commands\n");
+    }
+    return OT_ERROR_NONE;
+}
@@ -0,0 +1,61 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "tag_window_agg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GW_AGG_FALLBACK_MS 1000    // Tumbling window used while the traffic shaper decimates ranges
+
+/**
+ * @brief Start the per-tag window aggregator, disabled until configured with the "agg" command.
+ *
+ * @param[in] result_cb  Called with each tag's window summary, from the esp_timer task.
+ *
+ * @return
+ *      - ESP_OK on success.
+ */
+esp_err_t gw_agg_start(tag_agg_result_cb_t result_cb);
+
+/**
+ * @brief Add a tag range to its window.
+ *
+ * @param[in] addr      Tag address.
+ * @param[in] dist_cm   Range reported by the tag.
+ *
+ * @return
+ *      - true if the range was aggregated and must not be forwarded raw. Tags that find the aggregation table
+ *        full are forwarded raw.
+ */
+bool gw_agg_add(const uint8_t addr[TAG_ADDR_LEN], uint16_t dist_cm);
+
+/**
+ * @brief Aggregate ranges next to the raw stream while the traffic shaper decimates it.
+ *
+ * Has no effect while a window is configured with the "agg" command.
+ *
+ * @param[in] on    Ranges are being decimated.
+ *
+ */
+void gw_agg_set_fallback(bool on);
+
+/**
+ * @brief User command "agg" process.
+ *
+ */
+otError esp_ot_process_agg(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
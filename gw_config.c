@@ -0,0 +1,202 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "gw_config.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "nvs.h"
+#include "openthread/cli.h"
+
+#define CONFIG_TAG "gw_config"
+
+static GATEWAY_CONFIG_STORE config_store;    // Only the CLI task publishes, so publishes need no lock
+
+static void gw_config_wait(void)
+{
+    vTaskDelay(1);
+}
+
+static esp_err_t gw_config_save(const GATEWAY_CONFIG *config)
+{
+    nvs_handle_t handle;
+
+    ESP_RETURN_ON_ERROR(nvs_open(GW_CONFIG_NVS_NAMESPACE, NVS_READWRITE, &handle), CONFIG_TAG, "Fail to open NVS");
+    esp_err_t err = nvs_set_blob(handle, GW_CONFIG_NVS_KEY, config, sizeof(*config));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+static bool gw_config_load(GATEWAY_CONFIG *config)
+{
+    nvs_handle_t handle;
+    size_t len = sizeof(*config);
+
+    if (nvs_open(GW_CONFIG_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    esp_err_t err = nvs_get_blob(handle, GW_CONFIG_NVS_KEY, config, &len);
+    nvs_close(handle);
+    return err == ESP_OK && len == sizeof(*config) && gateway_config_valid(config);
+}
+
+esp_err_t gw_config_start(void)
+{
+    GATEWAY_CONFIG config;
+
+    if (gw_config_load(&config)) {
+        ESP_LOGI(CONFIG_TAG, "Settings version %" PRIu32 " loaded from NVS", config.version);
+    } else {
+        // Nothing saved yet, or saved by a firmware with another layout
+        config = (GATEWAY_CONFIG)GATEWAY_CONFIG_DEFAULT();
+        ESP_LOGI(CONFIG_TAG, "Using default settings");
+    }
+    gateway_config_store_init(&config_store, &config);
+    return ESP_OK;
+}
+
+const GATEWAY_CONFIG *gw_config_acquire(void)
+{
+    return gateway_config_read_lock(&config_store);
+}
+
+void gw_config_release(const GATEWAY_CONFIG *config)
+{
+    gateway_config_read_unlock(&config_store, config);
+}
+
+// Apply one "<key> <value>" pair to a draft, false if the key or value is invalid
+
+static bool gw_config_set_field(GATEWAY_CONFIG *config, const char *key, const char *value)
+{
+    char *end;
+    long number = strtol(value, &end, 0);
+    bool is_number = *value != '\0' && *end == '\0';
+
+    if (strcmp(key, "dest") == 0) {
+        struct in6_addr addr;
+        if (strlen(value) >= sizeof(config->dest_ipaddr) || inet6_aton(value, &addr) != 1) {
+            return false;
+        }
+        strcpy(config->dest_ipaddr, value);
+        memcpy(config->dest_addr, &addr, sizeof(config->dest_addr));
+    } else if (strcmp(key, "port") == 0 && is_number && number > 0 && number <= UINT16_MAX) {
+        config->dest_port = number;
+    } else if (strcmp(key, "localport") == 0 && is_number && number > 0 && number <= UINT16_MAX) {
+        config->local_port = number;
+    } else if (strcmp(key, "period") == 0 && is_number && number > 0 && number <= 60000) {
+        config->send_period_ms = number;
+    } else if (strcmp(key, "mfgid") == 0 && is_number && number >= 0 && number <= UINT16_MAX) {
+        config->manufacturer_id = number;
+    } else if (strcmp(key, "minrssi") == 0 && is_number && number >= INT8_MIN && number <= 0) {
+        config->min_rssi = number;
+    } else if (strcmp(key, "codec") == 0 && is_number && (number == 0 || number == 1)) {
+        config->stream_codec = number;
+    } else if (strcmp(key, "resync") == 0 && is_number && number > 0 && number <= UINT16_MAX) {
+        config->codec_resync_ms = number;
+    } else if (strcmp(key, "backend") == 0 && (strcmp(value, "udp") == 0 || strcmp(value, "mqttsn") == 0)) {
+        config->backend = strcmp(value, "udp") == 0 ? GATEWAY_BACKEND_UDP : GATEWAY_BACKEND_MQTTSN;
+    } else if (strcmp(key, "sngw") == 0) {
+        struct in6_addr addr;
+        if (strlen(value) >= sizeof(config->mqttsn_ipaddr) || inet6_aton(value, &addr) != 1) {
+            return false;
+        }
+        strcpy(config->mqttsn_ipaddr, value);
+        memcpy(config->mqttsn_addr, &addr, sizeof(config->mqttsn_addr));
+    } else if (strcmp(key, "snport") == 0 && is_number && number > 0 && number <= UINT16_MAX) {
+        config->mqttsn_port = number;
+    } else if (strcmp(key, "snkeepalive") == 0 && is_number && number >= 0 && number <= UINT16_MAX) {
+        config->mqttsn_keepalive_s = number;
+    } else if (strcmp(key, "snqos") == 0 && is_number && number >= -1 && number <= 1) {
+        config->mqttsn_qos = number;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void gw_config_show(void)
+{
+    const GATEWAY_CONFIG *config = gw_config_acquire();
+    GATEWAY_CONFIG snapshot = *config;
+    gw_config_release(config);
+
+    otCliOutputFormat("version: %" PRIu32 "\tpublishes: %" PRIu32 "\tgrace waits: %" PRIu32 "\n", snapshot.version,
+                      config_store.publishes, config_store.grace_waits);
+    otCliOutputFormat("dest: [%s]:%u\tlocalport: %u\tperiod: %" PRIu32 " ms\n", snapshot.dest_ipaddr,
+                      snapshot.dest_port, snapshot.local_port, snapshot.send_period_ms);
+    otCliOutputFormat("mfgid: 0x%04x\tminrssi: %d dBm\n", snapshot.manufacturer_id, snapshot.min_rssi);
+    otCliOutputFormat("codec: %u\tresync: %u ms\n", snapshot.stream_codec, snapshot.codec_resync_ms);
+    otCliOutputFormat("backend: %s\tsngw: [%s]:%u\tsnkeepalive: %u s\tsnqos: %d\n",
+                      snapshot.backend == GATEWAY_BACKEND_MQTTSN ? "mqttsn" : "udp", snapshot.mqttsn_ipaddr,
+                      snapshot.mqttsn_port, snapshot.mqttsn_keepalive_s, snapshot.mqttsn_qos);
+}
+
+// Publish a draft and save it; the running settings change even if saving fails
+
+static otError gw_config_commit(const GATEWAY_CONFIG *draft)
+{
+    uint32_t version = gateway_config_publish(&config_store, draft, gw_config_wait);
+    const GATEWAY_CONFIG *config = gw_config_acquire();
+    esp_err_t err = gw_config_save(config);
+    gw_config_release(config);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(CONFIG_TAG, "Version %" PRIu32 " applied but not saved: %s", version, esp_err_to_name(err));
+        return OT_ERROR_FAILED;
+    }
+    otCliOutputFormat("version %" PRIu32 " applied\n", version);
+    return OT_ERROR_NONE;
+}
+
+otError esp_ot_process_config(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    if (aArgsLength == 0) {
+        otCliOutputFormat("---config parameter---\n");
+        otCliOutputFormat("show                                     :     current settings and version\n");
+        otCliOutputFormat("set <key> <value> [<key> <value>...]     :     change settings at once, saved in NVS\n");
+        otCliOutputFormat("    dest <ipv6> | port <n> | localport <n> | period <ms> | mfgid <id> | minrssi <dBm>\n");
+        otCliOutputFormat("    codec <0|1> | resync <ms> | backend <udp|mqttsn> | sngw <ipv6> | snport <n>\n");
+        otCliOutputFormat("    snkeepalive <s> | snqos <-1|0|1>\n");
+        otCliOutputFormat("reset                                    :     back to the built-in defaults\n");
+        otCliOutputFormat("---example---\n");
+        otCliOutputFormat("send to another bridge                   :     config set dest fd00::1 port 20617\n");
+        otCliOutputFormat("publish over MQTT-SN                     :     config set backend mqttsn sngw fd00::1\n");
+    } else if (strcmp(aArgs[0], "show") == 0) {
+        gw_config_show();
+    } else if (strcmp(aArgs[0], "set") == 0) {
+        const GATEWAY_CONFIG *config = gw_config_acquire();
+        GATEWAY_CONFIG draft = *config;
+        gw_config_release(config);
+
+        if (aArgsLength < 3 || aArgsLength % 2 == 0) {
+            ESP_LOGE(CONFIG_TAG, "Invalid arguments.");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        for (int i = 1; i < aArgsLength; i += 2) {
+            if (!gw_config_set_field(&draft, aArgs[i], aArgs[i + 1])) {
+                ESP_LOGE(CONFIG_TAG, "Invalid %s: %s", aArgs[i], aArgs[i + 1]);
+                return OT_ERROR_INVALID_ARGS;
+            }
+        }
+        return gw_config_commit(&draft);
+    } else if (strcmp(aArgs[0], "reset") == 0) {
+        const GATEWAY_CONFIG draft = GATEWAY_CONFIG_DEFAULT();
+        return gw_config_commit(&draft);
+    } else {
+        otCliOutputFormat("invalid commands\n");
+    }
+    return OT_ERROR_NONE;
+}
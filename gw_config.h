@@ -0,0 +1,50 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "gateway_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GW_CONFIG_NVS_NAMESPACE "gw_config"
+#define GW_CONFIG_NVS_KEY "config"
+
+/**
+ * @brief Load the settings saved in NVS, or the defaults. Call after nvs_flash_init() and before any reader.
+ *
+ * @return
+ *      - ESP_OK on success, also when nothing valid was saved.
+ */
+esp_err_t gw_config_start(void);
+
+/**
+ * @brief Get the current settings without blocking, for the send and scan paths.
+ *
+ * @return
+ *      - The settings, unchanged until gw_config_release().
+ */
+const GATEWAY_CONFIG *gw_config_acquire(void);
+
+/**
+ * @brief Release the settings returned by gw_config_acquire().
+ *
+ */
+void gw_config_release(const GATEWAY_CONFIG *config);
+
+/**
+ * @brief User command "config" process.
+ *
+ */
+otError esp_ot_process_config(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
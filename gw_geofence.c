@@ -0,0 +1,186 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "gw_geofence.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "openthread/cli.h"
+
+#define GEOFENCE_TAG "gw_geofence"
+
+static GEOFENCE fence;
+static SemaphoreHandle_t fence_lock;   // Serialises the sample path, the tick timer and the CLI
+static geofence_event_cb_t fence_event_cb;
+static esp_timer_handle_t fence_timer;
+
+static uint32_t gw_geofence_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void gw_geofence_tick_cb(void *arg)
+{
+    // Never block the esp_timer task: while the sample path or the CLI holds the engine, skip this tick, the
+    // next one fires the same dwell and lost-tag deadlines one period later
+    if (xSemaphoreTake(fence_lock, 0) != pdTRUE) {
+        return;
+    }
+    geofence_tick(&fence, gw_geofence_now_ms(), fence_event_cb, NULL);
+    xSemaphoreGive(fence_lock);
+}
+
+esp_err_t gw_geofence_start(geofence_event_cb_t event_cb)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = gw_geofence_tick_cb,
+        .name = "geofence",
+    };
+
+    geofence_init(&fence);
+    fence_event_cb = event_cb;
+    fence_lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(fence_lock != NULL, ESP_FAIL, GEOFENCE_TAG, "Fail to create geofence lock");
+    ESP_RETURN_ON_ERROR(esp_timer_create(&timer_args, &fence_timer), GEOFENCE_TAG, "Fail to create geofence timer");
+    return esp_timer_start_periodic(fence_timer, GW_GEOFENCE_TICK_PERIOD_MS * 1000);
+}
+
+bool gw_geofence_process(const uint8_t addr[TAG_ADDR_LEN], uint16_t dist_cm, bool report)
+{
+    // TWR tags range against a single anchor and the gateway never learns a position, so only range zones on
+    // GW_GEOFENCE_ANCHOR can fire; the CLI refuses any other zone
+    const GEOFENCE_SAMPLE sample = {.anchor = GW_GEOFENCE_ANCHOR, .dist_cm = dist_cm};
+
+    if (fence_lock == NULL) {
+        return true;
+    }
+    xSemaphoreTake(fence_lock, portMAX_DELAY);
+    bool raw = geofence_evaluate(&fence, addr, &sample, gw_geofence_now_ms(), report, fence_event_cb, NULL);
+    xSemaphoreGive(fence_lock);
+    return raw;
+}
+
+static bool gw_geofence_parse_uint(const char *str, uint32_t max, uint32_t *value)
+{
+    char *end;
+    unsigned long parsed = strtoul(str, &end, 0);
+
+    if (*str == '\0' || *end != '\0' || parsed > max) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+static void gw_geofence_print_zone(const GEOFENCE_ZONE *zone)
+{
+    if (zone->type == GEOFENCE_ZONE_RANGE) {
+        otCliOutputFormat("zone %u: range anchor %u enter <= %u cm exit > %u cm dwell %" PRIu32 " s\n", zone->id,
+                          zone->anchor, zone->enter_cm, zone->exit_cm, zone->dwell_ms / 1000);
+        return;
+    }
+    otCliOutputFormat("zone %u: polygon margin %u cm dwell %" PRIu32 " s:", zone->id, zone->margin_cm,
+                      zone->dwell_ms / 1000);
+    for (int i = 0; i < zone->vertex_count; i++) {
+        otCliOutputFormat(" %d,%d", zone->vertices[i].x_cm, zone->vertices[i].y_cm);
+    }
+    otCliOutputFormat("\n");
+}
+
+otError esp_ot_process_zone(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    GEOFENCE_ZONE zone = {0};
+    uint32_t value;
+    bool ok = true;
+
+    if (fence_lock == NULL) {
+        otCliOutputFormat("Geofence is not started\n");
+        return OT_ERROR_INVALID_STATE;
+    }
+
+    if (aArgsLength == 0) {
+        otCliOutputFormat("---zone parameter---\n");
+        otCliOutputFormat("status                                   :     zones, raw interval and counters\n");
+        otCliOutputFormat("range <id> <anchor> <enter_cm> <exit_cm> <dwell_s>\n");
+        otCliOutputFormat("                                         :     set a zone on the range to the anchor, 0\n");
+        otCliOutputFormat("remove <id>                              :     remove a zone\n");
+        otCliOutputFormat("clear                                    :     remove every zone, raw ranges flow again\n");
+        otCliOutputFormat("raw <interval_ms>                        :     raw ranges still sent per tag, 0 for none\n");
+        otCliOutputFormat("---example---\n");
+        otCliOutputFormat("tag within 2 m of the anchor             :     zone range 1 0 200 250 30\n");
+        otCliOutputFormat("one raw range per tag every 10 s         :     zone raw 10000\n");
+        return OT_ERROR_NONE;
+    }
+
+    if (strcmp(aArgs[0], "range") == 0) {
+        uint32_t id, anchor, enter_cm, exit_cm, dwell_s;
+        ok = aArgsLength == 6 && gw_geofence_parse_uint(aArgs[1], UINT8_MAX, &id) &&
+             gw_geofence_parse_uint(aArgs[2], UINT8_MAX, &anchor) &&
+             gw_geofence_parse_uint(aArgs[3], UINT16_MAX, &enter_cm) &&
+             gw_geofence_parse_uint(aArgs[4], UINT16_MAX, &exit_cm) &&
+             gw_geofence_parse_uint(aArgs[5], UINT32_MAX / 1000, &dwell_s);
+        if (ok && anchor != GW_GEOFENCE_ANCHOR) {
+            otCliOutputFormat("Ranges only reach the gateway against anchor %d\n", GW_GEOFENCE_ANCHOR);
+            return OT_ERROR_INVALID_ARGS;
+        }
+        if (ok) {
+            zone.id = id;
+            zone.type = GEOFENCE_ZONE_RANGE;
+            zone.anchor = anchor;
+            zone.enter_cm = enter_cm;
+            zone.exit_cm = exit_cm;
+            zone.dwell_ms = dwell_s * 1000;
+        }
+    } else if (strcmp(aArgs[0], "poly") == 0) {
+        // geofence.c evaluates polygons, but tag positions are only solved on the bridge (TDoA)
+        otCliOutputFormat("Polygon zones need tag positions, which the gateway does not have\n");
+        return OT_ERROR_NOT_IMPLEMENTED;
+    } else if (strcmp(aArgs[0], "remove") == 0 || strcmp(aArgs[0], "raw") == 0) {
+        ok = aArgsLength == 2 && gw_geofence_parse_uint(aArgs[1], UINT32_MAX, &value);
+    } else if (strcmp(aArgs[0], "status") != 0 && strcmp(aArgs[0], "clear") != 0) {
+        otCliOutputFormat("invalid commands\n");
+        return OT_ERROR_INVALID_ARGS;
+    }
+    if (!ok) {
+        ESP_LOGE(GEOFENCE_TAG, "Invalid arguments.");
+        return OT_ERROR_INVALID_ARGS;
+    }
+
+    otError error = OT_ERROR_NONE;
+    xSemaphoreTake(fence_lock, portMAX_DELAY);
+    if (strcmp(aArgs[0], "range") == 0) {
+        if (!geofence_zone_set(&fence, &zone)) {
+            otCliOutputFormat("Invalid zone or zone table full!\n");
+            error = OT_ERROR_INVALID_ARGS;
+        }
+    } else if (strcmp(aArgs[0], "remove") == 0) {
+        if (!geofence_zone_remove(&fence, value)) {
+            error = OT_ERROR_NOT_FOUND;
+        }
+    } else if (strcmp(aArgs[0], "raw") == 0) {
+        fence.raw_interval_ms = value;
+    } else if (strcmp(aArgs[0], "clear") == 0) {
+        geofence_zone_clear(&fence);
+    } else {
+        for (int i = 0; i < GEOFENCE_MAX_ZONES; i++) {
+            if (fence.zones[i].id != 0) {
+                gw_geofence_print_zone(&fence.zones[i]);
+            }
+        }
+        otCliOutputFormat("zones: %d\traw interval: %" PRIu32 " ms\n", geofence_zone_count(&fence),
+                          fence.raw_interval_ms);
+        otCliOutputFormat("samples: %" PRIu32 "\tevents: %" PRIu32 "\traw forwarded: %" PRIu32 "\n", fence.samples,
+                          fence.events, fence.raw_forwarded);
+    }
+    xSemaphoreGive(fence_lock);
+    return error;
+}
@@ -0,0 +1,52 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "geofence.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GW_GEOFENCE_TICK_PERIOD_MS 1000    // Dwell and lost-tag resolution
+#define GW_GEOFENCE_ANCHOR 0               // TWR ranges carry no anchor id or position: every range is to this anchor
+
+/**
+ * @brief Start the zone engine. Until a zone is set every sample is forwarded as is.
+ *
+ * @param[in] event_cb  Called with each zone event, from the sample path or the tick timer.
+ *
+ * @return
+ *      - ESP_OK on success.
+ */
+esp_err_t gw_geofence_start(geofence_event_cb_t event_cb);
+
+/**
+ * @brief Evaluate a tag range against the zones.
+ *
+ * @param[in] addr      Tag address.
+ * @param[in] dist_cm   Range reported by the tag.
+ * @param[in] report    This gateway forwards the tag, so its events are reported.
+ *
+ * @return
+ *      - true if the raw range must be forwarded too.
+ */
+bool gw_geofence_process(const uint8_t addr[TAG_ADDR_LEN], uint16_t dist_cm, bool report);
+
+/**
+ * @brief User command "zone" process.
+ *
+ */
+otError esp_ot_process_zone(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,240 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "gw_mqttsn.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "gw_config.h"
+#include "lwip/sockets.h"
+#include "mem_budget.h"
+#include "openthread/cli.h"
+
+#define MQTTSN_TAG "gw_mqttsn"
+
+typedef struct gw_mqttsn_route {
+    const char *prefix;         // Line prefix, "" matches range lines
+    bool strip;                 // Publish the line without its prefix, as the bridge does
+    const char *topic;
+    uint16_t predefined_id;
+} GW_MQTTSN_ROUTE;
+
+static const GW_MQTTSN_ROUTE mqttsn_routes[] = {
+    {"zone,", true, GW_MQTTSN_TOPIC_ZONE, GW_MQTTSN_PREDEFINED_ZONE},
+    {"agg,", true, GW_MQTTSN_TOPIC_AGG, GW_MQTTSN_PREDEFINED_AGG},
+    {"tdoa,", false, GW_MQTTSN_TOPIC_TDOA, GW_MQTTSN_PREDEFINED_TDOA},
+    {"", false, GW_MQTTSN_TOPIC_RANGE, GW_MQTTSN_PREDEFINED_RANGE},
+};
+
+#define GW_MQTTSN_ROUTE_COUNT ((int)(sizeof(mqttsn_routes) / sizeof(mqttsn_routes[0])))
+
+static MQTTSN_CLIENT mqttsn_client;
+static SemaphoreHandle_t mqttsn_lock;      // The client task and the UDP sender share the client
+static int mqttsn_sock = -1;
+static struct sockaddr_in6 mqttsn_dest;
+static int mqttsn_topics[GW_MQTTSN_ROUTE_COUNT][2];    // Normal and predefined topic of every route
+static int8_t mqttsn_qos;
+static bool mqttsn_ready;                  // Client set up for the current gateway
+static uint32_t mqttsn_refused;            // Lines other than events the client could not take, lost
+static char mqttsn_client_id[MQTTSN_CLIENT_ID_MAX + 1];
+static EventGroupHandle_t mqttsn_link_group;
+static EventBits_t mqttsn_attached_bit;
+
+GATEWAY_TASK_DEFINE(mqttsn_task, GW_MQTTSN_TASK_STACK_SIZE);
+
+static uint32_t gw_mqttsn_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void gw_mqttsn_tx(const uint8_t *packet, size_t len, void *ctx)
+{
+    if (sendto(mqttsn_sock, packet, len, 0, (struct sockaddr *)&mqttsn_dest, sizeof(mqttsn_dest)) < 0) {
+        ESP_LOGW(MQTTSN_TAG, "Fail to send packet: errno %d", errno);
+    }
+}
+
+// A new gateway address, port or keep-alive starts a new session, anything buffered for the old one is dropped
+
+static void gw_mqttsn_setup(const GATEWAY_CONFIG *config)
+{
+    MQTTSN_CONFIG client_config = MQTTSN_CONFIG_DEFAULT();
+
+    strcpy(client_config.client_id, mqttsn_client_id);
+    client_config.keepalive_s = config->mqttsn_keepalive_s;
+    memset(&mqttsn_dest, 0, sizeof(mqttsn_dest));
+    memcpy(&mqttsn_dest.sin6_addr, config->mqttsn_addr, sizeof(mqttsn_dest.sin6_addr));
+    mqttsn_dest.sin6_family = AF_INET6;
+    mqttsn_dest.sin6_port = htons(config->mqttsn_port);
+
+    mqttsn_client_init(&mqttsn_client, &client_config, gw_mqttsn_tx, NULL);
+    for (int i = 0; i < GW_MQTTSN_ROUTE_COUNT; i++) {
+        mqttsn_topics[i][0] = mqttsn_client_add_topic(&mqttsn_client, mqttsn_routes[i].topic, MQTTSN_TOPIC_NORMAL, 0);
+        mqttsn_topics[i][1] = mqttsn_client_add_topic(&mqttsn_client, mqttsn_routes[i].topic, MQTTSN_TOPIC_PREDEFINED,
+                                                      mqttsn_routes[i].predefined_id);
+    }
+    mqttsn_client_start(&mqttsn_client, gw_mqttsn_now_ms());
+    mqttsn_ready = true;
+    ESP_LOGI(MQTTSN_TAG, "Publishing to [%s]:%u as %s", config->mqttsn_ipaddr, config->mqttsn_port,
+             mqttsn_client_id);
+}
+
+static void gw_mqttsn_task(void *arg)
+{
+    esp_err_t ret = ESP_OK;
+    struct sockaddr_in6 bind_addr = {0};
+    uint8_t rx_buf[64];
+    GATEWAY_CONFIG peer = {0};    // Settings the session was set up with
+
+    mqttsn_sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_IPV6);
+    ESP_GOTO_ON_FALSE((mqttsn_sock >= 0), ESP_FAIL, exit, MQTTSN_TAG, "Unable to create socket: errno %d", errno);
+    bind_addr.sin6_family = AF_INET6;
+    ESP_GOTO_ON_FALSE(bind(mqttsn_sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) == 0, ESP_FAIL, exit,
+                      MQTTSN_TAG, "Socket unable to bind: errno %d", errno);
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = GW_MQTTSN_POLL_MS * 1000};
+    setsockopt(mqttsn_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    while (true) {
+        // Timers stand still while detached, the gateway cannot be reached anyway
+        xEventGroupWaitBits(mqttsn_link_group, mqttsn_attached_bit, pdFALSE, pdTRUE, portMAX_DELAY);
+
+        const GATEWAY_CONFIG *config = gw_config_acquire();
+        bool selected = config->backend == GATEWAY_BACKEND_MQTTSN;
+        xSemaphoreTake(mqttsn_lock, portMAX_DELAY);
+        if (!selected) {
+            mqttsn_ready = false;
+        } else if (!mqttsn_ready || memcmp(peer.mqttsn_addr, config->mqttsn_addr, sizeof(peer.mqttsn_addr)) != 0 ||
+                   peer.mqttsn_port != config->mqttsn_port ||
+                   peer.mqttsn_keepalive_s != config->mqttsn_keepalive_s) {
+            peer = *config;
+            gw_mqttsn_setup(config);
+        }
+        mqttsn_qos = config->mqttsn_qos;
+        xSemaphoreGive(mqttsn_lock);
+        gw_config_release(config);
+        if (!selected) {
+            vTaskDelay(pdMS_TO_TICKS(GW_MQTTSN_IDLE_MS));
+            continue;
+        }
+
+        int len = recvfrom(mqttsn_sock, rx_buf, sizeof(rx_buf), 0, NULL, NULL);
+        xSemaphoreTake(mqttsn_lock, portMAX_DELAY);
+        if (len > 0) {
+            mqttsn_client_on_packet(&mqttsn_client, rx_buf, len, gw_mqttsn_now_ms());
+        }
+        mqttsn_client_poll(&mqttsn_client, gw_mqttsn_now_ms());
+        xSemaphoreGive(mqttsn_lock);
+    }
+
+exit:
+    if (ret != ESP_OK && mqttsn_sock >= 0) {
+        close(mqttsn_sock);
+        mqttsn_sock = -1;
+    }
+    ESP_LOGW(MQTTSN_TAG, "MQTT-SN backend unavailable");
+    mem_budget_unregister_task(xTaskGetCurrentTaskHandle());
+    vTaskDelete(NULL);
+}
+
+esp_err_t gw_mqttsn_start(EventGroupHandle_t link_group, EventBits_t attached_bit)
+{
+    uint8_t mac[6];
+
+    ESP_RETURN_ON_ERROR(esp_efuse_mac_get_default(mac), MQTTSN_TAG, "Fail to read MAC");
+    snprintf(mqttsn_client_id, sizeof(mqttsn_client_id), "uwbgw-%02x%02x%02x", mac[3], mac[4], mac[5]);
+    mqttsn_lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(mqttsn_lock != NULL, ESP_FAIL, MQTTSN_TAG, "Fail to create MQTT-SN lock");
+    mqttsn_link_group = link_group;
+    mqttsn_attached_bit = attached_bit;
+    return GATEWAY_TASK_CREATE(mqttsn_task, gw_mqttsn_task, "gw_mqttsn", NULL, 3, NULL);
+}
+
+bool gw_mqttsn_publish(const char *line, size_t len, bool event)
+{
+    int index = GW_MQTTSN_ROUTE_COUNT - 1;
+    bool ok = false;
+
+    for (int i = 0; i < GW_MQTTSN_ROUTE_COUNT; i++) {
+        size_t prefix_len = strlen(mqttsn_routes[i].prefix);
+        if (strncmp(line, mqttsn_routes[i].prefix, prefix_len) == 0) {
+            index = i;
+            if (mqttsn_routes[i].strip) {
+                line += prefix_len;
+                len -= prefix_len;
+            }
+            break;
+        }
+    }
+
+    xSemaphoreTake(mqttsn_lock, portMAX_DELAY);
+    if (mqttsn_ready) {
+        int qos = event ? 1 : mqttsn_qos;
+        ok = mqttsn_client_publish(&mqttsn_client, mqttsn_topics[index][qos < 0], line, len, qos, gw_mqttsn_now_ms());
+    }
+    mqttsn_refused += !ok && !event;
+    xSemaphoreGive(mqttsn_lock);
+    return ok;
+}
+
+otError esp_ot_process_mqttsn(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    static const char *const state_names[] = {"disconnected", "connecting", "active", "asleep", "awake"};
+
+    if (mqttsn_lock == NULL) {
+        otCliOutputFormat("MQTT-SN backend is not started\n");
+        return OT_ERROR_INVALID_STATE;
+    }
+
+    if (aArgsLength == 0 || strcmp(aArgs[0], "status") == 0) {
+        xSemaphoreTake(mqttsn_lock, portMAX_DELAY);
+        if (!mqttsn_ready) {
+            otCliOutputFormat("not selected (config set backend mqttsn)\n");
+        } else {
+            const MQTTSN_CLIENT *client = &mqttsn_client;
+            otCliOutputFormat("client: %s\tstate: %s\tsleep: %u s\tbuffered: %d/%d (max %" PRIu32 ")\n",
+                              client->config.client_id, state_names[client->state], client->sleep_s,
+                              client->buffer_count, MQTTSN_BUFFER_LEN, client->buffered_max);
+            otCliOutputFormat("published: %" PRIu32 "\tacked: %" PRIu32 "\tretransmits: %" PRIu32 "\tdropped: %" PRIu32
+                              "\trefused: %" PRIu32 "\n", client->published, client->acked, client->retransmits,
+                              client->dropped, mqttsn_refused);
+            otCliOutputFormat("connects: %" PRIu32 "\tlost: %" PRIu32 "\tregisters: %" PRIu32 "\tpings: %" PRIu32
+                              "\tpackets: %" PRIu32 "/%" PRIu32 " tx/rx\n", client->connects, client->lost,
+                              client->registers, client->pings, client->packets_tx, client->packets_rx);
+        }
+        xSemaphoreGive(mqttsn_lock);
+    } else if (!mqttsn_ready && (strcmp(aArgs[0], "sleep") == 0 || strcmp(aArgs[0], "wake") == 0)) {
+        otCliOutputFormat("not selected (config set backend mqttsn)\n");
+        return OT_ERROR_INVALID_STATE;
+    } else if (strcmp(aArgs[0], "sleep") == 0) {
+        char *end;
+        long duration_s = aArgsLength == 2 ? strtol(aArgs[1], &end, 10) : 0;
+        if (aArgsLength != 2 || *end != '\0' || duration_s <= 0 || duration_s > UINT16_MAX) {
+            ESP_LOGE(MQTTSN_TAG, "Invalid arguments.");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        xSemaphoreTake(mqttsn_lock, portMAX_DELAY);
+        mqttsn_client_sleep(&mqttsn_client, duration_s, gw_mqttsn_now_ms());
+        xSemaphoreGive(mqttsn_lock);
+    } else if (strcmp(aArgs[0], "wake") == 0) {
+        xSemaphoreTake(mqttsn_lock, portMAX_DELAY);
+        mqttsn_client_wake(&mqttsn_client, gw_mqttsn_now_ms());
+        xSemaphoreGive(mqttsn_lock);
+    } else {
+        otCliOutputFormat("---mqttsn parameter---\n");
+        otCliOutputFormat("status                                   :     session state and counters\n");
+        otCliOutputFormat("sleep <s>                                :     sleeping client, publishes are buffered\n");
+        otCliOutputFormat("wake                                     :     reconnect and send the buffer\n");
+    }
+    return OT_ERROR_NONE;
+}
@@ -0,0 +1,67 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "mqttsn_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GW_MQTTSN_TASK_STACK_SIZE 3072
+#define GW_MQTTSN_POLL_MS 50            // Longest wait for a packet from the MQTT-SN gateway, bounds timer slack
+#define GW_MQTTSN_IDLE_MS 1000          // Settings check period while another backend is selected
+#define GW_MQTTSN_HDR_LEN 7             // PUBLISH overhead on top of the line, charged to the shaper
+
+// Topics as the bridge publishes them (mqttconnection.py). The predefined IDs, used at QoS -1, must be configured
+// on the MQTT-SN gateway with the same names.
+#define GW_MQTTSN_TOPIC_RANGE "test/topic"
+#define GW_MQTTSN_TOPIC_ZONE "test/topic/zone"
+#define GW_MQTTSN_TOPIC_AGG "test/topic/agg"
+#define GW_MQTTSN_TOPIC_TDOA "test/topic/tdoa"     // Raw anchor reports, positions still need the bridge's solver
+#define GW_MQTTSN_PREDEFINED_RANGE 1
+#define GW_MQTTSN_PREDEFINED_ZONE 2
+#define GW_MQTTSN_PREDEFINED_AGG 3
+#define GW_MQTTSN_PREDEFINED_TDOA 4
+
+/**
+ * @brief Start the MQTT-SN client task. It stays idle until the "backend" setting selects MQTT-SN.
+ *
+ * @param[in] link_group    Event group carrying the Thread attach state.
+ * @param[in] attached_bit  Bit set while attached.
+ *
+ */
+esp_err_t gw_mqttsn_start(EventGroupHandle_t link_group, EventBits_t attached_bit);
+
+/**
+ * @brief Publish a forwarded line on its topic, "zone," and "agg," prefixes stripped as the bridge does.
+ *
+ * @param[in] line      The line, as sent to the bridge.
+ * @param[in] len       Its length.
+ * @param[in] event     Zone events and the like: QoS 1 whatever the "snqos" setting.
+ *
+ * @return
+ *      - false if the client is not set up yet or the line is too long. The caller keeps events to try again,
+ *        other lines are lost and counted as "refused" in "mqttsn status".
+ */
+bool gw_mqttsn_publish(const char *line, size_t len, bool event);
+
+/**
+ * @brief User command "mqttsn" process.
+ *
+ */
+otError esp_ot_process_mqttsn(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
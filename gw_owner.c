@@ -0,0 +1,214 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "gw_owner.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_ot_udp_socket.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "mem_budget.h"
+#include "openthread/cli.h"
+
+#define OWNER_TAG "gw_owner"
+
+// Claim datagram: 'T', 'O', version, count, sender id (LE), then count x (tag address, rssi)
+#define GW_OWNER_MAGIC0 'T'
+#define GW_OWNER_MAGIC1 'O'
+#define GW_OWNER_VERSION 1
+#define GW_OWNER_HDR_LEN 8
+#define GW_OWNER_CLAIM_LEN (TAG_ADDR_LEN + 1)
+
+static TAG_OWNER_TABLE owner_table;
+static SemaphoreHandle_t owner_lock;
+static bool owner_enabled = true;
+static EventGroupHandle_t owner_link_group;
+static EventBits_t owner_attached_bit;
+static uint32_t owner_claims_sent;
+static uint32_t owner_claims_received;
+
+GATEWAY_TASK_DEFINE(owner_task, GW_OWNER_TASK_STACK_SIZE);
+
+static uint32_t gw_owner_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void gw_owner_send_claims(int sock, const struct sockaddr_in6 *group_addr)
+{
+    uint8_t buf[GW_OWNER_HDR_LEN + GW_OWNER_MAX_CLAIMS * GW_OWNER_CLAIM_LEN];
+    TAG_OWNER_CLAIM claims[GW_OWNER_MAX_CLAIMS];
+    int cursor = 0;
+    int count;
+
+    do {
+        xSemaphoreTake(owner_lock, portMAX_DELAY);
+        count = tag_owner_build_claims(&owner_table, gw_owner_now_ms(), claims, GW_OWNER_MAX_CLAIMS, &cursor);
+        xSemaphoreGive(owner_lock);
+        if (count == 0) {
+            break;
+        }
+
+        buf[0] = GW_OWNER_MAGIC0;
+        buf[1] = GW_OWNER_MAGIC1;
+        buf[2] = GW_OWNER_VERSION;
+        buf[3] = (uint8_t)count;
+        for (int i = 0; i < 4; i++) {
+            buf[4 + i] = (uint8_t)(owner_table.self_id >> (8 * i));
+        }
+        for (int i = 0; i < count; i++) {
+            uint8_t *entry = &buf[GW_OWNER_HDR_LEN + i * GW_OWNER_CLAIM_LEN];
+            memcpy(entry, claims[i].addr, TAG_ADDR_LEN);
+            entry[TAG_ADDR_LEN] = (uint8_t)claims[i].rssi;
+        }
+        if (sendto(sock, buf, GW_OWNER_HDR_LEN + count * GW_OWNER_CLAIM_LEN, 0, (const struct sockaddr *)group_addr,
+                   sizeof(*group_addr)) < 0) {
+            ESP_LOGW(OWNER_TAG, "Fail to send claims: errno %d", errno);
+        } else {
+            owner_claims_sent += count;
+        }
+    } while (count == GW_OWNER_MAX_CLAIMS);
+}
+
+static void gw_owner_handle_claims(const uint8_t *buf, int len)
+{
+    if (len < GW_OWNER_HDR_LEN || buf[0] != GW_OWNER_MAGIC0 || buf[1] != GW_OWNER_MAGIC1 ||
+        buf[2] != GW_OWNER_VERSION || len < GW_OWNER_HDR_LEN + buf[3] * GW_OWNER_CLAIM_LEN) {
+        return;
+    }
+    uint32_t peer_id = buf[4] | (buf[5] << 8) | (buf[6] << 16) | ((uint32_t)buf[7] << 24);
+    uint32_t now_ms = gw_owner_now_ms();
+
+    xSemaphoreTake(owner_lock, portMAX_DELAY);
+    for (int i = 0; i < buf[3]; i++) {
+        const uint8_t *entry = &buf[GW_OWNER_HDR_LEN + i * GW_OWNER_CLAIM_LEN];
+        TAG_OWNER_CLAIM claim;
+        memcpy(claim.addr, entry, TAG_ADDR_LEN);
+        claim.rssi = (int8_t)entry[TAG_ADDR_LEN];
+        tag_owner_peer_claim(&owner_table, peer_id, &claim, now_ms);
+    }
+    xSemaphoreGive(owner_lock);
+    owner_claims_received += buf[3];
+}
+
+static void gw_owner_task(void *arg)
+{
+    esp_err_t ret = ESP_OK;
+    int sock = -1;
+    ip6_addr_t group;
+    struct sockaddr_in6 group_addr = {0};
+    struct sockaddr_in6 bind_addr = {0};
+    uint8_t rx_buf[GW_OWNER_HDR_LEN + GW_OWNER_MAX_CLAIMS * GW_OWNER_CLAIM_LEN];
+
+    // Multicast needs the Thread interface up
+    xEventGroupWaitBits(owner_link_group, owner_attached_bit, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    inet6_aton(GW_OWNER_MCAST_GROUP, &group);
+    ESP_GOTO_ON_FALSE(esp_netif_tcpip_exec(join_ip6_mcast, &group) == ESP_OK, ESP_FAIL, exit, OWNER_TAG,
+                      "Failed to join group");
+
+    sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_IPV6);
+    ESP_GOTO_ON_FALSE((sock >= 0), ESP_FAIL, exit, OWNER_TAG, "Unable to create socket: errno %d", errno);
+    bind_addr.sin6_family = AF_INET6;
+    bind_addr.sin6_port = htons(GW_OWNER_PORT);
+    ESP_GOTO_ON_FALSE(bind(sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) == 0, ESP_FAIL, exit, OWNER_TAG,
+                      "Socket unable to bind: errno %d", errno);
+
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = GW_OWNER_CLAIM_PERIOD_MS * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int hops = 16;
+    setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+
+    inet6_aton(GW_OWNER_MCAST_GROUP, &group_addr.sin6_addr);
+    group_addr.sin6_family = AF_INET6;
+    group_addr.sin6_port = htons(GW_OWNER_PORT);
+    ESP_LOGI(OWNER_TAG, "Exchanging tag claims on [%s]:%d as %08" PRIx32, GW_OWNER_MCAST_GROUP, GW_OWNER_PORT,
+             owner_table.self_id);
+
+    uint32_t next_claims_ms = gw_owner_now_ms();
+    while (true) {
+        int len = recvfrom(sock, rx_buf, sizeof(rx_buf), 0, NULL, NULL);
+        if (len > 0) {
+            gw_owner_handle_claims(rx_buf, len);
+        }
+        if ((int32_t)(gw_owner_now_ms() - next_claims_ms) >= 0) {
+            next_claims_ms += GW_OWNER_CLAIM_PERIOD_MS;
+            if (owner_enabled) {
+                gw_owner_send_claims(sock, &group_addr);
+            }
+        }
+    }
+
+exit:
+    if (ret != ESP_OK && sock >= 0) {
+        close(sock);
+    }
+    ESP_LOGW(OWNER_TAG, "Tag ownership disabled, forwarding every tag");
+    owner_enabled = false;
+    mem_budget_unregister_task(xTaskGetCurrentTaskHandle());
+    vTaskDelete(NULL);
+}
+
+esp_err_t gw_owner_start(EventGroupHandle_t link_group, EventBits_t attached_bit)
+{
+    uint8_t mac[6];
+
+    ESP_RETURN_ON_ERROR(esp_efuse_mac_get_default(mac), OWNER_TAG, "Fail to read MAC");
+    owner_lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(owner_lock != NULL, ESP_FAIL, OWNER_TAG, "Fail to create owner lock");
+
+    uint32_t self_id = (mac[2] << 24) | (mac[3] << 16) | (mac[4] << 8) | mac[5];
+    tag_owner_init(&owner_table, self_id != 0 ? self_id : 1);
+    owner_link_group = link_group;
+    owner_attached_bit = attached_bit;
+    return GATEWAY_TASK_CREATE(owner_task, gw_owner_task, "gw_owner", NULL, 3, NULL);
+}
+
+bool gw_owner_should_forward(const uint8_t addr[TAG_ADDR_LEN], int8_t rssi)
+{
+    if (!owner_enabled || owner_lock == NULL) {
+        return true;
+    }
+    xSemaphoreTake(owner_lock, portMAX_DELAY);
+    bool forward = tag_owner_observe(&owner_table, addr, rssi, gw_owner_now_ms());
+    xSemaphoreGive(owner_lock);
+    return forward;
+}
+
+otError esp_ot_process_owner(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    if (aArgsLength == 1 && (strcmp(aArgs[0], "enable") == 0 || strcmp(aArgs[0], "disable") == 0)) {
+        owner_enabled = strcmp(aArgs[0], "enable") == 0;
+        return OT_ERROR_NONE;
+    }
+    if (owner_lock == NULL) {
+        otCliOutputFormat("Tag ownership is not started\n");
+        return OT_ERROR_NONE;
+    }
+
+    xSemaphoreTake(owner_lock, portMAX_DELAY);
+    int owned = tag_owner_owned_count(&owner_table);
+    uint32_t forwarded = owner_table.forwarded;
+    uint32_t suppressed = owner_table.suppressed;
+    uint32_t takeovers = owner_table.takeovers;
+    uint32_t yields = owner_table.yields;
+    xSemaphoreGive(owner_lock);
+
+    otCliOutputFormat("%s\tgateway id: %08" PRIx32 "\towned tags: %d\n", owner_enabled ? "enabled" : "disabled",
+                      owner_table.self_id, owned);
+    otCliOutputFormat("forwarded: %" PRIu32 "\tsuppressed: %" PRIu32 "\n", forwarded, suppressed);
+    otCliOutputFormat("takeovers: %" PRIu32 "\tyields: %" PRIu32 "\n", takeovers, yields);
+    otCliOutputFormat("claims sent: %" PRIu32 "\tclaims received: %" PRIu32 "\n", owner_claims_sent,
+                      owner_claims_received);
+    return OT_ERROR_NONE;
+}
@@ -0,0 +1,57 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "tag_owner.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GW_OWNER_MCAST_GROUP "ff03::7467"   // Realm-local, reaches every gateway in the Thread mesh
+#define GW_OWNER_PORT 20618
+#define GW_OWNER_CLAIM_PERIOD_MS 400
+#define GW_OWNER_MAX_CLAIMS 32              // Claims per datagram
+#define GW_OWNER_TASK_STACK_SIZE 3072
+
+/**
+ * @brief Start exchanging tag ownership claims with the other gateways.
+ *
+ * @param[in] link_group    Event group holding the Thread attached bit.
+ * @param[in] attached_bit  Bit set while the device is attached.
+ *
+ * @return
+ *      - ESP_OK on success.
+ */
+esp_err_t gw_owner_start(EventGroupHandle_t link_group, EventBits_t attached_bit);
+
+/**
+ * @brief Record a tag reception and decide whether this gateway forwards it.
+ *
+ * @param[in] addr  Tag address.
+ * @param[in] rssi  RSSI of the reception.
+ *
+ * @return
+ *      - true if this gateway is the tag's owner (or ownership is disabled).
+ */
+bool gw_owner_should_forward(const uint8_t addr[TAG_ADDR_LEN], int8_t rssi);
+
+/**
+ * @brief User command "owner" process.
+ *
+ */
+otError esp_ot_process_owner(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,146 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "gw_shaper.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "gw_agg.h"
+#include "openthread/cli.h"
+
+#define SHAPER_TAG "gw_shaper"
+
+static const char *const shaper_class_names[SHAPER_CLASS_COUNT] = {"event", "sample", "stats"};
+
+static TRAFFIC_SHAPER shaper;
+static portMUX_TYPE shaper_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t shaper_timer;
+static bool shaper_started = false;
+static uint32_t shaper_queue_lost[SHAPER_CLASS_COUNT];    // Lost to a full sample queue before reaching the shaper
+
+static uint32_t gw_shaper_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void gw_shaper_update_cb(void *arg)
+{
+    uint8_t old_level, new_level;
+
+    portENTER_CRITICAL(&shaper_lock);
+    old_level = shaper.level;
+    new_level = traffic_shaper_update(&shaper, gw_shaper_now_ms());
+    portEXIT_CRITICAL(&shaper_lock);
+
+    if (new_level != old_level) {
+        ESP_LOGI(SHAPER_TAG, "Sample decimation 1/%u -> 1/%u", 1u << old_level, 1u << new_level);
+    }
+    gw_agg_set_fallback(new_level > 0);
+}
+
+esp_err_t gw_shaper_start(void)
+{
+    const TRAFFIC_SHAPER_RATE config[SHAPER_CLASS_COUNT] = TRAFFIC_SHAPER_CONFIG_DEFAULT();
+    const esp_timer_create_args_t timer_args = {
+        .callback = gw_shaper_update_cb,
+        .name = "shaper",
+    };
+
+    traffic_shaper_init(&shaper, config, gw_shaper_now_ms());
+    shaper_started = true;
+    ESP_RETURN_ON_ERROR(esp_timer_create(&timer_args, &shaper_timer), SHAPER_TAG, "Fail to create shaper timer");
+    return esp_timer_start_periodic(shaper_timer, GW_SHAPER_UPDATE_PERIOD_MS * 1000);
+}
+
+bool gw_shaper_consume(shaper_class_t cls, uint32_t bytes)
+{
+    bool admitted;
+
+    if (!shaper_started) {
+        return true;
+    }
+    portENTER_CRITICAL(&shaper_lock);
+    admitted = traffic_shaper_consume(&shaper, cls, bytes, gw_shaper_now_ms());
+    portEXIT_CRITICAL(&shaper_lock);
+    return admitted;
+}
+
+bool gw_shaper_keep_sample(uint8_t seq)
+{
+    bool keep;
+
+    portENTER_CRITICAL(&shaper_lock);
+    keep = traffic_shaper_keep_sample(&shaper, seq);
+    portEXIT_CRITICAL(&shaper_lock);
+    return keep;
+}
+
+void gw_shaper_count_queue_lost(shaper_class_t cls)
+{
+    portENTER_CRITICAL(&shaper_lock);
+    shaper_queue_lost[cls]++;
+    portEXIT_CRITICAL(&shaper_lock);
+}
+
+otError esp_ot_process_shaper(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    TRAFFIC_SHAPER snapshot;
+    uint32_t queue_lost[SHAPER_CLASS_COUNT];
+
+    if (!shaper_started) {
+        otCliOutputFormat("Traffic shaper is not started\n");
+        return OT_ERROR_INVALID_STATE;
+    }
+
+    if (aArgsLength == 0) {
+        otCliOutputFormat("---shaper parameter---\n");
+        otCliOutputFormat("status                                   :     class rates, buckets and counters\n");
+        otCliOutputFormat("rate <event|sample|stats> <B/s> <burst>  :     set the token bucket of a class\n");
+        otCliOutputFormat("---example---\n");
+        otCliOutputFormat("allow 3 kB/s of ranges                   :     shaper rate sample 3000 6000\n");
+    } else if (strcmp(aArgs[0], "status") == 0) {
+        portENTER_CRITICAL(&shaper_lock);
+        snapshot = shaper;
+        memcpy(queue_lost, shaper_queue_lost, sizeof(queue_lost));
+        portEXIT_CRITICAL(&shaper_lock);
+        for (int i = 0; i < SHAPER_CLASS_COUNT; i++) {
+            const TRAFFIC_SHAPER_BUCKET *bucket = &snapshot.buckets[i];
+            otCliOutputFormat("%-6s rate %" PRIu32 " B/s burst %" PRIu32 " tokens %" PRIu32 "\tsent %" PRIu32 " (%" PRIu32
+                              " B)\theld %" PRIu32 "\tdropped %" PRIu32 "\tqueue full %" PRIu32 "\n",
+                              shaper_class_names[i], bucket->config.rate, bucket->config.burst,
+                              (uint32_t)(bucket->tokens_x1000 / 1000), bucket->sent, bucket->sent_bytes, bucket->held,
+                              bucket->dropped, queue_lost[i]);
+        }
+        otCliOutputFormat("sample decimation: 1/%u\tdownsampled: %" PRIu32 "\tlevel changes: %" PRIu32 "\n",
+                          1u << snapshot.level, snapshot.downsampled, snapshot.level_changes);
+    } else if (strcmp(aArgs[0], "rate") == 0) {
+        int cls = -1;
+        for (int i = 0; aArgsLength == 4 && i < SHAPER_CLASS_COUNT; i++) {
+            if (strcmp(aArgs[1], shaper_class_names[i]) == 0) {
+                cls = i;
+            }
+        }
+        if (cls < 0) {
+            ESP_LOGE(SHAPER_TAG, "Invalid arguments.");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        TRAFFIC_SHAPER_RATE rate = {
+            .rate = strtoul(aArgs[2], NULL, 0),
+            .burst = strtoul(aArgs[3], NULL, 0),
+        };
+        portENTER_CRITICAL(&shaper_lock);
+        traffic_shaper_set_rate(&shaper, cls, &rate, gw_shaper_now_ms());
+        portEXIT_CRITICAL(&shaper_lock);
+    } else {
+        otCliOutputFormat("invalid commands\n");
+    }
+    return OT_ERROR_NONE;
+}
@@ -0,0 +1,62 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "traffic_shaper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GW_SHAPER_UPDATE_PERIOD_MS 1000
+#define GW_SHAPER_HOLD_RETRY_MS 100    // Sender back-off after events were held for lack of tokens or reliable window
+
+/**
+ * @brief Start the traffic shaper with the default class rates.
+ *
+ * @return
+ *      - ESP_OK on success.
+ */
+esp_err_t gw_shaper_start(void);
+
+/**
+ * @brief Take the tokens for one message about to be sent.
+ *
+ * @return
+ *      - true if the message may be sent now.
+ */
+bool gw_shaper_consume(shaper_class_t cls, uint32_t bytes);
+
+/**
+ * @brief Decimate a tag's samples while the sample class is over budget.
+ *
+ * @param[in] seq   Tag sequence number, so that every gateway and anchor keeps the same samples.
+ *
+ * @return
+ *      - true if the sample is kept.
+ */
+bool gw_shaper_keep_sample(uint8_t seq);
+
+/**
+ * @brief Count a message lost because the sample queue was full, shown by "shaper status".
+ *
+ */
+void gw_shaper_count_queue_lost(shaper_class_t cls);
+
+/**
+ * @brief User command "shaper" process.
+ *
+ */
+otError esp_ot_process_shaper(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
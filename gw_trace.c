@@ -0,0 +1,170 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "gw_trace.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "driver/uart.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "mem_budget.h"
+#include "openthread/cli.h"
+
+#define TRACE_TAG "gw_trace"
+
+typedef enum {
+    GW_TRACE_OFF = 0,
+    GW_TRACE_UDP,
+    GW_TRACE_UART,
+} gw_trace_output_t;
+
+static uint8_t trace_buf[GW_TRACE_BUF_SIZE];
+static uint8_t trace_chunk[GW_TRACE_CHUNK_LEN];    // Only used by the stream task
+static TRACE_RING trace_ring;
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile gw_trace_output_t trace_output = GW_TRACE_OFF;
+static int trace_sock = -1;
+static struct sockaddr_in6 trace_dest;
+static uart_port_t trace_uart;
+static uint32_t trace_chunks_sent;
+static uint32_t trace_send_errors;
+
+GATEWAY_TASK_DEFINE(trace_task, GW_TRACE_TASK_STACK_SIZE);
+
+static void gw_trace_task(void *arg)
+{
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(GW_TRACE_FLUSH_MS));
+
+        gw_trace_output_t output = trace_output;
+        while (output != GW_TRACE_OFF) {
+            portENTER_CRITICAL(&trace_lock);
+            size_t len = trace_ring_take(&trace_ring, trace_chunk, sizeof(trace_chunk));
+            portEXIT_CRITICAL(&trace_lock);
+            if (len == 0) {
+                break;
+            }
+
+            bool sent;
+            if (output == GW_TRACE_UDP) {
+                sent = sendto(trace_sock, trace_chunk, len, 0, (struct sockaddr *)&trace_dest, sizeof(trace_dest)) ==
+                       (int)len;
+            } else {
+                sent = uart_write_bytes(trace_uart, trace_chunk, len) == (int)len;
+            }
+            if (sent) {
+                trace_chunks_sent++;
+            } else {
+                trace_send_errors++;
+            }
+        }
+    }
+}
+
+esp_err_t gw_trace_start(void)
+{
+    trace_ring_init(&trace_ring, trace_buf, sizeof(trace_buf));
+    return GATEWAY_TASK_CREATE(trace_task, gw_trace_task, "gw_trace", NULL, 2, NULL);
+}
+
+void gw_trace_ble_adv(const struct ble_scan_result_evt_param *scan_rst)
+{
+    uint8_t payload[8 + ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    uint8_t len = scan_rst->adv_data_len + scan_rst->scan_rsp_len;
+
+    if (trace_output == GW_TRACE_OFF) {
+        return;
+    }
+    if (len > sizeof(payload) - 8) {
+        len = sizeof(payload) - 8;
+    }
+    memcpy(payload, scan_rst->bda, 6);
+    payload[6] = (uint8_t)scan_rst->rssi;
+    payload[7] = scan_rst->adv_data_len;
+    memcpy(&payload[8], scan_rst->ble_adv, len);
+
+    portENTER_CRITICAL(&trace_lock);
+    trace_ring_put(&trace_ring, TRACE_SRC_BLE_ADV, esp_timer_get_time(), payload, 8 + len);
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+static void gw_trace_restart_ring(void)
+{
+    // A new capture starts with an empty buffer and a fresh SYNC
+    portENTER_CRITICAL(&trace_lock);
+    trace_ring_init(&trace_ring, trace_buf, sizeof(trace_buf));
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+otError esp_ot_process_trace(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    if (aArgsLength == 0) {
+        otCliOutputFormat("---trace parameter---\n");
+        otCliOutputFormat("status                               :     capture output and counters\n");
+        otCliOutputFormat("udp <ipv6 address> <port>            :     stream raw BLE scan results over UDP\n");
+        otCliOutputFormat("uart <port> <baud>                   :     stream them over a spare UART\n");
+        otCliOutputFormat("stop                                 :     stop capturing\n");
+        otCliOutputFormat("---example---\n");
+        otCliOutputFormat("capture to the bridge                :     trace udp fdde:ad00:beef:0:0:0:0:1 12346\n");
+    } else if (strcmp(aArgs[0], "status") == 0) {
+        static const char *const output_names[] = {"off", "udp", "uart"};
+        portENTER_CRITICAL(&trace_lock);
+        uint32_t records = trace_ring.records;
+        uint32_t dropped = trace_ring.dropped;
+        uint32_t used = trace_ring.used;
+        portEXIT_CRITICAL(&trace_lock);
+        otCliOutputFormat("output: %s\tbuffered: %" PRIu32 "/%d B\n", output_names[trace_output], used,
+                          GW_TRACE_BUF_SIZE);
+        otCliOutputFormat("records: %" PRIu32 "\tdropped: %" PRIu32 "\tchunks sent: %" PRIu32 "\tsend errors: %" PRIu32
+                          "\n", records, dropped, trace_chunks_sent, trace_send_errors);
+    } else if (strcmp(aArgs[0], "udp") == 0 && aArgsLength == 3) {
+        trace_output = GW_TRACE_OFF;
+        memset(&trace_dest, 0, sizeof(trace_dest));
+        trace_dest.sin6_family = AF_INET6;
+        trace_dest.sin6_port = htons(atoi(aArgs[2]));
+        if (inet6_aton(aArgs[1], &trace_dest.sin6_addr) != 1) {
+            ESP_LOGE(TRACE_TAG, "Invalid arguments.");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        // The socket is kept across captures, so the stream task never sees it closed
+        if (trace_sock < 0) {
+            trace_sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_IPV6);
+        }
+        if (trace_sock < 0) {
+            ESP_LOGE(TRACE_TAG, "Unable to create socket: errno %d", errno);
+            return OT_ERROR_FAILED;
+        }
+        gw_trace_restart_ring();
+        trace_output = GW_TRACE_UDP;
+    } else if (strcmp(aArgs[0], "uart") == 0 && aArgsLength == 3) {
+        uart_port_t port = atoi(aArgs[1]);
+        if (port >= UART_NUM_MAX || port == CONFIG_ESP_CONSOLE_UART_NUM) {
+            ESP_LOGE(TRACE_TAG, "Invalid arguments.");
+            return OT_ERROR_INVALID_ARGS;
+        }
+        trace_output = GW_TRACE_OFF;
+        if (!uart_is_driver_installed(port) && uart_driver_install(port, 256, 2 * GW_TRACE_CHUNK_LEN, 0, NULL, 0) !=
+                                               ESP_OK) {
+            ESP_LOGE(TRACE_TAG, "Fail to install UART %d driver", port);
+            return OT_ERROR_FAILED;
+        }
+        uart_set_baudrate(port, strtoul(aArgs[2], NULL, 0));
+        trace_uart = port;
+        gw_trace_restart_ring();
+        trace_output = GW_TRACE_UART;
+    } else if (strcmp(aArgs[0], "stop") == 0) {
+        trace_output = GW_TRACE_OFF;
+    } else {
+        otCliOutputFormat("invalid commands\n");
+    }
+    return OT_ERROR_NONE;
+}
@@ -0,0 +1,49 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "esp_gap_ble_api.h"
+#include "trace_capture.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GW_TRACE_BUF_SIZE 8192          // Captured records waiting to be streamed out
+#define GW_TRACE_CHUNK_LEN 512          // Bytes per UDP datagram or UART write
+#define GW_TRACE_FLUSH_MS 100
+#define GW_TRACE_TASK_STACK_SIZE 3072
+
+/**
+ * @brief Start the capture stream task. Nothing is captured until enabled with the "trace" command.
+ *
+ * @return
+ *      - ESP_OK on success.
+ */
+esp_err_t gw_trace_start(void);
+
+/**
+ * @brief Capture one BLE scan result as received, before any filtering.
+ *
+ * Cheap when capture is off; called from the Bluetooth stack task.
+ *
+ */
+void gw_trace_ble_adv(const struct ble_scan_result_evt_param *scan_rst);
+
+/**
+ * @brief User command "trace" process.
+ *
+ */
+otError esp_ot_process_trace(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,138 @@
+import argparse
+import heapq
+import json
+import random
+import sys
+import time
+
+from bridge_jitter import JitterBuffer, SEQ_MOD
+
+# Benchmark of the bridge's reorder buffer (bridge_jitter.py) on synthetic reordering, on its own, without sockets.
+# Sample j of tag k is produced at phase_k + j / rate and arrives after the mesh delay, plus up to --reorder-ms for
+# a --reorder share of them, or never for a --loss share. Arrivals are generated one second at a time so that the
+# tag count is bounded by the buffer's max_tags, not by memory; only the add() and flush() calls are timed.
+# Every tag's output is checked: its samples in order, each once, the gap markers covering exactly what was lost.
+
+MESH_DELAY_S = 0.01
+FLUSH_EVERY_S = 0.01        # mqttconnection.py flushes after every datagram, at least this often under load
+JUMP = 150                  # Sequence numbers skipped by the tags that jump in the middle of the run
+JUMP_SILENCE_S = 1.0        # Heard by no gateway around the jump, so nothing from before it is still in flight
+
+
+def arrivals(cfg, rng):
+    """Batches of (arrival, tag, seq, index) in arrival order; index counts the tag's samples, jumps included."""
+    phases = [rng.random() / cfg["rate"] for _ in range(cfg["tags"])]
+    jump_at = cfg["duration"] / 2
+    pending = []
+    for second in range(int(cfg["duration"])):
+        for k in range(cfg["tags"]):
+            j = int(max(0.0, second - phases[k]) * cfg["rate"])
+            while phases[k] + j / cfg["rate"] < second:
+                j += 1
+            while (t := phases[k] + j / cfg["rate"]) < second + 1:
+                jumps = k < cfg["jumps"]
+                index = j + (JUMP if jumps and t >= jump_at else 0)
+                silent = jumps and jump_at - JUMP_SILENCE_S <= t < jump_at
+                if rng.random() >= cfg["loss"] and not silent:
+                    delay = MESH_DELAY_S
+                    if rng.random() < cfg["reorder"]:
+                        delay += rng.uniform(0, cfg["reorder_ms"] / 1000)
+                    heapq.heappush(pending, (t + delay, k, index % SEQ_MOD, index))
+                j += 1
+        # Everything produced from now on arrives later than this
+        batch = []
+        while pending and pending[0][0] <= second + 1:
+            batch.append(heapq.heappop(pending))
+        yield batch
+    yield sorted(pending)
+
+
+def check(outputs):
+    """Per tag: samples published once each in production order, gap markers covering exactly the samples
+    skipped in between (lost on the mesh, or late). Returns the order errors, the expected and the marked loss."""
+    errors, expected_lost, lost = 0, 0, 0
+    for out in outputs.values():
+        next_seq, last_index, published = None, None, []
+        for item in out:
+            if item.startswith("gap,"):
+                _, _, first_seq, count = item.split(",")
+                seq, count = int(first_seq), int(count)
+                lost += count
+            else:
+                _, seq, index = (int(v) for v in item.split(":"))
+                count = 1
+                errors += last_index is not None and index <= last_index
+                last_index = index
+                published.append(index)
+            errors += next_seq is not None and seq != next_seq
+            next_seq = (seq + count) % SEQ_MOD
+        if published:
+            expected_lost += published[-1] - published[0] + 1 - len(published)
+    return errors, expected_lost, lost
+
+
+def run_case(cfg):
+    rng = random.Random(cfg["seed"])
+    jitter = JitterBuffer(hold_s=cfg["hold_ms"] / 1000, max_tags=max(cfg["tags"], 20000))
+    outputs = {k: [] for k in range(cfg["tags"])}
+    samples, busy_ns, next_flush = 0, 0, 0.0
+
+    def emit(items):
+        for item in items:
+            outputs[int(item.split(",")[1] if item.startswith("gap,") else item.split(":")[0])].append(item)
+
+    for batch in arrivals(cfg, rng):
+        start = time.perf_counter_ns()
+        released = []
+        for now, k, seq, index in batch:
+            if now >= next_flush:
+                released += jitter.flush(now)
+                next_flush = now + FLUSH_EVERY_S
+            released += jitter.add(k, seq, f"{k}:{seq}:{index}", now)
+        busy_ns += time.perf_counter_ns() - start
+        samples += len(batch)
+        emit(released)
+    emit(jitter.flush(cfg["duration"] + 60))
+
+    errors, expected_lost, lost = check(outputs)
+    metrics = jitter.metrics()
+    # Within the hold time, a sample can only be late by overtaking the first one a stream starts at
+    late_max = cfg["tags"] + cfg["jumps"] if cfg["reorder_ms"] <= cfg["hold_ms"] else metrics["received"]
+    ok = errors == 0 and lost == expected_lost and metrics["held"] == 0 and metrics["duplicates"] == 0 and \
+        metrics["resyncs"] == cfg["jumps"] and metrics["late"] <= late_max
+    return {"tags": cfg["tags"], "rate": cfg["rate"], "samples": samples,
+            "ns_per_sample": round(busy_ns / max(1, samples)), "order_errors": errors, "lost": lost,
+            "expected_lost": expected_lost, "jitter": metrics, "ok": ok}
+
+
+# python3 jitter_bench.py --tags 100,1000,10000 --rate 10 --reorder 0.2 --reorder-ms 150 --loss 0.01
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Reorder buffer cost and accounting under synthetic reordering")
+    parser.add_argument("--tags", default="100,1000,10000", help="comma separated tag counts")
+    parser.add_argument("--rate", type=float, default=10.0, help="per-tag rate, Hz")
+    parser.add_argument("--duration", type=int, default=30, help="seconds of samples per case")
+    parser.add_argument("--reorder", type=float, default=0.2, help="share of samples delayed")
+    parser.add_argument("--reorder-ms", type=float, default=150.0, help="maximum extra delay of a delayed sample")
+    parser.add_argument("--loss", type=float, default=0.01, help="share of samples lost")
+    parser.add_argument("--hold-ms", type=float, default=200.0, help="as JITTER_HOLD_S")
+    parser.add_argument("--jumps", type=int, default=10,
+                        help="tags whose sequence jumps by more than half its range mid-run, as after a restart")
+    parser.add_argument("--max-growth", type=float, default=3.0,
+                        help="fail if the cost per sample grows more than this from the fewest to the most tags")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    failed = False
+    costs = []
+    for tags in [int(v) for v in args.tags.split(",")]:
+        cfg = {"tags": tags, "rate": args.rate, "duration": args.duration, "reorder": args.reorder,
+               "reorder_ms": args.reorder_ms, "loss": args.loss, "hold_ms": args.hold_ms,
+               "jumps": min(args.jumps, tags), "seed": args.seed}
+        result = run_case(cfg)
+        costs.append(result["ns_per_sample"])
+        failed |= not result["ok"]
+        print(json.dumps(result))
+    growth = costs[-1] / max(1, costs[0])
+    failed |= growth > args.max_growth
+    print(json.dumps({"cost_growth": round(growth, 2), "ok": growth <= args.max_growth}))
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,233 @@
+import argparse
+import ctypes
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+from collections import deque
+
+# Simulated time check of the UDP sender's Thread attach gating (udp_socket_client_task() in main.c), in 1 ms steps.
+# Tags produce samples into the 32-entry sample queue while the device attaches, detaches for partitions of
+# several lengths and reattaches. Two senders are compared:
+#  - poll: the original task, which looked at the role every 500 ms until the first attach, then sent forever,
+#    losing whatever it sent while detached
+#  - callback: the event group driven by the state-changed callback, which wakes the sender on attach, keeps the
+#    samples queued while detached and flushes them on reattach
+# Both batch as the firmware does: radio_coex_policy.c (compiled for the host) decides when a TX window is due,
+# bounded by the send period. Time to first packet is measured from every attach to the first datagram sent
+# while attached. The callback sender fails the check if a sample is lost in a failed send, if a sample is
+# dropped in a detach the queue could hold, or if its first packet comes later than the batching rules allow.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+SAMPLE_QUEUE_LEN = 32       # As in main.c
+SEND_PERIOD_MS = 200        # GATEWAY_CONFIG_DEFAULT send_period_ms
+ACK_POLL_MS = 20            # UDP_RELIABLE_ACK_POLL_MS, longest sleep of the batching loop
+ROLE_POLL_MS = 500          # The original sender's role polling period
+TX_WINDOW_MS = 20           # Exclusive TX window per batch, as bridge_bench.py
+
+SHIM = """
+#include <stdlib.h>
+#include "radio_coex_policy.h"
+
+RADIO_COEX_POLICY *sim_policy_new(void)
+{
+    static const RADIO_COEX_CONFIG config = RADIO_COEX_CONFIG_DEFAULT();
+    RADIO_COEX_POLICY *policy = malloc(sizeof(*policy));
+    radio_coex_policy_init(policy, &config, 0);
+    return policy;
+}
+
+uint32_t sim_tx_max_wait_ms(const RADIO_COEX_POLICY *policy)
+{
+    return policy->config.tx_max_wait_ms;
+}
+"""
+
+
+def load_policy(workdir):
+    """Build radio_coex_policy.c with its default configuration into a shared library."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run radio_coex_policy.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    lib = os.path.join(workdir, "radio_coex_policy.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", lib, shim,
+                    os.path.join(HERE, "radio_coex_policy.c")], check=True)
+    dll = ctypes.CDLL(lib)
+    dll.sim_policy_new.restype = ctypes.c_void_p
+    dll.sim_tx_max_wait_ms.restype = ctypes.c_uint32
+    dll.sim_tx_max_wait_ms.argtypes = [ctypes.c_void_p]
+    dll.radio_coex_policy_want_tx.restype = ctypes.c_bool
+    dll.radio_coex_policy_want_tx.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint32]
+    return dll
+
+
+def role_trace(cfg, rng):
+    """Attached intervals [(attach_ms, detach_ms)], the last one open until the end."""
+    intervals, t = [], cfg["attach_ms"]
+    end = cfg["duration_ms"]
+    detaches = list(cfg["detach_ms"])
+    while t < end:
+        up = rng.randint(*cfg["up_ms"])
+        if not detaches or t + up >= end:
+            intervals.append((t, end))
+            break
+        intervals.append((t, t + up))
+        t += up + detaches.pop(0)
+    return intervals
+
+
+def arrivals(cfg, rng):
+    """Sample times of every tag, at its rate from a random phase with some scheduling jitter."""
+    period = 1000 / cfg["rate"]
+    times = []
+    for _ in range(cfg["tags"]):
+        t = rng.uniform(0, period)
+        while t < cfg["duration_ms"]:
+            times.append(int(t + rng.uniform(0, 5)))
+            t += period
+    times.sort()
+    return times
+
+
+def percentiles(values):
+    if not values:
+        return None
+    values = sorted(values)
+    pick = lambda q: values[min(len(values) - 1, int(q * len(values)))]
+    return {"count": len(values), "p50_ms": pick(0.5), "p99_ms": pick(0.99), "max_ms": values[-1]}
+
+
+def simulate(mode, cfg, intervals, times, dll):
+    policy = dll.sim_policy_new()
+    max_wait = dll.sim_tx_max_wait_ms(policy)
+    attached = bytearray(cfg["duration_ms"])
+    for start, end in intervals:
+        attached[start:end] = b"\x01" * (end - start)
+
+    queue = deque()
+    stats = {"generated": len(times), "delivered": 0, "lost_failed_send": 0, "dropped_queue_full": 0,
+             "queue_max": 0, "datagrams": 0, "failed_sends": 0}
+    ttfp, late = [], []
+    # Per attach: the time its first packet is allowed by the batching rules, and whether it has had one yet
+    attach_index = {start: k for k, (start, _) in enumerate(intervals)}
+    first_sent = [None] * len(intervals)
+    allowed = [None] * len(intervals)
+    detaches = []               # Per detach: [samples queued at its start plus those arriving during it, dropped]
+    current = None              # Index of the current attached interval
+    started = False             # The poll sender has seen an attach and sends from then on
+    next_check = 0              # The sender's next wake-up while a batch builds up
+    busy_until = 0
+    k = 0
+
+    for t in range(cfg["duration_ms"]):
+        if t in attach_index:
+            current = attach_index[t]
+            # With samples waiting, the batching rules apply from the attach, otherwise from the next sample
+            ref = t if queue else next((a for a in times[k:] if a >= t), t)
+            allowed[current] = ref + min(max_wait, SEND_PERIOD_MS) + ACK_POLL_MS + 1
+            next_check = t
+        elif current is not None and t == intervals[current][1]:
+            current = None
+            detaches.append([len(queue), 0])
+
+        woke = not queue
+        while k < len(times) and times[k] == t:
+            if len(queue) == SAMPLE_QUEUE_LEN:
+                queue.popleft()
+                stats["dropped_queue_full"] += 1
+                if current is None and detaches:
+                    detaches[-1][1] += 1
+            if current is None and detaches:
+                detaches[-1][0] += 1
+            queue.append(t)
+            k += 1
+        stats["queue_max"] = max(stats["queue_max"], len(queue))
+
+        if t < busy_until or not queue:
+            continue
+        if mode == "poll":
+            if not started:
+                # The role is only looked at on the poll grid, the task starting with the device
+                if t % ROLE_POLL_MS != 0 or not attached[t]:
+                    continue
+                started = True
+                next_check = t
+        elif not attached[t]:
+            continue                # Blocked on THREAD_ATTACHED_BIT, the queue keeps buffering
+        if woke:
+            next_check = t          # xQueueReceive returns as soon as the first sample arrives
+        if t < next_check:
+            continue
+
+        age = t - queue[0]
+        want_tx = dll.radio_coex_policy_want_tx(policy, len(queue), age)
+        wait = 0 if want_tx or age >= max_wait else max_wait - age
+        if wait > 0 and age < SEND_PERIOD_MS:
+            next_check = t + min(wait, SEND_PERIOD_MS - age, ACK_POLL_MS) + 1
+            continue
+
+        batch = len(queue)
+        queue.clear()
+        stats["datagrams"] += 1
+        busy_until = t + TX_WINDOW_MS
+        if attached[t]:
+            stats["delivered"] += batch
+            if current is not None and first_sent[current] is None:
+                first_sent[current] = t
+                ttfp.append(t - intervals[current][0])
+                if t > allowed[current]:
+                    late.append({"attach_ms": intervals[current][0], "first_packet_ms": t,
+                                 "allowed_ms": allowed[current]})
+        else:
+            stats["failed_sends"] += 1
+            stats["lost_failed_send"] += batch
+
+    # A detach only has to drop what does not fit in the queue
+    overflow = [d for d in detaches if d[0] <= SAMPLE_QUEUE_LEN and d[1] > 0]
+    stats["queued_at_end"] = len(queue)
+    stats["attaches"] = len(intervals)
+    stats["ttfp"] = percentiles(ttfp)
+    if mode == "callback":
+        stats["late_first_packets"] = len(late)
+        stats["needless_drops"] = len(overflow)
+        stats["ok"] = (not late and not overflow and stats["lost_failed_send"] == 0 and
+                       all(s is not None for s in first_sent) and
+                       stats["delivered"] + stats["dropped_queue_full"] + len(queue) == stats["generated"])
+        stats["first_errors"] = late[:5]
+    return stats
+
+
+# python3 link_sim.py --tags 20 --rate 2 --detach 300,1000,3000,10000
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Time to first packet and loss of the attach-gated UDP sender")
+    parser.add_argument("--tags", type=int, default=20)
+    parser.add_argument("--rate", type=float, default=2.0, help="samples per second per tag")
+    parser.add_argument("--attach", type=float, default=3.3, help="seconds from start to the first attach")
+    parser.add_argument("--detach", default="300,1000,3000,10000,150,700",
+                        help="comma separated partition lengths, ms, in order")
+    parser.add_argument("--up", default="2000,8000", help="attached time range between partitions, ms")
+    parser.add_argument("--duration", type=float, default=120.0, help="simulated seconds")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    cfg = {"tags": args.tags, "rate": args.rate, "attach_ms": int(args.attach * 1000),
+           "detach_ms": [int(v) for v in args.detach.split(",") if v],
+           "up_ms": [int(v) for v in args.up.split(",")], "duration_ms": int(args.duration * 1000)}
+    rng = random.Random(args.seed)
+    intervals = role_trace(cfg, rng)
+    times = arrivals(cfg, rng)
+    failed = False
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_policy(workdir)
+        for mode in ("poll", "callback"):
+            result = simulate(mode, cfg, intervals, times, dll)
+            failed |= not result.get("ok", True)
+            print(json.dumps({"sender": mode, **result}))
+    sys.exit(1 if failed else 0)
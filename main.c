@@ -16,6 +16,8 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
 
 // Libraries needed for OpenThread inilitation
 
@@ -41,15 +43,34 @@
 #include "openthread/instance.h"
 #include "openthread/logging.h"
 #include "openthread/tasklet.h"
+#include "openthread/thread.h"
 
 // Libraries for OpenThread
 
 #include "esp_ot_udp_socket.h"
+#include "boot_report.h"
+#include "mem_budget.h"
+#include "ble_adv_worker.h"
+#include "ble_scan_filter.h"
+#include "radio_coex.h"
+#include "gw_owner.h"
+#include "gw_geofence.h"
+#include "gw_agg.h"
+#include "udp_reliable.h"
+#include "gw_shaper.h"
+#include "gw_trace.h"
+#include "gw_config.h"
+#include "gw_mqttsn.h"
+#include "stream_codec.h"
+#include "uwb_msg.h"
 #include "cc.h"
 #include "esp_check.h"
 #include "esp_netif_net_stack.h"
 #include <sys/unistd.h>
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 #include "lwip/err.h"
 #include "lwip/mld6.h"
 #include "lwip/sockets.h"
@@ -64,7 +85,7 @@
 
 
 #define BLE_TAG "BLE_SCANNER"   // Define name of BLE scanner to debugging logs
-#define MANUFACTURER_ID 0xFFFF  // Replace with your actual UWB manufacturer ID if different
+// Tag and anchor manufacturer data and the forwarded line formats come from uwb_msg.h, generated by uwb_schema.py
 
 extern UDP_CLIENT udp_client; // Access global from BLE task
 
@@ -78,19 +99,49 @@ extern UDP_CLIENT udp_client; // Access global from BLE task
 
 #define TAG "ot_esp_cli"
 
+#define THREAD_ATTACHED_BIT BIT0    // Set while the device is child/router/leader
+#define SAMPLE_QUEUE_LEN 32         // Readings buffered while the device is detached
+#define UDP_FRAME_LEN 384           // Samples of one TX window share a datagram, one per line
+
+#define OT_TASK_STACK_SIZE 10240
+#define UDP_TASK_STACK_SIZE 4096
+#define BLE_TASK_STACK_SIZE 4096
+#define STACK_MONITOR_PERIOD_MS 5000
+
+// One reading from the BLE scanner waiting to be sent over Thread
+
+typedef struct sample_msg {
+    char message[64];
+    int64_t queued_us;    // esp_timer time the reading was queued
+    uint8_t cls;          // shaper_class_t, events are sent on the acknowledged stream (udp_reliable.c)
+    bool has_range;       // A tag range, sent as range instead of message while the stream codec is on
+    STREAM_SAMPLE range;
+} SAMPLE_MSG;
+
+typedef struct udp_frame {
+    char data[UDP_FRAME_LEN];
+    size_t len;
+} UDP_FRAME;
+
+static EventGroupHandle_t thread_link_event_group;
+static QueueHandle_t sample_queue;    // Carries SAMPLE_MSG pointers taken from sample_pool
+MSG_POOL_DEFINE(sample_pool, SAMPLE_MSG, SAMPLE_QUEUE_LEN);
+
+GATEWAY_TASK_DEFINE(ot_task, OT_TASK_STACK_SIZE);
+GATEWAY_TASK_DEFINE(udp_task, UDP_TASK_STACK_SIZE);
+static int64_t thread_attach_time_us = 0;    // esp_timer time of the last attach, 0 when detached
+static uint32_t udp_client_sent;             // Datagrams sendto() accepted, only used by the UDP task
+static STREAM_ENCODER stream_encoder;        // Only used by the UDP task
+
 // Function for UDP client with the message updated from BLE scanner
+// Destination, source port and send period come from the runtime settings (gw_config.c, "config" command)
 
 static UDP_CLIENT udp_client = {
     .exist = 1,
     .sock = -1,
-    .local_port = 12345,
+    .local_port = -1,                                             // Bound source port, follows the settings
     .local_ipaddr = "::",
     .ifr = {{0}},
-    .messagesend = {
-        .port = 20617,                                            // Destination port address
-        .ipaddr = "fd40:e3e2:5852:4d1:a433:cd2c:20c8:fb4b",       // Destination IPv6 addresss
-        .message = "", 
-    },
 };
 
 
@@ -105,6 +156,58 @@ static esp_netif_t *init_openthread_netif(const esp_openthread_platform_config_t
     return netif;
 }
 
+// OpenThread state-changed callback: gates the UDP sender on the device role.
+// Runs in the OpenThread task, so it only flips event group bits.
+
+static void thread_state_changed_cb(otChangedFlags flags, void *context)
+{
+    if ((flags & OT_CHANGED_THREAD_ROLE) == 0) {
+        return;
+    }
+
+    otDeviceRole role = otThreadGetDeviceRole((otInstance *)context);
+    if (role == OT_DEVICE_ROLE_CHILD || role == OT_DEVICE_ROLE_ROUTER || role == OT_DEVICE_ROLE_LEADER) {
+        if ((xEventGroupGetBits(thread_link_event_group) & THREAD_ATTACHED_BIT) == 0) {
+            thread_attach_time_us = esp_timer_get_time();
+            boot_report_mark(BOOT_PHASE_THREAD_ATTACHED);
+            ESP_LOGI(OT_EXT_CLI_TAG, "Device joined Thread network with role: %d", role);
+        }
+        xEventGroupSetBits(thread_link_event_group, THREAD_ATTACHED_BIT);
+    } else {
+        xEventGroupClearBits(thread_link_event_group, THREAD_ATTACHED_BIT);
+        thread_attach_time_us = 0;
+        ESP_LOGI(OT_EXT_CLI_TAG, "Device detached (role: %d), buffering samples", role);
+    }
+}
+
+// Gateway specific CLI commands, registered next to the ESP CLI extension
+// OpenThread keeps OPENTHREAD_CONFIG_CLI_MAX_USER_CMD_ENTRIES user tables, the extension's table needs a second one
+// (README). This table goes first and also carries the socket commands (esp_ot_udp_socket.c), so the gateway stays
+// usable on a build that still accepts only one
+
+#if CONFIG_OPENTHREAD_CLI
+static const otCliCommand gateway_commands[] = {
+#if CONFIG_OPENTHREAD_CLI_ESP_EXTENSION
+    {"mcast", esp_ot_process_mcast_group},
+    {"udpsockserver", esp_ot_process_udp_server},
+    {"udpsockclient", esp_ot_process_udp_client},
+#endif // CONFIG_OPENTHREAD_CLI_ESP_EXTENSION
+    {"bootreport", esp_ot_process_boot_report},
+    {"membudget", esp_ot_process_mem_budget},
+    {"blestats", esp_ot_process_ble_stats},
+    {"tagfilter", esp_ot_process_tag_filter},
+    {"coex", esp_ot_process_coex},
+    {"owner", esp_ot_process_owner},
+    {"zone", esp_ot_process_zone},
+    {"agg", esp_ot_process_agg},
+    {"reliable", esp_ot_process_reliable},
+    {"shaper", esp_ot_process_shaper},
+    {"trace", esp_ot_process_trace},
+    {"config", esp_ot_process_config},
+    {"mqttsn", esp_ot_process_mqttsn},
+};
+#endif
+
 // Function to initialise Thread network
 
 static void ot_task_worker(void *aContext)
@@ -117,6 +220,7 @@ static void ot_task_worker(void *aContext)
 
     // Initialize the OpenThread stack
     ESP_ERROR_CHECK(esp_openthread_init(&config));
+    boot_report_mark(BOOT_PHASE_OT_INIT_DONE);
 
 #if CONFIG_OPENTHREAD_STATE_INDICATOR_ENABLE
     ESP_ERROR_CHECK(esp_openthread_state_indicator_init(esp_openthread_get_instance()));
@@ -126,6 +230,13 @@ static void ot_task_worker(void *aContext)
     // The OpenThread log level directly matches ESP log level
     (void)otLoggingSetLevel(CONFIG_LOG_DEFAULT_LEVEL);
 #endif
+
+    // Let role changes drive the UDP sender instead of polling the role
+    if (otSetStateChangedCallback(esp_openthread_get_instance(), thread_state_changed_cb,
+                                  esp_openthread_get_instance()) != OT_ERROR_NONE) {
+        ESP_LOGE(TAG, "Fail to register Thread state callback");
+    }
+
     // Initialize the OpenThread cli
 #if CONFIG_OPENTHREAD_CLI
     esp_openthread_cli_init();
@@ -136,6 +247,12 @@ static void ot_task_worker(void *aContext)
     openthread_netif = init_openthread_netif(&config);
     esp_netif_set_default_netif(openthread_netif);
 
+#if CONFIG_OPENTHREAD_CLI
+    if (otCliSetUserCommands(gateway_commands, sizeof(gateway_commands) / sizeof(gateway_commands[0]),
+                             esp_openthread_get_instance()) != OT_ERROR_NONE) {
+        ESP_LOGE(TAG, "Fail to register gateway CLI commands");
+    }
+#endif
 #if CONFIG_OPENTHREAD_CLI_ESP_EXTENSION
     esp_cli_custom_command_init();
 #endif // CONFIG_OPENTHREAD_CLI_ESP_EXTENSION
@@ -149,6 +266,7 @@ static void ot_task_worker(void *aContext)
     otError error = otDatasetGetActiveTlvs(esp_openthread_get_instance(), &dataset);
     ESP_ERROR_CHECK(esp_openthread_auto_start((error == OT_ERROR_NONE) ? &dataset : NULL));
 #endif
+    boot_report_mark(BOOT_PHASE_OT_STARTED);
     esp_openthread_launch_mainloop();
 
     // Clean up
@@ -156,133 +274,491 @@ static void ot_task_worker(void *aContext)
     esp_netif_destroy(openthread_netif);
 
     esp_vfs_eventfd_unregister();
+    mem_budget_unregister_task(xTaskGetCurrentTaskHandle());
     vTaskDelete(NULL);
 }
 
 // Function to send a UDP message using IPv6 address over a Thread network
 
-static void udp_client_send(UDP_CLIENT *udp_client_member)
+static void udp_client_send(UDP_CLIENT *udp_client_member, const void *payload, size_t payload_len)
 {
     struct sockaddr_in6 dest_addr = {0};    // IPv6 destination address structure
     int len = 0;                            // Length of the sent message
 
-    // Convert the destination IP address (string) to binary format
-    inet6_aton(udp_client_member->messagesend.ipaddr, &dest_addr.sin6_addr);
+    // Take the destination from one settings snapshot, a concurrent "config set" never mixes old and new fields
+    const GATEWAY_CONFIG *config = gw_config_acquire();
+    memcpy(&dest_addr.sin6_addr, config->dest_addr, sizeof(dest_addr.sin6_addr));
     dest_addr.sin6_family = AF_INET6;    // Set address family to IPv6
-    dest_addr.sin6_port = htons(udp_client_member->messagesend.port);    // Set destination port in network byte order
+    dest_addr.sin6_port = htons(config->dest_port);    // Set destination port in network byte order
     // Log the destination IP and port
-    ESP_LOGI(OT_EXT_CLI_TAG, "Sending to %s : %d", udp_client_member->messagesend.ipaddr,
-             udp_client_member->messagesend.port);
+    ESP_LOGI(OT_EXT_CLI_TAG, "Sending to %s : %d", config->dest_ipaddr, config->dest_port);
+    gw_config_release(config);
     // Bind the socket to the specified network interface (Thread in this case)
     esp_err_t err = socket_bind_interface(udp_client_member->sock, &(udp_client_member->ifr));
     // If the binding fails, return immediately and log the issue
     ESP_RETURN_ON_FALSE(err == ESP_OK, , OT_EXT_CLI_TAG, "Stop sending message");
     // Send the message using sendto() to the destination address
-    len = sendto(udp_client_member->sock, udp_client_member->messagesend.message,
-                 strlen(udp_client_member->messagesend.message), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    len = sendto(udp_client_member->sock, payload, payload_len, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
     // Check if sending failed
     if (len < 0) {
         ESP_LOGW(OT_EXT_CLI_TAG, "Fail to send message");
+    } else {
+        udp_client_sent++;
     }
 }
 
 
 
-static void udp_socket_client_task(void *pvParameters)
+static void udp_client_tx(const uint8_t *frame, size_t len, void *ctx)
 {
-    UDP_CLIENT *udp_client_member = (UDP_CLIENT *)pvParameters;
+    udp_client_send((UDP_CLIENT *)ctx, frame, len);
+}
 
-    esp_err_t ret = ESP_OK;
-    int err = 0;
-    int sock = -1;
-    int err_flag = 0;
+static void udp_frame_flush(UDP_CLIENT *udp_client_member, UDP_FRAME *frame, bool reliable)
+{
+    if (frame->len == 0) {
+        return;
+    }
+    if (reliable) {
+        udp_reliable_send(frame->data, frame->len, udp_client_tx, udp_client_member);
+    } else {
+        udp_client_send(udp_client_member, frame->data, frame->len);
+    }
+    frame->len = 0;
+}
+
+// True if appending len bytes starts a new frame
+static bool udp_frame_opens(const UDP_FRAME *frame, size_t len)
+{
+    return frame->len == 0 || frame->len + 1 + len > sizeof(frame->data);
+}
+
+static void udp_frame_append(UDP_CLIENT *udp_client_member, UDP_FRAME *frame, bool reliable, const char *message,
+                             size_t len)
+{
+    if (frame->len > 0 && udp_frame_opens(frame, len)) {
+        udp_frame_flush(udp_client_member, frame, reliable);
+    }
+    if (frame->len > 0) {
+        frame->data[frame->len++] = '\n';
+    }
+    memcpy(&frame->data[frame->len], message, len);
+    frame->len += len;
+}
+
+static void udp_codec_flush(UDP_CLIENT *udp_client_member, STREAM_ENCODER *codec)
+{
+    const uint8_t *frame;
+    size_t len = stream_encoder_flush(codec, &frame);
+
+    if (len > 0) {
+        udp_client_send(udp_client_member, frame, len);
+    }
+}
+
+static void udp_codec_append(UDP_CLIENT *udp_client_member, STREAM_ENCODER *codec, const STREAM_SAMPLE *range)
+{
+    if (!stream_encoder_add(codec, range)) {
+        udp_codec_flush(udp_client_member, codec);
+        stream_encoder_add(codec, range);
+    }
+}
+
+// Send the samples of a TX window joined by '\n', one frame per stream, as many datagrams as UDP_FRAME_LEN requires
+// With the stream codec on (codec not NULL), ranges go in compressed frames of their own instead
+// With the MQTT-SN backend selected, every line is published on its own (gw_mqttsn.c), events at QoS 1
+// Classes go out in priority order within the shaper's budget: held events stay queued, other classes are dropped
+// Events are also held when the reliable stream has no room for the frame they would open, or when the MQTT-SN client
+// refuses them while its session is being set up again (other classes are counted as dropped by gw_mqttsn.c)
+
+static bool udp_client_send_batch(UDP_CLIENT *udp_client_member, STREAM_ENCODER *codec, bool mqttsn,
+                                  SAMPLE_MSG *sample)
+{
+    static int64_t first_packet_attach_us = 0;    // Attach instance for which time-to-first-packet was logged
+    static UDP_FRAME frames[2];                   // Best-effort, reliable
+    SAMPLE_MSG *batch[SAMPLE_QUEUE_LEN];
+    SAMPLE_MSG *held[SAMPLE_QUEUE_LEN];
+    int count = 0;
+    int held_count = 0;
+    uint32_t sent_before = udp_client_sent;
+    bool published = false;    // A line taken by the MQTT-SN client
+    int reliable_room = mqttsn ? 0 : udp_reliable_window_room();    // Reliable frames this batch may still open
+
+    do {
+        batch[count++] = sample;
+    } while (count < SAMPLE_QUEUE_LEN && xQueueReceive(sample_queue, &sample, 0) == pdTRUE);
+
+    for (int cls = 0; cls < SHAPER_CLASS_COUNT; cls++) {
+        for (int i = 0; i < count; i++) {
+            if (batch[i]->cls != cls) {
+                continue;
+            }
+            bool reliable = cls == SHAPER_CLASS_EVENT;
+            size_t len = strlen(batch[i]->message);
+            bool opens = !mqttsn && reliable && udp_frame_opens(&frames[1], len);
+            bool fits = !opens || reliable_room > 0;
+            if (codec != NULL && batch[i]->has_range) {
+                if (gw_shaper_consume(cls, stream_encoder_cost(codec, &batch[i]->range))) {
+                    udp_codec_append(udp_client_member, codec, &batch[i]->range);
+                }
+            } else if (fits && gw_shaper_consume(cls, len + (mqttsn ? GW_MQTTSN_HDR_LEN : 1))) {
+                if (mqttsn) {
+                    if (gw_mqttsn_publish(batch[i]->message, len, reliable)) {
+                        published = true;
+                    } else if (reliable) {
+                        held[held_count++] = batch[i];
+                        continue;
+                    }
+                } else {
+                    reliable_room -= opens;
+                    udp_frame_append(udp_client_member, &frames[reliable], reliable, batch[i]->message, len);
+                }
+            } else if (reliable) {
+                held[held_count++] = batch[i];
+                continue;
+            }
+            msg_pool_free(&sample_pool, batch[i]);
+        }
+    }
+    udp_frame_flush(udp_client_member, &frames[0], false);
+    udp_frame_flush(udp_client_member, &frames[1], true);
+    if (codec != NULL) {
+        udp_codec_flush(udp_client_member, codec);
+    }
+
+    // Back to the head of the queue in their original order
+    for (int i = held_count - 1; i >= 0; i--) {
+        if (xQueueSendToFront(sample_queue, &held[i], 0) != pdTRUE) {
+            gw_shaper_count_queue_lost(held[i]->cls);
+            msg_pool_free(&sample_pool, held[i]);
+        }
+    }
+
+    // Only a datagram that left the socket counts, not a batch that was all held, decimated or refused
+    int64_t attach_us = thread_attach_time_us;
+    bool sent = published || udp_client_sent != sent_before;
+    if (sent) {
+        boot_report_mark(BOOT_PHASE_FIRST_SAMPLE_SENT);
+    }
+    if (sent && attach_us != 0 && attach_us != first_packet_attach_us) {
+        first_packet_attach_us = attach_us;
+        ESP_LOGI(OT_EXT_CLI_TAG, "Time to first packet after attach: %lld us",
+                 (long long)(esp_timer_get_time() - attach_us));
+    }
+    return held_count > 0;
+}
+
+static uint32_t sample_queue_depth(void)
+{
+    return uxQueueMessagesWaiting(sample_queue);
+}
+
+// Bind a new socket to the local IP/port for UDP sending source, it replaces the current one only once bound
+
+static esp_err_t udp_client_bind(UDP_CLIENT *udp_client_member, int local_port)
+{
     struct sockaddr_in6 bind_addr = {0};
 
-    sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_IPV6);
-    ESP_GOTO_ON_FALSE((sock >= 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "Unable to create socket: errno %d", errno);
-    ESP_LOGI(OT_EXT_CLI_TAG, "Socket created");
-    udp_client_member->sock = sock;
-    err_flag = 1;
+    int sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_IPV6);
+    ESP_RETURN_ON_FALSE((sock >= 0), ESP_FAIL, OT_EXT_CLI_TAG, "Unable to create socket: errno %d", errno);
 
-    // Restore binding the socket to the local IP/port for UDP sending source
-    if (udp_client_member->local_port != -1) {
-        inet6_aton(udp_client_member->local_ipaddr, &bind_addr.sin6_addr);
-        bind_addr.sin6_family = AF_INET6;
-        bind_addr.sin6_port = htons(udp_client_member->local_port);
+    inet6_aton(udp_client_member->local_ipaddr, &bind_addr.sin6_addr);
+    bind_addr.sin6_family = AF_INET6;
+    bind_addr.sin6_port = htons(local_port);
+    if (bind(sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) != 0) {
+        ESP_LOGE(OT_EXT_CLI_TAG, "Socket unable to bind: errno %d", errno);
+        close(sock);
+        return ESP_FAIL;
+    }
 
-        err = bind(sock, (struct sockaddr *)&bind_addr, sizeof(bind_addr));
-        ESP_GOTO_ON_FALSE((err == 0), ESP_FAIL, exit, OT_EXT_CLI_TAG, "Socket unable to bind: errno %d", errno);
-        ESP_LOGI(OT_EXT_CLI_TAG, "Socket bound, port %d", udp_client_member->local_port);
+    if (udp_client_member->sock >= 0) {
+        shutdown(udp_client_member->sock, 0);
+        close(udp_client_member->sock);
     }
+    udp_client_member->sock = sock;
+    udp_client_member->local_port = local_port;
+    ESP_LOGI(OT_EXT_CLI_TAG, "Socket bound, port %d", local_port);
+    return ESP_OK;
+}
+
+static void udp_socket_client_task(void *pvParameters)
+{
+    UDP_CLIENT *udp_client_member = (UDP_CLIENT *)pvParameters;
+
+    esp_err_t ret = ESP_OK;
+    const GATEWAY_CONFIG *config = gw_config_acquire();
+    int bind_port = config->local_port;    // Last port asked for, a failed rebind is not retried until it changes
+    gw_config_release(config);
+    uint32_t codec_version = 0;            // Settings version the encoder was started with, 0 while off
+
+    ESP_GOTO_ON_ERROR(udp_client_bind(udp_client_member, bind_port), exit, OT_EXT_CLI_TAG, "Socket unusable");
 
     udp_client_member->exist = 1;
     ESP_LOGI(OT_EXT_CLI_TAG, "Successfully created");
 
-    otInstance *instance = esp_openthread_get_instance();
     while (true) {
-        otDeviceRole role = otThreadGetDeviceRole(instance);
-        if (role == OT_DEVICE_ROLE_CHILD || role == OT_DEVICE_ROLE_ROUTER || role == OT_DEVICE_ROLE_LEADER) {
-            ESP_LOGI(OT_EXT_CLI_TAG, "Device joined Thread network with role: %d", role);
-            break;
+        SAMPLE_MSG *sample = NULL;
+
+        // Block until the state-changed callback reports an attached role
+        xEventGroupWaitBits(thread_link_event_group, THREAD_ATTACHED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+
+        // A new source port moves the client to a new socket between two batches
+        config = gw_config_acquire();
+        int local_port = config->local_port;
+        uint32_t send_period_ms = config->send_period_ms;
+        bool mqttsn = config->backend == GATEWAY_BACKEND_MQTTSN;
+        // Any change of the settings restarts the stream with keyframes, a random frame seq reads as a gap
+        // The MQTT-SN backend publishes text lines, subscribers have no codec state
+        if (!config->stream_codec || mqttsn) {
+            codec_version = 0;
+        } else if (codec_version != config->version) {
+            STREAM_CODEC_CONFIG codec_config = STREAM_CODEC_CONFIG_DEFAULT();
+            codec_config.resync_ms = config->codec_resync_ms;
+            stream_encoder_init(&stream_encoder, &codec_config, (uint16_t)esp_random());
+            codec_version = config->version;
+        }
+        gw_config_release(config);
+        if (local_port != bind_port) {
+            bind_port = local_port;
+            udp_client_bind(udp_client_member, local_port);
+        }
+
+        // Collect the ACKs of the reliable stream, retransmit what timed out in a TX window of its own
+        uint32_t poll_ms = udp_reliable_poll(udp_client_member->sock);
+        if (poll_ms == 0) {
+            radio_coex_tx_window_begin();
+            udp_reliable_retransmit(udp_client_tx, udp_client_member);
+            radio_coex_tx_window_end();
+            continue;
+        }
+        if (xQueueReceive(sample_queue, &sample, pdMS_TO_TICKS(MIN(poll_ms, 1000)) + 1) != pdTRUE) {
+            continue;
         }
-    ESP_LOGI(OT_EXT_CLI_TAG, "Waiting for Thread join...");
-    vTaskDelay(pdMS_TO_TICKS(500));  // Check every 500ms
-}
 
+        // Let a batch build up until the coexistence policy asks for a TX window or the send period is up
+        // ACKs keep being read meanwhile, so RTT samples stay within UDP_RELIABLE_ACK_POLL_MS of their arrival
+        while (true) {
+            uint32_t age_ms = (esp_timer_get_time() - sample->queued_us) / 1000;
+            uint32_t wait_ms = radio_coex_tx_wait_ms(uxQueueMessagesWaiting(sample_queue) + 1, age_ms);
+            if (wait_ms == 0 || age_ms >= send_period_ms) {
+                break;
+            }
+            if (udp_reliable_poll(udp_client_member->sock) == 0) {
+                radio_coex_tx_window_begin();
+                udp_reliable_retransmit(udp_client_tx, udp_client_member);
+                radio_coex_tx_window_end();
+            }
+            vTaskDelay(pdMS_TO_TICKS(MIN(MIN(wait_ms, send_period_ms - age_ms), UDP_RELIABLE_ACK_POLL_MS)) + 1);
+        }
 
-    while (true) {
-        // No event wait: just continuously send UDP packets (or you can add delay here)
-        udp_client_send(udp_client_member);
-        vTaskDelay(pdMS_TO_TICKS(1000));  // for example, send every 1 second
+        // Detached while waiting for a sample: keep it at the head of the queue for the next attach
+        if ((xEventGroupGetBits(thread_link_event_group) & THREAD_ATTACHED_BIT) == 0) {
+            if (xQueueSendToFront(sample_queue, &sample, 0) != pdTRUE) {
+                gw_shaper_count_queue_lost(sample->cls);
+                msg_pool_free(&sample_pool, sample);
+            }
+            continue;
+        }
+
+        // Send the whole batch in one exclusive TX window, BLE scanning resumes right after
+        radio_coex_tx_window_begin();
+        bool events_held = udp_client_send_batch(udp_client_member, codec_version ? &stream_encoder : NULL, mqttsn,
+                                                 sample);
+        radio_coex_tx_window_end();
+        // Held events wait for tokens or for ACKs to free the reliable window, which keep being read
+        for (uint32_t ms = 0; events_held && ms < GW_SHAPER_HOLD_RETRY_MS; ms += UDP_RELIABLE_ACK_POLL_MS) {
+            udp_reliable_poll(udp_client_member->sock);
+            vTaskDelay(pdMS_TO_TICKS(UDP_RELIABLE_ACK_POLL_MS));
+        }
     }
 
 exit:
     if (ret != ESP_OK) {
-        if (err_flag) {
-            udp_client_member->sock = -1;
-            shutdown(sock, 0);
-            close(sock);
-        }
         udp_client_member->local_port = -1;
         ESP_LOGI(OT_EXT_CLI_TAG, "Fail to create a UDP client");
     }
+    mem_budget_unregister_task(xTaskGetCurrentTaskHandle());
     vTaskDelete(NULL);
 }
 
-// BLE GAP callback function to process scan results
+// Make room in a full queue: take out the oldest reading that is not an event
+// Held events sit at the head of the queue, so evicting the head would lose them first
 
-static void gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+static SAMPLE_MSG *sample_queue_evict(void)
 {
-    if (event == ESP_GAP_BLE_SCAN_RESULT_EVT) {
-        esp_ble_gap_cb_param_t *scan_result = param;
-        if (scan_result->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT) {
-            uint8_t *adv_data = scan_result->scan_rst.ble_adv;
-            uint8_t adv_len = scan_result->scan_rst.adv_data_len;
-
-            for (int i = 0; i < adv_len;) {
-                uint8_t field_len = adv_data[i];
-                if (field_len == 0) break;
-                uint8_t field_type = adv_data[i + 1];
-
-                // Manufacturer Specific Data
-                if (field_type == ESP_BLE_AD_TYPE_MANUFACTURER_SPECIFIC_TYPE && field_len > 2) {
-                    uint16_t mfg_id = adv_data[i + 2] | (adv_data[i + 3] << 8);
-                    if (mfg_id == MANUFACTURER_ID) {
-                        // Extract string from remaining data
-                        char distance_str[64] = {0};
-                        memcpy(distance_str, &adv_data[i + 4], field_len - 3);
-                        distance_str[field_len - 3] = '\0';  // Ensure null-termination
-
-                        ESP_LOGI(BLE_TAG, "Received distance: %s", distance_str);
-
-                        // Update UDP message buffer
-                        strncpy(udp_client.messagesend.message, distance_str, sizeof(udp_client.messagesend.message) - 1);
-                        udp_client.messagesend.message[sizeof(udp_client.messagesend.message) - 1] = '\0';
-                    }
+    SAMPLE_MSG *events[SAMPLE_QUEUE_LEN];
+    SAMPLE_MSG *victim = NULL;
+    int event_count = 0;
+
+    while (victim == NULL && event_count < SAMPLE_QUEUE_LEN && xQueueReceive(sample_queue, &victim, 0) == pdTRUE) {
+        if (victim->cls == SHAPER_CLASS_EVENT) {
+            events[event_count++] = victim;
+            victim = NULL;
+        }
+    }
+    // Back to the head of the queue in their original order
+    for (int i = event_count - 1; i >= 0; i--) {
+        if (xQueueSendToFront(sample_queue, &events[i], 0) != pdTRUE) {
+            gw_shaper_count_queue_lost(SHAPER_CLASS_EVENT);
+            msg_pool_free(&sample_pool, events[i]);
+        }
+    }
+    if (victim != NULL) {
+        gw_shaper_count_queue_lost(victim->cls);
+    }
+    return victim;
+}
+
+// Queue a reading for the UDP sender, dropping the oldest reading that is not an event when full
+// With only events queued the new reading is dropped, "shaper status" counts every reading lost this way
+
+static void sample_queue_push(const char *message, shaper_class_t cls, const STREAM_SAMPLE *range)
+{
+    SAMPLE_MSG *sample = msg_pool_alloc(&sample_pool);
+    if (sample == NULL && (sample = sample_queue_evict()) == NULL) {
+        gw_shaper_count_queue_lost(cls);
+        return;
+    }
+    strncpy(sample->message, message, sizeof(sample->message) - 1);
+    sample->message[sizeof(sample->message) - 1] = '\0';
+    sample->queued_us = esp_timer_get_time();
+    sample->cls = cls;
+    sample->has_range = range != NULL;
+    if (range != NULL) {
+        sample->range = *range;
+    }
+    if (xQueueSend(sample_queue, &sample, 0) != pdTRUE) {
+        gw_shaper_count_queue_lost(cls);
+        msg_pool_free(&sample_pool, sample);
+    }
+}
+
+// Zone event: forwarded as "zone,<tag address>,<enter|exit|dwell>,<zone id>,<time inside ms>"
+
+static void geofence_event_handler(const GEOFENCE_EVENT *event, void *ctx)
+{
+    static const char *const event_names[] = {"enter", "exit", "dwell"};
+    char event_str[64] = {0};
+
+    snprintf(event_str, sizeof(event_str), UWB_LINE_ZONE_FMT, UWB_LINE_BDA_ARGS(event->addr),
+             event_names[event->type], event->zone_id, event->inside_ms);
+    ESP_LOGI(BLE_TAG, "Zone event: %s", event_str);
+    sample_queue_push(event_str, SHAPER_CLASS_EVENT, NULL);
+}
+
+// Window summary: forwarded as "agg,<tag address>,<window ms>,<count>,<min>,<max>,<mean>,<variance>,<last>"
+
+static void tag_agg_result_handler(const TAG_AGG_RESULT *result, void *ctx)
+{
+    char agg_str[64] = {0};
+
+    snprintf(agg_str, sizeof(agg_str), UWB_LINE_AGG_FMT, UWB_LINE_BDA_ARGS(result->addr), result->window_ms,
+             result->count, result->min, result->max, result->mean, result->variance, result->last);
+    ESP_LOGD(BLE_TAG, "Window summary: %s", agg_str);
+    sample_queue_push(agg_str, SHAPER_CLASS_STATS, NULL);
+}
+
+// TDoA anchor report: forwarded as "tdoa,<anchor address>,<tag id>,<tag seq>,<sync seq>,<blink rx ts>,<sync rx ts>"
+
+static void tdoa_report_handler(const BLE_ADV_EVENT *event, const UWB_MSG_TDOA_REPORT *report)
+{
+    // An anchor reports many tags, so the duplicate window is keyed on anchor and tag together
+    esp_bd_addr_t key = {event->bda[2], event->bda[3], event->bda[4], event->bda[5], (uint8_t)report->tag_id,
+                         (uint8_t)(report->tag_id >> 8)};
+    if (!ble_scan_filter_accept(key, report->seq)) {
+        return;
+    }
+    // Decimating on the tag sequence number keeps complete blinks: every anchor drops the same ones
+    if (!gw_shaper_keep_sample(report->seq)) {
+        return;
+    }
+
+    char report_str[64] = {0};
+    snprintf(report_str, sizeof(report_str), UWB_LINE_TDOA_FMT, UWB_LINE_BDA_ARGS(event->bda), report->tag_id,
+             report->seq, report->sync_seq, (unsigned long long)report->rx_ts, (unsigned long long)report->sync_ts);
+    ESP_LOGD(BLE_TAG, "Received TDoA report: %s", report_str);
+    sample_queue_push(report_str, SHAPER_CLASS_SAMPLE, NULL);
+}
+
+// Tag advertisement handler: runs on the BLE adv worker task, not in the Bluetooth stack
+
+static void tag_adv_handler(const BLE_ADV_EVENT *event)
+{
+    const uint8_t *adv_data = event->data;
+    uint8_t adv_len = event->len;
+    const GATEWAY_CONFIG *config = gw_config_acquire();
+    uint16_t manufacturer_id = config->manufacturer_id;
+    gw_config_release(config);
+
+    for (int i = 0; i < adv_len;) {
+        uint8_t field_len = adv_data[i];
+        if (field_len == 0 || i + field_len >= adv_len) break;
+        uint8_t field_type = adv_data[i + 1];
+
+        // Manufacturer Specific Data
+        if (field_type == ESP_BLE_AD_TYPE_MANUFACTURER_SPECIFIC_TYPE && field_len > 2) {
+            uint16_t mfg_id = adv_data[i + 2] | (adv_data[i + 3] << 8);
+            if (mfg_id == manufacturer_id && field_len - 3 >= UWB_MSG_RANGE_LEN) {
+                const uint8_t *payload = &adv_data[i + 4];
+                size_t payload_len = field_len - 3;
+                boot_report_mark(BOOT_PHASE_FIRST_ADV);
+
+                UWB_MSG_TDOA_REPORT report;
+                if (uwb_msg_tdoa_report_decode(payload, payload_len, &report)) {
+                    tdoa_report_handler(event, &report);
+                    break;
                 }
-                i += field_len + 1;
+
+                UWB_MSG_RANGE range;
+                if (!uwb_msg_range_decode(payload, payload_len, &range)) {
+                    break;
+                }
+                uint16_t dist_cm = range.dist_cm;
+                uint8_t seq = range.seq;
+
+                // The tag keeps re-advertising its last range, only forward a sequence number once
+                if (!ble_scan_filter_accept(event->bda, seq)) {
+                    break;
+                }
+                // Only the gateway owning the tag forwards it, the others stay quiet until the owner loses it
+                // Every gateway still runs the zones, so a new owner takes over with the tag's current zones
+                bool owner = gw_owner_should_forward(event->bda, event->rssi);
+                bool raw = gw_geofence_process(event->bda, dist_cm, owner);
+                // With aggregation on, ranges only leave the gateway as window summaries
+                if (!owner || gw_agg_add(event->bda, dist_cm) || !raw) {
+                    break;
+                }
+                // Over the sample budget the raw stream is decimated, the fallback aggregation still sees every range
+                if (!gw_shaper_keep_sample(seq)) {
+                    break;
+                }
+
+                // Forward as "<tag address>,<seq>,<distance cm>,<rssi>", the bridge keeps the strongest gateway's copy
+                char distance_str[64] = {0};
+                snprintf(distance_str, sizeof(distance_str), UWB_LINE_RANGE_FMT, UWB_LINE_BDA_ARGS(event->bda), seq,
+                         dist_cm, event->rssi);
+                ESP_LOGD(BLE_TAG, "Received distance: %s", distance_str);
+                STREAM_SAMPLE range_sample = {
+                    .seq = seq,
+                    .rssi = event->rssi,
+                    .dist_cm = dist_cm,
+                    .time_ms = (uint32_t)(event->rx_time_us / 1000),
+                };
+                memcpy(range_sample.addr, event->bda, sizeof(range_sample.addr));
+                sample_queue_push(distance_str, SHAPER_CLASS_SAMPLE, &range_sample);
             }
         }
+        i += field_len + 1;
+    }
+}
+
+// BLE GAP callback: runs in the Bluetooth stack task, so it only filters and enqueues
+
+static void gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+    if (event == ESP_GAP_BLE_SCAN_RESULT_EVT && param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT) {
+        gw_trace_ble_adv(&param->scan_rst);
+        ble_adv_submit(&param->scan_rst);
     }
 }
 
@@ -300,6 +776,7 @@ static void ble_scanner_task(void *arg)
     // Enable the controller in BLE-only mode
     ret = esp_bt_controller_enable(ESP_BT_MODE_BLE);
     ESP_ERROR_CHECK(ret);        // Halt if enabling fails
+    boot_report_mark(BOOT_PHASE_BLE_CONTROLLER_READY);
 
     // Initialise the Bluedroid Bluetooth stack (required by ESP BLE APIs)
     ret = esp_bluedroid_init();
@@ -308,6 +785,11 @@ static void ble_scanner_task(void *arg)
     // Enable the Bluedroid stack
     ret = esp_bluedroid_enable();
     ESP_ERROR_CHECK(ret);
+    boot_report_mark(BOOT_PHASE_BLUEDROID_READY);
+
+    // Start the worker that parses advertisements outside of the Bluetooth stack task
+    ret = ble_adv_worker_start(tag_adv_handler);
+    ESP_ERROR_CHECK(ret);
 
     // Register the BLE GAP event handler (our custom callback function)
     ret = esp_ble_gap_register_callback(gap_cb);
@@ -322,14 +804,17 @@ static void ble_scanner_task(void *arg)
         .scan_window = 0x30,
         .scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE
     };
-    // Set the configured scan parameters
-    ret = esp_ble_gap_set_scan_params(&scan_params);
+    // Set the configured scan parameters (plus the tag filter mode) and start scanning indefinitely
+    ret = ble_scan_filter_start(&scan_params);
     ESP_ERROR_CHECK(ret);
 
-    // Start BLE scanning indefinitely (duration = 0)
-    esp_ble_gap_start_scanning(0); // Continuous scanning
+    // Adapt the scan window to the tag adv rate and the Thread TX backlog from now on
+    ret = radio_coex_start(sample_queue_depth);
+    ESP_ERROR_CHECK(ret);
+    boot_report_mark(BOOT_PHASE_SCAN_STARTED);
 
     // Delete this task since scanning is now handled by the registered callback
+    mem_budget_unregister_task(xTaskGetCurrentTaskHandle());
     vTaskDelete(NULL); // Let GAP callback do the work
 }
 
@@ -343,11 +828,37 @@ void app_main(void)
         .max_fds = 3,
     };
 
+    boot_report_mark(BOOT_PHASE_APP_MAIN);
+
+    // The sample queue must exist before the scanner starts, readings are buffered there until Thread attaches
+    thread_link_event_group = xEventGroupCreate();
+    sample_queue = xQueueCreate(SAMPLE_QUEUE_LEN, sizeof(SAMPLE_MSG *));
+    assert(thread_link_event_group != NULL && sample_queue != NULL);
+    msg_pool_init(sample_pool, "sample");
+    ESP_ERROR_CHECK(udp_reliable_init());
+    ESP_ERROR_CHECK(gw_shaper_start());
+
     ESP_ERROR_CHECK(nvs_flash_init());
+    boot_report_mark(BOOT_PHASE_NVS_READY);
+    // Runtime settings are read by the scanner and the sender, so they are loaded before either starts
+    ESP_ERROR_CHECK(gw_config_start());
+
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_vfs_eventfd_register(&eventfd_config));
-    xTaskCreate(ot_task_worker, "ot_cli_main", 10240, xTaskGetCurrentTaskHandle(), 5, NULL);
-    xTaskCreate(udp_socket_client_task, "udp_client", 4096, &udp_client, 3, NULL);
-    xTaskCreate(ble_scanner_task, "ble_scanner", 4096, NULL, 4, NULL);
+    boot_report_mark(BOOT_PHASE_NETIF_READY);
+
+    // Thread attach is the longest path, so OpenThread starts first and the scanner, one priority lower, brings BLE
+    // up while OpenThread waits on the radio and attaches (boot_sim.py); readings wait in the sample queue till then
+    // The scanner task exits once scanning runs, so its stack stays on the heap and is given back
+    ESP_ERROR_CHECK(GATEWAY_TASK_CREATE(ot_task, ot_task_worker, "ot_cli_main", xTaskGetCurrentTaskHandle(), 5, NULL));
+    ESP_ERROR_CHECK(gateway_task_create(ble_scanner_task, "ble_scanner", BLE_TASK_STACK_SIZE, NULL, 4, NULL, NULL,
+                                        NULL));
+    ESP_ERROR_CHECK(GATEWAY_TASK_CREATE(udp_task, udp_socket_client_task, "udp_client", &udp_client, 3, NULL));
+    ESP_ERROR_CHECK(gw_owner_start(thread_link_event_group, THREAD_ATTACHED_BIT));
+    ESP_ERROR_CHECK(gw_mqttsn_start(thread_link_event_group, THREAD_ATTACHED_BIT));
+    ESP_ERROR_CHECK(gw_geofence_start(geofence_event_handler));
+    ESP_ERROR_CHECK(gw_agg_start(tag_agg_result_handler));
+    ESP_ERROR_CHECK(gw_trace_start());
+    ESP_ERROR_CHECK(mem_budget_monitor_start(STACK_MONITOR_PERIOD_MS));
 }
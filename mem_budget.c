@@ -0,0 +1,250 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "mem_budget.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "openthread/cli.h"
+
+#define MEM_TAG "mem_budget"
+
+typedef struct budget_task {
+    TaskHandle_t handle;
+    const char *name;
+    uint32_t stack_size;
+    uint32_t min_headroom;    // Lowest high-water mark seen by the monitor, in bytes
+    bool is_static;
+} BUDGET_TASK;
+
+static BUDGET_TASK budget_tasks[MEM_BUDGET_MAX_TASKS];
+static MSG_POOL *budget_pools[MEM_BUDGET_MAX_POOLS];
+static portMUX_TYPE budget_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t budget_untracked;    // Tasks that found the table full
+static esp_timer_handle_t budget_monitor_timer;
+
+esp_err_t gateway_task_create(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg, UBaseType_t prio,
+                              StackType_t *stack, StaticTask_t *tcb, TaskHandle_t *handle)
+{
+    TaskHandle_t task = NULL;
+
+    // With the scheduler suspended a higher priority task cannot run, or exit and unregister, before its entry exists
+    vTaskSuspendAll();
+    if (stack != NULL && tcb != NULL) {
+        task = xTaskCreateStatic(fn, name, stack_size, arg, prio, stack, tcb);
+    } else if (xTaskCreate(fn, name, stack_size, arg, prio, &task) != pdPASS) {
+        task = NULL;
+    }
+    if (task != NULL) {
+        mem_budget_register_task(task, name, stack_size, stack != NULL);
+    }
+    xTaskResumeAll();
+    ESP_RETURN_ON_FALSE(task != NULL, ESP_FAIL, MEM_TAG, "Fail to create task %s", name);
+
+    if (handle != NULL) {
+        *handle = task;
+    }
+    return ESP_OK;
+}
+
+void mem_budget_register_task(TaskHandle_t handle, const char *name, uint32_t stack_size, bool is_static)
+{
+    bool registered = false;
+
+    portENTER_CRITICAL(&budget_lock);
+    for (int i = 0; i < MEM_BUDGET_MAX_TASKS; i++) {
+        if (budget_tasks[i].handle == NULL) {
+            budget_tasks[i] = (BUDGET_TASK) {
+                .handle = handle,
+                .name = name,
+                .stack_size = stack_size,
+                .min_headroom = stack_size,
+                .is_static = is_static,
+            };
+            registered = true;
+            break;
+        }
+    }
+    if (!registered) {
+        budget_untracked++;
+    }
+    portEXIT_CRITICAL(&budget_lock);
+    if (!registered) {
+        ESP_EARLY_LOGW(MEM_TAG, "Task table full (%d), %s is not monitored", MEM_BUDGET_MAX_TASKS, name);
+    }
+}
+
+void mem_budget_unregister_task(TaskHandle_t handle)
+{
+    portENTER_CRITICAL(&budget_lock);
+    for (int i = 0; i < MEM_BUDGET_MAX_TASKS; i++) {
+        if (budget_tasks[i].handle == handle) {
+            budget_tasks[i].handle = NULL;
+        }
+    }
+    portEXIT_CRITICAL(&budget_lock);
+}
+
+void msg_pool_init_impl(MSG_POOL *pool, const char *name, void *storage, size_t block_size, size_t block_count)
+{
+    assert(block_size >= sizeof(void *));
+
+    pool->name = name;
+    pool->storage = storage;
+    pool->block_size = block_size;
+    pool->block_count = block_count;
+    pool->free_list = NULL;
+    pool->in_use = 0;
+    pool->peak = 0;
+    pool->alloc_fail = 0;
+    portMUX_INITIALIZE(&pool->lock);
+
+    // Thread the free list through the blocks; memcpy keeps this safe for unaligned block types
+    for (size_t i = block_count; i > 0; i--) {
+        void *block = pool->storage + (i - 1) * block_size;
+        memcpy(block, &pool->free_list, sizeof(void *));
+        pool->free_list = block;
+    }
+
+    portENTER_CRITICAL(&budget_lock);
+    for (int i = 0; i < MEM_BUDGET_MAX_POOLS; i++) {
+        if (budget_pools[i] == NULL || budget_pools[i] == pool) {
+            budget_pools[i] = pool;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&budget_lock);
+}
+
+void *msg_pool_alloc(MSG_POOL *pool)
+{
+    void *block;
+
+    portENTER_CRITICAL_SAFE(&pool->lock);
+    block = pool->free_list;
+    if (block != NULL) {
+        memcpy(&pool->free_list, block, sizeof(void *));
+        pool->in_use++;
+        if (pool->in_use > pool->peak) {
+            pool->peak = pool->in_use;
+        }
+    } else {
+        pool->alloc_fail++;
+    }
+    portEXIT_CRITICAL_SAFE(&pool->lock);
+    return block;
+}
+
+void msg_pool_free(MSG_POOL *pool, void *block)
+{
+    if (block == NULL) {
+        return;
+    }
+    portENTER_CRITICAL_SAFE(&pool->lock);
+    memcpy(block, &pool->free_list, sizeof(void *));
+    pool->free_list = block;
+    pool->in_use--;
+    portEXIT_CRITICAL_SAFE(&pool->lock);
+}
+
+static void mem_budget_monitor_cb(void *arg)
+{
+    for (int i = 0; i < MEM_BUDGET_MAX_TASKS; i++) {
+        // As in gateway_task_create(): with the scheduler suspended a registered task cannot unregister and delete
+        // itself, nor the idle task free its TCB, between reading the entry and reading the high-water mark
+        vTaskSuspendAll();
+        portENTER_CRITICAL(&budget_lock);
+        BUDGET_TASK task = budget_tasks[i];
+        portEXIT_CRITICAL(&budget_lock);
+        // On ESP-IDF the high-water mark is reported in bytes
+        uint32_t headroom = task.handle != NULL ? uxTaskGetStackHighWaterMark(task.handle) : 0;
+        xTaskResumeAll();
+        if (task.handle == NULL) {
+            continue;
+        }
+
+        if (headroom < task.min_headroom) {
+            portENTER_CRITICAL(&budget_lock);
+            if (budget_tasks[i].handle == task.handle) {
+                budget_tasks[i].min_headroom = headroom;
+            }
+            portEXIT_CRITICAL(&budget_lock);
+            if (headroom < MEM_BUDGET_STACK_WARN_BYTES) {
+                ESP_LOGW(MEM_TAG, "Task %s stack headroom down to %" PRIu32 " of %" PRIu32 " bytes", task.name,
+                         headroom, task.stack_size);
+            }
+        }
+    }
+}
+
+esp_err_t mem_budget_monitor_start(uint32_t period_ms)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = mem_budget_monitor_cb,
+        .name = "mem_budget",
+    };
+
+    ESP_RETURN_ON_ERROR(esp_timer_create(&timer_args, &budget_monitor_timer), MEM_TAG, "Fail to create monitor");
+    return esp_timer_start_periodic(budget_monitor_timer, (uint64_t)period_ms * 1000);
+}
+
+otError esp_ot_process_mem_budget(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    uint32_t stack_total = 0;
+    uint32_t stack_static = 0;
+    uint32_t stack_spare = 0;
+    uint32_t pool_total = 0;
+
+    // Refresh the high-water marks so the report is current even between monitor runs
+    mem_budget_monitor_cb(NULL);
+
+    otCliOutputFormat("task                  stack  min-free   used%%  alloc\n");
+    for (int i = 0; i < MEM_BUDGET_MAX_TASKS; i++) {
+        portENTER_CRITICAL(&budget_lock);
+        BUDGET_TASK task = budget_tasks[i];
+        portEXIT_CRITICAL(&budget_lock);
+        if (task.handle == NULL) {
+            continue;
+        }
+        uint32_t used = task.stack_size - task.min_headroom;
+        otCliOutputFormat("%-20s %6" PRIu32 "  %8" PRIu32 "  %5" PRIu32 "%%  %s\n", task.name, task.stack_size,
+                          task.min_headroom, used * 100 / task.stack_size, task.is_static ? "static" : "heap");
+        stack_total += task.stack_size;
+        stack_static += task.is_static ? task.stack_size : 0;
+        if (task.min_headroom > MEM_BUDGET_STACK_WARN_BYTES) {
+            stack_spare += task.min_headroom - MEM_BUDGET_STACK_WARN_BYTES;
+        }
+    }
+
+    otCliOutputFormat("pool                  block  count  in-use  peak  fail\n");
+    for (int i = 0; i < MEM_BUDGET_MAX_POOLS; i++) {
+        MSG_POOL *pool = budget_pools[i];
+        if (pool == NULL) {
+            continue;
+        }
+        otCliOutputFormat("%-20s %6u %6u  %6u %5u %5" PRIu32 "\n", pool->name, (unsigned)pool->block_size,
+                          (unsigned)pool->block_count, (unsigned)pool->in_use, (unsigned)pool->peak,
+                          pool->alloc_fail);
+        pool_total += pool->block_size * pool->block_count;
+    }
+
+    otCliOutputFormat("stacks: %" PRIu32 " bytes (%" PRIu32 " static), reclaimable above %d byte margin: %" PRIu32 "\n",
+                      stack_total, stack_static, MEM_BUDGET_STACK_WARN_BYTES, stack_spare);
+    if (budget_untracked > 0) {
+        otCliOutputFormat("untracked tasks: %" PRIu32 " (raise MEM_BUDGET_MAX_TASKS)\n", budget_untracked);
+    }
+    otCliOutputFormat("pools: %" PRIu32 " bytes\n", pool_total);
+    otCliOutputFormat("heap: free %u, min free %u, largest block %u\n", (unsigned)esp_get_free_heap_size(),
+                      (unsigned)esp_get_minimum_free_heap_size(),
+                      (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    return OT_ERROR_NONE;
+}
@@ -0,0 +1,152 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Build the gateway tasks with xTaskCreateStatic and fixed buffers instead of heap allocation
+#ifndef GATEWAY_STATIC_ALLOCATION
+#define GATEWAY_STATIC_ALLOCATION 1
+#endif
+
+#define MEM_BUDGET_GATEWAY_TASKS 8    // ble_scanner, ble_adv_worker, radio_coex, ot_cli_main, udp_client, gw_owner,
+                                      // gw_mqttsn, gw_trace
+#define MEM_BUDGET_CLI_TASKS 4        // udpsockserver/udpsockclient and their receive tasks (esp_ot_udp_socket.c)
+#define MEM_BUDGET_MAX_TASKS (MEM_BUDGET_GATEWAY_TASKS + MEM_BUDGET_CLI_TASKS)
+#define MEM_BUDGET_MAX_POOLS 4
+#define MEM_BUDGET_STACK_WARN_BYTES 512    // Warn when a task has less stack headroom than this
+
+/**
+ * @brief Declare the stack and TCB of a statically allocated task.
+ *
+ */
+#if GATEWAY_STATIC_ALLOCATION
+#define GATEWAY_TASK_DEFINE(task, stack_size)                                                                       \
+    static StackType_t task##_stack[stack_size];                                                                    \
+    static StaticTask_t task##_tcb
+#define GATEWAY_TASK_CREATE(task, fn, name, arg, prio, handle)                                                      \
+    gateway_task_create(fn, name, sizeof(task##_stack), arg, prio, task##_stack, &task##_tcb, handle)
+#else
+#define GATEWAY_TASK_DEFINE(task, stack_size) static const uint32_t task##_stack_size = (stack_size)
+#define GATEWAY_TASK_CREATE(task, fn, name, arg, prio, handle)                                                      \
+    gateway_task_create(fn, name, task##_stack_size, arg, prio, NULL, NULL, handle)
+#endif
+
+/**
+ * @brief Fixed-size block pool backed by a static array.
+ *
+ */
+typedef struct msg_pool {
+    const char *name;
+    uint8_t *storage;
+    size_t block_size;
+    size_t block_count;
+    void *free_list;
+    size_t in_use;
+    size_t peak;
+    uint32_t alloc_fail;
+    portMUX_TYPE lock;
+} MSG_POOL;
+
+/**
+ * @brief Declare the backing storage of a message pool.
+ *
+ */
+#define MSG_POOL_DEFINE(pool, type, count)                                                                          \
+    static type pool##_storage[count];                                                                              \
+    static MSG_POOL pool
+
+/**
+ * @brief Create a task and register it with the stack monitor before it gets to run.
+ *
+ * @param[in] fn            Task function.
+ * @param[in] name          Task name.
+ * @param[in] stack_size    Stack size in bytes.
+ * @param[in] arg           Task argument.
+ * @param[in] prio          Task priority.
+ * @param[in] stack         Static stack buffer, NULL to allocate from the heap.
+ * @param[in] tcb           Static TCB, NULL to allocate from the heap.
+ * @param[out] handle       Created task handle (optional).
+ *
+ * @return
+ *      - ESP_OK on success.
+ *      - ESP_FAIL on failure in creating the task.
+ */
+esp_err_t gateway_task_create(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg, UBaseType_t prio,
+                              StackType_t *stack, StaticTask_t *tcb, TaskHandle_t *handle);
+
+/**
+ * @brief Register a task created elsewhere with the stack monitor. A full table is logged and counted.
+ *
+ * @param[in] handle        Task handle.
+ * @param[in] name          Task name.
+ * @param[in] stack_size    Stack size in bytes.
+ * @param[in] is_static     Whether the stack is statically allocated.
+ *
+ */
+void mem_budget_register_task(TaskHandle_t handle, const char *name, uint32_t stack_size, bool is_static);
+
+/**
+ * @brief Remove a task from the stack monitor, call before the task deletes itself.
+ *
+ * @param[in] handle    Task handle.
+ *
+ */
+void mem_budget_unregister_task(TaskHandle_t handle);
+
+/**
+ * @brief Initialise a message pool over its static storage.
+ *
+ */
+#define msg_pool_init(pool, name) msg_pool_init_impl(&pool, name, pool##_storage, sizeof(pool##_storage[0]),          \
+                                                     sizeof(pool##_storage) / sizeof(pool##_storage[0]))
+
+void msg_pool_init_impl(MSG_POOL *pool, const char *name, void *storage, size_t block_size, size_t block_count);
+
+/**
+ * @brief Take a block from the pool. Safe to call from any task.
+ *
+ * @return
+ *      - Pointer to a block, NULL if the pool is exhausted.
+ */
+void *msg_pool_alloc(MSG_POOL *pool);
+
+/**
+ * @brief Return a block to the pool.
+ *
+ */
+void msg_pool_free(MSG_POOL *pool, void *block);
+
+/**
+ * @brief Start the periodic stack high-water-mark monitor.
+ *
+ * @param[in] period_ms     Check period.
+ *
+ * @return
+ *      - ESP_OK on success.
+ */
+esp_err_t mem_budget_monitor_start(uint32_t period_ms);
+
+/**
+ * @brief User command "membudget" process.
+ *
+ */
+otError esp_ot_process_mem_budget(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
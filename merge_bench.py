@@ -0,0 +1,128 @@
+import argparse
+import heapq
+import json
+import random
+import sys
+import time
+
+from bridge_merge import POLICY_BEST_RSSI, POLICY_FIRST_ARRIVAL, MergeStage
+
+# Load test of the bridge's cross-gateway merge (bridge_merge.py) on its own, without sockets, in simulated time.
+# Tags spread over overlapping gateway coverage: each sample is heard by one to --overlap gateways, each copy
+# with its own RSSI and mesh delay, and a --late share of copies comes in after the merge window (but within
+# the remembered time). Arrivals are generated one second at a time, and the stage is flushed as often as
+# mqttconnection.py does under load; only the add() and flush() calls are timed. Checks, per policy:
+#  - every sample heard is published exactly once, late copies included
+#  - with the best-RSSI policy, the copy published is the strongest one that arrived before the release
+#  - the peak held and remembered key counts stay within what the offered rate, the merge window and the
+#    remembered time allow, below max_pending and max_seen, so no key is ever forced out
+#  - the stage keeps up with --rate samples/s with the measured cost per copy
+
+MESH_DELAY_S = 0.01
+SPREAD_S = 0.03             # Extra delay between the gateways hearing the same sample
+LATE_S = (0.1, 1.0)         # Delay range of late copies, past the merge window
+FLUSH_EVERY_S = 0.01        # mqttconnection.py flushes after every datagram, at least this often under load
+WINDOW_S = 0.05             # MERGE_WINDOW_S
+SEEN_S = 5.0                # MergeStage default
+BOUND_MARGIN = 1.2
+
+
+def arrivals(cfg, rng):
+    """Batches of (arrival, tag, seq, index, rssi) in arrival order, one second of production at a time."""
+    per_tag = cfg["rate"] / cfg["tags"]
+    phases = [rng.random() / per_tag for _ in range(cfg["tags"])]
+    pending = []
+    for second in range(int(cfg["duration"])):
+        for k in range(cfg["tags"]):
+            j = int(max(0.0, second - phases[k]) * per_tag)
+            while phases[k] + j / per_tag < second:
+                j += 1
+            while (t := phases[k] + j / per_tag) < second + 1:
+                for _ in range(rng.randint(1, cfg["overlap"])):
+                    delay = MESH_DELAY_S + rng.uniform(0, SPREAD_S)
+                    if rng.random() < cfg["late"]:
+                        delay += rng.uniform(*LATE_S)
+                    heapq.heappush(pending, (t + delay, k, j % 256, j, rng.randint(-100, -40)))
+                j += 1
+        batch = []
+        while pending and pending[0][0] <= second + 1:
+            batch.append(heapq.heappop(pending))
+        yield batch
+    yield sorted(pending)
+
+
+def run_case(cfg, policy):
+    rng = random.Random(cfg["seed"])
+    stage = MergeStage(window_s=WINDOW_S, policy=policy, seen_s=SEEN_S)
+    copies = {}                 # (tag, index) -> [(arrival, rssi)]
+    published = {}              # (tag, index) -> (release, rssi)
+    peak_pending = peak_seen = 0
+    count, busy_ns, next_flush = 0, 0, 0.0
+
+    def emit(items, now):
+        for item in items:
+            k, index, rssi = (int(v) for v in item.split(":"))
+            published.setdefault((k, index), []).append((now, rssi))
+
+    for batch in arrivals(cfg, rng):
+        out = []
+        start = time.perf_counter_ns()
+        for now, k, seq, index, rssi in batch:
+            if now >= next_flush:
+                out.append((stage.flush(now), now))
+                next_flush = now + FLUSH_EVERY_S
+                peak_pending = max(peak_pending, len(stage.pending))
+                peak_seen = max(peak_seen, len(stage.seen))
+            out.append((stage.add((k, seq), rssi, f"{k}:{index}:{rssi}", now), now))
+        busy_ns += time.perf_counter_ns() - start
+        for items, now in out:
+            emit(items, now)
+        for now, k, seq, index, rssi in batch:
+            copies.setdefault((k, index), []).append((now, rssi))
+        count += len(batch)
+    end = cfg["duration"] + 60
+    emit(stage.flush(end), end)
+
+    twice = sum(1 for v in published.values() if len(v) > 1)
+    missing = len(copies) - len(published)
+    weaker = 0
+    if policy == POLICY_BEST_RSSI:
+        for key, [(release, rssi)] in ((k, v) for k, v in published.items() if len(v) == 1):
+            weaker += rssi < max(r for t, r in copies[key] if t <= release)
+    # Keys held for the window plus one flush period, remembered for SEEN_S plus one flush period
+    pending_bound = int(cfg["rate"] * (WINDOW_S + FLUSH_EVERY_S) * BOUND_MARGIN) if policy == POLICY_BEST_RSSI else 0
+    seen_bound = int(cfg["rate"] * (SEEN_S + FLUSH_EVERY_S) * BOUND_MARGIN)
+    ns_per_copy = busy_ns / max(1, count)
+    capacity = 1e9 / ns_per_copy * len(copies) / max(1, count)
+    metrics = stage.metrics()
+    ok = (twice == 0 and missing == 0 and weaker == 0 and peak_pending <= min(pending_bound, stage.max_pending) and
+          peak_seen <= min(seen_bound, stage.max_seen) and capacity >= cfg["rate"])
+    return {"policy": policy, "rate": cfg["rate"], "tags": cfg["tags"], "samples": len(copies), "copies": count,
+            "published_twice": twice, "missing": missing, "weaker_copy_published": weaker,
+            "peak_pending": peak_pending, "pending_bound": pending_bound, "peak_remembered": peak_seen,
+            "remembered_bound": seen_bound, "ns_per_copy": round(ns_per_copy),
+            "capacity_samples_s": round(capacity), "duplicate_ratio": round(metrics["duplicate_ratio"], 3),
+            "late_duplicates": metrics["late_duplicates"],
+            "merge_latency_avg_ms": round(metrics["merge_latency_avg_ms"], 1),
+            "merge_latency_max_ms": round(metrics["merge_latency_max_ms"], 1), "ok": ok}
+
+
+# python3 merge_bench.py --rate 10000 --tags 1000 --overlap 3 --duration 30
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Merge stage load test under overlapping gateway coverage")
+    parser.add_argument("--rate", type=float, default=10000.0, help="samples per second, all tags together")
+    parser.add_argument("--tags", type=int, default=1000)
+    parser.add_argument("--overlap", type=int, default=3, help="most gateways hearing one sample")
+    parser.add_argument("--late", type=float, default=0.01, help="share of copies arriving past the merge window")
+    parser.add_argument("--duration", type=int, default=30, help="seconds of samples per policy")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    cfg = {"rate": args.rate, "tags": args.tags, "overlap": args.overlap, "late": args.late,
+           "duration": args.duration, "seed": args.seed}
+    failed = False
+    for policy in (POLICY_BEST_RSSI, POLICY_FIRST_ARRIVAL):
+        result = run_case(cfg, policy)
+        failed |= not result["ok"]
+        print(json.dumps(result))
+    sys.exit(1 if failed else 0)
@@ -1,25 +1,135 @@
 
+import json
+import logging
+import os
+import sys
 import time
 import paho.mqtt.client as mqtt
 import socket
+from tdoa_solver import TdoaSolver
+from bridge_merge import MergeStage, parse_range, POLICY_BEST_RSSI
+from bridge_reliable import ReliableReceiver
+from bridge_codec import CodecReceiver, range_lines
+from bridge_jitter import JitterBuffer
+from bridge_store import RangeStore
+from bridge_state import StateServer
+from bridge_shm import SampleRing, KIND_RANGE, KIND_GAP, KIND_POSITION
+from bridge_trace import TraceWriter
+from bridge_msg import parse_line
 
 # Define the UDP IP and port
 UDP_IP = "**************"
 UDP_PORT = 12345
 
+# MQTT broker
+MQTT_BROKER = "192.168.0.2"  # Change this if necessary
+MQTT_PORT = 1883
+MQTT_USERNAME = "username"   # Set the username and password of your MQTT broker
+MQTT_PASSWORD = "password"
+
+# TDoA anchors (uwb_anchor_tdoa.ino): BLE address as forwarded by the gateway -> (x, y, z) in metres.
+# Leave empty when the tags run in TWR mode.
+TDOA_ANCHORS = {}
+TDOA_REFERENCE = ""   # Address of anchor 0, the sync transmitter
+TDOA_TOPIC = "test/topic/position"
+
+# Overlapping gateways forward the same range; publish each (tag, seq) once
+MERGE_WINDOW_S = 0.05
+MERGE_POLICY = POLICY_BEST_RSSI     # or POLICY_FIRST_ARRIVAL for the lowest latency
+METRICS_TOPIC = "test/topic/metrics"
+METRICS_INTERVAL_S = 10.0
+
+# Zone events from the gateway geofence ("zone" CLI command), published apart from the ranges
+ZONE_TOPIC = "test/topic/zone"
+# Ranges are published per tag in sequence order; a sample ahead of a missing one waits at most JITTER_HOLD_S,
+# then "gap,<tag>,<first seq>,<count>" marks the samples that never came
+JITTER_HOLD_S = 0.2
+JITTER_STATS_TOPIC = "test/topic/metrics/tags"
+
+# Range history on disk (bridge_store.py), None to disable. Read back with bridge_store.py or RangeStore.query()
+STORE_DIR = "range_store"
+STORE_FLUSH_S = 30.0
+
+# Latest range, position and zones per tag for local readers (bridge_state.py: point lookups and filtered
+# push subscriptions over a binary protocol). None to disable either socket
+STATE_SOCKET = "/tmp/uwb_state.sock"
+STATE_TCP_PORT = None
+
+# Decoded ranges, gap markers and positions as fixed-size records in a shared-memory ring for analytics on this
+# host (bridge_shm.py: RingReader, or "python3 bridge_shm.py" to tail it). None to disable
+SHM_RING = "/dev/shm/uwb_samples"
+
+# Capture every received datagram with its arrival time (bridge_trace.py), e.g. "bridge.utrc"; None to disable.
+# "python3 bridge_trace.py replay|pipeline <file>" plays a capture back
+TRACE_FILE = None
+
+# Per-tag window summaries ("agg" CLI command): "<tag>,<window ms>,<count>,<min>,<max>,<mean>,<variance>,<last>"
+AGG_TOPIC = "test/topic/agg"
+
+# Worker processes sharing UDP_PORT through SO_REUSEPORT (bridge_workers.py). The kernel keeps every gateway on one
+# worker; each worker has its own MQTT connection, state socket (".<worker>" suffix, TCP port + worker), ring
+# (".<worker>" suffix), store ("worker-<n>" subdirectory) and trace file, and the metrics are published combined
+WORKERS = 1
+# Set by the supervisor for each worker
+WORKER_INDEX = None
+WORKER_METRICS_FD = None
+
+# Per-message logs (received datagrams, publish acknowledgements) are at DEBUG level
+LOG_LEVEL = "INFO"
+
+# Any setting above can be overridden from the environment as JSON, e.g. BRIDGE_UDP_PORT=12346 or
+# BRIDGE_STORE_DIR=null (bridge_bench.py runs the bridge this way)
+for _name in [n for n in globals() if n.isupper()]:
+    if "BRIDGE_" + _name in os.environ:
+        _value = os.environ["BRIDGE_" + _name]
+        try:
+            globals()[_name] = json.loads(_value)
+        except ValueError:
+            globals()[_name] = _value
+
+if WORKERS > 1 and WORKER_INDEX is None:
+    from bridge_workers import supervise
+    supervise(os.path.abspath(__file__), WORKERS, MQTT_BROKER, MQTT_PORT, (MQTT_USERNAME, MQTT_PASSWORD),
+              METRICS_INTERVAL_S, METRICS_TOPIC, JITTER_STATS_TOPIC)
+    sys.exit(0)
+if WORKER_INDEX is not None:
+    STATE_SOCKET = STATE_SOCKET and f"{STATE_SOCKET}.{WORKER_INDEX}"
+    STATE_TCP_PORT = STATE_TCP_PORT and STATE_TCP_PORT + WORKER_INDEX
+    SHM_RING = SHM_RING and f"{SHM_RING}.{WORKER_INDEX}"
+    STORE_DIR = STORE_DIR and os.path.join(STORE_DIR, f"worker-{WORKER_INDEX}")
+    TRACE_FILE = TRACE_FILE and f"{TRACE_FILE}.{WORKER_INDEX}"
+
+logging.basicConfig(level=LOG_LEVEL, format="%(asctime)s %(levelname)s %(message)s")
+log = logging.getLogger("bridge")
+
+tdoa_solver = TdoaSolver(TDOA_ANCHORS, TDOA_REFERENCE) if TDOA_ANCHORS else None
+merge_stage = MergeStage(window_s=MERGE_WINDOW_S, policy=MERGE_POLICY)
+# Reliable frames (zone events) are acknowledged on the same socket, best-effort frames pass through
+reliable_receiver = ReliableReceiver()
+codec_receiver = CodecReceiver()     # Compressed range frames ("config set codec 1" on the gateway)
+jitter_buffer = JitterBuffer(hold_s=JITTER_HOLD_S)
+range_store = RangeStore(STORE_DIR) if STORE_DIR else None
+state_server = StateServer(STATE_SOCKET, STATE_TCP_PORT) if STATE_SOCKET or STATE_TCP_PORT else None
+sample_ring = SampleRing(SHM_RING) if SHM_RING else None
+trace_writer = TraceWriter(TRACE_FILE) if TRACE_FILE else None
+# Metrics go to the supervisor instead of the broker when running as one of several workers
+worker_metrics = os.fdopen(WORKER_METRICS_FD, "w") if WORKER_METRICS_FD is not None else None
+# Text lines received, and those dropped for not being valid UTF-8
+input_stats = {"lines": 0, "dropped_lines": 0}
+
 
 # Callback when a message is successfully published
 def on_publish(client, userdata, mid, reason_code=None, properties=None):
     try:
         # If we're using MQTT v3, reason_code and properties will be None
         if reason_code is None or properties is None:
-            print(f"Message with MID {mid} was successfully published (MQTT v3).")
+            log.debug("Message with MID %s was successfully published (MQTT v3).", mid)
         else:
-            print(f"Message with MID {mid} published. Reason code: {reason_code}, Properties: {properties}")
+            log.debug("Message with MID %s published. Reason code: %s, Properties: %s", mid, reason_code, properties)
         
         userdata.remove(mid)
     except KeyError:
-        print(f"Warning: MID {mid} not found in unacknowledged set.")
+        log.warning("MID %s not found in unacknowledged set.", mid)
 
 # Set of unacknowledged messages
 unacked_publish = set()
@@ -28,7 +138,7 @@ unacked_publish = set()
 mqttc = mqtt.Client()
 
 # Set credentials for broker
-mqttc.username_pw_set("username", "password")        # Set the username and password of your MQTT broker
+mqttc.username_pw_set(MQTT_USERNAME, MQTT_PASSWORD)
 
 # Assign callback for publish
 mqttc.on_publish = on_publish
@@ -37,27 +147,144 @@ mqttc.on_publish = on_publish
 mqttc.user_data_set(unacked_publish)
 
 # Connect to the broker
-broker = "192.168.0.2"  # Change this if necessary
-port = 1883
-mqttc.connect(broker, port)
+mqttc.connect(MQTT_BROKER, MQTT_PORT)
 
 # Start the loop
 mqttc.loop_start()
 
+def publish(topic, payload):
+    msg_info = mqttc.publish(topic, payload, qos=1)
+    unacked_publish.add(msg_info.mid)  # Track the message MID
+    return msg_info
+
+# Publish ranges and gap markers in per-tag order, and keep the ranges' history and latest state
+def publish_ordered(payloads, now):
+    for payload in payloads:
+        msg_info = publish("test/topic", payload)
+        log.debug("Published UDP message to MQTT with MID: %s", msg_info.mid)
+        fields = payload.split(",")
+        t_ms = int(time.time() * 1000)
+        if fields[0] == "gap":
+            if sample_ring is not None:
+                sample_ring.write(KIND_GAP, fields[1], int(fields[2]), t_ms, int(fields[3]))
+            continue
+        rssi = parse_range(payload)[1]
+        if range_store is not None:
+            range_store.append(fields[0], t_ms, int(fields[2]))
+        if state_server is not None:
+            state_server.update_range(fields[0], int(fields[2]), rssi, now)
+        if sample_ring is not None:
+            sample_ring.write(KIND_RANGE, fields[0], int(fields[1]), t_ms, int(fields[2]), 0, rssi or 0)
+
+# Put merged ranges back in per-tag sequence order before they are published
+def publish_ranges(payloads, now):
+    for payload in payloads:
+        (tag, seq), _ = parse_range(payload)
+        publish_ordered(jitter_buffer.add(tag, seq, payload, now), now)
+
+# Route one gateway message: TDoA reports to the solver, zone events and window summaries to their topics,
+# ranges through the merge stage and the jitter buffer, anything else as is
+def handle_message(text, now):
+    # TDoA anchor reports are solved here and only the positions are published
+    if tdoa_solver is not None and tdoa_solver.parse_and_add(text, now):
+        return
+
+    if text.startswith("zone,"):
+        publish(ZONE_TOPIC, text[len("zone,"):])
+        parsed = parse_line(text)
+        if state_server is not None and parsed is not None and parsed[1][1] in ("enter", "exit"):
+            tag, event, zone_id, _ = parsed[1]
+            state_server.update_zone(tag, zone_id, event == "enter", now)
+        return
+    if text.startswith("agg,"):
+        publish(AGG_TOPIC, text[len("agg,"):])
+        return
+
+    parsed = parse_range(text)
+    if parsed is None:
+        msg_info = publish("test/topic", text)
+        log.debug("Published UDP message to MQTT with MID: %s", msg_info.mid)
+        return
+
+    key, rssi = parsed
+    publish_ranges(merge_stage.add(key, rssi, text, now), now)
+
 # Function to start the UDP server
 def start_udp_server(UDP_IP, UDP_PORT):
     sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)  # Create UDP socket
+    if WORKERS > 1:
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)  # Every worker binds the same port
     sock.bind((UDP_IP, UDP_PORT))  # Bind to the IP and port
+    sock.settimeout(MERGE_WINDOW_S / 2)  # Wake up to release held samples even when no datagram arrives
+    next_metrics = time.monotonic() + METRICS_INTERVAL_S
+    next_store_flush = time.monotonic() + STORE_FLUSH_S
 
     while True:
         # Receive data from UDP
-        data, addr = sock.recvfrom(1024)  # buffer size is 1024 bytes
-        print(f"Received message: {data.decode()} from {addr}")
-        
-        # Publish the received UDP data to the MQTT broker
-        msg_info = mqttc.publish("test/topic", data.decode(), qos=1)
-        unacked_publish.add(msg_info.mid)  # Track the message MID
-        print(f"Published UDP message to MQTT with MID: {msg_info.mid}")
+        try:
+            data, addr = sock.recvfrom(1024)  # buffer size is 1024 bytes
+        except socket.timeout:
+            data = None
+        now = time.monotonic()
+
+        if data is not None and trace_writer is not None:
+            trace_writer.udp_rx(addr, data, time.monotonic_ns() // 1000)
+        if data is not None:
+            data, ack = reliable_receiver.handle(data, addr)
+            if ack is not None:
+                sock.sendto(ack, addr)
+        if data is not None:
+            samples = codec_receiver.handle(data, addr)
+            if samples is not None:
+                for line in range_lines(samples):
+                    handle_message(line, now)
+                data = None
+        if data is not None:
+            log.debug("Received message: %r from %s", data, addr)
+            # A datagram carries one or more samples, one per line; a damaged line does not cost the others
+            for raw in data.splitlines():
+                input_stats["lines"] += 1
+                try:
+                    line = raw.decode()
+                except UnicodeDecodeError:
+                    input_stats["dropped_lines"] += 1
+                    continue
+                handle_message(line, now)
+
+        publish_ranges(merge_stage.flush(now), now)
+        publish_ordered(jitter_buffer.flush(now), now)
+        if range_store is not None and now >= next_store_flush:
+            range_store.flush()
+            next_store_flush = now + STORE_FLUSH_S
+        if tdoa_solver is not None:
+            for tag, seq, x, y, rms in tdoa_solver.flush(now):
+                publish(TDOA_TOPIC, f"{tag},{seq},{x:.3f},{y:.3f},{rms:.3f}")
+                if state_server is not None:
+                    state_server.update_position(str(tag), x, y, rms, now)
+                if sample_ring is not None:
+                    sample_ring.write(KIND_POSITION, str(tag), seq, int(time.time() * 1000), int(x * 1000),
+                                      int(y * 1000), min(int(rms * 1000), 0x7FFF))
+        if sample_ring is not None:
+            sample_ring.notify()
+
+        if now >= next_metrics:
+            metrics = {"input": dict(input_stats),
+                       "merge": merge_stage.metrics(),
+                       "reliable": reliable_receiver.metrics(),
+                       "codec": codec_receiver.metrics(),
+                       "jitter": jitter_buffer.metrics(),
+                       "store": range_store.metrics() if range_store else None,
+                       "state": state_server.metrics() if state_server else None,
+                       "ring": sample_ring.metrics() if sample_ring else None}
+            if worker_metrics is not None:
+                worker_metrics.write(json.dumps({"metrics": metrics, "tags": jitter_buffer.tag_stats()}) + "\n")
+                worker_metrics.flush()
+            else:
+                publish(METRICS_TOPIC, json.dumps(metrics))
+                publish(JITTER_STATS_TOPIC, json.dumps(jitter_buffer.tag_stats()))
+            if trace_writer is not None:
+                trace_writer.flush()
+            next_metrics = now + METRICS_INTERVAL_S
 
 # Start the UDP server
 start_udp_server(UDP_IP, UDP_PORT)
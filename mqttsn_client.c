@@ -0,0 +1,549 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "mqttsn_client.h"
+
+#include <string.h>
+
+#define MQTTSN_PROTOCOL_ID 0x01
+
+static bool mqttsn_due(uint32_t now_ms, uint32_t at_ms)
+{
+    return (int32_t)(now_ms - at_ms) >= 0;
+}
+
+static uint32_t mqttsn_until(uint32_t now_ms, uint32_t at_ms)
+{
+    return mqttsn_due(now_ms, at_ms) ? 0 : at_ms - now_ms;
+}
+
+static uint32_t mqttsn_min(uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+static void mqttsn_put_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = (uint8_t)(value >> 8);
+    out[1] = (uint8_t)value;
+}
+
+static uint16_t mqttsn_get_u16(const uint8_t *in)
+{
+    return (uint16_t)(in[0] << 8 | in[1]);
+}
+
+// Length and type in front of a body already written at packet + 4; returns the start of the packet
+
+static uint8_t *mqttsn_frame(uint8_t *packet, uint8_t type, size_t body_len, size_t *len)
+{
+    if (body_len + 2 <= 255) {
+        packet[2] = (uint8_t)(body_len + 2);
+        packet[3] = type;
+        *len = body_len + 2;
+        return &packet[2];
+    }
+    packet[0] = 0x01;
+    mqttsn_put_u16(&packet[1], (uint16_t)(body_len + 4));
+    packet[3] = type;
+    *len = body_len + 4;
+    return packet;
+}
+
+static void mqttsn_client_send(MQTTSN_CLIENT *client, uint8_t *packet, uint8_t type, size_t body_len,
+                               uint32_t now_ms)
+{
+    size_t len;
+    uint8_t *start = mqttsn_frame(packet, type, body_len, &len);
+
+    client->tx(start, len, client->ctx);
+    client->packets_tx++;
+    client->bytes_tx += len;
+    client->last_tx_ms = now_ms;
+}
+
+static uint16_t mqttsn_client_msg_id(MQTTSN_CLIENT *client)
+{
+    if (client->next_msg_id == 0) {
+        client->next_msg_id = 1;
+    }
+    return client->next_msg_id++;
+}
+
+static void mqttsn_client_send_publish(MQTTSN_CLIENT *client, int topic, int qos, bool dup, uint16_t msg_id,
+                                       const void *payload, size_t len, uint32_t now_ms)
+{
+    uint8_t packet[MQTTSN_PACKET_MAX];
+    uint8_t *body = &packet[4];
+
+    body[0] = client->topics[topic].type | (dup ? MQTTSN_FLAG_DUP : 0) |
+              (qos == 1 ? MQTTSN_FLAG_QOS_1 : qos < 0 ? MQTTSN_FLAG_QOS_M1 : 0);
+    mqttsn_put_u16(&body[1], client->topics[topic].id);
+    mqttsn_put_u16(&body[3], msg_id);
+    memcpy(&body[5], payload, len);
+    mqttsn_client_send(client, packet, MQTTSN_TYPE_PUBLISH, 5 + len, now_ms);
+}
+
+static void mqttsn_client_send_message(MQTTSN_CLIENT *client, const MQTTSN_MESSAGE *msg, uint32_t now_ms)
+{
+    mqttsn_client_send_publish(client, msg->topic, msg->qos, msg->dup, msg->msg_id, msg->payload, msg->len, now_ms);
+}
+
+// (Re)send the open control transaction
+
+static void mqttsn_client_send_control(MQTTSN_CLIENT *client, uint32_t now_ms)
+{
+    uint8_t packet[4 + 5 + MQTTSN_TOPIC_NAME_MAX + 1];
+    uint8_t *body = &packet[4];
+    size_t len = 0;
+
+    switch (client->pending_type) {
+    case MQTTSN_TYPE_CONNECT:
+        body[0] = client->session ? 0 : MQTTSN_FLAG_CLEAN_SESSION;
+        body[1] = MQTTSN_PROTOCOL_ID;
+        mqttsn_put_u16(&body[2], client->config.keepalive_s);
+        len = strlen(client->config.client_id);
+        memcpy(&body[4], client->config.client_id, len);
+        len += 4;
+        break;
+    case MQTTSN_TYPE_REGISTER: {
+        const MQTTSN_TOPIC *topic = &client->topics[client->pending_topic];
+        mqttsn_put_u16(&body[0], 0);
+        mqttsn_put_u16(&body[2], client->pending_msg_id);
+        len = strlen(topic->name);
+        memcpy(&body[4], topic->name, len);
+        len += 4;
+        break;
+    }
+    case MQTTSN_TYPE_PINGREQ:
+        // A sleeping client names itself so that the gateway knows who checked in
+        if (client->state == MQTTSN_STATE_AWAKE) {
+            len = strlen(client->config.client_id);
+            memcpy(body, client->config.client_id, len);
+        }
+        break;
+    case MQTTSN_TYPE_DISCONNECT:
+        mqttsn_put_u16(body, client->sleep_s);
+        len = 2;
+        break;
+    default:
+        return;
+    }
+    client->pending_sent_ms = now_ms;
+    mqttsn_client_send(client, packet, client->pending_type, len, now_ms);
+}
+
+static void mqttsn_client_control(MQTTSN_CLIENT *client, uint8_t type, uint32_t now_ms)
+{
+    client->pending_type = type;
+    client->pending_retries = 0;
+    mqttsn_client_send_control(client, now_ms);
+}
+
+static void mqttsn_client_connect(MQTTSN_CLIENT *client, uint32_t now_ms)
+{
+    client->state = MQTTSN_STATE_CONNECTING;
+    client->connects++;
+    mqttsn_client_control(client, MQTTSN_TYPE_CONNECT, now_ms);
+}
+
+static void mqttsn_client_push_front(MQTTSN_CLIENT *client, const MQTTSN_MESSAGE *msg)
+{
+    if (client->buffer_count == MQTTSN_BUFFER_LEN) {
+        client->dropped++;
+        return;
+    }
+    client->buffer_head = (client->buffer_head + MQTTSN_BUFFER_LEN - 1) % MQTTSN_BUFFER_LEN;
+    client->buffer[client->buffer_head] = *msg;
+    client->buffer_count++;
+}
+
+static MQTTSN_MESSAGE *mqttsn_client_push_back(MQTTSN_CLIENT *client)
+{
+    if (client->buffer_count == MQTTSN_BUFFER_LEN) {
+        client->buffer_head = (client->buffer_head + 1) % MQTTSN_BUFFER_LEN;
+        client->buffer_count--;
+        client->dropped++;
+    }
+    MQTTSN_MESSAGE *msg = &client->buffer[(client->buffer_head + client->buffer_count) % MQTTSN_BUFFER_LEN];
+    client->buffer_count++;
+    if ((uint32_t)client->buffer_count > client->buffered_max) {
+        client->buffered_max = client->buffer_count;
+    }
+    return msg;
+}
+
+static int mqttsn_client_free_slot(const MQTTSN_CLIENT *client)
+{
+    for (int i = 0; i < MQTTSN_INFLIGHT_MAX; i++) {
+        if (!client->inflight_used[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// The gateway is gone or dropped the session: forget the registrations, requeue what was not acknowledged
+
+static void mqttsn_client_drop(MQTTSN_CLIENT *client, uint32_t now_ms)
+{
+    client->lost++;
+    client->state = MQTTSN_STATE_DISCONNECTED;
+    client->session = false;
+    client->pending_type = 0;
+    client->reconnect_at_ms = now_ms + client->config.retry_ms;
+    for (int i = 0; i < client->topic_count; i++) {
+        if (client->topics[i].type == MQTTSN_TOPIC_NORMAL) {
+            client->topics[i].registered = false;
+        }
+    }
+    for (int i = MQTTSN_INFLIGHT_MAX - 1; i >= 0; i--) {
+        if (client->inflight_used[i]) {
+            client->inflight_used[i] = false;
+            client->inflight[i].dup = true;
+            client->inflight[i].retries = 0;
+            mqttsn_client_push_front(client, &client->inflight[i]);
+        }
+    }
+}
+
+// Send buffered publishes while connected, registering topics on the way; sleep again once idle
+
+static void mqttsn_client_pump(MQTTSN_CLIENT *client, uint32_t now_ms)
+{
+    // Nothing goes out between asking to sleep and the gateway confirming it
+    while (client->state == MQTTSN_STATE_ACTIVE && client->buffer_count > 0 &&
+           client->pending_type != MQTTSN_TYPE_DISCONNECT) {
+        MQTTSN_MESSAGE *msg = &client->buffer[client->buffer_head];
+        MQTTSN_TOPIC *topic = &client->topics[msg->topic];
+        int slot = -1;
+
+        if (topic->type == MQTTSN_TOPIC_NORMAL && !topic->registered) {
+            if (client->pending_type == 0) {
+                client->pending_topic = msg->topic;
+                client->pending_msg_id = mqttsn_client_msg_id(client);
+                client->registers++;
+                mqttsn_client_control(client, MQTTSN_TYPE_REGISTER, now_ms);
+            }
+            return;
+        }
+        if (msg->qos == 1) {
+            slot = mqttsn_client_free_slot(client);
+            if (slot < 0) {
+                return;
+            }
+            if (!msg->dup) {
+                msg->msg_id = mqttsn_client_msg_id(client);
+            }
+            msg->sent_ms = now_ms;
+            msg->retries = 0;
+            client->inflight[slot] = *msg;
+            client->inflight_used[slot] = true;
+        }
+        client->buffer_head = (client->buffer_head + 1) % MQTTSN_BUFFER_LEN;
+        client->buffer_count--;
+        mqttsn_client_send_message(client, slot >= 0 ? &client->inflight[slot] : msg, now_ms);
+        client->published++;
+    }
+    if (client->state == MQTTSN_STATE_ACTIVE && client->sleep_s > 0 && client->buffer_count == 0 &&
+            client->pending_type == 0) {
+        for (int i = 0; i < MQTTSN_INFLIGHT_MAX; i++) {
+            if (client->inflight_used[i]) {
+                return;
+            }
+        }
+        mqttsn_client_control(client, MQTTSN_TYPE_DISCONNECT, now_ms);
+    }
+}
+
+void mqttsn_client_init(MQTTSN_CLIENT *client, const MQTTSN_CONFIG *config, mqttsn_tx_fn_t tx, void *ctx)
+{
+    memset(client, 0, sizeof(*client));
+    client->config = *config;
+    client->config.client_id[MQTTSN_CLIENT_ID_MAX] = '\0';
+    client->tx = tx;
+    client->ctx = ctx;
+    client->state = MQTTSN_STATE_DISCONNECTED;
+    client->next_msg_id = 1;
+}
+
+int mqttsn_client_add_topic(MQTTSN_CLIENT *client, const char *name, mqttsn_topic_type_t type, uint16_t id)
+{
+    size_t len = strlen(name);
+
+    if (client->topic_count == MQTTSN_TOPICS_MAX || len == 0 || len > MQTTSN_TOPIC_NAME_MAX ||
+            (type == MQTTSN_TOPIC_SHORT && len != 2) || type > MQTTSN_TOPIC_SHORT) {
+        return -1;
+    }
+    MQTTSN_TOPIC *topic = &client->topics[client->topic_count];
+    memcpy(topic->name, name, len + 1);
+    topic->type = type;
+    topic->registered = type != MQTTSN_TOPIC_NORMAL;
+    topic->id = type == MQTTSN_TOPIC_SHORT ? (uint16_t)((uint8_t)name[0] << 8 | (uint8_t)name[1]) :
+                type == MQTTSN_TOPIC_PREDEFINED ? id : 0;
+    return client->topic_count++;
+}
+
+void mqttsn_client_start(MQTTSN_CLIENT *client, uint32_t now_ms)
+{
+    client->enabled = true;
+    if (client->state == MQTTSN_STATE_DISCONNECTED) {
+        mqttsn_client_connect(client, now_ms);
+    }
+}
+
+bool mqttsn_client_publish(MQTTSN_CLIENT *client, int topic, const void *payload, size_t len, int qos,
+                           uint32_t now_ms)
+{
+    if (topic < 0 || topic >= client->topic_count || len > MQTTSN_PAYLOAD_MAX || qos < -1 || qos > 1 ||
+            (qos < 0 && client->topics[topic].type == MQTTSN_TOPIC_NORMAL)) {
+        return false;
+    }
+    bool asleep = client->state == MQTTSN_STATE_ASLEEP || client->state == MQTTSN_STATE_AWAKE;
+
+    // QoS -1 needs no connection, only a sleeping client holds it back
+    if (qos < 0 && !asleep) {
+        mqttsn_client_send_publish(client, topic, -1, false, 0, payload, len, now_ms);
+        client->published++;
+        return true;
+    }
+    MQTTSN_MESSAGE *msg = mqttsn_client_push_back(client);
+    memset(msg, 0, offsetof(MQTTSN_MESSAGE, payload));
+    msg->topic = (uint8_t)topic;
+    msg->qos = (int8_t)qos;
+    msg->len = (uint16_t)len;
+    memcpy(msg->payload, payload, len);
+
+    if (client->state == MQTTSN_STATE_ACTIVE) {
+        mqttsn_client_pump(client, now_ms);
+    } else if (client->state == MQTTSN_STATE_ASLEEP && client->buffer_count >= MQTTSN_WAKE_FILL &&
+               client->pending_type == 0) {
+        mqttsn_client_connect(client, now_ms);
+    }
+    return true;
+}
+
+void mqttsn_client_sleep(MQTTSN_CLIENT *client, uint16_t duration_s, uint32_t now_ms)
+{
+    if (duration_s == 0) {
+        mqttsn_client_wake(client, now_ms);
+        return;
+    }
+    client->sleep_s = duration_s;
+    mqttsn_client_pump(client, now_ms);
+}
+
+void mqttsn_client_wake(MQTTSN_CLIENT *client, uint32_t now_ms)
+{
+    client->sleep_s = 0;
+    if (client->state == MQTTSN_STATE_ASLEEP || client->state == MQTTSN_STATE_AWAKE) {
+        client->pending_type = 0;
+        mqttsn_client_connect(client, now_ms);
+    }
+}
+
+void mqttsn_client_on_packet(MQTTSN_CLIENT *client, const uint8_t *buf, size_t len, uint32_t now_ms)
+{
+    size_t hdr = 1;
+    size_t total;
+
+    if (len < 2) {
+        return;
+    }
+    total = buf[0];
+    if (buf[0] == 0x01) {
+        if (len < 4) {
+            return;
+        }
+        total = mqttsn_get_u16(&buf[1]);
+        hdr = 3;
+    }
+    if (total > len || total < hdr + 1) {
+        return;
+    }
+    uint8_t type = buf[hdr];
+    const uint8_t *body = &buf[hdr + 1];
+    size_t body_len = total - hdr - 1;
+    client->packets_rx++;
+
+    switch (type) {
+    case MQTTSN_TYPE_CONNACK:
+        if (client->pending_type != MQTTSN_TYPE_CONNECT || body_len < 1) {
+            break;
+        }
+        client->pending_type = 0;
+        if (body[0] != MQTTSN_RC_ACCEPTED) {
+            mqttsn_client_drop(client, now_ms);
+            break;
+        }
+        client->state = MQTTSN_STATE_ACTIVE;
+        client->session = true;
+        mqttsn_client_pump(client, now_ms);
+        break;
+    case MQTTSN_TYPE_REGACK:
+        // A rejected REGISTER stays open and is retried by the timer
+        if (client->pending_type != MQTTSN_TYPE_REGISTER || body_len < 5 ||
+                mqttsn_get_u16(&body[2]) != client->pending_msg_id || body[4] != MQTTSN_RC_ACCEPTED) {
+            break;
+        }
+        client->pending_type = 0;
+        client->topics[client->pending_topic].id = mqttsn_get_u16(body);
+        client->topics[client->pending_topic].registered = true;
+        mqttsn_client_pump(client, now_ms);
+        break;
+    case MQTTSN_TYPE_PUBACK: {
+        if (body_len < 5) {
+            break;
+        }
+        uint16_t topic_id = mqttsn_get_u16(body);
+        uint16_t msg_id = mqttsn_get_u16(&body[2]);
+        bool found = false;
+        for (int i = 0; i < MQTTSN_INFLIGHT_MAX && !found; i++) {
+            MQTTSN_MESSAGE *msg = &client->inflight[i];
+            if (!client->inflight_used[i] || msg->msg_id != msg_id) {
+                continue;
+            }
+            found = true;
+            if (body[4] == MQTTSN_RC_ACCEPTED) {
+                client->inflight_used[i] = false;
+                client->acked++;
+            } else if (body[4] == MQTTSN_RC_INVALID_TOPIC_ID) {
+                // Register again and resend as a new publish
+                client->inflight_used[i] = false;
+                msg->dup = false;
+                mqttsn_client_push_front(client, msg);
+            }
+            // Congestion: keep it in flight, the retry timer backs off
+        }
+        // The gateway lost the registration, also reported for QoS 0 publishes that have no PUBACK otherwise
+        if (body[4] == MQTTSN_RC_INVALID_TOPIC_ID) {
+            for (int i = 0; i < client->topic_count; i++) {
+                if (client->topics[i].type == MQTTSN_TOPIC_NORMAL && client->topics[i].id == topic_id) {
+                    client->topics[i].registered = false;
+                }
+            }
+        }
+        mqttsn_client_pump(client, now_ms);
+        break;
+    }
+    case MQTTSN_TYPE_PINGRESP:
+        if (client->pending_type != MQTTSN_TYPE_PINGREQ) {
+            break;
+        }
+        client->pending_type = 0;
+        if (client->state == MQTTSN_STATE_AWAKE) {
+            client->state = MQTTSN_STATE_ASLEEP;
+        }
+        break;
+    case MQTTSN_TYPE_PINGREQ: {
+        uint8_t packet[4];
+        mqttsn_client_send(client, packet, MQTTSN_TYPE_PINGRESP, 0, now_ms);
+        break;
+    }
+    case MQTTSN_TYPE_DISCONNECT:
+        if (client->pending_type == MQTTSN_TYPE_DISCONNECT) {
+            client->pending_type = 0;
+            client->state = MQTTSN_STATE_ASLEEP;
+            client->last_tx_ms = now_ms;
+            if (client->sleep_s == 0 || client->buffer_count >= MQTTSN_WAKE_FILL) {
+                mqttsn_client_connect(client, now_ms);
+            }
+        } else if (client->state != MQTTSN_STATE_DISCONNECTED) {
+            // The gateway answers but has no session for us, e.g. after a restart: reconnect at once
+            mqttsn_client_drop(client, now_ms);
+            client->reconnect_at_ms = now_ms;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+uint32_t mqttsn_client_poll(MQTTSN_CLIENT *client, uint32_t now_ms)
+{
+    uint32_t retry_ms = client->config.retry_ms;
+    uint32_t next = UINT32_MAX;
+
+    if (!client->enabled) {
+        return next;
+    }
+    if (client->pending_type != 0) {
+        uint32_t at_ms = client->pending_sent_ms + retry_ms;
+        if (mqttsn_due(now_ms, at_ms)) {
+            if (client->pending_retries >= client->config.max_retries) {
+                mqttsn_client_drop(client, now_ms);
+            } else {
+                client->pending_retries++;
+                client->retransmits++;
+                mqttsn_client_send_control(client, now_ms);
+                at_ms = now_ms + retry_ms;
+            }
+        }
+        if (client->pending_type != 0) {
+            next = mqttsn_until(now_ms, at_ms);
+        }
+    }
+    for (int i = 0; i < MQTTSN_INFLIGHT_MAX && client->state == MQTTSN_STATE_ACTIVE; i++) {
+        MQTTSN_MESSAGE *msg = &client->inflight[i];
+        if (!client->inflight_used[i]) {
+            continue;
+        }
+        if (mqttsn_due(now_ms, msg->sent_ms + retry_ms)) {
+            if (msg->retries >= client->config.max_retries) {
+                mqttsn_client_drop(client, now_ms);
+                break;
+            }
+            msg->retries++;
+            msg->dup = true;
+            msg->sent_ms = now_ms;
+            client->retransmits++;
+            mqttsn_client_send_message(client, msg, now_ms);
+        }
+        next = mqttsn_min(next, mqttsn_until(now_ms, msg->sent_ms + retry_ms));
+    }
+
+    switch (client->state) {
+    case MQTTSN_STATE_DISCONNECTED:
+        if (mqttsn_due(now_ms, client->reconnect_at_ms)) {
+            mqttsn_client_connect(client, now_ms);
+            next = mqttsn_min(next, retry_ms);
+        } else {
+            next = mqttsn_min(next, mqttsn_until(now_ms, client->reconnect_at_ms));
+        }
+        break;
+    case MQTTSN_STATE_ACTIVE:
+        if (client->pending_type == 0 && client->config.keepalive_s > 0) {
+            uint32_t at_ms = client->last_tx_ms + client->config.keepalive_s * 1000u;
+            if (mqttsn_due(now_ms, at_ms)) {
+                client->pings++;
+                mqttsn_client_control(client, MQTTSN_TYPE_PINGREQ, now_ms);
+                at_ms = now_ms + retry_ms;
+            }
+            next = mqttsn_min(next, mqttsn_until(now_ms, at_ms));
+        }
+        break;
+    case MQTTSN_STATE_ASLEEP:
+        // Check in well before the gateway gives up on us, leaving room for the retries
+        if (client->pending_type == 0) {
+            uint32_t at_ms = client->last_tx_ms + client->sleep_s * 750u;
+            if (mqttsn_due(now_ms, at_ms)) {
+                if (client->buffer_count > 0) {
+                    mqttsn_client_connect(client, now_ms);
+                } else {
+                    client->state = MQTTSN_STATE_AWAKE;
+                    client->pings++;
+                    mqttsn_client_control(client, MQTTSN_TYPE_PINGREQ, now_ms);
+                }
+                at_ms = now_ms + retry_ms;
+            }
+            next = mqttsn_min(next, mqttsn_until(now_ms, at_ms));
+        }
+        break;
+    default:
+        break;
+    }
+    return next;
+}
@@ -0,0 +1,215 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * MQTT-SN 1.2 publishing client: CONNECT, REGISTER, PUBLISH at QoS 0, 1 and -1, keep-alive PINGREQ and the
+ * sleeping client cycle (DISCONNECT with a duration, PINGREQ with the client ID to check in). One control
+ * transaction (CONNECT, REGISTER, PINGREQ, DISCONNECT) is open at a time; QoS 1 publishes have a window of
+ * their own, one PUBACK round trip per line would not keep up with a busy site. Publishes that cannot go out
+ * yet (not connected, asleep, topic not registered, window full) wait in a buffer that drops its oldest entry
+ * when full.
+ *
+ * A sleeping client checks in before each sleep duration runs out. With publishes buffered it reconnects instead
+ * of pinging, sends them and goes back to sleep, as it also does once the buffer reaches MQTTSN_WAKE_FILL.
+ */
+#define MQTTSN_TYPE_CONNECT 0x04
+#define MQTTSN_TYPE_CONNACK 0x05
+#define MQTTSN_TYPE_REGISTER 0x0A
+#define MQTTSN_TYPE_REGACK 0x0B
+#define MQTTSN_TYPE_PUBLISH 0x0C
+#define MQTTSN_TYPE_PUBACK 0x0D
+#define MQTTSN_TYPE_PINGREQ 0x16
+#define MQTTSN_TYPE_PINGRESP 0x17
+#define MQTTSN_TYPE_DISCONNECT 0x18
+
+#define MQTTSN_FLAG_DUP 0x80
+#define MQTTSN_FLAG_QOS_1 0x20
+#define MQTTSN_FLAG_QOS_M1 0x60
+#define MQTTSN_FLAG_CLEAN_SESSION 0x04
+#define MQTTSN_RC_ACCEPTED 0x00
+#define MQTTSN_RC_INVALID_TOPIC_ID 0x02
+
+#define MQTTSN_CLIENT_ID_MAX 23
+#define MQTTSN_TOPIC_NAME_MAX 47
+#define MQTTSN_TOPICS_MAX 8
+#define MQTTSN_PAYLOAD_MAX 64           // One forwarded line, as SAMPLE_MSG in main.c
+#define MQTTSN_PACKET_MAX (MQTTSN_PAYLOAD_MAX + 9)
+#define MQTTSN_INFLIGHT_MAX 16          // QoS 1 publishes waiting for their PUBACK, keeps up with 200 lines/s
+#define MQTTSN_BUFFER_LEN 32            // Publishes waiting to be sent, as SAMPLE_QUEUE_LEN
+#define MQTTSN_WAKE_FILL 24             // A sleeping client wakes up to flush the buffer at this many entries
+
+typedef enum {
+    MQTTSN_TOPIC_NORMAL = 0,            // Registered: the gateway assigns the ID for this session
+    MQTTSN_TOPIC_PREDEFINED = 1,        // ID agreed with the gateway beforehand, usable at QoS -1
+    MQTTSN_TOPIC_SHORT = 2,             // Two-character name sent in place of the ID
+} mqttsn_topic_type_t;
+
+typedef enum {
+    MQTTSN_STATE_DISCONNECTED = 0,
+    MQTTSN_STATE_CONNECTING,
+    MQTTSN_STATE_ACTIVE,
+    MQTTSN_STATE_ASLEEP,
+    MQTTSN_STATE_AWAKE,                 // Checked in while asleep, waiting for the PINGRESP
+} mqttsn_state_t;
+
+typedef void (*mqttsn_tx_fn_t)(const uint8_t *packet, size_t len, void *ctx);
+
+typedef struct mqttsn_config {
+    char client_id[MQTTSN_CLIENT_ID_MAX + 1];
+    uint16_t keepalive_s;
+    uint32_t retry_ms;                  // T_retry
+    uint8_t max_retries;                // N_retry, then the gateway counts as lost and the client reconnects
+} MQTTSN_CONFIG;
+
+#define MQTTSN_CONFIG_DEFAULT() {               \
+    .client_id = "uwbgw",                       \
+    .keepalive_s = 60,                          \
+    .retry_ms = 1000,                           \
+    .max_retries = 3,                           \
+}
+
+typedef struct mqttsn_topic {
+    char name[MQTTSN_TOPIC_NAME_MAX + 1];
+    uint8_t type;                       // mqttsn_topic_type_t
+    bool registered;
+    uint16_t id;
+} MQTTSN_TOPIC;
+
+typedef struct mqttsn_message {
+    uint8_t topic;                      // Index in the topic table
+    int8_t qos;
+    bool dup;
+    uint8_t retries;
+    uint16_t msg_id;
+    uint16_t len;
+    uint32_t sent_ms;
+    uint8_t payload[MQTTSN_PAYLOAD_MAX];
+} MQTTSN_MESSAGE;
+
+/**
+ * @brief Client state and statistics.
+ *
+ */
+typedef struct mqttsn_client {
+    MQTTSN_CONFIG config;
+    mqttsn_tx_fn_t tx;
+    void *ctx;
+    bool enabled;
+    uint8_t state;                      // mqttsn_state_t
+    uint16_t sleep_s;                   // Sleep duration asked for, 0 to stay awake
+    bool session;                       // The gateway keeps our registrations, reconnect without clean session
+    uint32_t reconnect_at_ms;
+    uint32_t last_tx_ms;
+    uint16_t next_msg_id;
+    MQTTSN_TOPIC topics[MQTTSN_TOPICS_MAX];
+    int topic_count;
+
+    uint8_t pending_type;               // Open control transaction, 0 if none
+    uint16_t pending_msg_id;
+    int pending_topic;
+    uint8_t pending_retries;
+    uint32_t pending_sent_ms;
+
+    MQTTSN_MESSAGE inflight[MQTTSN_INFLIGHT_MAX];
+    bool inflight_used[MQTTSN_INFLIGHT_MAX];
+    MQTTSN_MESSAGE buffer[MQTTSN_BUFFER_LEN];
+    int buffer_head;
+    int buffer_count;
+
+    uint32_t published;                 // PUBLISH packets sent, retransmissions excluded
+    uint32_t acked;
+    uint32_t retransmits;
+    uint32_t dropped;                   // Pushed out of a full buffer
+    uint32_t buffered_max;
+    uint32_t registers;
+    uint32_t pings;
+    uint32_t connects;
+    uint32_t lost;                      // Times the gateway stopped answering
+    uint32_t packets_tx;
+    uint32_t packets_rx;
+    uint32_t bytes_tx;
+} MQTTSN_CLIENT;
+
+/**
+ * @brief Reset the client, disconnected and without topics.
+ *
+ * @param[in] client    The client. Not thread safe, callers serialise access.
+ * @param[in] config    Client ID, keep-alive and retry policy.
+ * @param[in] tx        Sends one packet to the MQTT-SN gateway.
+ * @param[in] ctx       Passed to tx.
+ *
+ */
+void mqttsn_client_init(MQTTSN_CLIENT *client, const MQTTSN_CONFIG *config, mqttsn_tx_fn_t tx, void *ctx);
+
+/**
+ * @brief Add a topic. Normal topics are registered on first use in every session.
+ *
+ * @param[in] client    The client.
+ * @param[in] name      Topic name; for a short topic its two characters.
+ * @param[in] type      mqttsn_topic_type_t.
+ * @param[in] id        Predefined topic ID, ignored for the other types.
+ *
+ * @return
+ *      - Index of the topic for mqttsn_client_publish(), -1 if the table is full or the name invalid.
+ */
+int mqttsn_client_add_topic(MQTTSN_CLIENT *client, const char *name, mqttsn_topic_type_t type, uint16_t id);
+
+/**
+ * @brief Connect now and keep reconnecting whenever the gateway is lost.
+ *
+ */
+void mqttsn_client_start(MQTTSN_CLIENT *client, uint32_t now_ms);
+
+/**
+ * @brief Publish a message, or buffer it until it can be sent.
+ *
+ * @param[in] qos   0, 1, or -1 to send without a connection (predefined and short topics only).
+ *
+ * @return
+ *      - false if the payload is too long, the topic unknown or QoS -1 used with a normal topic.
+ */
+bool mqttsn_client_publish(MQTTSN_CLIENT *client, int topic, const void *payload, size_t len, int qos,
+                           uint32_t now_ms);
+
+/**
+ * @brief Ask the gateway to treat the client as sleeping for duration_s; publishes are buffered meanwhile.
+ *
+ */
+void mqttsn_client_sleep(MQTTSN_CLIENT *client, uint16_t duration_s, uint32_t now_ms);
+
+/**
+ * @brief Leave the sleeping state: reconnect and send the buffered publishes.
+ *
+ */
+void mqttsn_client_wake(MQTTSN_CLIENT *client, uint32_t now_ms);
+
+/**
+ * @brief Handle a packet received from the gateway.
+ *
+ */
+void mqttsn_client_on_packet(MQTTSN_CLIENT *client, const uint8_t *buf, size_t len, uint32_t now_ms);
+
+/**
+ * @brief Run the retry, keep-alive and sleep timers.
+ *
+ * @return
+ *      - Milliseconds until the next timer, UINT32_MAX if none.
+ */
+uint32_t mqttsn_client_poll(MQTTSN_CLIENT *client, uint32_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,546 @@
+import argparse
+import ctypes
+import heapq
+import json
+import os
+import random
+import shutil
+import struct
+import subprocess
+import tempfile
+
+from bridge_bench import MESH_DELAY_S, TX_WINDOW_S, UDP_FRAME_LEN, Schedule, percentiles, tag_adv
+from bridge_jitter import JitterBuffer
+from bridge_merge import MergeStage, parse_range
+from bridge_trace import GatewayModel
+
+# Simulated time comparison of the two gateway backends: the UDP path (datagrams over the Thread mesh to
+# mqttconnection.py, merge stage and jitter buffer, QoS 1 MQTT to the broker) and the MQTT-SN path (mqttsn_client.c
+# compiled for the host, one PUBLISH per line to an MQTT-SN gateway next to the border router). The MQTT-SN gateway
+# is a stand-in that parses and checks every packet and answers as a transparent gateway would. Reports per sample:
+# latency from the tag to the broker, mesh datagrams and 802.15.4 frames in both directions, and LAN packets.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+MERGE_WINDOW_S = 0.05       # As mqttconnection.py
+JITTER_HOLD_S = 0.2
+BRIDGE_TICK_S = MERGE_WINDOW_S / 2    # The bridge's receive timeout
+LAN_DELAY_S = 0.001         # Border router host to broker
+POLL_S = 0.05               # GW_MQTTSN_POLL_MS
+FRAME_AIR_S = 0.004         # Each further 6LoWPAN fragment of a datagram, 127 byte frame at 250 kbps
+LOWPAN_SINGLE = 88          # UDP payload of an unfragmented frame after compressed IPv6/UDP headers
+LOWPAN_FIRST = 80
+LOWPAN_NEXT = 96
+
+# As gw_mqttsn.h
+RANGE_TOPIC = "test/topic"
+PREDEFINED_TOPICS = {1: "test/topic", 2: "test/topic/zone", 3: "test/topic/agg", 4: "test/topic/tdoa"}
+
+CONNECT, CONNACK, REGISTER, REGACK, PUBLISH, PUBACK = 0x04, 0x05, 0x0A, 0x0B, 0x0C, 0x0D
+PINGREQ, PINGRESP, DISCONNECT = 0x16, 0x17, 0x18
+RC_ACCEPTED, RC_INVALID_TOPIC_ID = 0x00, 0x02
+QOS_FLAGS = {0x00: 0, 0x20: 1, 0x60: -1}
+
+SHIM = """
+#include <stdlib.h>
+#include <string.h>
+#include "mqttsn_client.h"
+
+MQTTSN_CLIENT *sim_client_new(uint16_t keepalive_s, mqttsn_tx_fn_t tx)
+{
+    MQTTSN_CONFIG config = MQTTSN_CONFIG_DEFAULT();
+    MQTTSN_CLIENT *client = malloc(sizeof(*client));
+    config.keepalive_s = keepalive_s;
+    mqttsn_client_init(client, &config, tx, NULL);
+    return client;
+}
+
+void sim_client_stats(const MQTTSN_CLIENT *c, uint32_t *out)
+{
+    uint32_t stats[] = {c->state, c->buffer_count, c->published, c->acked, c->retransmits, c->dropped,
+                        c->buffered_max, c->registers, c->pings, c->connects, c->lost, c->packets_tx, c->packets_rx};
+    memcpy(out, stats, sizeof(stats));
+}
+"""
+
+CLIENT_STATS = ("state", "buffered", "published", "acked", "retransmits", "dropped", "buffered_max", "registers",
+                "pings", "connects", "lost", "packets_tx", "packets_rx")
+TX_FN = ctypes.CFUNCTYPE(None, ctypes.POINTER(ctypes.c_uint8), ctypes.c_size_t, ctypes.c_void_p)
+
+
+def load_client(workdir):
+    """Build mqttsn_client.c into a shared library."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run mqttsn_client.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    lib = os.path.join(workdir, "mqttsn_client.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", lib, shim,
+                    os.path.join(HERE, "mqttsn_client.c")], check=True)
+    dll = ctypes.CDLL(lib)
+    dll.sim_client_new.restype = ctypes.c_void_p
+    dll.sim_client_new.argtypes = [ctypes.c_uint16, TX_FN]
+    dll.sim_client_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint32)]
+    dll.mqttsn_client_add_topic.restype = ctypes.c_int
+    dll.mqttsn_client_add_topic.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_uint16]
+    dll.mqttsn_client_start.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    dll.mqttsn_client_publish.restype = ctypes.c_bool
+    dll.mqttsn_client_publish.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t,
+                                          ctypes.c_int, ctypes.c_uint32]
+    dll.mqttsn_client_sleep.argtypes = [ctypes.c_void_p, ctypes.c_uint16, ctypes.c_uint32]
+    dll.mqttsn_client_wake.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    dll.mqttsn_client_on_packet.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_uint32]
+    dll.mqttsn_client_poll.restype = ctypes.c_uint32
+    dll.mqttsn_client_poll.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    return dll
+
+
+def radio_frames(length):
+    if length <= LOWPAN_SINGLE:
+        return 1
+    return 1 + -(-(length - LOWPAN_FIRST) // LOWPAN_NEXT)
+
+
+def mqttsn_packet(msg_type, body):
+    if len(body) + 2 <= 255:
+        return bytes((len(body) + 2, msg_type)) + body
+    return struct.pack(">BHB", 0x01, len(body) + 4, msg_type) + body
+
+
+class Sim:
+    def __init__(self):
+        self.now = 0.0
+        self.events = []
+        self.tie = 0
+
+    def at(self, t, fn, *args):
+        heapq.heappush(self.events, (t, self.tie, fn, args))
+        self.tie += 1
+
+    def every(self, period, fn, until):
+        def tick():
+            fn()
+            if self.now + period <= until:
+                self.at(self.now + period, tick)
+        self.at(self.now + period, tick)
+
+    def run(self, until):
+        while self.events and self.events[0][0] <= until:
+            self.now, _, fn, args = heapq.heappop(self.events)
+            fn(*args)
+
+
+class Mesh:
+    """One direction of the Thread mesh: a datagram is lost if any of its fragments is, later fragments add delay."""
+
+    def __init__(self, sim, rng, loss):
+        self.sim = sim
+        self.rng = rng
+        self.loss = loss
+        self.stats = {"datagrams": 0, "frames": 0, "bytes": 0, "lost": 0}
+
+    def send(self, data, deliver):
+        frames = radio_frames(len(data))
+        self.stats["datagrams"] += 1
+        self.stats["frames"] += frames
+        self.stats["bytes"] += len(data)
+        if any(self.rng.random() < self.loss for _ in range(frames)):
+            self.stats["lost"] += 1
+            return
+        self.sim.at(self.sim.now + MESH_DELAY_S + (frames - 1) * FRAME_AIR_S, deliver, data)
+
+
+class Broker:
+    """First arrival time of every range sample, by tag and sample index."""
+
+    def __init__(self, sim, schedule):
+        self.sim = sim
+        self.schedule = schedule
+        self.delivered = {}
+        self.duplicates = 0
+        self.packets = 0
+        self.out_of_order = 0
+        self.last_j = {}
+
+    def publish(self, topic, payload, qos):
+        self.packets += 2 if qos == 1 else 1     # PUBLISH, and its PUBACK at QoS 1
+        self.sim.at(self.sim.now + LAN_DELAY_S, self._arrive, topic, payload)
+
+    def _arrive(self, topic, payload):
+        parsed = parse_range(payload) if topic == RANGE_TOPIC else None
+        if parsed is None:
+            return      # Gap markers
+        (tag, seq), _ = parsed
+        k = self.schedule.index[tag]
+        j = self.schedule.sample_index(k, seq, self.sim.now)
+        if (k, j) in self.delivered:
+            self.duplicates += 1
+            return
+        self.delivered[(k, j)] = self.sim.now
+        if j < self.last_j.get(k, -1):
+            self.out_of_order += 1
+        self.last_j[k] = max(j, self.last_j.get(k, -1))
+
+
+class GatewayFirmware:
+    """Tags heard by one gateway; the lines pending at each TX window go to the backend, as udp_socket_client_task()
+    batches them."""
+
+    def __init__(self, sim, cfg, schedule, backend):
+        self.sim = sim
+        self.model = GatewayModel()
+        self.pending = []
+        self.backend = backend
+        self.offered = 0
+        for k in range(cfg["tags"]):
+            j = 0
+            while schedule.due(k, j) < cfg["duration"]:
+                sim.at(schedule.due(k, j), self._heard, schedule, k, j)
+                j += 1
+        sim.every(TX_WINDOW_S, self._window, cfg["duration"] + TX_WINDOW_S)
+
+    def _heard(self, schedule, k, j):
+        self.offered += 1
+        adv = tag_adv(100 + (j % 500), j % 256)
+        scan = schedule.addrs[k] + struct.pack("<bB", -60, len(adv)) + adv
+        text = self.model.process(int(self.sim.now * 1e6), scan)
+        if text is not None:
+            self.pending.append(text)
+
+    def _window(self):
+        if self.pending:
+            self.backend.send_batch(self.pending)
+            self.pending = []
+
+
+class BridgePath:
+    """UDP backend: lines joined into datagrams of up to UDP_FRAME_LEN, mqttconnection.py's range path behind."""
+
+    def __init__(self, sim, up, broker, until):
+        self.sim = sim
+        self.up = up
+        self.broker = broker
+        self.merge = MergeStage(window_s=MERGE_WINDOW_S)
+        self.jitter = JitterBuffer(hold_s=JITTER_HOLD_S)
+        sim.every(BRIDGE_TICK_S, self._flush, until)
+
+    def send_batch(self, lines):
+        packed, size = [], 0
+        for text in lines + [None]:
+            if packed and (text is None or size + len(text) + 1 > UDP_FRAME_LEN):
+                self.up.send("\n".join(packed).encode(), self._receive)
+                packed, size = [], 0
+            if text is not None:
+                packed.append(text)
+                size += len(text) + 1
+
+    def _receive(self, data):
+        for line in data.decode().splitlines():
+            key, rssi = parse_range(line)
+            self._publish_ranges(self.merge.add(key, rssi, line, self.sim.now))
+        self._flush()
+
+    def _flush(self):
+        self._publish_ranges(self.merge.flush(self.sim.now))
+        for payload in self.jitter.flush(self.sim.now):
+            self.broker.publish(RANGE_TOPIC, payload, 1)
+
+    def _publish_ranges(self, payloads):
+        for payload in payloads:
+            (tag, seq), _ = parse_range(payload)
+            for out in self.jitter.add(tag, seq, payload, self.sim.now):
+                self.broker.publish(RANGE_TOPIC, out, 1)
+
+    def metrics(self):
+        return {"merge": self.merge.metrics(), "jitter": self.jitter.metrics()}
+
+
+class MqttsnGateway:
+    """MQTT-SN gateway stand-in for one client: sessions with clean session semantics, topic registration,
+    predefined and short topics, QoS -1, keep-alive and sleeping client pings. Packets that break the protocol
+    are counted as violations; a run is only valid with none."""
+
+    def __init__(self, sim, down, broker):
+        self.sim = sim
+        self.down = down
+        self.broker = broker
+        self.deliver = None         # Client side of the mesh
+        self.running = True
+        self.session = None
+        self.stats = {"connects": 0, "resumed": 0, "registers": 0, "publishes": 0, "dup_publishes": 0,
+                      "invalid_topic": 0, "pings": 0, "checkins": 0, "sleeps": 0, "unknown_client": 0,
+                      "violations": 0, "restarts": 0}
+
+    def restart(self, down_s):
+        """Crash and come back after down_s without any session."""
+        self.running = False
+        self.session = None
+        self.stats["restarts"] += 1
+        self.sim.at(self.sim.now + down_s, setattr, self, "running", True)
+
+    def _reply(self, msg_type, body=b""):
+        self.down.send(mqttsn_packet(msg_type, body), self.deliver)
+
+    def _violation(self, what):
+        self.stats["violations"] += 1
+        self.stats.setdefault("violation_kinds", {}).setdefault(what, 0)
+        self.stats["violation_kinds"][what] += 1
+
+    def receive(self, data):
+        if not self.running:
+            return
+        if data[0] == 0x01:
+            length, hdr = struct.unpack_from(">H", data, 1)[0], 3
+            if length <= 255:
+                self._violation("long length form for a short packet")
+        else:
+            length, hdr = data[0], 1
+        if length != len(data) or length < hdr + 1:
+            self._violation("length")
+            return
+        msg_type, body = data[hdr], data[hdr + 1:]
+        handler = {CONNECT: self._connect, REGISTER: self._register, PUBLISH: self._publish, PINGREQ: self._pingreq,
+                   DISCONNECT: self._disconnect}.get(msg_type)
+        if handler is None:
+            self._violation(f"type {msg_type:#x}")
+            return
+        handler(body)
+
+    def _connect(self, body):
+        if len(body) < 5 or body[1] != 0x01 or body[0] & ~0x0C:
+            self._violation("connect")
+            return
+        clean = bool(body[0] & 0x04)
+        client_id = body[4:].decode()
+        if not 1 <= len(client_id) <= 23:
+            self._violation("client id")
+        if clean or self.session is None or self.session["client_id"] != client_id:
+            self.session = {"client_id": client_id, "topics": {}, "next_id": 1}
+            self.stats["connects"] += 1
+        else:
+            self.stats["resumed"] += 1
+        self.session["state"] = "active"
+        self.session["keepalive"] = struct.unpack_from(">H", body, 2)[0]
+        self._reply(CONNACK, bytes((RC_ACCEPTED,)))
+
+    def _active(self):
+        return self.session is not None and self.session["state"] == "active"
+
+    def _register(self, body):
+        if len(body) < 5 or struct.unpack_from(">H", body)[0] != 0:
+            self._violation("register")
+            return
+        if not self._active():
+            self._violation("register without a session")
+            return
+        topic_id_msg = body[2:4]
+        name = body[4:].decode()
+        topics = self.session["topics"]
+        topic_id = next((i for i, n in topics.items() if n == name), None)
+        if topic_id is None:
+            topic_id = self.session["next_id"]
+            self.session["next_id"] += 1
+            topics[topic_id] = name
+        self.stats["registers"] += 1
+        self._reply(REGACK, struct.pack(">H", topic_id) + topic_id_msg + bytes((RC_ACCEPTED,)))
+
+    def _publish(self, body):
+        if len(body) < 5:
+            self._violation("publish")
+            return
+        flags = body[0]
+        qos = QOS_FLAGS.get(flags & 0x60)
+        topic_type = flags & 0x03
+        topic_id, msg_id = struct.unpack_from(">HH", body, 1)
+        payload = body[5:].decode()
+        if qos is None or topic_type == 0x03 or flags & 0x1C:
+            self._violation("publish flags")
+            return
+        if (msg_id == 0) != (qos <= 0) or (qos < 0 and topic_type == 0):
+            self._violation("publish msg id or qos -1 topic")
+            return
+        if qos >= 0 and not self._active():
+            # Not connected from our point of view: as after a restart, tell the client to start over
+            self.stats["unknown_client"] += 1
+            if self.session is not None and self.session["state"] != "active":
+                self._violation("publish while asleep")
+            self._reply(DISCONNECT)
+            return
+        if topic_type == 0x01:
+            name = PREDEFINED_TOPICS.get(topic_id)
+        elif topic_type == 0x02:
+            name = struct.pack(">H", topic_id).decode()
+        else:
+            name = self.session["topics"].get(topic_id)
+        if name is None:
+            self.stats["invalid_topic"] += 1
+            if qos >= 0:
+                self._reply(PUBACK, struct.pack(">HH", topic_id, msg_id) + bytes((RC_INVALID_TOPIC_ID,)))
+            return
+        self.stats["publishes"] += 1
+        self.stats["dup_publishes"] += bool(flags & 0x80)
+        self.broker.publish(name, payload, max(qos, 0))
+        if qos == 1:
+            self._reply(PUBACK, struct.pack(">HH", topic_id, msg_id) + bytes((RC_ACCEPTED,)))
+
+    def _pingreq(self, body):
+        if body:
+            # A sleeping client checking in
+            if self.session is None or self.session["client_id"] != body.decode():
+                self.stats["unknown_client"] += 1
+                return
+            if self.session["state"] == "active":
+                self._violation("check-in while active")
+            self.stats["checkins"] += 1
+        else:
+            self.stats["pings"] += 1
+        self._reply(PINGRESP)
+
+    def _disconnect(self, body):
+        if len(body) not in (0, 2):
+            self._violation("disconnect")
+            return
+        if self.session is not None and len(body) == 2:
+            self.session["state"] = "asleep"
+            self.stats["sleeps"] += 1
+        elif self.session is not None:
+            self.session = None
+        self._reply(DISCONNECT)
+
+
+class MqttsnPath:
+    """MQTT-SN backend: mqttsn_client.c set up as gw_mqttsn.c does, polled like its task."""
+
+    def __init__(self, sim, dll, up, down, broker, cfg, until):
+        self.sim = sim
+        self.dll = dll
+        self.up = up
+        self.qos = cfg["qos"]
+        self.gateway = MqttsnGateway(sim, down, broker)
+        self.gateway.deliver = self._receive
+        self.rejected = 0
+        self.tx = TX_FN(self._tx)     # Kept referenced for as long as the client lives
+        self.client = dll.sim_client_new(cfg["keepalive_s"], self.tx)
+        self.topics = [dll.mqttsn_client_add_topic(self.client, RANGE_TOPIC.encode(), 0, 0),
+                       dll.mqttsn_client_add_topic(self.client, RANGE_TOPIC.encode(), 1, 1)]
+        dll.mqttsn_client_start(self.client, self._now_ms())
+        sim.every(POLL_S, self._poll, until)
+
+    def _now_ms(self):
+        return int(self.sim.now * 1000) & 0xFFFFFFFF
+
+    def _tx(self, packet, length, ctx):
+        self.up.send(ctypes.string_at(packet, length), self.gateway.receive)
+
+    def _receive(self, data):
+        self.dll.mqttsn_client_on_packet(self.client, data, len(data), self._now_ms())
+        self._poll()
+
+    def _poll(self):
+        self.dll.mqttsn_client_poll(self.client, self._now_ms())
+
+    def send_batch(self, lines):
+        for text in lines:
+            line = text.encode()
+            if not self.dll.mqttsn_client_publish(self.client, self.topics[self.qos < 0], line, len(line), self.qos,
+                                                  self._now_ms()):
+                self.rejected += 1
+
+    def sleep(self, duration_s):
+        self.dll.mqttsn_client_sleep(self.client, duration_s, self._now_ms())
+
+    def wake(self):
+        self.dll.mqttsn_client_wake(self.client, self._now_ms())
+
+    def metrics(self):
+        out = (ctypes.c_uint32 * len(CLIENT_STATS))()
+        self.dll.sim_client_stats(self.client, out)
+        return {"client": dict(zip(CLIENT_STATS, out)), "gateway": self.gateway.stats, "rejected": self.rejected}
+
+
+def simulate(name, cfg, dll):
+    sim = Sim()
+    rng = random.Random(cfg["seed"])
+    schedule = Schedule({"seed": cfg["seed"], "rate": cfg["rate"], "t0": 0.0, "tags": cfg["tags"]})
+    until = cfg["duration"] + cfg["drain"]
+    up = Mesh(sim, rng, cfg["loss"])
+    down = Mesh(sim, rng, cfg["loss"])
+    broker = Broker(sim, schedule)
+    if cfg["backend"] == "udp":
+        path = BridgePath(sim, up, broker, until)
+    else:
+        path = MqttsnPath(sim, dll, up, down, broker, cfg, until)
+        if cfg.get("sleep_s"):
+            sim.at(cfg["sleep_at"], path.sleep, cfg["sleep_s"])
+            sim.at(cfg["duration"], path.wake)
+        if cfg.get("restart_at") is not None:
+            sim.at(cfg["restart_at"], path.gateway.restart, cfg["restart_down_s"])
+    firmware = GatewayFirmware(sim, cfg, schedule, path)
+    sim.run(until)
+
+    latency = [t - schedule.due(k, j) for (k, j), t in broker.delivered.items()]
+    samples = max(firmware.offered, 1)
+    per_sample = lambda v: round(v / samples, 3)
+    result = {
+        "scenario": name,
+        "backend": cfg["backend"],
+        "qos": cfg.get("qos"),
+        "offered": firmware.offered,
+        "delivered": len(broker.delivered),
+        "delivered_ratio": round(len(broker.delivered) / samples, 4),
+        "duplicates": broker.duplicates,
+        "out_of_order": broker.out_of_order,
+        "latency": percentiles(latency),
+        "per_sample": {
+            "mesh_datagrams_up": per_sample(up.stats["datagrams"]),
+            "mesh_datagrams_down": per_sample(down.stats["datagrams"]),
+            "radio_frames": per_sample(up.stats["frames"] + down.stats["frames"]),
+            "mesh_bytes": per_sample(up.stats["bytes"] + down.stats["bytes"]),
+            "lan_packets": per_sample(broker.packets),
+            "packets": per_sample(up.stats["datagrams"] + down.stats["datagrams"] + broker.packets),
+        },
+        "mesh": {"up": up.stats, "down": down.stats},
+    }
+    if cfg.get("restart_at") is not None:
+        up_at = cfg["restart_at"] + cfg["restart_down_s"]
+        after = [t for t in broker.delivered.values() if t >= up_at]
+        result["recovered_after_s"] = round(min(after) - up_at, 3) if after else None
+    result.update(path.metrics())
+    return result
+
+
+SCENARIOS = {
+    "udp": {"backend": "udp"},
+    "mqttsn-qos0": {"backend": "mqttsn", "qos": 0},
+    "mqttsn-qos1": {"backend": "mqttsn", "qos": 1},
+    "mqttsn-qos-1": {"backend": "mqttsn", "qos": -1},
+    # A quiet site: the client sleeps after 2 s, reconnects to flush whenever its buffer fills or a check-in is due,
+    # and is woken up at the end of the run
+    "mqttsn-sleep": {"backend": "mqttsn", "qos": 1, "tags": 2, "rate": 1.0, "sleep_at": 2.0, "sleep_s": 20},
+    # The MQTT-SN gateway crashes for 2 s a third into the run and comes back without the session
+    "mqttsn-restart": {"backend": "mqttsn", "qos": 0, "restart_at": None, "restart_down_s": 2.0},
+}
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Latency and packets per sample: UDP+bridge vs MQTT-SN backend")
+    parser.add_argument("--tags", type=int, default=20)
+    parser.add_argument("--rate", type=float, default=10.0, help="ranges per tag per second")
+    parser.add_argument("--duration", type=float, default=30.0, help="simulated seconds")
+    parser.add_argument("--loss", type=float, default=0.01, help="loss per 802.15.4 frame after MAC retries")
+    parser.add_argument("--keepalive", type=int, default=60, help="MQTT-SN keep-alive, s")
+    parser.add_argument("--scenarios", default=",".join(SCENARIOS))
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_client(workdir)
+        for name in args.scenarios.split(","):
+            cfg = {"tags": args.tags, "rate": args.rate, "duration": args.duration, "drain": 5.0, "loss": args.loss,
+                   "keepalive_s": args.keepalive, "seed": args.seed}
+            cfg.update(SCENARIOS[name])
+            if "restart_at" in cfg and cfg["restart_at"] is None:
+                cfg["restart_at"] = args.duration / 3
+            print(json.dumps(simulate(name, cfg, dll)))
@@ -0,0 +1,249 @@
+import argparse
+import ctypes
+import json
+import math
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+# Simulated time check of tag ownership between gateways: one tag_owner.c table (compiled for the host) per
+# gateway, claims exchanged every GW_OWNER_CLAIM_PERIOD_MS in the gw_owner.c datagram layout over a simulated
+# multicast group with per-receiver delay and loss. Gateways stand in a line; tags walk up and down it, so the
+# strongest receiver of each tag keeps changing, with log-distance path loss and shadowing on every reception.
+# One gateway is switched off for a while and comes back with an empty table. Each range a gateway hears (minus
+# a --miss share) goes through tag_owner_observe() as gw_owner_should_forward() does; after every range, the
+# gateways still owning the tag are counted. The check fails if the tag has exactly one owner for fewer than
+# --min-single of the ranges heard, or if a tag goes without an owner, or with two, for longer than the claim
+# timing allows with at most one claim lost in a row. Ranges the owner itself missed are not forwarded by anyone
+# and are reported as owner_missed.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+CLAIM_PERIOD_MS = 400       # GW_OWNER_CLAIM_PERIOD_MS
+CLAIM_EXPIRE_MS = 1200      # TAG_OWNER_CLAIM_EXPIRE_MS
+HEARD_MS = 800              # TAG_OWNER_HEARD_MS
+MAX_CLAIMS = 32             # GW_OWNER_MAX_CLAIMS
+CLAIM_HDR = struct.Struct("<2sBBI")     # 'T', 'O', version, count, sender id
+CLAIM = struct.Struct("<6sb")           # Tag address, rssi
+MCAST_DELAY_MS = (5, 60)    # One to a few mesh hops
+TX_POWER_DBM = -45          # RSSI at 1 m
+PATH_LOSS_EXP = 2.2
+SHADOWING_DB = 3.0
+SENSITIVITY_DBM = -92
+
+# Without an owner: the owner's last claim outlives its last reception by up to HEARD_MS plus a claim period,
+# then CLAIM_EXPIRE_MS. With two: the old owner yields once the new owner's first claim reaches it, up to one
+# period after the takeover plus the mesh delay, one more period if that copy is lost, and until its next range.
+# Stretches are measured between ranges, so both bounds also allow one range interval
+DARK_BOUND_MS = HEARD_MS + CLAIM_PERIOD_MS + CLAIM_EXPIRE_MS + MCAST_DELAY_MS[1]
+DOUBLE_BOUND_MS = 3 * CLAIM_PERIOD_MS + MCAST_DELAY_MS[1]
+
+SHIM = """
+#include <stdlib.h>
+#include "tag_owner.c"
+
+TAG_OWNER_TABLE *sim_table_new(uint32_t self_id)
+{
+    TAG_OWNER_TABLE *table = malloc(sizeof(*table));
+    tag_owner_init(table, self_id);
+    return table;
+}
+
+// Whether the table still owns the tag: build_claims() only drops a tag it stopped hearing on the next claim
+bool sim_owns(TAG_OWNER_TABLE *table, const uint8_t *addr, uint32_t now_ms)
+{
+    TAG_OWNER_ENTRY *entry = tag_owner_find(table, addr, false, now_ms);
+    return entry != NULL && entry->owned && now_ms - entry->heard_ms <= TAG_OWNER_HEARD_MS;
+}
+"""
+
+
+def load_owner(workdir):
+    """Build tag_owner.c into a shared library."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run tag_owner.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    lib = os.path.join(workdir, "tag_owner.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", lib, shim], check=True)
+    dll = ctypes.CDLL(lib)
+    dll.sim_table_new.restype = ctypes.c_void_p
+    dll.sim_table_new.argtypes = [ctypes.c_uint32]
+    dll.tag_owner_observe.restype = ctypes.c_bool
+    dll.tag_owner_observe.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int8, ctypes.c_uint32]
+    dll.tag_owner_peer_claim.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_char_p, ctypes.c_uint32]
+    dll.sim_owns.restype = ctypes.c_bool
+    dll.sim_owns.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint32]
+    dll.tag_owner_build_claims.restype = ctypes.c_int
+    dll.tag_owner_build_claims.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_char_p, ctypes.c_int,
+                                           ctypes.POINTER(ctypes.c_int)]
+    return dll
+
+
+class Gateway:
+    def __init__(self, dll, self_id, x):
+        self.dll, self.self_id, self.x = dll, self_id, x
+        self.table = dll.sim_table_new(self_id)
+        self.next_claims_ms = 0
+        self.up = True
+
+    def restart(self, now_ms):
+        """Power cycle: an empty table, claims on the gateway's own period from now."""
+        self.table = self.dll.sim_table_new(self.self_id)
+        self.next_claims_ms = now_ms
+
+    def claim_datagrams(self, now_ms):
+        """The datagrams gw_owner_send_claims() sends now."""
+        datagrams, cursor = [], ctypes.c_int(0)
+        claims = ctypes.create_string_buffer(CLAIM.size * MAX_CLAIMS)
+        while True:
+            count = self.dll.tag_owner_build_claims(self.table, now_ms, claims, MAX_CLAIMS, ctypes.byref(cursor))
+            if count == 0:
+                break
+            datagrams.append(CLAIM_HDR.pack(b"TO", 1, count, self.self_id) + claims.raw[:count * CLAIM.size])
+            if count < MAX_CLAIMS:
+                break
+        return datagrams
+
+    def handle_claims(self, buf, now_ms):
+        """As gw_owner_handle_claims()."""
+        magic, version, count, peer_id = CLAIM_HDR.unpack_from(buf)
+        if magic != b"TO" or version != 1 or len(buf) < CLAIM_HDR.size + count * CLAIM.size:
+            return
+        for i in range(count):
+            claim = buf[CLAIM_HDR.size + i * CLAIM.size:CLAIM_HDR.size + (i + 1) * CLAIM.size]
+            self.dll.tag_owner_peer_claim(self.table, peer_id, claim, now_ms)
+
+
+def tag_position(cfg, k, t_ms):
+    """Tags walk up and down the line of gateways, each at its own speed and phase."""
+    span = cfg["spacing"] * (cfg["gateways"] - 1) + 2 * cfg["margin"]
+    speed = cfg["speed"] * (0.5 + (k * 0.618) % 1)
+    d = (k * span / cfg["tags"] + speed * t_ms / 1000) % (2 * span)
+    return (d if d < span else 2 * span - d) - cfg["margin"], 2.0 + k % 3
+
+
+def rssi_at(gw, pos, rng):
+    d = max(1.0, math.hypot(pos[0] - gw.x, pos[1]))
+    return TX_POWER_DBM - 10 * PATH_LOSS_EXP * math.log10(d) + rng.gauss(0, SHADOWING_DB)
+
+
+def simulate(cfg, dll, rng):
+    gateways = [Gateway(dll, 0x1000 + g, g * cfg["spacing"]) for g in range(cfg["gateways"])]
+    for gw in gateways:
+        gw.next_claims_ms = rng.randrange(CLAIM_PERIOD_MS)
+    off_gw, off_ms, on_ms = cfg["off"]
+    in_flight = []              # (delivery ms, receiver, datagram)
+    period_ms = int(1000 / cfg["rate"])
+    phases = [rng.randrange(period_ms) for _ in range(cfg["tags"])]
+    addrs = [bytes((0x24, 0x0a, 0xc4, 0, k >> 8, k & 0xff)) for k in range(cfg["tags"])]
+    stats = {"ranges": 0, "unheard": 0, "one_owner": 0, "two_owners": 0, "no_owner": 0, "forwarded_once": 0,
+             "forwarded_twice": 0, "owner_missed": 0, "claim_datagrams": 0}
+    # Per tag: start of the current stretch without an owner / with two, and the longest of each
+    since = {"dark": [None] * cfg["tags"], "double": [None] * cfg["tags"]}
+    longest = {"dark_ms": 0, "double_ms": 0}
+    worst = {"dark": None, "double": None}
+
+    def stretch(kind, k, t, active):
+        if active:
+            since[kind][k] = t if since[kind][k] is None else since[kind][k]
+        elif since[kind][k] is not None:
+            if t - since[kind][k] > longest[kind + "_ms"]:
+                longest[kind + "_ms"] = t - since[kind][k]
+                worst[kind] = {"tag": k, "from_ms": since[kind][k], "to_ms": t}
+            since[kind][k] = None
+
+    for t in range(cfg["duration_ms"]):
+        if t == off_ms:
+            gateways[off_gw].up = False
+        elif t == on_ms:
+            gateways[off_gw].up = True
+            gateways[off_gw].restart(t)
+        # Claims due now go out to every other gateway, some lost, each after its own mesh delay
+        for gw in gateways:
+            if gw.up and t >= gw.next_claims_ms:
+                gw.next_claims_ms += CLAIM_PERIOD_MS
+                for datagram in gw.claim_datagrams(t):
+                    stats["claim_datagrams"] += 1
+                    for peer in gateways:
+                        if peer is not gw and rng.random() >= cfg["loss"]:
+                            in_flight.append((t + rng.randint(*MCAST_DELAY_MS), peer, datagram))
+        if in_flight:
+            due = [f for f in in_flight if f[0] <= t]
+            in_flight = [f for f in in_flight if f[0] > t]
+            for _, peer, datagram in due:
+                if peer.up:
+                    peer.handle_claims(datagram, t)
+
+        for k in range(cfg["tags"]):
+            if (t - phases[k]) % period_ms:
+                continue
+            pos = tag_position(cfg, k, t)
+            forwarding, heard = 0, 0
+            for gw in gateways:
+                rssi = rssi_at(gw, pos, rng)
+                if not gw.up or rssi < SENSITIVITY_DBM:
+                    continue
+                heard += 1
+                # A range the gateway could hear but missed: its table is not touched
+                if rng.random() >= cfg["miss"]:
+                    forwarding += dll.tag_owner_observe(gw.table, addrs[k], max(-128, int(rssi)), t)
+            stats["ranges"] += 1
+            if heard == 0:
+                stats["unheard"] += 1
+                stretch("dark", k, t, False)
+                stretch("double", k, t, False)
+                continue
+            owners = sum(dll.sim_owns(gw.table, addrs[k], t) for gw in gateways if gw.up)
+            stats["one_owner"] += owners == 1
+            stats["two_owners"] += owners > 1
+            stats["no_owner"] += owners == 0
+            stats["forwarded_once"] += forwarding == 1
+            stats["forwarded_twice"] += forwarding > 1
+            stats["owner_missed"] += owners > 0 and forwarding == 0
+            stretch("dark", k, t, owners == 0)
+            stretch("double", k, t, owners > 1)
+
+    heard = stats["ranges"] - stats["unheard"]
+    stats["one_owner_share"] = round(stats["one_owner"] / heard, 4) if heard else 1.0
+    stats.update(longest)
+    stats["worst"] = worst
+    stats["dark_bound_ms"] = DARK_BOUND_MS + period_ms
+    stats["double_bound_ms"] = DOUBLE_BOUND_MS + period_ms
+    return stats
+
+
+# python3 owner_sim.py --gateways 3 --tags 30 --duration 120 --loss 0.05
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="One owner per tag across gateways, through RSSI swaps and loss")
+    parser.add_argument("--gateways", type=int, default=3)
+    parser.add_argument("--tags", type=int, default=30)
+    parser.add_argument("--rate", type=float, default=5.0, help="ranges per second per tag")
+    parser.add_argument("--spacing", type=float, default=12.0, help="distance between gateways, m")
+    parser.add_argument("--speed", type=float, default=1.2, help="walking speed, m/s")
+    parser.add_argument("--duration", type=float, default=120.0, help="simulated seconds")
+    parser.add_argument("--loss", type=float, default=0.05, help="claim datagram loss per receiver")
+    parser.add_argument("--miss", type=float, default=0.1, help="share of ranges a gateway in range misses")
+    parser.add_argument("--off", default="1,40,70", help="<gateway>,<off s>,<on s>: a gateway switched off")
+    parser.add_argument("--min-single", type=float, default=0.95,
+                        help="share of ranges heard while exactly one gateway owns the tag")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    off = [float(v) for v in args.off.split(",")]
+    cfg = {"gateways": args.gateways, "tags": args.tags, "rate": args.rate, "spacing": args.spacing, "margin": 4.0,
+           "speed": args.speed, "duration_ms": int(args.duration * 1000), "loss": args.loss, "miss": args.miss,
+           "off": (int(off[0]), int(off[1] * 1000), int(off[2] * 1000))}
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_owner(workdir)
+        result = simulate(cfg, dll, random.Random(args.seed))
+    result["ok"] = (result["one_owner_share"] >= args.min_single and result["dark_ms"] <= result["dark_bound_ms"] and
+                    result["double_ms"] <= result["double_bound_ms"])
+    print(json.dumps(result))
+    sys.exit(0 if result["ok"] else 1)
@@ -0,0 +1,128 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "radio_coex.h"
+
+#include <inttypes.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ble_adv_worker.h"
+#include "ble_scan_filter.h"
+#include "mem_budget.h"
+#include "openthread/cli.h"
+
+#define COEX_TAG "radio_coex"
+
+static RADIO_COEX_POLICY coex_policy;
+static portMUX_TYPE coex_lock = portMUX_INITIALIZER_UNLOCKED;
+static radio_coex_queue_depth_fn_t coex_queue_depth;
+static uint32_t coex_last_advs;
+
+GATEWAY_TASK_DEFINE(coex_task, RADIO_COEX_TASK_STACK_SIZE);
+
+static uint32_t radio_coex_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void radio_coex_update(void)
+{
+    BLE_ADV_STATS stats;
+    uint16_t old_window, new_window;
+
+    ble_adv_get_stats(&stats);
+    // "blestats reset" zeroes the counter, the period it happened in counts as no advertisements
+    uint32_t advs = stats.enqueued >= coex_last_advs ? stats.enqueued - coex_last_advs : 0;
+    uint32_t depth = coex_queue_depth();
+    coex_last_advs = stats.enqueued;
+
+    portENTER_CRITICAL(&coex_lock);
+    old_window = coex_policy.window;
+    new_window = radio_coex_policy_update(&coex_policy, radio_coex_now_ms(), advs, depth);
+    portEXIT_CRITICAL(&coex_lock);
+
+    if (new_window != old_window) {
+        ESP_LOGD(COEX_TAG, "Scan window 0x%02x -> 0x%02x", old_window, new_window);
+        ble_scan_filter_set_window(new_window);
+    }
+}
+
+// Runs the policy in a task of its own: applying a new window takes the scan lock and calls into GAP
+
+static void radio_coex_task(void *arg)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (true) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(RADIO_COEX_UPDATE_PERIOD_MS));
+        radio_coex_update();
+    }
+}
+
+esp_err_t radio_coex_start(radio_coex_queue_depth_fn_t queue_depth)
+{
+    const RADIO_COEX_CONFIG config = RADIO_COEX_CONFIG_DEFAULT();
+
+    coex_queue_depth = queue_depth;
+    radio_coex_policy_init(&coex_policy, &config, radio_coex_now_ms());
+    return GATEWAY_TASK_CREATE(coex_task, radio_coex_task, "radio_coex", NULL, RADIO_COEX_TASK_PRIORITY, NULL);
+}
+
+uint32_t radio_coex_tx_wait_ms(uint32_t queue_depth, uint32_t oldest_age_ms)
+{
+    bool want_tx;
+    uint32_t max_wait_ms;
+
+    portENTER_CRITICAL(&coex_lock);
+    want_tx = radio_coex_policy_want_tx(&coex_policy, queue_depth, oldest_age_ms);
+    max_wait_ms = coex_policy.config.tx_max_wait_ms;
+    portEXIT_CRITICAL(&coex_lock);
+
+    if (want_tx || oldest_age_ms >= max_wait_ms) {
+        return 0;
+    }
+    return max_wait_ms - oldest_age_ms;
+}
+
+void radio_coex_tx_window_begin(void)
+{
+    portENTER_CRITICAL(&coex_lock);
+    radio_coex_policy_tx_begin(&coex_policy, radio_coex_now_ms());
+    portEXIT_CRITICAL(&coex_lock);
+    ble_scan_filter_pause(true);
+}
+
+void radio_coex_tx_window_end(void)
+{
+    ble_scan_filter_pause(false);
+    portENTER_CRITICAL(&coex_lock);
+    radio_coex_policy_tx_end(&coex_policy, radio_coex_now_ms());
+    portEXIT_CRITICAL(&coex_lock);
+}
+
+otError esp_ot_process_coex(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    RADIO_COEX_POLICY policy;
+
+    portENTER_CRITICAL(&coex_lock);
+    policy = coex_policy;
+    portEXIT_CRITICAL(&coex_lock);
+
+    uint64_t total = policy.total_time_ms > 0 ? policy.total_time_ms : 1;
+    otCliOutputFormat("scan interval: 0x%02x\twindow: 0x%02x (%u%% duty)\n", policy.config.scan_interval,
+                      policy.window, policy.window * 100 / policy.config.scan_interval);
+    otCliOutputFormat("tag adv rate: %" PRIu32 ".%02" PRIu32 "/s of scanning\n", policy.adv_rate_x100 / 100,
+                      policy.adv_rate_x100 % 100);
+    otCliOutputFormat("time share: ble scan %u%%, thread tx windows %u%%, other %u%%\n",
+                      (unsigned)(policy.scan_time_ms * 100 / total), (unsigned)(policy.tx_time_ms * 100 / total),
+                      (unsigned)((total - policy.scan_time_ms - policy.tx_time_ms) * 100 / total));
+    otCliOutputFormat("tx windows: %" PRIu32 "\twindow changes: %" PRIu32 "\n", policy.tx_windows,
+                      policy.window_changes);
+    return OT_ERROR_NONE;
+}
@@ -0,0 +1,70 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "radio_coex_policy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RADIO_COEX_UPDATE_PERIOD_MS 1000
+#define RADIO_COEX_TASK_STACK_SIZE 2560
+#define RADIO_COEX_TASK_PRIORITY 4          // Above the UDP sender, below the BLE scanner
+
+/**
+ * @brief Returns the number of samples waiting for Thread TX.
+ *
+ */
+typedef uint32_t (*radio_coex_queue_depth_fn_t)(void);
+
+/**
+ * @brief Start the task adapting the scan window every RADIO_COEX_UPDATE_PERIOD_MS.
+ *
+ * @param[in] queue_depth   Reports the UDP send backlog.
+ *
+ * @return
+ *      - ESP_OK on success.
+ */
+esp_err_t radio_coex_start(radio_coex_queue_depth_fn_t queue_depth);
+
+/**
+ * @brief How long the sender should keep collecting before asking for a TX window.
+ *
+ * @param[in] queue_depth       Samples waiting, including the one held by the sender.
+ * @param[in] oldest_age_ms     Age of the oldest waiting sample.
+ *
+ * @return
+ *      - 0 if a TX window should be opened now, otherwise the time to wait in milliseconds.
+ */
+uint32_t radio_coex_tx_wait_ms(uint32_t queue_depth, uint32_t oldest_age_ms);
+
+/**
+ * @brief Pause BLE scanning for an exclusive Thread TX window.
+ *
+ */
+void radio_coex_tx_window_begin(void);
+
+/**
+ * @brief Close the TX window and give the radio back to BLE scanning.
+ *
+ */
+void radio_coex_tx_window_end(void);
+
+/**
+ * @brief User command "coex" process.
+ *
+ */
+otError esp_ot_process_coex(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,107 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "radio_coex_policy.h"
+
+#include <string.h>
+
+void radio_coex_policy_init(RADIO_COEX_POLICY *policy, const RADIO_COEX_CONFIG *config, uint32_t now_ms)
+{
+    memset(policy, 0, sizeof(*policy));
+    policy->config = *config;
+    if (policy->config.max_window > policy->config.scan_interval) {
+        policy->config.max_window = policy->config.scan_interval;
+    }
+    if (policy->config.min_window > policy->config.max_window) {
+        policy->config.min_window = policy->config.max_window;
+    }
+    policy->window = policy->config.max_window;
+    policy->last_update_ms = now_ms;
+}
+
+// Account the elapsed period to scanning (window share of the interval) outside of TX windows
+static void radio_coex_policy_account(RADIO_COEX_POLICY *policy, uint32_t now_ms)
+{
+    uint32_t elapsed = now_ms - policy->last_update_ms;
+
+    policy->total_time_ms += elapsed;
+    if (!policy->tx_open) {
+        policy->scan_time_ms += (uint64_t)elapsed * policy->window / policy->config.scan_interval;
+    }
+    policy->last_update_ms = now_ms;
+}
+
+uint16_t radio_coex_policy_update(RADIO_COEX_POLICY *policy, uint32_t now_ms, uint32_t advs, uint32_t queue_depth)
+{
+    const RADIO_COEX_CONFIG *config = &policy->config;
+    uint32_t elapsed = now_ms - policy->last_update_ms;
+
+    radio_coex_policy_account(policy, now_ms);
+    if (elapsed == 0) {
+        return policy->window;
+    }
+
+    // Advertisements are only heard while scanning: dividing by the time scanned, not the time elapsed, keeps a
+    // narrow window from lowering the rate that sizes the window, which would settle far below the demand and
+    // stay at the floor after a quiet period
+    uint64_t scanned_ms = policy->scan_time_ms - policy->rate_scan_ms;
+    policy->rate_advs += advs;
+    if (scanned_ms > 0) {
+        uint32_t rate_x100 = (uint32_t)((uint64_t)policy->rate_advs * 100000 / scanned_ms);
+        policy->adv_rate_x100 = (policy->adv_rate_x100 * (100 - config->rate_alpha_pct) +
+                                 rate_x100 * config->rate_alpha_pct) / 100;
+        policy->rate_advs = 0;
+        policy->rate_scan_ms = policy->scan_time_ms;
+    }
+
+    // Scan demand grows with the adv rate we are actually seeing
+    uint32_t window = config->min_window;
+    if (config->advs_per_window_unit > 0) {
+        window += policy->adv_rate_x100 / config->advs_per_window_unit;
+    }
+    if (window > config->max_window) {
+        window = config->max_window;
+    }
+
+    // A TX backlog takes radio time back from scanning, linearly down to the floor at queue_high
+    if (queue_depth >= config->queue_high) {
+        window = config->min_window;
+    } else if (queue_depth > 0 && config->queue_high > 0) {
+        window -= (window - config->min_window) * queue_depth / config->queue_high;
+    }
+
+    if (window != policy->window) {
+        policy->window = (uint16_t)window;
+        policy->window_changes++;
+    }
+    return policy->window;
+}
+
+bool radio_coex_policy_want_tx(const RADIO_COEX_POLICY *policy, uint32_t queue_depth, uint32_t oldest_age_ms)
+{
+    if (queue_depth == 0 || policy->tx_open) {
+        return false;
+    }
+    return queue_depth >= policy->config.tx_batch_min || oldest_age_ms >= policy->config.tx_max_wait_ms;
+}
+
+void radio_coex_policy_tx_begin(RADIO_COEX_POLICY *policy, uint32_t now_ms)
+{
+    radio_coex_policy_account(policy, now_ms);
+    policy->tx_open = true;
+    policy->tx_open_ms = now_ms;
+    policy->tx_windows++;
+}
+
+void radio_coex_policy_tx_end(RADIO_COEX_POLICY *policy, uint32_t now_ms)
+{
+    if (!policy->tx_open) {
+        return;
+    }
+    radio_coex_policy_account(policy, now_ms);
+    policy->tx_time_ms += now_ms - policy->tx_open_ms;
+    policy->tx_open = false;
+}
@@ -0,0 +1,102 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Tuning of the BLE scan / Thread TX time-share policy. Scan units are 0.625 ms.
+ *
+ */
+typedef struct radio_coex_config {
+    uint16_t scan_interval;         // Fixed scan interval
+    uint16_t min_window;            // Scan window floor, keeps tags visible when idle
+    uint16_t max_window;            // Scan window ceiling, must not exceed scan_interval
+    uint32_t advs_per_window_unit;  // Adv rate (per second of scanning, x100) that justifies one window unit
+    uint32_t queue_high;            // Pending samples at which the window is squeezed to the floor
+    uint32_t tx_batch_min;          // Pending samples that justify a TX window right away
+    uint32_t tx_max_wait_ms;        // Oldest pending sample age that forces a TX window
+    uint32_t rate_alpha_pct;        // EWMA weight of the newest adv rate measurement, in percent
+} RADIO_COEX_CONFIG;
+
+#define RADIO_COEX_CONFIG_DEFAULT() {           \
+    .scan_interval = 0x50,                      \
+    .min_window = 0x10,                         \
+    .max_window = 0x48,                         \
+    .advs_per_window_unit = 50,                 \
+    .queue_high = 16,                           \
+    .tx_batch_min = 4,                          \
+    .tx_max_wait_ms = 200,                      \
+    .rate_alpha_pct = 30,                       \
+}
+
+/**
+ * @brief Policy state and time-share statistics.
+ *
+ */
+typedef struct radio_coex_policy {
+    RADIO_COEX_CONFIG config;
+    uint32_t adv_rate_x100;     // Smoothed accepted adv rate per second of scanning, x100
+    uint32_t rate_advs;         // Advertisements not yet in the rate, for want of scanning time to divide by
+    uint64_t rate_scan_ms;      // scan_time_ms when the rate was last updated
+    uint16_t window;            // Current scan window
+    uint32_t last_update_ms;
+    bool tx_open;
+    uint32_t tx_open_ms;
+    uint64_t scan_time_ms;      // Radio time granted to BLE scanning
+    uint64_t tx_time_ms;        // Time spent in exclusive Thread TX windows
+    uint64_t total_time_ms;
+    uint32_t tx_windows;
+    uint32_t window_changes;
+} RADIO_COEX_POLICY;
+
+/**
+ * @brief Initialise the policy at the maximum scan window.
+ *
+ */
+void radio_coex_policy_init(RADIO_COEX_POLICY *policy, const RADIO_COEX_CONFIG *config, uint32_t now_ms);
+
+/**
+ * @brief Feed one observation period and compute the scan window.
+ *
+ * @param[in] policy        The policy.
+ * @param[in] now_ms        Current time in milliseconds.
+ * @param[in] advs          Tag advertisements accepted since the previous update.
+ * @param[in] queue_depth   Samples waiting for Thread TX.
+ *
+ * @return
+ *      - The scan window to apply, in 0.625 ms units.
+ */
+uint16_t radio_coex_policy_update(RADIO_COEX_POLICY *policy, uint32_t now_ms, uint32_t advs, uint32_t queue_depth);
+
+/**
+ * @brief Decide whether the sender should take an exclusive TX window now.
+ *
+ * @param[in] policy            The policy.
+ * @param[in] queue_depth       Samples waiting for Thread TX.
+ * @param[in] oldest_age_ms     Age of the oldest waiting sample.
+ *
+ * @return
+ *      - true if a TX window should be opened.
+ */
+bool radio_coex_policy_want_tx(const RADIO_COEX_POLICY *policy, uint32_t queue_depth, uint32_t oldest_age_ms);
+
+/**
+ * @brief Account the start and end of an exclusive TX window.
+ *
+ */
+void radio_coex_policy_tx_begin(RADIO_COEX_POLICY *policy, uint32_t now_ms);
+void radio_coex_policy_tx_end(RADIO_COEX_POLICY *policy, uint32_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,171 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "rel_link.h"
+
+#include <string.h>
+
+static uint32_t rel_link_clamp_rto(uint32_t rto_ms)
+{
+    if (rto_ms < REL_LINK_RTO_MIN_MS) {
+        return REL_LINK_RTO_MIN_MS;
+    }
+    return rto_ms > REL_LINK_RTO_MAX_MS ? REL_LINK_RTO_MAX_MS : rto_ms;
+}
+
+static void rel_link_rtt_sample(REL_LINK *link, uint32_t rtt_ms)
+{
+    if (!link->rtt_valid) {
+        link->srtt_ms = rtt_ms;
+        link->rttvar_ms = rtt_ms / 2;
+        link->rtt_valid = true;
+    } else {
+        uint32_t err = rtt_ms > link->srtt_ms ? rtt_ms - link->srtt_ms : link->srtt_ms - rtt_ms;
+        link->rttvar_ms = (3 * link->rttvar_ms + err) / 4;
+        link->srtt_ms = (7 * link->srtt_ms + rtt_ms) / 8;
+    }
+    link->rto_ms = rel_link_clamp_rto(link->srtt_ms + 4 * link->rttvar_ms);
+}
+
+static void rel_link_ack_slot(REL_LINK *link, REL_LINK_SLOT *slot, uint32_t now_ms)
+{
+    // Karn: a retransmitted frame gives an ambiguous RTT
+    if (slot->retries == 0) {
+        rel_link_rtt_sample(link, now_ms - slot->sent_ms);
+    }
+    slot->used = false;
+    link->acked++;
+}
+
+// Oldest sequence number in flight, written into every frame (re)transmitted
+static void rel_link_set_base(REL_LINK *link, REL_LINK_SLOT *slot)
+{
+    uint16_t base = slot->seq;
+
+    for (int i = 0; i < REL_LINK_WINDOW; i++) {
+        if (link->slots[i].used && (int16_t)(link->slots[i].seq - base) < 0) {
+            base = link->slots[i].seq;
+        }
+    }
+    slot->frame[4] = base & 0xFF;
+    slot->frame[5] = base >> 8;
+}
+
+void rel_link_init(REL_LINK *link, uint16_t first_seq)
+{
+    memset(link, 0, sizeof(*link));
+    link->next_seq = first_seq;
+    link->rto_ms = REL_LINK_RTO_INIT_MS;
+}
+
+const uint8_t *rel_link_send(REL_LINK *link, const void *payload, size_t len, uint32_t now_ms, size_t *frame_len)
+{
+    REL_LINK_SLOT *slot = NULL;
+
+    if (len > REL_LINK_FRAME_MAX) {
+        return NULL;
+    }
+    for (int i = 0; i < REL_LINK_WINDOW; i++) {
+        if (!link->slots[i].used) {
+            slot = &link->slots[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        link->window_full++;
+        return NULL;
+    }
+
+    slot->used = true;
+    slot->retries = 0;
+    slot->seq = link->next_seq++;
+    slot->len = REL_LINK_HDR_LEN + len;
+    slot->sent_ms = now_ms;
+    slot->rto_ms = link->rto_ms;
+    slot->frame[0] = REL_LINK_MAGIC;
+    slot->frame[1] = REL_LINK_TYPE_DATA;
+    slot->frame[2] = slot->seq & 0xFF;
+    slot->frame[3] = slot->seq >> 8;
+    memcpy(&slot->frame[REL_LINK_HDR_LEN], payload, len);
+    rel_link_set_base(link, slot);
+    link->sent++;
+
+    *frame_len = slot->len;
+    return slot->frame;
+}
+
+bool rel_link_on_ack(REL_LINK *link, const uint8_t *buf, size_t len, uint32_t now_ms)
+{
+    if (len < REL_LINK_ACK_LEN || buf[0] != REL_LINK_MAGIC || buf[1] != REL_LINK_TYPE_ACK) {
+        return false;
+    }
+    uint16_t cum = buf[2] | (buf[3] << 8);
+    uint32_t sack = buf[4] | (buf[5] << 8) | (buf[6] << 16) | ((uint32_t)buf[7] << 24);
+
+    link->acks++;
+    for (int i = 0; i < REL_LINK_WINDOW; i++) {
+        REL_LINK_SLOT *slot = &link->slots[i];
+        if (!slot->used) {
+            continue;
+        }
+        int16_t offset = (int16_t)(slot->seq - cum);
+        if (offset < 0 || (offset >= 1 && offset <= 32 && (sack & (1u << (offset - 1))))) {
+            rel_link_ack_slot(link, slot, now_ms);
+        }
+    }
+    return true;
+}
+
+const uint8_t *rel_link_next_retransmit(REL_LINK *link, uint32_t now_ms, size_t *frame_len)
+{
+    for (int i = 0; i < REL_LINK_WINDOW; i++) {
+        REL_LINK_SLOT *slot = &link->slots[i];
+        if (!slot->used || now_ms - slot->sent_ms < slot->rto_ms) {
+            continue;
+        }
+        if (slot->retries == REL_LINK_MAX_RETRIES) {
+            slot->used = false;
+            link->expired++;
+            continue;
+        }
+        slot->retries++;
+        slot->sent_ms = now_ms;
+        slot->rto_ms = rel_link_clamp_rto(slot->rto_ms * 2);
+        rel_link_set_base(link, slot);
+        link->retransmits++;
+        *frame_len = slot->len;
+        return slot->frame;
+    }
+    return NULL;
+}
+
+uint32_t rel_link_next_timeout_ms(const REL_LINK *link, uint32_t now_ms)
+{
+    uint32_t timeout_ms = UINT32_MAX;
+
+    for (int i = 0; i < REL_LINK_WINDOW; i++) {
+        const REL_LINK_SLOT *slot = &link->slots[i];
+        if (!slot->used) {
+            continue;
+        }
+        uint32_t elapsed_ms = now_ms - slot->sent_ms;
+        uint32_t left_ms = elapsed_ms >= slot->rto_ms ? 0 : slot->rto_ms - elapsed_ms;
+        if (left_ms < timeout_ms) {
+            timeout_ms = left_ms;
+        }
+    }
+    return timeout_ms;
+}
+
+int rel_link_in_flight(const REL_LINK *link)
+{
+    int count = 0;
+
+    for (int i = 0; i < REL_LINK_WINDOW; i++) {
+        count += link->slots[i].used;
+    }
+    return count;
+}
@@ -0,0 +1,118 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reliable frames: magic, REL_LINK_TYPE_DATA, seq (u16 LE), base (u16 LE), payload. Base is the oldest sequence
+ * number the gateway still retransmits, so the bridge stops waiting for frames that were given up.
+ * ACKs from the bridge: magic, REL_LINK_TYPE_ACK, cumulative ack (u16 LE, next expected seq),
+ * selective ack bitmap (u32 LE, bit n set: cumulative ack + 1 + n received).
+ * Best-effort frames carry no header: text never starts with the magic byte.
+ */
+#define REL_LINK_MAGIC 0xA5
+#define REL_LINK_TYPE_DATA 0x01
+#define REL_LINK_TYPE_ACK 0x02
+#define REL_LINK_HDR_LEN 6
+#define REL_LINK_ACK_LEN 8
+
+#define REL_LINK_WINDOW 8               // Frames in flight, new frames are refused while it is full
+#define REL_LINK_FRAME_MAX 400          // Largest payload
+#define REL_LINK_MAX_RETRIES 6
+#define REL_LINK_RTO_INIT_MS 1000
+#define REL_LINK_RTO_MIN_MS 150
+#define REL_LINK_RTO_MAX_MS 8000
+
+typedef struct rel_link_slot {
+    bool used;
+    uint8_t retries;
+    uint16_t seq;
+    uint16_t len;                   // Frame length, header included
+    uint32_t sent_ms;               // Last transmission
+    uint32_t rto_ms;                // Timeout of the last transmission, doubled on each retry
+    uint8_t frame[REL_LINK_HDR_LEN + REL_LINK_FRAME_MAX];
+} REL_LINK_SLOT;
+
+typedef struct rel_link {
+    uint16_t next_seq;
+    REL_LINK_SLOT slots[REL_LINK_WINDOW];
+    bool rtt_valid;
+    uint32_t srtt_ms;               // Smoothed RTT and variation (RFC 6298)
+    uint32_t rttvar_ms;
+    uint32_t rto_ms;
+    uint32_t sent;
+    uint32_t retransmits;
+    uint32_t acked;
+    uint32_t expired;               // Given up: retries exhausted
+    uint32_t window_full;           // Frames refused for lack of a free slot
+    uint32_t acks;
+} REL_LINK;
+
+/**
+ * @brief Reset the link.
+ *
+ * @param[in] link      The link. Not thread safe, callers serialise access.
+ * @param[in] first_seq Initial sequence number, random so that the bridge tells a restarted gateway apart.
+ *
+ */
+void rel_link_init(REL_LINK *link, uint16_t first_seq);
+
+/**
+ * @brief Frame a reliable payload and keep it until acknowledged.
+ *
+ * @param[in] link          The link.
+ * @param[in] payload       Payload.
+ * @param[in] len           Payload length, at most REL_LINK_FRAME_MAX.
+ * @param[in] now_ms        Current time in milliseconds.
+ * @param[out] frame_len    Length of the returned frame.
+ *
+ * @return
+ *      - The frame to transmit, valid until the next call on the link. NULL if the payload is too long or all
+ *        REL_LINK_WINDOW frames are in flight: nothing in flight is given up to make room.
+ */
+const uint8_t *rel_link_send(REL_LINK *link, const void *payload, size_t len, uint32_t now_ms, size_t *frame_len);
+
+/**
+ * @brief Apply an ACK datagram.
+ *
+ * @return
+ *      - false if the datagram is not an ACK.
+ */
+bool rel_link_on_ack(REL_LINK *link, const uint8_t *buf, size_t len, uint32_t now_ms);
+
+/**
+ * @brief Next frame whose timeout expired, marked as sent again.
+ *
+ * @return
+ *      - The frame to retransmit, or NULL when none is due.
+ */
+const uint8_t *rel_link_next_retransmit(REL_LINK *link, uint32_t now_ms, size_t *frame_len);
+
+/**
+ * @brief Time until the next retransmission is due.
+ *
+ * @return
+ *      - Milliseconds, 0 if one is due now, UINT32_MAX if nothing is in flight.
+ */
+uint32_t rel_link_next_timeout_ms(const REL_LINK *link, uint32_t now_ms);
+
+/**
+ * @brief Number of frames waiting for an ACK.
+ *
+ */
+int rel_link_in_flight(const REL_LINK *link);
+
+#ifdef __cplusplus
+}
+#endif
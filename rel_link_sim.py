@@ -0,0 +1,264 @@
+import argparse
+import ctypes
+import heapq
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from bridge_reliable import ReliableReceiver
+
+# Host check of the acknowledged event stream: rel_link.c compiled for the host sends through a proxy that loses,
+# delays, reorders and duplicates datagrams in both directions, to the bridge's receive side (bridge_reliable.py).
+# The sender follows udp_socket_client_task() in main.c on simulated time: events are batched every send period,
+# an event that would open a frame while the window is full is held, and ACKs are read every
+# UDP_RELIABLE_ACK_POLL_MS ("wait" polling) or, as before, only while no batch is building up or held ("idle").
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+WINDOW = 8                  # REL_LINK_WINDOW
+FRAME_MAX = 400             # REL_LINK_FRAME_MAX
+ACK_POLL_MS = 20            # UDP_RELIABLE_ACK_POLL_MS
+HOLD_RETRY_MS = 100         # GW_SHAPER_HOLD_RETRY_MS
+DRAIN_MS = 60000            # Past the longest retransmission schedule
+
+SHIM = """
+#include <stdlib.h>
+#include "rel_link.h"
+
+REL_LINK *sim_link_new(uint16_t first_seq)
+{
+    REL_LINK *link = malloc(sizeof(*link));
+    rel_link_init(link, first_seq);
+    return link;
+}
+
+uint32_t sim_link_counter(const REL_LINK *link, int which)
+{
+    const uint32_t counters[] = {link->sent, link->retransmits, link->acked, link->expired, link->window_full,
+                                 link->acks, link->srtt_ms, link->rto_ms, link->rtt_valid};
+    return counters[which];
+}
+"""
+COUNTERS = ("sent", "retransmits", "acked", "expired", "window_full", "acks", "srtt_ms", "rto_ms", "rtt_valid")
+
+
+def load_link(workdir):
+    """Build rel_link.c into a shared library."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run rel_link.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    lib = os.path.join(workdir, "rel_link.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", lib, shim, os.path.join(HERE, "rel_link.c")],
+                   check=True)
+    dll = ctypes.CDLL(lib)
+    dll.sim_link_new.restype = ctypes.c_void_p
+    dll.sim_link_new.argtypes = [ctypes.c_uint16]
+    dll.sim_link_counter.restype = ctypes.c_uint32
+    dll.sim_link_counter.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    dll.rel_link_send.restype = ctypes.POINTER(ctypes.c_uint8)
+    dll.rel_link_send.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_uint32,
+                                  ctypes.POINTER(ctypes.c_size_t)]
+    dll.rel_link_on_ack.restype = ctypes.c_bool
+    dll.rel_link_on_ack.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_uint32]
+    dll.rel_link_next_retransmit.restype = ctypes.POINTER(ctypes.c_uint8)
+    dll.rel_link_next_retransmit.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.POINTER(ctypes.c_size_t)]
+    dll.rel_link_in_flight.restype = ctypes.c_int
+    dll.rel_link_in_flight.argtypes = [ctypes.c_void_p]
+    return dll
+
+
+class Proxy:
+    """One direction of the lossy path: each datagram is lost, or delayed by base + uniform jitter, maybe twice."""
+
+    def __init__(self, rng, cfg):
+        self.rng, self.cfg = rng, cfg
+        self.queue = []
+        self.count = 0
+        self.lost = 0
+
+    def send(self, now_ms, data):
+        copies = 2 if self.rng.random() < self.cfg["dup"] else 1
+        for _ in range(copies):
+            if self.rng.random() < self.cfg["loss"]:
+                self.lost += 1
+                continue
+            delay = self.cfg["delay_ms"] + self.rng.uniform(0, self.cfg["jitter_ms"])
+            self.count += 1
+            heapq.heappush(self.queue, (now_ms + delay, self.count, data))
+
+    def due(self, now_ms):
+        while self.queue and self.queue[0][0] <= now_ms:
+            yield heapq.heappop(self.queue)[2]
+
+
+def simulate(dll, cfg, polling):
+    rng = random.Random(cfg["seed"])
+    link = dll.sim_link_new(rng.getrandbits(16))
+    up, down = Proxy(random.Random(cfg["seed"] + 1), cfg), Proxy(random.Random(cfg["seed"] + 2), cfg)
+    bridge = ReliableReceiver()
+    frame_len = ctypes.c_size_t()
+
+    # Event arrivals: Poisson, plus bursts that overrun the window
+    arrivals = []
+    t = 0.0
+    while t < cfg["duration_s"] * 1000:
+        t += rng.expovariate(cfg["rate"] / 1000)
+        arrivals.append(t)
+    for start in range(0, int(cfg["duration_s"] * 1000), int(cfg["burst_every_s"] * 1000) or 1 << 62):
+        arrivals += [start + 0.5] * cfg["burst"]
+    arrivals.sort()
+    created = {k: t for k, t in enumerate(arrivals)}
+    offered_bytes = sum(len(f"evt,{k},") + cfg["event_bytes"] for k in created)
+
+    queue, next_arrival = [], 0
+    delivered, app_duplicates, latencies = {}, 0, []
+    delivered_bytes, last_delivery = 0, 0
+    ack_inbox = []
+    wake_ms, next_poll, hold_until = None, 0, 0
+    held_batches = 0
+    end_ms = int(cfg["duration_s"] * 1000) + DRAIN_MS
+
+    def transmit(now, frame):
+        up.send(now, bytes(frame[:frame_len.value]))
+
+    def read_acks(now):
+        for ack in ack_inbox:
+            dll.rel_link_on_ack(link, ack, len(ack), now)
+        ack_inbox.clear()
+        while True:
+            frame = dll.rel_link_next_retransmit(link, now, ctypes.byref(frame_len))
+            if not frame:
+                break
+            transmit(now, frame)
+
+    for now in range(end_ms):
+        # Datagrams arriving at the bridge and ACKs arriving at the gateway's socket
+        for data in up.due(now):
+            payload, ack = bridge.handle(data, ("gw", 0))
+            if ack is not None:
+                down.send(now, ack)
+            for line in (payload.decode().split("\n") if payload else ()):
+                event = int(line.split(",")[1])
+                if event in delivered:
+                    app_duplicates += 1
+                else:
+                    delivered[event] = now
+                    latencies.append(round(now - created[event], 1))
+                    delivered_bytes += len(line)
+                    last_delivery = now
+        ack_inbox += list(down.due(now))
+
+        while next_arrival < len(arrivals) and arrivals[next_arrival] <= now:
+            queue.append(next_arrival)
+            next_arrival += 1
+
+        if queue and wake_ms is None:
+            wake_ms = max(int(created[queue[0]]) + cfg["send_period_ms"], hold_until)
+        if (polling == "wait" or (wake_ms is None and now >= hold_until)) and now >= next_poll:
+            read_acks(now)
+            next_poll = now + ACK_POLL_MS
+        if wake_ms is None or now < wake_ms:
+            continue
+
+        # TX window: the task reads its socket, then frames what the window has room for
+        wake_ms = None
+        read_acks(now)
+        room = WINDOW - dll.rel_link_in_flight(link)
+        lines, size = [], 0
+        while queue:
+            line = f"evt,{queue[0]},{'x' * cfg['event_bytes']}"
+            if lines and size + 1 + len(line) > FRAME_MAX:
+                frame = dll.rel_link_send(link, "\n".join(lines).encode(), size, now, ctypes.byref(frame_len))
+                transmit(now, frame)
+                lines, size = [], 0
+            if not lines:
+                if room == 0:
+                    break
+                room -= 1
+            lines.append(line)
+            size += len(line) + (1 if len(lines) > 1 else 0)
+            queue.pop(0)
+        if lines:
+            frame = dll.rel_link_send(link, "\n".join(lines).encode(), size, now, ctypes.byref(frame_len))
+            transmit(now, frame)
+        if queue:
+            held_batches += 1
+            hold_until = now + HOLD_RETRY_MS
+        if next_arrival == len(arrivals) and not queue and dll.rel_link_in_flight(link) == 0 and not up.queue:
+            break
+
+    counters = {name: dll.sim_link_counter(link, i) for i, name in enumerate(COUNTERS)}
+    latencies.sort()
+    true_rtt = 2 * (cfg["delay_ms"] + cfg["jitter_ms"] / 2)
+    missing = len(arrivals) - len(delivered)
+    ok = missing == 0 and app_duplicates == 0 and counters["expired"] == 0 and counters["window_full"] == 0
+    if polling == "wait" and counters["rtt_valid"]:
+        ok &= counters["srtt_ms"] <= true_rtt + ACK_POLL_MS
+    return {
+        "case": cfg["name"], "ack_polling": polling, "events": len(arrivals), "delivered": len(delivered),
+        "missing": missing, "duplicates_to_app": app_duplicates, "bridge_duplicates": bridge.duplicates,
+        "held_batches": held_batches, "datagrams_lost": up.lost + down.lost,
+        "retransmits": counters["retransmits"], "sent": counters["sent"],
+        "offered_Bps": round(offered_bytes / cfg["duration_s"]),
+        "goodput_Bps": round(delivered_bytes * 1000 / max(1, last_delivery)),
+        "latency_ms": {"p50": latencies[len(latencies) // 2], "p99": latencies[int(len(latencies) * 0.99)],
+                       "max": latencies[-1]} if latencies else None,
+        "link": {k: v for k, v in counters.items() if k != "rtt_valid"},
+        "mean_rtt_ms": true_rtt, "ok": ok,
+    }
+
+
+def check_window_full(dll):
+    """A full window refuses the next frame and keeps everything in flight."""
+    link = dll.sim_link_new(0xFFFC)
+    frame_len = ctypes.c_size_t()
+    accepted = sum(bool(dll.rel_link_send(link, b"evt", 3, 0, ctypes.byref(frame_len))) for _ in range(WINDOW + 2))
+    counters = {name: dll.sim_link_counter(link, i) for i, name in enumerate(COUNTERS)}
+    ok = accepted == WINDOW and dll.rel_link_in_flight(link) == WINDOW and counters["expired"] == 0 and \
+        counters["window_full"] == 2
+    return {"case": "window_full", "accepted": accepted, "in_flight": dll.rel_link_in_flight(link),
+            "expired": counters["expired"], "window_full": counters["window_full"], "ok": ok}
+
+
+CASES = [
+    {"name": "loss_1", "loss": 0.01, "dup": 0.0, "delay_ms": 15, "jitter_ms": 10},
+    {"name": "loss_10", "loss": 0.10, "dup": 0.02, "delay_ms": 15, "jitter_ms": 60},
+    {"name": "loss_30", "loss": 0.30, "dup": 0.05, "delay_ms": 30, "jitter_ms": 120},
+]
+
+
+# python3 rel_link_sim.py --duration 120
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Reliable event stream over a lossy, reordering proxy")
+    parser.add_argument("--duration", type=float, default=120.0, help="simulated seconds of events")
+    parser.add_argument("--rate", type=float, default=5.0, help="events per second")
+    parser.add_argument("--burst", type=int, default=200, help="events arriving at once, every --burst-every")
+    parser.add_argument("--burst-every", type=float, default=30.0, help="s, 0 for no bursts")
+    parser.add_argument("--event-bytes", type=int, default=30, help="padding per event line")
+    parser.add_argument("--send-period", type=int, default=200, help="ms, as \"config set sendperiod\"")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    failed = False
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_link(workdir)
+        result = check_window_full(dll)
+        failed |= not result["ok"]
+        print(json.dumps(result))
+        for case in CASES:
+            cfg = dict(case, duration_s=args.duration, rate=args.rate, burst=args.burst,
+                       burst_every_s=args.burst_every, event_bytes=args.event_bytes, send_period_ms=args.send_period,
+                       seed=args.seed)
+            for polling in ("wait", "idle"):
+                result = simulate(dll, cfg, polling)
+                # Reading ACKs only while idle is the old behaviour, reported for its RTT estimate
+                failed |= polling == "wait" and not result["ok"]
+                print(json.dumps(result))
+    sys.exit(1 if failed else 0)
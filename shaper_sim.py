@@ -0,0 +1,277 @@
+import argparse
+import ctypes
+import heapq
+import json
+import math
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+from collections import defaultdict
+
+# N gateways sharing one Thread mesh, each running traffic_shaper.c compiled for the host, on simulated time.
+# Each gateway follows main.c: ranges are decimated at the shaper's level, the 1 s fallback aggregation summarises
+# every range while the level is above 0, and a TX window opens once RADIO_COEX tx_batch_min messages are queued or
+# the oldest has waited tx_max_wait_ms. A window sends events, then ranges, then summaries within the budget:
+# held events stay queued, the others are dropped. The mesh is modelled as one channel: each datagram costs
+# 802.15.4 frames on every hop, and beyond the usable share of airtime the excess is lost by every gateway alike.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+CLASS_EVENT, CLASS_SAMPLE, CLASS_STATS = range(3)
+CLASS_NAMES = ("event", "sample", "stats")
+SAMPLE_QUEUE_LEN = 32       # main.c
+UDP_FRAME_LEN = 384
+TX_BATCH_MIN = 4            # RADIO_COEX_CONFIG_DEFAULT
+TX_MAX_WAIT_MS = 200
+UPDATE_PERIOD_MS = 1000     # GW_SHAPER_UPDATE_PERIOD_MS
+AGG_WINDOW_MS = 1000        # GW_AGG_FALLBACK_MS
+HOLD_RETRY_MS = 100         # GW_SHAPER_HOLD_RETRY_MS
+STEP_MS = 5
+DRAIN_MS = 30000            # No new input, so held events get their tokens
+
+# 802.15.4 at 250 kbps: payload per frame after MAC, 6LoWPAN fragment and compressed IPv6/UDP headers, and the
+# airtime of one frame including preamble, ACK, turnaround and average CSMA backoff
+FRAME_PAYLOAD = 80
+BYTE_MS = 8 / 250
+FRAME_OVERHEAD_MS = 2.5
+
+SHIM = """
+#include <stdlib.h>
+#include "traffic_shaper.h"
+
+TRAFFIC_SHAPER *sim_shaper_new(uint32_t now_ms)
+{
+    static const TRAFFIC_SHAPER_RATE config[SHAPER_CLASS_COUNT] = TRAFFIC_SHAPER_CONFIG_DEFAULT();
+    TRAFFIC_SHAPER *shaper = malloc(sizeof(*shaper));
+    traffic_shaper_init(shaper, config, now_ms);
+    return shaper;
+}
+
+uint32_t sim_shaper_budget(int cls)
+{
+    static const TRAFFIC_SHAPER_RATE config[SHAPER_CLASS_COUNT] = TRAFFIC_SHAPER_CONFIG_DEFAULT();
+    return config[cls].rate;
+}
+
+uint32_t sim_shaper_burst(int cls)
+{
+    static const TRAFFIC_SHAPER_RATE config[SHAPER_CLASS_COUNT] = TRAFFIC_SHAPER_CONFIG_DEFAULT();
+    return config[cls].burst;
+}
+"""
+
+
+def load_shaper(workdir):
+    """Build traffic_shaper.c with its default rates into a shared library."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run traffic_shaper.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    lib = os.path.join(workdir, "traffic_shaper.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", lib, shim,
+                    os.path.join(HERE, "traffic_shaper.c")], check=True)
+    dll = ctypes.CDLL(lib)
+    dll.sim_shaper_new.restype = ctypes.c_void_p
+    dll.sim_shaper_new.argtypes = [ctypes.c_uint32]
+    dll.sim_shaper_budget.restype = ctypes.c_uint32
+    dll.sim_shaper_burst.restype = ctypes.c_uint32
+    dll.traffic_shaper_consume.restype = ctypes.c_bool
+    dll.traffic_shaper_consume.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_uint32, ctypes.c_uint32]
+    dll.traffic_shaper_update.restype = ctypes.c_uint8
+    dll.traffic_shaper_update.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    dll.traffic_shaper_keep_sample.restype = ctypes.c_bool
+    dll.traffic_shaper_keep_sample.argtypes = [ctypes.c_void_p, ctypes.c_uint8]
+    return dll
+
+
+def datagram_airtime_ms(length, hops):
+    frames = math.ceil(length / FRAME_PAYLOAD)
+    return hops * (frames * FRAME_OVERHEAD_MS + length * BYTE_MS)
+
+
+class Gateway:
+    def __init__(self, dll, index, tags, cfg, rng, shaped):
+        self.dll, self.index, self.cfg, self.rng, self.shaped = dll, index, cfg, rng, shaped
+        self.shaper = dll.sim_shaper_new(0) if shaped else None
+        self.level, self.max_level = 0, 0
+        self.queue = []             # (class, bytes, queued_ms, tag or None)
+        self.next_window = 0
+        self.agg = {}               # tag -> samples in the current fallback window
+        self.due = [(rng.uniform(0, 1000 / cfg["rate"]), k) for k in range(tags)]
+        heapq.heapify(self.due)
+        self.seq = [0] * tags
+        self.next_event = rng.expovariate(cfg["event_rate"] / 1000)
+        self.offered = [0] * 3
+        self.admitted = [0] * 3
+        self.admitted_bytes = [0] * 3
+        self.queue_full = [0] * 3
+        self.held = 0
+        self.event_delay = []
+        self.covered = set()        # (tag, second) with a raw range or a summary sent
+        self.seconds = set()        # (tag, second) with a range produced
+        self.datagrams = []         # (time_ms, bytes, {class: messages})
+
+    def push(self, cls, size, now, tag=None):
+        self.offered[cls] += 1
+        if len(self.queue) >= SAMPLE_QUEUE_LEN:
+            self.queue_full[cls] += 1
+            return
+        self.queue.append((cls, size, now, tag))
+
+    def produce(self, now, end_ms):
+        while self.due and self.due[0][0] <= now:
+            t, k = heapq.heappop(self.due)
+            seq = self.seq[k] & 0xFF
+            self.seq[k] += 1
+            self.seconds.add((k, int(t // 1000)))
+            if t + 1000 / self.cfg["rate"] < end_ms:
+                heapq.heappush(self.due, (t + 1000 / self.cfg["rate"], k))
+            if self.shaped and self.level > 0:
+                self.agg[k] = self.agg.get(k, 0) + 1
+            if self.shaped and not self.dll.traffic_shaper_keep_sample(self.shaper, seq):
+                continue
+            self.push(CLASS_SAMPLE, len(f"c0de0000{k:04x},{seq},{self.rng.randrange(100, 3000)},-60") + 1, now, k)
+        while self.next_event <= now and now < end_ms:
+            self.push(CLASS_EVENT, len(f"zone,c0de0000ffff,enter,{self.rng.randrange(1, 16)},0") + 1, now)
+            self.next_event += self.rng.expovariate(self.cfg["event_rate"] / 1000)
+
+    def tick(self, now):
+        if self.shaped and now % UPDATE_PERIOD_MS == 0:
+            self.level = self.dll.traffic_shaper_update(self.shaper, now)
+            self.max_level = max(self.max_level, self.level)
+        if self.shaped and now % AGG_WINDOW_MS == 0:
+            for k, count in self.agg.items():
+                self.push(CLASS_STATS, len(f"agg,c0de0000{k:04x},1000,{count},1200,1260,1230,250,1244") + 1, now, k)
+            self.agg = {}
+        if not self.queue or now < self.next_window:
+            return
+        if len(self.queue) < TX_BATCH_MIN and now - self.queue[0][2] < TX_MAX_WAIT_MS:
+            return
+        batch, self.queue = self.queue, []
+        sent = {CLASS_EVENT: [], CLASS_SAMPLE: [], CLASS_STATS: []}
+        held = []
+        for cls in (CLASS_EVENT, CLASS_SAMPLE, CLASS_STATS):
+            for message in (m for m in batch if m[0] == cls):
+                _, size, queued, tag = message
+                if not self.shaped or self.dll.traffic_shaper_consume(self.shaper, cls, size, now):
+                    sent[cls].append(message)
+                    self.admitted[cls] += 1
+                    self.admitted_bytes[cls] += size
+                    if cls == CLASS_EVENT:
+                        self.event_delay.append(now - queued)
+                    if tag is not None:
+                        self.covered.add((tag, int(queued // 1000)))
+                elif cls == CLASS_EVENT:
+                    held.append(message)
+        # Events go on the reliable stream, the rest share best-effort datagrams
+        for stream in ((CLASS_EVENT,), (CLASS_SAMPLE, CLASS_STATS)):
+            size, counts = 0, defaultdict(int)
+            for cls in stream:
+                for message in sent[cls]:
+                    if size + message[1] > UDP_FRAME_LEN:
+                        self.datagrams.append((now, size, dict(counts)))
+                        size, counts = 0, defaultdict(int)
+                    size += message[1]
+                    counts[cls] += 1
+            if size:
+                self.datagrams.append((now, size, dict(counts)))
+        if held:
+            self.held += len(held)
+            self.queue = held + self.queue
+            self.next_window = now + HOLD_RETRY_MS
+
+
+def budget_fit(dll, cfg):
+    """Gateways the mesh carries with each one sending its whole budget in full datagrams."""
+    rate = sum(dll.sim_shaper_budget(c) for c in range(3))
+    airtime_ms = rate / UDP_FRAME_LEN * datagram_airtime_ms(UDP_FRAME_LEN + 8, cfg["hops"])
+    return {"budget_bytes_s": rate, "airtime_ms_s": round(airtime_ms, 1),
+            "gateways_at_full_budget": round(1000 * cfg["mesh_share"] / airtime_ms, 2)}
+
+
+def simulate(dll, cfg, gateways, shaped):
+    rng = random.Random(cfg["seed"])
+    end_ms = int(cfg["duration_s"] * 1000)
+    nodes = []
+    for g in range(gateways):
+        tags = cfg["hot_tags"] if g == 0 else cfg["tags"]
+        nodes.append(Gateway(dll, g, tags, cfg, random.Random(cfg["seed"] * 100 + g), shaped))
+    for now in range(0, end_ms + DRAIN_MS, STEP_MS):
+        for node in nodes:
+            node.produce(now, end_ms)
+            node.tick(now)
+
+    # Mesh: airtime per second over every gateway; beyond the usable share the excess is lost evenly
+    airtime = defaultdict(float)
+    for node in nodes:
+        for t, size, _ in node.datagrams:
+            airtime[int(t // 1000)] += datagram_airtime_ms(size + 8, cfg["hops"])
+    capacity_ms = 1000 * cfg["mesh_share"]
+    utilization = sorted(airtime[s] / 1000 for s in range(int(cfg["duration_s"])))
+    delivered = [0.0] * 3
+    for node in nodes:
+        for t, size, counts in node.datagrams:
+            share = min(1.0, capacity_ms / airtime[int(t // 1000)])
+            for cls, n in counts.items():
+                delivered[cls] += n * share
+    offered = [sum(node.offered[c] for node in nodes) for c in range(3)]
+    ranges = sum(len(node.seconds) for node in nodes)
+    delays = sorted(d for node in nodes for d in node.event_delay)
+
+    # Per gateway, what the shaper let out may not exceed its rates plus one burst
+    budget_ok = True
+    if shaped:
+        allowance = sum(dll.sim_shaper_budget(c) * (end_ms + DRAIN_MS) / 1000 + dll.sim_shaper_burst(c)
+                        for c in range(3))
+        budget_ok = all(sum(node.admitted_bytes) <= allowance for node in nodes)
+    events_lost = sum(node.offered[CLASS_EVENT] - node.admitted[CLASS_EVENT] for node in nodes)
+    return {
+        "gateways": gateways, "shaper": shaped, "tags": cfg["tags"] * (gateways - 1) + cfg["hot_tags"],
+        "mesh_utilization": {"mean": round(sum(utilization) / len(utilization), 3),
+                             "p95": round(utilization[int(len(utilization) * 0.95)], 3),
+                             "max": round(utilization[-1], 3), "usable": cfg["mesh_share"]},
+        "offered": dict(zip(CLASS_NAMES, offered)),
+        "sent_by_gateways": dict(zip(CLASS_NAMES, (sum(n.admitted[c] for n in nodes) for c in range(3)))),
+        "delivered_share": {name: round(delivered[c] / offered[c], 3) if offered[c] else None
+                            for c, name in enumerate(CLASS_NAMES)},
+        "tag_seconds_sent": round(sum(len(n.covered & n.seconds) for n in nodes) / ranges, 3) if ranges else None,
+        "events_held": sum(n.held for n in nodes), "events_never_sent": events_lost,
+        "event_delay_ms": {"p50": delays[len(delays) // 2], "p99": delays[int(len(delays) * 0.99)],
+                           "max": delays[-1]} if delays else None,
+        "queue_full_drops": dict(zip(CLASS_NAMES, (sum(n.queue_full[c] for n in nodes) for c in range(3)))),
+        "max_decimation": f"1/{1 << max(n.max_level for n in nodes)}" if shaped else None,
+        "ok": budget_ok and (not shaped or events_lost == 0),
+    }
+
+
+# python3 shaper_sim.py --gateways 1,4,8,16 --tags 20 --hot-tags 80 --rate 10
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="N gateways with per-class token buckets sharing a Thread mesh")
+    parser.add_argument("--gateways", default="1,4,8,16")
+    parser.add_argument("--tags", type=int, default=20, help="tags per gateway")
+    parser.add_argument("--hot-tags", type=int, default=80, help="tags of gateway 0, a crowd in one spot")
+    parser.add_argument("--rate", type=float, default=10.0, help="ranges per tag per second")
+    parser.add_argument("--event-rate", type=float, default=0.5, help="zone events per gateway per second")
+    parser.add_argument("--duration", type=float, default=60.0, help="simulated seconds of traffic")
+    parser.add_argument("--hops", type=int, default=2, help="mesh hops to the border router")
+    parser.add_argument("--mesh-share", type=float, default=0.4, help="usable share of the channel's airtime")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    cfg = {"tags": args.tags, "hot_tags": args.hot_tags, "rate": args.rate, "event_rate": args.event_rate,
+           "duration_s": args.duration, "hops": args.hops, "mesh_share": args.mesh_share, "seed": args.seed}
+    failed = False
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_shaper(workdir)
+        print(json.dumps(budget_fit(dll, cfg)))
+        for gateways in (int(v) for v in args.gateways.split(",")):
+            for shaped in (False, True):
+                result = simulate(dll, cfg, gateways, shaped)
+                failed |= not result["ok"]
+                print(json.dumps(result))
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,132 @@
+import argparse
+import json
+import multiprocessing as mp
+import os
+import sys
+import tempfile
+import time
+
+from bridge_shm import KIND_RANGE, MAX_READERS, RING_CAPACITY, RingReader, SampleRing
+
+# Benchmark of the shared-memory sample ring (bridge_shm.py) with several reader processes:
+#  - throughput: the writer fills the ring as fast as it can, notifying once per batch as mqttconnection.py does
+#    per datagram; each reader reports the records/s it consumed and what it lost to overruns
+#  - wakeup: the writer sends one small batch at a time, so the readers sleep in wait() between batches; the
+#    latency is from the write (its monotonic time in ns is the record's t_ms) to the reader having the record
+# Every reader checks that the sequence numbers it reads only ever increase, and that what each read() skipped is
+# what it counted as overruns.
+
+KIND_END = 0                # Last record of a run, the readers stop at it
+
+
+def run_reader(path, ready, results, sample_every):
+    reader = RingReader(path)
+    ready.release()
+    received, order_errors, latencies = 0, 0, []
+    last_seq, last_overruns, first_t, done = None, 0, None, False
+    while not done:
+        reader.wait(timeout=5.0)
+        now = time.monotonic_ns()
+        skipped = 0
+        for kind, _, seq, t_ns, _, _, _ in reader.read():
+            if kind == KIND_END:
+                done = True
+                break
+            if first_t is None:
+                first_t = time.monotonic()
+            if last_seq is not None:
+                order_errors += seq <= last_seq
+                skipped += seq - last_seq - 1
+            last_seq = seq
+            received += 1
+            if sample_every and seq % sample_every == 0:
+                latencies.append(now - t_ns)
+        # An overrun in the middle of a read() is counted before the records are returned
+        order_errors += skipped != reader.overruns - last_overruns
+        last_overruns = reader.overruns
+    elapsed = time.monotonic() - first_t if first_t is not None else 0.0
+    results.put({"received": received, "overruns": reader.overruns, "order_errors": order_errors,
+                 "records_per_s": round(received / elapsed) if elapsed else None, "latencies_ns": latencies})
+    reader.close()
+
+
+def percentiles_us(values):
+    if not values:
+        return None
+    values = sorted(values)
+    pick = lambda q: round(values[min(len(values) - 1, int(q * len(values)))] / 1000, 1)
+    return {"count": len(values), "p50_us": pick(0.5), "p99_us": pick(0.99), "max_us": round(values[-1] / 1000, 1)}
+
+
+def run_case(path, mode, readers, cfg):
+    ring = SampleRing(path, capacity=cfg["capacity"])
+    ctx = mp.get_context("fork")
+    results, ready = ctx.Queue(), ctx.Semaphore(0)
+    sample_every = 0 if mode == "throughput" else 1
+    procs = [ctx.Process(target=run_reader, args=(path, ready, results, sample_every)) for _ in range(readers)]
+    for p in procs:
+        p.start()
+    for _ in procs:
+        ready.acquire()
+
+    if mode == "throughput":
+        count, batch = cfg["records"], cfg["batch"]
+        start = time.monotonic()
+        for seq in range(count):
+            ring.write(KIND_RANGE, "a1b2c3d4e5f6", seq, 0, 100, 0, -60)
+            if seq % batch == batch - 1:
+                ring.notify()
+        ring.notify()
+        write_s = time.monotonic() - start
+    else:
+        count, period = int(cfg["wakeups"]), 1 / cfg["wakeup_rate"]
+        start = time.monotonic()
+        for seq in range(count):
+            due = start + seq * period
+            delay = due - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+            ring.write(KIND_RANGE, "a1b2c3d4e5f6", seq, time.monotonic_ns(), 100, 0, -60)
+            ring.notify()
+        write_s = time.monotonic() - start
+    ring.write(KIND_END, "", count, 0, 0)
+    ring.notify()
+
+    outcomes = [results.get(timeout=60) for _ in procs]
+    for p in procs:
+        p.join()
+    ring.close()
+    os.unlink(path)
+    ok = all(o["order_errors"] == 0 and o["received"] + o["overruns"] == count for o in outcomes)
+    result = {"mode": mode, "readers": readers, "records": count, "writer_records_per_s": round(count / write_s),
+              "reader_records_per_s": [o["records_per_s"] for o in outcomes],
+              "received": [o["received"] for o in outcomes], "overruns": [o["overruns"] for o in outcomes],
+              "order_errors": sum(o["order_errors"] for o in outcomes), "ok": ok}
+    if mode == "wakeup":
+        result["wakeup_rate"] = cfg["wakeup_rate"]
+        result["latency"] = percentiles_us([v for o in outcomes for v in o["latencies_ns"]])
+    return result
+
+
+# python3 shm_bench.py --readers 1,4,8 --records 2000000 --wakeups 5000
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Samples/s and wakeup latency of the shared-memory ring")
+    parser.add_argument("--readers", default="1,4,8", help=f"comma separated reader counts, at most {MAX_READERS}")
+    parser.add_argument("--records", type=int, default=2000000, help="records written in the throughput run")
+    parser.add_argument("--batch", type=int, default=64, help="records per notify in the throughput run")
+    parser.add_argument("--wakeups", type=int, default=5000, help="single-record batches in the wakeup run")
+    parser.add_argument("--wakeup-rate", type=float, default=1000.0, help="batches per second in the wakeup run")
+    parser.add_argument("--capacity", type=int, default=RING_CAPACITY)
+    args = parser.parse_args()
+
+    failed = False
+    shm_dir = "/dev/shm" if os.path.isdir("/dev/shm") else tempfile.gettempdir()
+    path = os.path.join(shm_dir, f"uwb_shm_bench_{os.getpid()}")
+    cfg = {"records": args.records, "batch": args.batch, "wakeups": args.wakeups, "wakeup_rate": args.wakeup_rate,
+           "capacity": args.capacity}
+    for readers in [int(v) for v in args.readers.split(",")]:
+        for mode in ("throughput", "wakeup"):
+            result = run_case(path, mode, readers, cfg)
+            failed |= not result["ok"]
+            print(json.dumps(result))
+    sys.exit(1 if failed else 0)
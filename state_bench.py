@@ -0,0 +1,148 @@
+import argparse
+import json
+import multiprocessing as mp
+import os
+import random
+import shutil
+import sys
+import tempfile
+import time
+
+from bridge_state import StateClient, StateServer
+
+# Benchmark of the latest-state server (bridge_state.py) on its Unix socket: point lookup round trips while idle and
+# while pushing, and push-on-change fan-out to many subscribers. The updates are made in the server's process at a
+# fixed rate, as the bridge loop does; each carries its index in the range, so subscribers (separate processes) can
+# count what they were pushed and time 1 in LATENCY_EVERY updates against the monotonic clock shared on the host.
+
+END_TAG = "end"             # Updated last, in every subscription: the subscribers stop at it
+LATENCY_EVERY = 16
+SNAPSHOT_RANGE = -1         # Range of the initial states, pushed on subscribe and not counted
+
+
+def percentiles(values):
+    if not values:
+        return None
+    values = sorted(values)
+    pick = lambda q: round(values[min(len(values) - 1, int(q * len(values)))] * 1000, 3)
+    return {"count": len(values), "p50_ms": pick(0.5), "p99_ms": pick(0.99), "max_ms": round(values[-1] * 1000, 3)}
+
+
+def run_subscriber(path, tags, ready, results):
+    client = StateClient(unix_path=path)
+    client.subscribe(tags=tags + [END_TAG] if tags else [])
+    ready.release()
+    received, latencies = 0, []
+    for record in client.updates():
+        if record["tag"] == END_TAG and record["range_cm"] != SNAPSHOT_RANGE:
+            break
+        if record["range_cm"] == SNAPSHOT_RANGE:
+            continue
+        received += 1
+        if record["range_cm"] % LATENCY_EVERY == 0:
+            latencies.append((record["range_cm"], time.monotonic()))
+    results.put((received, latencies))
+
+
+def run_lookups(path, tags, count, results):
+    client = StateClient(unix_path=path)
+    rng = random.Random(len(tags))
+    latencies, missing = [], 0
+    for _ in range(count):
+        start = time.monotonic()
+        missing += client.get(rng.choice(tags)) is None
+        latencies.append(time.monotonic() - start)
+    results.put((latencies, missing))
+
+
+def run_case(cfg, workdir):
+    path = os.path.join(workdir, f"state_{cfg['sub_tags']}.sock")
+    server = StateServer(unix_path=path)
+    rng = random.Random(cfg["seed"])
+    tags = [f"{rng.getrandbits(48):012x}" for _ in range(cfg["tags"])]
+    now = time.monotonic()
+    for tag in tags + [END_TAG]:
+        server.update_range(tag, SNAPSHOT_RANGE, -60, now)
+
+    ctx = mp.get_context("fork")
+    results, ready = ctx.Queue(), ctx.Semaphore(0)
+    idle = ctx.Process(target=run_lookups, args=(path, tags, cfg["lookups"], results))
+    idle.start()
+    idle_latencies, idle_missing = results.get()
+    idle.join()
+
+    sub_tags = [rng.sample(tags, cfg["sub_tags"]) if cfg["sub_tags"] else [] for _ in range(cfg["subscribers"])]
+    subscribers = [ctx.Process(target=run_subscriber, args=(path, t, ready, results)) for t in sub_tags]
+    for p in subscribers:
+        p.start()
+    for _ in subscribers:
+        ready.acquire()
+    while server.metrics()["subscribers"] < cfg["subscribers"]:
+        time.sleep(0.01)
+    loaded = ctx.Process(target=run_lookups, args=(path, tags, cfg["lookups"], results))
+    loaded.start()
+
+    # Paced updates, round robin over the tags
+    updates = int(cfg["rate"] * cfg["duration"])
+    sent_at = {}
+    start = time.monotonic()
+    for i in range(updates):
+        due = start + i / cfg["rate"]
+        now = time.monotonic()
+        if due > now:
+            time.sleep(due - now)
+            now = time.monotonic()
+        if i % LATENCY_EVERY == 0:
+            sent_at[i] = now
+        server.update_range(tags[i % len(tags)], i, -60, now)
+    update_s = time.monotonic() - start
+    server.update_range(END_TAG, updates, -60, time.monotonic())
+
+    outcomes = [results.get(timeout=cfg["duration"] + 60) for _ in range(len(subscribers) + 1)]
+    delivered_s = time.monotonic() - start
+    for p in subscribers + [loaded]:
+        p.join()
+    loaded_latencies, loaded_missing = next(o for o in outcomes if isinstance(o[1], int))
+    subscriber_outcomes = [o for o in outcomes if isinstance(o[1], list)]
+
+    # Every update of a subscribed tag is pushed: min change 0, no zone filter
+    per_tag = [updates // len(tags) + (k < updates % len(tags)) for k in range(len(tags))]
+    position = {tag: k for k, tag in enumerate(tags)}
+    counts = [sum(per_tag[position[tag]] for tag in t) if t else updates for t in sub_tags]
+    expected, received = sum(counts), sum(o[0] for o in subscriber_outcomes)
+    push_latencies = [t - sent_at[i] for o in subscriber_outcomes for i, t in o[1]]
+    metrics = server.metrics()
+    ok = received == expected and metrics["dropped_clients"] == 0 and idle_missing == 0 and loaded_missing == 0
+    return {"tags": cfg["tags"], "subscribers": cfg["subscribers"], "tags_per_subscriber": cfg["sub_tags"] or "all",
+            "updates": updates, "update_rate": round(updates / update_s), "pushes": received,
+            "pushes_expected": expected, "fanout_pushes_per_s": round(received / delivered_s),
+            "push_latency": percentiles(push_latencies), "lookup_idle": percentiles(idle_latencies),
+            "lookup_while_pushing": percentiles(loaded_latencies), "dropped_clients": metrics["dropped_clients"],
+            "ok": ok}
+
+
+# python3 state_bench.py --tags 1000 --subscribers 100 --sub-tags 10,0 --rate 2000
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Lookup latency and fan-out of the latest-state server")
+    parser.add_argument("--tags", type=int, default=1000)
+    parser.add_argument("--subscribers", type=int, default=100)
+    parser.add_argument("--sub-tags", default="10,0",
+                        help="comma separated tags per subscriber, 0 for subscribers to every tag")
+    parser.add_argument("--rate", type=float, default=2000.0, help="updates per second")
+    parser.add_argument("--duration", type=float, default=5.0, help="seconds of updates per case")
+    parser.add_argument("--lookups", type=int, default=5000, help="lookups per measurement")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    failed = False
+    workdir = tempfile.mkdtemp(prefix="uwb_state_")
+    try:
+        for sub_tags in [int(v) for v in args.sub_tags.split(",")]:
+            cfg = {"tags": args.tags, "subscribers": args.subscribers, "sub_tags": sub_tags, "rate": args.rate,
+                   "duration": args.duration, "lookups": args.lookups, "seed": args.seed}
+            result = run_case(cfg, workdir)
+            failed |= not result["ok"]
+            print(json.dumps(result))
+    finally:
+        shutil.rmtree(workdir)
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,140 @@
+import argparse
+import json
+import os
+import random
+import shutil
+import sys
+import tempfile
+import time
+
+from bridge_store import RangeStore
+
+# Benchmark of the range history (bridge_store.py): ingest rate, bytes per sample on disk, reopen time and the
+# latency of raw and downsampled range queries, up to 100M samples (--samples 100000000 writes about 210 MB and
+# takes a few minutes). Tag k ranges every period_ms from phase_k with a random-walk distance, so the count of any
+# query is known and every query is checked. A clock step check covers appends earlier than the stored history.
+
+T0_MS = 1700000000000
+QUERY_SPANS_MS = (1000, 60000, 3600000)
+DOWNSAMPLE_SPAN_MS = 3600000
+DOWNSAMPLE_BUCKET_MS = 1000
+
+
+def percentiles(values):
+    values = sorted(values)
+    pick = lambda q: round(values[min(len(values) - 1, int(q * len(values)))] * 1000, 3)
+    return {"p50_ms": pick(0.5), "p99_ms": pick(0.99), "max_ms": round(values[-1] * 1000, 3)}
+
+
+def expected_count(phase, period_ms, ticks, t0, t1):
+    """Samples of a tag with phase + j * period_ms in [t0, t1], j < ticks."""
+    first = max(0, -(-(t0 - phase) // period_ms))
+    last = min(ticks - 1, (t1 - phase) // period_ms)
+    return max(0, last - first + 1)
+
+
+def ingest(store, cfg, rng):
+    tags = [f"{rng.getrandbits(48):012x}" for _ in range(cfg["tags"])]
+    phases = [T0_MS + rng.randrange(cfg["period_ms"]) for _ in range(cfg["tags"])]
+    dists = [rng.randrange(100, 2000) for _ in range(cfg["tags"])]
+    ticks = cfg["samples"] // cfg["tags"]
+    busy = 0.0
+    for j in range(ticks):
+        # The distances are drawn outside the timed part
+        steps = [rng.randrange(-15, 16) for _ in range(cfg["tags"])]
+        start = time.perf_counter()
+        for k, tag in enumerate(tags):
+            dists[k] += steps[k]
+            store.append(tag, phases[k] + j * cfg["period_ms"], dists[k])
+        busy += time.perf_counter() - start
+    start = time.perf_counter()
+    store.flush()
+    busy += time.perf_counter() - start
+    return tags, phases, ticks, busy
+
+
+def run_queries(store, cfg, rng, tags, phases, ticks):
+    end_ms = T0_MS + ticks * cfg["period_ms"]
+    results, errors = {}, 0
+    for span in QUERY_SPANS_MS:
+        latencies = []
+        for _ in range(cfg["queries"]):
+            k = rng.randrange(len(tags))
+            t0 = rng.randrange(T0_MS, max(T0_MS + 1, end_ms - span))
+            start = time.perf_counter()
+            rows = store.query(tags[k], t0, t0 + span)
+            latencies.append(time.perf_counter() - start)
+            errors += len(rows) != expected_count(phases[k], cfg["period_ms"], ticks, t0, t0 + span)
+            errors += any(a[0] >= b[0] for a, b in zip(rows, rows[1:]))
+        results[f"raw_{span // 1000}s"] = percentiles(latencies)
+    latencies = []
+    for _ in range(cfg["queries"]):
+        k = rng.randrange(len(tags))
+        t0 = rng.randrange(T0_MS, max(T0_MS + 1, end_ms - DOWNSAMPLE_SPAN_MS))
+        start = time.perf_counter()
+        rows = store.query_downsampled(tags[k], t0, t0 + DOWNSAMPLE_SPAN_MS, DOWNSAMPLE_BUCKET_MS)
+        latencies.append(time.perf_counter() - start)
+        errors += sum(row[1] for row in rows) != expected_count(phases[k], cfg["period_ms"], ticks, t0,
+                                                                t0 + DOWNSAMPLE_SPAN_MS)
+    results[f"downsampled_{DOWNSAMPLE_SPAN_MS // 1000}s_by_{DOWNSAMPLE_BUCKET_MS // 1000}s"] = percentiles(latencies)
+    return results, errors
+
+
+def check_clock_step(directory):
+    """Appends earlier than what is already in blocks, or in a previous run's segments, keep the history sorted."""
+    store = RangeStore(directory, block_samples=4)
+    for i in range(8):
+        store.append("a", 10000 + i * 100, i)
+    store.flush()
+    store.append("a", 5000, 100)            # Clock stepped back after a flush
+    store.close()
+    store = RangeStore(directory, block_samples=4)
+    store.append("a", 6000, 101)            # And after a restart
+    store.flush()
+    rows = store.query("a", 0, 20000)
+    late = store.query("a", 10700, 10700)
+    store.close()
+    times = [t for t, _ in rows]
+    ok = len(rows) == 10 and times == sorted(times) and [d for t, d in late] == [7, 100, 101]
+    return {"case": "clock_step", "samples": len(rows), "sorted": times == sorted(times), "ok": ok}
+
+
+# python3 store_bench.py --samples 100000000 --tags 1000 --period-ms 100
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Ingest, size and query latency of the range store")
+    parser.add_argument("--samples", type=int, default=10000000, help="samples to ingest, up to 100M")
+    parser.add_argument("--tags", type=int, default=1000)
+    parser.add_argument("--period-ms", type=int, default=100, help="ranging period of every tag")
+    parser.add_argument("--queries", type=int, default=200, help="queries per kind")
+    parser.add_argument("--dir", help="store directory, a temporary one by default")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    failed = False
+    directory = args.dir or tempfile.mkdtemp(prefix="uwb_store_")
+    try:
+        result = check_clock_step(os.path.join(directory, "clock_step"))
+        failed |= not result["ok"]
+        print(json.dumps(result))
+
+        cfg = {"samples": args.samples, "tags": args.tags, "period_ms": args.period_ms, "queries": args.queries}
+        rng = random.Random(args.seed)
+        store = RangeStore(os.path.join(directory, "bench"))
+        tags, phases, ticks, busy = ingest(store, cfg, rng)
+        metrics = store.metrics()
+        store.close()
+        start = time.perf_counter()
+        store = RangeStore(os.path.join(directory, "bench"))
+        reopen_s = time.perf_counter() - start
+        queries, errors = run_queries(store, cfg, rng, tags, phases, ticks)
+        store.close()
+        ok = errors == 0 and metrics["samples"] == ticks * args.tags
+        failed |= not ok
+        print(json.dumps(dict(cfg, ingest_samples_per_s=round(metrics["samples"] / busy),
+                              bytes_per_sample=round(metrics["bytes_per_sample"], 3),
+                              segments=metrics["segments"], reopen_s=round(reopen_s, 3), queries=queries,
+                              query_errors=errors, ok=ok)))
+    finally:
+        if not args.dir:
+            shutil.rmtree(directory)
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,159 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "stream_codec.h"
+
+#include <string.h>
+
+static size_t stream_codec_put_varint(uint8_t *out, uint32_t value)
+{
+    size_t len = 0;
+
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (uint8_t)value;
+    return len;
+}
+
+static size_t stream_codec_put_zigzag(uint8_t *out, int32_t value)
+{
+    return stream_codec_put_varint(out, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+// Slot of the tag, a free one, or the one sent longest ago
+
+static int stream_encoder_slot(const STREAM_ENCODER *enc, const STREAM_SAMPLE *sample)
+{
+    int free_slot = -1;
+    int oldest = 0;
+
+    for (int i = 0; i < STREAM_CODEC_MAX_TAGS; i++) {
+        const STREAM_CODEC_TAG *tag = &enc->tags[i];
+        if (!tag->used) {
+            if (free_slot < 0) {
+                free_slot = i;
+            }
+        } else if (memcmp(tag->addr, sample->addr, sizeof(tag->addr)) == 0) {
+            return i;
+        } else if (sample->time_ms - tag->time_ms > sample->time_ms - enc->tags[oldest].time_ms) {
+            oldest = i;
+        }
+    }
+    return free_slot >= 0 ? free_slot : oldest;
+}
+
+// Encode the record of a sample into rec, leaving the encoder unchanged
+
+static size_t stream_encoder_record(const STREAM_ENCODER *enc, const STREAM_SAMPLE *sample, int *slot_out,
+                                    bool *key_out, uint8_t *rec)
+{
+    int slot = stream_encoder_slot(enc, sample);
+    const STREAM_CODEC_TAG *tag = &enc->tags[slot];
+    bool known = tag->used && memcmp(tag->addr, sample->addr, sizeof(tag->addr)) == 0;
+    bool key = !known || sample->time_ms - tag->key_ms >= enc->config.resync_ms ||
+               tag->since_key + 1 >= enc->config.resync_samples;
+    int32_t time_step = known ? (int32_t)(sample->time_ms - tag->time_ms) : 0;
+    int32_t dist_step = known ? (int32_t)sample->dist_cm - tag->dist_cm : 0;
+    size_t len = stream_codec_put_varint(rec, (uint32_t)slot << 1 | key);
+
+    if (key) {
+        uint32_t base_ms = enc->len > 0 ? enc->base_ms : sample->time_ms;
+        memcpy(&rec[len], sample->addr, sizeof(sample->addr));
+        len += sizeof(sample->addr);
+        rec[len++] = sample->seq;
+        len += stream_codec_put_zigzag(&rec[len], (int32_t)(sample->time_ms - base_ms));
+        len += stream_codec_put_zigzag(&rec[len], time_step);
+        len += stream_codec_put_varint(&rec[len], sample->dist_cm);
+        len += stream_codec_put_zigzag(&rec[len], dist_step);
+        rec[len++] = (uint8_t)sample->rssi;
+    } else {
+        len += stream_codec_put_zigzag(&rec[len], (int8_t)(sample->seq - (uint8_t)(tag->seq + 1)));
+        len += stream_codec_put_zigzag(&rec[len], (int32_t)(sample->time_ms - (tag->time_ms + tag->time_step)));
+        len += stream_codec_put_zigzag(&rec[len], (int32_t)sample->dist_cm - (tag->dist_cm + tag->dist_step));
+        len += stream_codec_put_zigzag(&rec[len], sample->rssi - tag->rssi);
+    }
+    *slot_out = slot;
+    *key_out = key;
+    return len;
+}
+
+void stream_encoder_init(STREAM_ENCODER *enc, const STREAM_CODEC_CONFIG *config, uint16_t frame_seq)
+{
+    memset(enc, 0, sizeof(*enc));
+    enc->config = *config;
+    enc->frame_seq = frame_seq;
+}
+
+size_t stream_encoder_cost(const STREAM_ENCODER *enc, const STREAM_SAMPLE *sample)
+{
+    uint8_t rec[STREAM_CODEC_RECORD_MAX];
+    int slot;
+    bool key;
+
+    return stream_encoder_record(enc, sample, &slot, &key, rec) + (enc->len > 0 ? 0 : STREAM_CODEC_HDR_LEN);
+}
+
+bool stream_encoder_add(STREAM_ENCODER *enc, const STREAM_SAMPLE *sample)
+{
+    uint8_t rec[STREAM_CODEC_RECORD_MAX];
+    int slot;
+    bool key;
+    size_t len = stream_encoder_record(enc, sample, &slot, &key, rec);
+
+    if (enc->len == 0) {
+        enc->base_ms = sample->time_ms;
+        enc->frame[0] = STREAM_CODEC_MAGIC;
+        enc->frame[1] = STREAM_CODEC_VERSION;
+        enc->frame[2] = (uint8_t)enc->frame_seq;
+        enc->frame[3] = (uint8_t)(enc->frame_seq >> 8);
+        for (int i = 0; i < 4; i++) {
+            enc->frame[4 + i] = (uint8_t)(enc->base_ms >> (8 * i));
+        }
+        enc->len = STREAM_CODEC_HDR_LEN;
+    } else if (enc->len + len > sizeof(enc->frame)) {
+        return false;
+    }
+    memcpy(&enc->frame[enc->len], rec, len);
+    enc->len += len;
+
+    // Same state update as the decoder's
+    STREAM_CODEC_TAG *tag = &enc->tags[slot];
+    bool known = tag->used && memcmp(tag->addr, sample->addr, sizeof(tag->addr)) == 0;
+    tag->time_step = known ? (int32_t)(sample->time_ms - tag->time_ms) : 0;
+    tag->dist_step = known ? (int32_t)sample->dist_cm - tag->dist_cm : 0;
+    if (key) {
+        tag->used = true;
+        memcpy(tag->addr, sample->addr, sizeof(tag->addr));
+        tag->key_ms = sample->time_ms;
+        tag->since_key = 0;
+        enc->keyframes++;
+    } else {
+        tag->since_key++;
+    }
+    tag->seq = sample->seq;
+    tag->rssi = sample->rssi;
+    tag->dist_cm = sample->dist_cm;
+    tag->time_ms = sample->time_ms;
+    enc->samples++;
+    return true;
+}
+
+size_t stream_encoder_flush(STREAM_ENCODER *enc, const uint8_t **frame)
+{
+    size_t len = enc->len;
+
+    if (len == 0) {
+        return 0;
+    }
+    *frame = enc->frame;
+    enc->len = 0;
+    enc->frame_seq++;
+    enc->frames++;
+    enc->bytes += len;
+    return len;
+}
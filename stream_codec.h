@@ -0,0 +1,130 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compressed range stream, decoded by bridge_codec.py. A frame is one datagram:
+ *
+ *   magic (u8, 0xC5), version (u8), frame seq (u16 LE), base time ms (u32 LE), records...
+ *
+ * Every record starts with varint (slot << 1 | key). Keyframes carry the whole tag state and bind the tag to the
+ * slot; deltas carry zig-zag varint residuals against the tag's linear prediction:
+ *
+ *   key:   address (6), seq (u8), zz(time - base), zz(time step), varint distance, zz(distance step), rssi (i8)
+ *   delta: zz(seq - (last + 1)), zz(time - (last + step)), zz(distance - (last + step)), zz(rssi - last)
+ *
+ * After every record both steps become the difference to the previous sample. The decoder forgets every slot when
+ * a frame seq is skipped, so a lost frame only costs the deltas up to each tag's next keyframe, at most one
+ * resync interval. Frames do not say which slots they carry records for, and a delta applied to a stale state
+ * decodes to a plausible wrong sample, so the decoder cannot keep the slots the lost frame did not touch.
+ */
+#define STREAM_CODEC_MAGIC 0xC5
+#define STREAM_CODEC_VERSION 1
+#define STREAM_CODEC_HDR_LEN 8
+#define STREAM_CODEC_FRAME_MAX 384      // As UDP_FRAME_LEN
+#define STREAM_CODEC_RECORD_MAX 32      // Longest keyframe: 1 + 6 + 1 + 5 + 5 + 3 + 5 + 1
+#define STREAM_CODEC_MAX_TAGS 64        // Slots, the least recently sent tag gives up its slot
+#define STREAM_CODEC_SAMPLE_BIN_LEN 14  // Same sample uncompressed: address, seq, time (u32), distance (u16), rssi
+
+/**
+ * @brief One range as forwarded by the gateway.
+ *
+ */
+typedef struct stream_sample {
+    uint8_t addr[6];
+    uint8_t seq;
+    int8_t rssi;
+    uint16_t dist_cm;
+    uint32_t time_ms;   // Gateway receive time
+} STREAM_SAMPLE;
+
+typedef struct stream_codec_config {
+    uint32_t resync_ms;         // Keyframe a tag at least this often
+    uint16_t resync_samples;    // ...and at least every this many samples
+} STREAM_CODEC_CONFIG;
+
+#define STREAM_CODEC_CONFIG_DEFAULT() {         \
+    .resync_ms = 1000,                          \
+    .resync_samples = 64,                       \
+}
+
+typedef struct stream_codec_tag {
+    bool used;
+    uint8_t addr[6];
+    uint8_t seq;
+    int8_t rssi;
+    uint16_t dist_cm;
+    int32_t dist_step;
+    uint32_t time_ms;
+    int32_t time_step;
+    uint32_t key_ms;            // Time of the last keyframe
+    uint16_t since_key;         // Deltas since the last keyframe
+} STREAM_CODEC_TAG;
+
+/**
+ * @brief Encoder state: the tag slots and the frame being built.
+ *
+ */
+typedef struct stream_encoder {
+    STREAM_CODEC_CONFIG config;
+    STREAM_CODEC_TAG tags[STREAM_CODEC_MAX_TAGS];
+    uint16_t frame_seq;
+    uint32_t base_ms;
+    size_t len;                 // Bytes in frame, 0 while empty
+    uint8_t frame[STREAM_CODEC_FRAME_MAX];
+    uint32_t samples;
+    uint32_t keyframes;
+    uint32_t frames;
+    uint32_t bytes;
+} STREAM_ENCODER;
+
+/**
+ * @brief Initialise the encoder; the first sample of every tag is a keyframe.
+ *
+ * @param[in] enc           The encoder.
+ * @param[in] config        Resync policy.
+ * @param[in] frame_seq     First frame sequence number, e.g. random so that a reboot reads as a gap.
+ *
+ */
+void stream_encoder_init(STREAM_ENCODER *enc, const STREAM_CODEC_CONFIG *config, uint16_t frame_seq);
+
+/**
+ * @brief Bytes a sample would take in the current frame, without adding it.
+ *
+ */
+size_t stream_encoder_cost(const STREAM_ENCODER *enc, const STREAM_SAMPLE *sample);
+
+/**
+ * @brief Append a sample to the current frame.
+ *
+ * @return
+ *      - false if the frame is full: send it with stream_encoder_flush() and add the sample again.
+ */
+bool stream_encoder_add(STREAM_ENCODER *enc, const STREAM_SAMPLE *sample);
+
+/**
+ * @brief Close the current frame. It stays valid until the next stream_encoder_add().
+ *
+ * @param[in]  enc      The encoder.
+ * @param[out] frame    The frame.
+ *
+ * @return
+ *      - Length of the frame, 0 if no sample was added since the last flush.
+ */
+size_t stream_encoder_flush(STREAM_ENCODER *enc, const uint8_t **frame);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,193 @@
+import argparse
+import ctypes
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+from collections import defaultdict
+
+# Checks tag_window_agg.c against a brute-force reference: every sample is kept with its pane number and each
+# summary is recomputed from scratch over the panes in its window. Random streams cover tumbling and sliding
+# windows, 16-bit values of either sign (the variance is a uint32_t), silent tags leaving the table and more tags
+# than TAG_AGG_TABLE_SIZE.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+TABLE_SIZE = 64             # TAG_AGG_TABLE_SIZE
+MAX_PANES = 8               # TAG_AGG_MAX_PANES
+
+SHIM = """
+#include <stdlib.h>
+#include <string.h>
+#include "tag_window_agg.h"
+
+#define CHECK_MAX_RESULTS 1024
+
+static TAG_AGG_RESULT check_results[CHECK_MAX_RESULTS];
+static int check_result_count;
+
+static void check_result_cb(const TAG_AGG_RESULT *result, void *ctx)
+{
+    if (check_result_count < CHECK_MAX_RESULTS) {
+        check_results[check_result_count] = *result;
+    }
+    check_result_count++;
+}
+
+TAG_WINDOW_AGG *check_agg_new(uint32_t pane_ms, uint8_t pane_count)
+{
+    TAG_WINDOW_AGG *agg = malloc(sizeof(*agg));
+    if (!tag_window_agg_init(agg, pane_ms, pane_count)) {
+        free(agg);
+        return NULL;
+    }
+    return agg;
+}
+
+// Flush and return the summaries through results, up to max
+int check_agg_flush(TAG_WINDOW_AGG *agg, TAG_AGG_RESULT *results, int max)
+{
+    check_result_count = 0;
+    tag_window_agg_flush(agg, check_result_cb, NULL);
+    memcpy(results, check_results, sizeof(TAG_AGG_RESULT) * (check_result_count < max ? check_result_count : max));
+    return check_result_count;
+}
+"""
+
+
+class AggResult(ctypes.Structure):
+    _fields_ = [("addr", ctypes.c_uint8 * 6), ("window_ms", ctypes.c_uint32), ("count", ctypes.c_uint32),
+                ("min", ctypes.c_int32), ("max", ctypes.c_int32), ("mean", ctypes.c_int32),
+                ("variance", ctypes.c_uint32), ("last", ctypes.c_int32)]
+
+
+def load_agg(workdir):
+    """Build tag_window_agg.c into a shared library."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run tag_window_agg.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    lib = os.path.join(workdir, "tag_window_agg.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", lib, shim,
+                    os.path.join(HERE, "tag_window_agg.c")], check=True)
+    dll = ctypes.CDLL(lib)
+    dll.check_agg_new.restype = ctypes.c_void_p
+    dll.check_agg_new.argtypes = [ctypes.c_uint32, ctypes.c_uint8]
+    dll.tag_window_agg_add.restype = ctypes.c_bool
+    dll.tag_window_agg_add.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int32]
+    dll.check_agg_flush.restype = ctypes.c_int
+    dll.check_agg_flush.argtypes = [ctypes.c_void_p, ctypes.POINTER(AggResult), ctypes.c_int]
+    dll.tag_window_agg_count.restype = ctypes.c_int
+    dll.tag_window_agg_count.argtypes = [ctypes.c_void_p]
+    return dll
+
+
+class Reference:
+    """Every sample with its pane number; the table is modelled only to know which tags get a slot."""
+
+    def __init__(self, pane_ms, pane_count):
+        self.pane_ms, self.pane_count = pane_ms, pane_count
+        self.pane = 0
+        self.samples = defaultdict(list)    # addr -> [(pane, value)]
+        self.slotted = set()
+
+    def add(self, addr, value):
+        if addr not in self.slotted:
+            if len(self.slotted) == TABLE_SIZE:
+                return False
+            self.slotted.add(addr)
+            self.samples[addr] = []
+        self.samples[addr].append((self.pane, value))
+        return True
+
+    def flush(self):
+        results = {}
+        first = self.pane - self.pane_count + 1
+        for addr in list(self.slotted):
+            window = [v for p, v in self.samples[addr] if p >= first]
+            current = [v for p, v in self.samples[addr] if p == self.pane]
+            if window and current:
+                n, total = len(window), sum(window)
+                mean = (total + n // 2) // n if total >= 0 else -((-total + n // 2) // n)
+                variance = (n * sum(v * v for v in window) - total * total) // (n * n)
+                results[addr] = {"window_ms": self.pane_ms * self.pane_count, "count": n, "min": min(window),
+                                 "max": max(window), "mean": mean, "variance": variance,
+                                 "last": self.samples[addr][-1][1]}
+            # The oldest pane leaves the window; a tag with nothing left gives its slot back
+            if not any(p > first for p, _ in self.samples[addr]):
+                self.slotted.discard(addr)
+                del self.samples[addr]
+        self.pane += 1
+        return results
+
+
+def run_case(dll, case, rng):
+    agg = dll.check_agg_new(case["pane_ms"], case["panes"])
+    ref = Reference(case["pane_ms"], case["panes"])
+    addrs = [bytes((0xC0, 0xDE, rng.randrange(256), rng.randrange(256), k >> 8, k & 0xFF))
+             for k in range(case["tags"])]
+    buf = (AggResult * 1024)()
+    stats = {"samples": 0, "summaries": 0, "unslotted": 0, "mismatches": 0}
+    errors = []
+
+    for _ in range(case["flushes"]):
+        # Each pane only a share of the tags speaks, so tags come and go and slots are reused
+        active = rng.sample(addrs, rng.randint(0, len(addrs)))
+        for _ in range(rng.randint(0, case["samples_per_pane"])):
+            if not active:
+                break
+            addr = rng.choice(active)
+            value = rng.randint(*case["values"])
+            expected = ref.add(addr, value)
+            got = dll.tag_window_agg_add(agg, addr, value)
+            stats["samples"] += 1
+            stats["unslotted"] += not expected
+            if got != expected:
+                errors.append({"pane": ref.pane, "add": addr.hex(), "expected": expected, "got": got})
+        expected = ref.flush()
+        count = dll.check_agg_flush(agg, buf, len(buf))
+        got = {bytes(r.addr): {f: getattr(r, f) for f in ("window_ms", "count", "min", "max", "mean", "variance",
+                                                            "last")} for r in buf[:count]}
+        stats["summaries"] += count
+        if got != expected:
+            for addr in set(got) | set(expected):
+                if got.get(addr) != expected.get(addr):
+                    errors.append({"pane": ref.pane - 1, "tag": addr.hex(), "expected": expected.get(addr),
+                                   "got": got.get(addr)})
+        if dll.tag_window_agg_count(agg) != len(ref.slotted):
+            errors.append({"pane": ref.pane - 1, "table": dll.tag_window_agg_count(agg), "expected": len(ref.slotted)})
+    stats["mismatches"] = len(errors)
+    return stats, errors[:5]
+
+
+CASES = [
+    {"name": "tumbling", "tags": 20, "panes": 1, "pane_ms": 1000, "values": (0, 0xFFFF)},
+    {"name": "sliding", "tags": 20, "panes": 4, "pane_ms": 250, "values": (0, 0xFFFF)},
+    {"name": "sliding_max_panes", "tags": 40, "panes": MAX_PANES, "pane_ms": 100, "values": (-32768, 32767)},
+    {"name": "table_full_tumbling", "tags": 3 * TABLE_SIZE, "panes": 1, "pane_ms": 1000, "values": (0, 0xFFFF)},
+    {"name": "table_full_sliding", "tags": 2 * TABLE_SIZE, "panes": 4, "pane_ms": 250, "values": (-5, 5)},
+]
+
+
+# python3 tag_agg_check.py --flushes 500
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Check tag_window_agg.c against a brute-force reference")
+    parser.add_argument("--flushes", type=int, default=500, help="panes closed per case")
+    parser.add_argument("--samples", type=int, default=400, help="most samples per pane")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    failed = False
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_agg(workdir)
+        for case in CASES:
+            case = dict(case, flushes=args.flushes, samples_per_pane=args.samples)
+            stats, errors = run_case(dll, case, random.Random(args.seed))
+            failed |= stats["mismatches"] > 0
+            print(json.dumps({"case": case["name"], **stats, "ok": not errors, "first_errors": errors}))
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,132 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tag_owner.h"
+
+#include <string.h>
+
+void tag_owner_init(TAG_OWNER_TABLE *table, uint32_t self_id)
+{
+    memset(table, 0, sizeof(*table));
+    table->self_id = self_id;
+}
+
+static TAG_OWNER_ENTRY *tag_owner_find(TAG_OWNER_TABLE *table, const uint8_t addr[TAG_ADDR_LEN], bool create,
+                                       uint32_t now_ms)
+{
+    TAG_OWNER_ENTRY *victim = NULL;
+
+    for (int i = 0; i < TAG_OWNER_TABLE_SIZE; i++) {
+        TAG_OWNER_ENTRY *entry = &table->entries[i];
+        if (entry->used && memcmp(entry->addr, addr, TAG_ADDR_LEN) == 0) {
+            return entry;
+        }
+        if (!entry->used) {
+            if (victim == NULL || victim->used) {
+                victim = entry;
+            }
+        } else if (victim == NULL || (victim->used && now_ms - entry->heard_ms > now_ms - victim->heard_ms)) {
+            victim = entry;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    memcpy(victim->addr, addr, TAG_ADDR_LEN);
+    victim->used = true;
+    return victim;
+}
+
+static bool tag_owner_peer_valid(const TAG_OWNER_ENTRY *entry, uint32_t now_ms)
+{
+    return entry->peer_id != 0 && now_ms - entry->peer_ms <= TAG_OWNER_CLAIM_EXPIRE_MS;
+}
+
+bool tag_owner_observe(TAG_OWNER_TABLE *table, const uint8_t addr[TAG_ADDR_LEN], int8_t rssi, uint32_t now_ms)
+{
+    TAG_OWNER_ENTRY *entry = tag_owner_find(table, addr, true, now_ms);
+
+    if (entry->heard_ms == 0 || now_ms - entry->heard_ms > TAG_OWNER_HEARD_MS) {
+        entry->rssi_x16 = rssi * 16;
+    } else {
+        entry->rssi_x16 += (rssi * 16 - entry->rssi_x16) >> TAG_OWNER_RSSI_ALPHA_SHIFT;
+    }
+    entry->heard_ms = now_ms;
+    int mine = entry->rssi_x16 / 16;
+
+    bool owned;
+    if (!tag_owner_peer_valid(entry, now_ms)) {
+        // Nobody else claims the tag (or the owner stopped hearing it): take it
+        owned = true;
+    } else if (entry->owned) {
+        // Both claim it: the stronger receiver keeps it, the lower id wins a tie
+        owned = mine > entry->peer_rssi || (mine == entry->peer_rssi && table->self_id < entry->peer_id);
+    } else {
+        // Someone else owns it: only a clearly better receiver challenges
+        owned = mine > entry->peer_rssi + TAG_OWNER_RSSI_HYST_DB;
+    }
+
+    if (owned && !entry->owned) {
+        table->takeovers++;
+    } else if (!owned && entry->owned) {
+        table->yields++;
+    }
+    entry->owned = owned;
+    if (owned) {
+        table->forwarded++;
+    } else {
+        table->suppressed++;
+    }
+    return owned;
+}
+
+void tag_owner_peer_claim(TAG_OWNER_TABLE *table, uint32_t peer_id, const TAG_OWNER_CLAIM *claim, uint32_t now_ms)
+{
+    if (peer_id == table->self_id) {
+        return;
+    }
+    TAG_OWNER_ENTRY *entry = tag_owner_find(table, claim->addr, true, now_ms);
+
+    // Keep the strongest live claimant; a refresh from the same peer always replaces its old claim
+    if (!tag_owner_peer_valid(entry, now_ms) || entry->peer_id == peer_id || claim->rssi > entry->peer_rssi) {
+        entry->peer_id = peer_id;
+        entry->peer_rssi = claim->rssi;
+        entry->peer_ms = now_ms;
+    }
+}
+
+int tag_owner_build_claims(TAG_OWNER_TABLE *table, uint32_t now_ms, TAG_OWNER_CLAIM *claims, int max, int *cursor)
+{
+    int count = 0;
+
+    for (; *cursor < TAG_OWNER_TABLE_SIZE && count < max; (*cursor)++) {
+        TAG_OWNER_ENTRY *entry = &table->entries[*cursor];
+        if (!entry->used || !entry->owned) {
+            continue;
+        }
+        if (now_ms - entry->heard_ms > TAG_OWNER_HEARD_MS) {
+            // Stop claiming a tag we no longer hear so that a peer takes over right away
+            entry->owned = false;
+            continue;
+        }
+        memcpy(claims[count].addr, entry->addr, TAG_ADDR_LEN);
+        claims[count].rssi = (int8_t)(entry->rssi_x16 / 16);
+        count++;
+    }
+    return count;
+}
+
+int tag_owner_owned_count(const TAG_OWNER_TABLE *table)
+{
+    int count = 0;
+
+    for (int i = 0; i < TAG_OWNER_TABLE_SIZE; i++) {
+        count += (table->entries[i].used && table->entries[i].owned) ? 1 : 0;
+    }
+    return count;
+}
@@ -0,0 +1,102 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "tag_seq_filter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TAG_OWNER_TABLE_SIZE 64
+#define TAG_OWNER_RSSI_HYST_DB 3        // A challenger must beat the owner by this much to take over
+#define TAG_OWNER_CLAIM_EXPIRE_MS 1200  // A peer claim not refreshed for this long is void (owner lost the tag)
+#define TAG_OWNER_HEARD_MS 800          // Not heard for this long: stop claiming the tag
+#define TAG_OWNER_RSSI_ALPHA_SHIFT 2    // RSSI EWMA weight 1/4
+
+/**
+ * @brief One ownership claim as exchanged between gateways.
+ *
+ */
+typedef struct tag_owner_claim {
+    uint8_t addr[TAG_ADDR_LEN];
+    int8_t rssi;
+} TAG_OWNER_CLAIM;
+
+typedef struct tag_owner_entry {
+    uint8_t addr[TAG_ADDR_LEN];
+    bool used;
+    bool owned;             // This gateway currently forwards the tag
+    int16_t rssi_x16;       // Smoothed local RSSI, x16
+    uint32_t heard_ms;
+    uint32_t peer_id;       // Strongest peer claiming the tag, 0 for none
+    int8_t peer_rssi;
+    uint32_t peer_ms;
+} TAG_OWNER_ENTRY;
+
+typedef struct tag_owner_table {
+    uint32_t self_id;
+    TAG_OWNER_ENTRY entries[TAG_OWNER_TABLE_SIZE];
+    uint32_t forwarded;
+    uint32_t suppressed;
+    uint32_t takeovers;
+    uint32_t yields;
+} TAG_OWNER_TABLE;
+
+/**
+ * @brief Reset the table.
+ *
+ * @param[in] table     The table. Not thread safe, callers serialise access.
+ * @param[in] self_id   Non-zero identifier of this gateway, also used as the tie-breaker.
+ *
+ */
+void tag_owner_init(TAG_OWNER_TABLE *table, uint32_t self_id);
+
+/**
+ * @brief Record a local reception of a tag and decide whether this gateway forwards it.
+ *
+ * @param[in] table     The table.
+ * @param[in] addr      Tag address.
+ * @param[in] rssi      RSSI of this reception.
+ * @param[in] now_ms    Current time in milliseconds.
+ *
+ * @return
+ *      - true if this gateway owns the tag and must forward the sample.
+ */
+bool tag_owner_observe(TAG_OWNER_TABLE *table, const uint8_t addr[TAG_ADDR_LEN], int8_t rssi, uint32_t now_ms);
+
+/**
+ * @brief Apply a claim received from another gateway.
+ *
+ */
+void tag_owner_peer_claim(TAG_OWNER_TABLE *table, uint32_t peer_id, const TAG_OWNER_CLAIM *claim, uint32_t now_ms);
+
+/**
+ * @brief Collect the claims for the tags this gateway owns and still hears.
+ *
+ * @param[in] table     The table.
+ * @param[in] now_ms    Current time in milliseconds.
+ * @param[out] claims   Output array.
+ * @param[in] max       Capacity of the output array.
+ * @param[inout] cursor Entry index to resume from, for claims split over several datagrams.
+ *
+ * @return
+ *      - Number of claims written.
+ */
+int tag_owner_build_claims(TAG_OWNER_TABLE *table, uint32_t now_ms, TAG_OWNER_CLAIM *claims, int max, int *cursor);
+
+/**
+ * @brief Number of tags this gateway owns.
+ *
+ */
+int tag_owner_owned_count(const TAG_OWNER_TABLE *table);
+
+#ifdef __cplusplus
+}
+#endif
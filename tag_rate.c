@@ -0,0 +1,91 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tag_rate.h"
+
+#include <string.h>
+
+void tag_rate_init(TAG_RATE_POLICY *policy, const TAG_RATE_CONFIG *config, uint32_t now_ms)
+{
+    memset(policy, 0, sizeof(*policy));
+    policy->config = *config;
+    if (policy->config.min_interval_ms == 0) {
+        policy->config.min_interval_ms = 1;
+    }
+    if (policy->config.moving_interval_ms < policy->config.min_interval_ms) {
+        policy->config.moving_interval_ms = policy->config.min_interval_ms;
+    }
+    if (policy->config.max_interval_ms < policy->config.moving_interval_ms) {
+        policy->config.max_interval_ms = policy->config.moving_interval_ms;
+    }
+    policy->interval_ms = policy->config.moving_interval_ms;
+    policy->last_motion_ms = now_ms;
+}
+
+static void tag_rate_observe(TAG_RATE_POLICY *policy, uint32_t now_ms, uint16_t dist_cm)
+{
+    const TAG_RATE_CONFIG *config = &policy->config;
+
+    if (!policy->have_ref) {
+        policy->have_ref = true;
+        policy->ref_cm = dist_cm;
+        policy->ref_ms = now_ms;
+        return;
+    }
+
+    // Compared with where the tag last moved rather than the previous range, so slow motion still adds up past
+    // the noise however fast the tag ranges
+    uint32_t moved_cm = dist_cm > policy->ref_cm ? dist_cm - policy->ref_cm : policy->ref_cm - dist_cm;
+    uint32_t elapsed_ms = now_ms - policy->ref_ms;
+    if (moved_cm > config->noise_cm && elapsed_ms > 0) {
+        uint32_t speed_cm_s = moved_cm * 1000 / elapsed_ms;
+        if (!policy->moving) {
+            policy->moving = true;
+            policy->motion_starts++;
+            policy->speed_cm_s = speed_cm_s;
+        } else {
+            policy->speed_cm_s = (policy->speed_cm_s * (100 - config->speed_alpha_pct) +
+                                  speed_cm_s * config->speed_alpha_pct) / 100;
+        }
+        policy->ref_cm = dist_cm;
+        policy->ref_ms = now_ms;
+        policy->last_motion_ms = now_ms;
+    } else if (policy->moving && now_ms - policy->last_motion_ms >= config->still_ms) {
+        policy->moving = false;
+        policy->speed_cm_s = 0;
+    }
+}
+
+uint32_t tag_rate_update(TAG_RATE_POLICY *policy, uint32_t now_ms, bool ok, uint16_t dist_cm, uint32_t random)
+{
+    const TAG_RATE_CONFIG *config = &policy->config;
+
+    policy->exchanges++;
+    if (ok) {
+        tag_rate_observe(policy, now_ms, dist_cm);
+    } else {
+        // A lost exchange says nothing about motion: keep the rate, the jitter moves it off a colliding tag
+        policy->failures++;
+    }
+
+    if (policy->moving) {
+        // One exchange per step_cm of radial motion, never slower than the fixed moving rate
+        uint32_t interval = policy->speed_cm_s > 0 ? (uint32_t)config->step_cm * 1000 / policy->speed_cm_s :
+                            config->moving_interval_ms;
+        if (interval < config->min_interval_ms) {
+            interval = config->min_interval_ms;
+        }
+        if (interval > config->moving_interval_ms) {
+            interval = config->moving_interval_ms;
+        }
+        policy->interval_ms = interval;
+    } else if (ok && now_ms - policy->last_motion_ms >= config->still_ms) {
+        uint32_t interval = policy->interval_ms + policy->interval_ms * config->backoff_pct / 100;
+        policy->interval_ms = interval > config->max_interval_ms ? config->max_interval_ms : interval;
+    }
+
+    return policy->interval_ms + policy->interval_ms * config->jitter_pct * (random % 1024) / (100 * 1024);
+}
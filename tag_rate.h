@@ -0,0 +1,85 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Tuning of the tag ranging rate. Motion is the range drifting away from where it last moved by more than
+ *        the noise; a single anchor only sees its radial component.
+ *
+ */
+typedef struct tag_rate_config {
+    uint16_t min_interval_ms;       // Fastest ranging, while moving quickly (20 ms = 50 Hz)
+    uint16_t moving_interval_ms;    // Slowest ranging while moving
+    uint16_t max_interval_ms;       // Heartbeat of a still tag
+    uint16_t step_cm;               // Range change worth one exchange: interval = step / speed while moving
+    uint16_t noise_cm;              // Range jitter of a still tag, smaller changes are not motion
+    uint16_t still_ms;              // Time without motion before the tag counts as still
+    uint8_t backoff_pct;            // Interval growth per exchange once still, in percent
+    uint8_t speed_alpha_pct;        // EWMA weight of the newest speed measurement, in percent
+    uint8_t jitter_pct;             // Random extra delay in percent of the interval, keeps tags out of step
+} TAG_RATE_CONFIG;
+
+#define TAG_RATE_CONFIG_DEFAULT() {             \
+    .min_interval_ms = 20,                      \
+    .moving_interval_ms = 100,                  \
+    .max_interval_ms = 2000,                    \
+    .step_cm = 10,                              \
+    .noise_cm = 15,                             \
+    .still_ms = 3000,                           \
+    .backoff_pct = 50,                          \
+    .speed_alpha_pct = 50,                      \
+    .jitter_pct = 10,                           \
+}
+
+/**
+ * @brief Rate controller state and statistics.
+ *
+ */
+typedef struct tag_rate_policy {
+    TAG_RATE_CONFIG config;
+    bool have_ref;
+    bool moving;
+    uint16_t ref_cm;                // Range where motion was last detected
+    uint32_t ref_ms;
+    uint32_t last_motion_ms;
+    uint32_t speed_cm_s;            // Smoothed radial speed
+    uint32_t interval_ms;           // Current interval, before jitter
+    uint32_t exchanges;
+    uint32_t failures;
+    uint32_t motion_starts;
+} TAG_RATE_POLICY;
+
+/**
+ * @brief Initialise the controller, ranging at moving_interval_ms until the first motion decision.
+ *
+ */
+void tag_rate_init(TAG_RATE_POLICY *policy, const TAG_RATE_CONFIG *config, uint32_t now_ms);
+
+/**
+ * @brief Feed the outcome of one ranging exchange and get the delay until the next one.
+ *
+ * @param[in] policy    The controller.
+ * @param[in] now_ms    Current time in milliseconds.
+ * @param[in] ok        Whether the exchange produced a range.
+ * @param[in] dist_cm   The range, ignored if ok is false.
+ * @param[in] random    Any random value, for the jitter.
+ *
+ * @return
+ *      - Milliseconds until the next exchange.
+ */
+uint32_t tag_rate_update(TAG_RATE_POLICY *policy, uint32_t now_ms, bool ok, uint16_t dist_cm, uint32_t random);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,210 @@
+import argparse
+import ctypes
+import heapq
+import json
+import math
+import os
+import random
+import shutil
+import subprocess
+import tempfile
+from collections import deque
+
+# Site simulation of uwb_tag.ino in TWR mode: tags walking and standing in a room around one anchor, ranging in
+# fixed mode (RNG_DELAY_MS, DW3000 always on), fixed with sleep, or adaptive (tag_rate.c compiled for the host,
+# DW3000 asleep between exchanges). Reports per tag: exchange rate, channel occupancy, collisions, DW3000 energy
+# and how far the last advertised range lags the true one.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# Frame timing for the sketch's configuration (channel 5, 128 symbol preamble, 6.8 Mbps)
+POLL_AIR_MS = 0.18
+RESP_AIR_MS = 0.19
+RESP_DELAY_MS = 1.72        # POLL_TX_TO_RESP_RX_DLY_UUS
+RX_MS = 0.25                # RESP_RX_TIMEOUT_UUS
+EXCHANGE_MS = RESP_DELAY_MS + RX_MS
+LOOP_OVERHEAD_MS = 1.0      # Serial output and BLE update per exchange, uniformly 0..this
+
+# DW3000 supply current, typical datasheet figures for channel 5; edit to match the board
+VDD = 3.3
+TX_MA = 40.0
+RX_MA = 60.0
+IDLE_MA = 11.0              # IDLE_PLL, where the fixed-rate sketch waits
+WAKE_MA = 4.0               # IDLE_RC while waking and restoring the configuration
+WAKE_MS = 2.0
+SLEEP_UA = 0.5
+DW_SLEEP_MIN_MS = 10        # As in uwb_tag.ino
+FIXED_INTERVAL_MS = 100     # RNG_DELAY_MS
+
+ADV_COPIES_PER_RANGE = 4
+FIXED_ADV_INTERVAL_MS = 30  # Arduino BLEAdvertising default, 20 to 40 ms
+
+SHIM = """
+#include <stdlib.h>
+#include "tag_rate.h"
+
+TAG_RATE_POLICY *sim_policy_new(uint32_t now_ms)
+{
+    static const TAG_RATE_CONFIG config = TAG_RATE_CONFIG_DEFAULT();
+    TAG_RATE_POLICY *policy = malloc(sizeof(*policy));
+    tag_rate_init(policy, &config, now_ms);
+    return policy;
+}
+"""
+
+
+def load_policy(workdir):
+    """Build tag_rate.c with its default configuration into a shared library."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run tag_rate.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    lib = os.path.join(workdir, "tag_rate.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", lib, shim, os.path.join(HERE, "tag_rate.c")],
+                   check=True)
+    dll = ctypes.CDLL(lib)
+    dll.sim_policy_new.restype = ctypes.c_void_p
+    dll.sim_policy_new.argtypes = [ctypes.c_uint32]
+    dll.tag_rate_update.restype = ctypes.c_uint32
+    dll.tag_rate_update.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_bool, ctypes.c_uint16, ctypes.c_uint32]
+    return dll
+
+
+class Walker:
+    """Stands still for an exponential time, then walks to a random point in the room, and again."""
+
+    def __init__(self, rng, cfg):
+        self.rng = rng
+        self.cfg = cfg
+        self.pos = (rng.uniform(1, cfg["room_m"]), rng.uniform(1, cfg["room_m"]))
+        self.start, self.end, self.vel = 0.0, rng.expovariate(1 / cfg["still_s"]), (0.0, 0.0)
+        self.moving = False
+        self.moving_s = 0.0
+
+    def at(self, t):
+        while t > self.end:
+            self.pos = (self.pos[0] + self.vel[0] * (self.end - self.start),
+                        self.pos[1] + self.vel[1] * (self.end - self.start))
+            self.start = self.end
+            if self.moving:
+                self.moving, self.vel = False, (0.0, 0.0)
+                self.end += self.rng.expovariate(1 / self.cfg["still_s"])
+            else:
+                target = (self.rng.uniform(1, self.cfg["room_m"]), self.rng.uniform(1, self.cfg["room_m"]))
+                speed = self.rng.uniform(*self.cfg["speed_m_s"])
+                dx, dy = target[0] - self.pos[0], target[1] - self.pos[1]
+                duration = max(math.hypot(dx, dy) / speed, 0.1)
+                self.moving, self.vel = True, (dx / duration, dy / duration)
+                self.end += duration
+                self.moving_s += duration
+        x = self.pos[0] + self.vel[0] * (t - self.start)
+        y = self.pos[1] + self.vel[1] * (t - self.start)
+        return math.hypot(x, y)     # Anchor in the corner of the room
+
+
+def simulate(mode, cfg, dll):
+    rng = random.Random(cfg["seed"])
+    tags = cfg["tags"]
+    walkers = [Walker(random.Random(cfg["seed"] * 1000 + k), cfg) for k in range(tags)]
+    policies = [dll.sim_policy_new(0) for _ in range(tags)] if mode == "adaptive" else None
+    sleeps = mode != "fixed"
+    end_ms = cfg["duration_s"] * 1000
+    events = [(rng.uniform(0, FIXED_INTERVAL_MS), k) for k in range(tags)]
+    heapq.heapify(events)
+    recent = deque()                # Exchange start times still able to overlap a new one
+    starts = [None] * tags
+    exchanges, failures = [0] * tags, [0] * tags
+    energy_mj = [0.0] * tags
+    last_range = [None] * tags
+    wait_ms = [0.0] * tags
+    adv_ms = [0.0] * tags           # Time-weighted BLE adv events
+    errors = []
+    next_probe, probe_ms = 0.0, 100.0
+
+    def wait_energy(k, ms):
+        if sleeps and ms >= DW_SLEEP_MIN_MS:
+            return (WAKE_MA * WAKE_MS + SLEEP_UA / 1000 * (ms - WAKE_MS)) * VDD / 1000
+        return IDLE_MA * ms * VDD / 1000
+
+    # Each exchange is resolved once every exchange that could overlap it has started
+    resolve = []
+    while events or resolve:
+        if resolve and (not events or resolve[0][0] <= events[0][0]):
+            t, k = heapq.heappop(resolve)
+            start = starts[k]
+            collided = any(abs(s - start) < EXCHANGE_MS and other != k for s, other in recent)
+            true_cm = walkers[k].at(start / 1000) * 100
+            ok = not collided
+            exchanges[k] += 1
+            energy_mj[k] += (TX_MA * POLL_AIR_MS + IDLE_MA * RESP_DELAY_MS + RX_MA * RX_MS) * VDD / 1000
+            if ok:
+                last_range[k] = true_cm + rng.gauss(0, cfg["noise_cm"])
+            else:
+                failures[k] += 1
+            if mode == "adaptive":
+                dist = max(0, min(0xFFFF, int(last_range[k] or 0)))
+                wait = dll.tag_rate_update(policies[k], int(t), ok, dist, rng.getrandbits(32))
+                adv_interval = min(max(wait / ADV_COPIES_PER_RANGE, 20.0), 1000.0)
+            else:
+                wait = FIXED_INTERVAL_MS
+                adv_interval = FIXED_ADV_INTERVAL_MS
+            wait += rng.uniform(0, LOOP_OVERHEAD_MS)
+            energy_mj[k] += wait_energy(k, wait)
+            wait_ms[k] += wait
+            adv_ms[k] += wait / adv_interval
+            if t + wait < end_ms:
+                heapq.heappush(events, (t + wait, k))
+            continue
+        t, k = heapq.heappop(events)
+        # Tracking error, sampled on a fixed grid between events
+        while next_probe <= t:
+            for j in range(tags):
+                if last_range[j] is not None:
+                    errors.append(abs(last_range[j] - walkers[j].at(next_probe / 1000) * 100))
+            next_probe += probe_ms * max(1, tags // 10)
+        while recent and recent[0][0] < t - EXCHANGE_MS:
+            recent.popleft()
+        recent.append((t, k))
+        starts[k] = t
+        heapq.heappush(resolve, (t + EXCHANGE_MS, k))
+
+    duration = cfg["duration_s"]
+    errors.sort()
+    total = sum(exchanges)
+    return {
+        "mode": mode,
+        "config": cfg,
+        "exchanges_per_tag_s": round(total / tags / duration, 3),
+        "channel_occupancy": round(total * (POLL_AIR_MS + RESP_AIR_MS) / 1000 / duration, 5),
+        "collision_rate": round(sum(failures) / total, 4) if total else 0.0,
+        "energy_mj_per_tag_h": round(sum(energy_mj) / tags / duration * 3600, 1),
+        "avg_current_ma": round(sum(energy_mj) / tags / duration / VDD, 3),
+        "adv_events_per_tag_s": round(sum(adv_ms) / tags / duration, 2),
+        "moving_fraction": round(sum(w.moving_s for w in walkers) / tags / duration, 3),
+        "range_error_cm": {"p50": round(errors[len(errors) // 2], 1), "p95": round(errors[int(len(errors) * 0.95)], 1),
+                           "p99": round(errors[int(len(errors) * 0.99)], 1)} if errors else None,
+    }
+
+
+# python3 tag_rate_sim.py --tags 20 --duration 600
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Channel occupancy and energy of adaptive vs fixed-rate tags")
+    parser.add_argument("--tags", type=int, default=20)
+    parser.add_argument("--duration", type=float, default=600.0, help="simulated seconds")
+    parser.add_argument("--still", type=float, default=60.0, help="mean time a tag stands still, s")
+    parser.add_argument("--speed", default="0.5,1.5", help="walking speed range, m/s")
+    parser.add_argument("--room", type=float, default=20.0, help="room side, m, anchor in a corner")
+    parser.add_argument("--noise", type=float, default=3.0, help="range noise standard deviation, cm")
+    parser.add_argument("--modes", default="fixed,fixed_sleep,adaptive")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    cfg = {"tags": args.tags, "duration_s": args.duration, "still_s": args.still,
+           "speed_m_s": [float(v) for v in args.speed.split(",")], "room_m": args.room, "noise_cm": args.noise,
+           "seed": args.seed}
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_policy(workdir)
+        for mode in args.modes.split(","):
+            print(json.dumps(simulate(mode, cfg, dll)))
@@ -0,0 +1,280 @@
+import argparse
+import ctypes
+import json
+import random
+import sys
+import tempfile
+
+from adv_worker_bench import FOREIGN_ADV, HOST_HEADERS, AdvStats, build_host
+from bridge_bench import tag_adv
+
+# Checks the per-tag sequence window (tag_seq_filter.c behind ble_scan_filter_accept()) on the gateway's own
+# path: ble_adv_submit()'s manufacturer filter, the adv worker and the sequence part of tag_adv_handler(), all
+# compiled for the host (ble_adv_worker.c, ble_scan_filter.c, tag_seq_filter.c, mem_budget.c). Each tag publishes
+# ranges at its rate and re-advertises the last one until the next, so most copies it sends are repeats; some
+# ranges are never heard, some copies arrive late behind newer ones, sequence numbers wrap, and a tag falls silent
+# past TAG_SEQ_STALE_MS and comes back from a new sequence number. Foreign devices fill the rest, about 90% of the
+# scan results being foreign or repeated. The reference accepts the first copy of each range heard: the filter
+# must accept exactly those, in arrival order, and the counters must add up. With more tags than
+# TAG_SEQ_TABLE_SIZE, evicted tags are new again when they come back: no first copy may be lost, and the repeats
+# accepted again are counted.
+
+TABLE_SIZE = 64             # TAG_SEQ_TABLE_SIZE
+STALE_MS = 10000            # TAG_SEQ_STALE_MS
+WINDOW = 32                 # TAG_SEQ_WINDOW
+
+HEADERS = dict(HOST_HEADERS)
+HEADERS["esp_gap_ble_api.h"] += """
+#include <stdbool.h>
+#include "esp_err.h"
+typedef struct {
+    int scan_type;
+    int own_addr_type;
+    int scan_filter_policy;
+    uint16_t scan_interval;
+    uint16_t scan_window;
+    int scan_duplicate;
+} esp_ble_gap_set_scan_params_t;
+#define BLE_SCAN_FILTER_ALLOW_ALL 0
+#define BLE_SCAN_FILTER_ALLOW_ONLY_WLST 1
+#define BLE_SCAN_DUPLICATE_DISABLE 0
+#define BLE_SCAN_DUPLICATE_ENABLE 1
+#define BLE_WL_ADDR_TYPE_PUBLIC 0
+#define ESP_BD_ADDR_STR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define ESP_BD_ADDR_HEX(addr) addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]
+static inline esp_err_t esp_ble_gap_set_scan_params(esp_ble_gap_set_scan_params_t *params)
+{
+    return ESP_OK;
+}
+static inline esp_err_t esp_ble_gap_start_scanning(uint32_t duration)
+{
+    return ESP_OK;
+}
+static inline esp_err_t esp_ble_gap_stop_scanning(void)
+{
+    return ESP_OK;
+}
+static inline esp_err_t esp_ble_gap_update_whitelist(bool add, esp_bd_addr_t bda, int type)
+{
+    return ESP_OK;
+}
+"""
+HEADERS["freertos/semphr.h"] = """
+#pragma once
+#include "freertos/FreeRTOS.h"
+typedef void *SemaphoreHandle_t;
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    static int mutex;
+    return &mutex;
+}
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t wait)
+{
+    return pdTRUE;
+}
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    return pdTRUE;
+}
+"""
+
+SHIM = r"""
+#include "ble_adv_worker.c"
+#include "ble_scan_filter.h"
+#include "uwb_msg.h"
+
+#define CHECK_MAX_ACCEPTED 262144
+
+static int64_t check_now_us;
+static GATEWAY_CONFIG check_config = GATEWAY_CONFIG_DEFAULT();
+static uint8_t check_accepted[CHECK_MAX_ACCEPTED][3];
+static int check_accepted_count;
+
+int64_t esp_timer_get_time(void)
+{
+    return check_now_us;
+}
+
+const GATEWAY_CONFIG *gw_config_acquire(void)
+{
+    return &check_config;
+}
+
+void gw_config_release(const GATEWAY_CONFIG *config)
+{
+}
+
+// The sequence part of tag_adv_handler() in main.c: records each range the filter lets through
+static void check_handler(const BLE_ADV_EVENT *event)
+{
+    for (int i = 0; i < event->len;) {
+        uint8_t field_len = event->data[i];
+        if (field_len == 0 || i + field_len >= event->len) {
+            break;
+        }
+        if (event->data[i + 1] == ESP_BLE_AD_TYPE_MANUFACTURER_SPECIFIC_TYPE && field_len > 2) {
+            uint16_t mfg_id = event->data[i + 2] | (event->data[i + 3] << 8);
+            UWB_MSG_RANGE range;
+            if (mfg_id == check_config.manufacturer_id &&
+                uwb_msg_range_decode(&event->data[i + 4], field_len - 3, &range)) {
+                if (ble_scan_filter_accept(event->bda, range.seq) && check_accepted_count < CHECK_MAX_ACCEPTED) {
+                    check_accepted[check_accepted_count][0] = event->bda[4];
+                    check_accepted[check_accepted_count][1] = event->bda[5];
+                    check_accepted[check_accepted_count][2] = range.seq;
+                    check_accepted_count++;
+                }
+                break;
+            }
+        }
+        i += field_len + 1;
+    }
+}
+
+int check_start(void)
+{
+    esp_ble_gap_set_scan_params_t params = {.scan_interval = 0x50, .scan_window = 0x30};
+
+    check_accepted_count = 0;
+    memset(&adv_stats, 0, sizeof(adv_stats));
+    if (ble_scan_filter_start(&params) != ESP_OK) {
+        return -1;
+    }
+    return ble_adv_worker_start(check_handler);
+}
+
+// One scan result through the GAP callback step, then the worker until its queue is empty
+void check_submit(const uint8_t *bda, int rssi, const uint8_t *data, uint8_t len, int64_t now_us)
+{
+    struct ble_scan_result_evt_param scan_rst = {.rssi = rssi, .adv_data_len = len};
+    BLE_ADV_EVENT *event = NULL;
+
+    memcpy(scan_rst.bda, bda, ESP_BD_ADDR_LEN);
+    memcpy(scan_rst.ble_adv, data, len);
+    check_now_us = now_us;
+    ble_adv_submit(&scan_rst);
+    while (xQueueReceive(adv_queue, &event, 0) == pdTRUE) {
+        adv_handler(event);
+        msg_pool_free(&adv_pool, event);
+        adv_stats.processed++;
+    }
+}
+
+// Accepted ranges as (address byte 4, address byte 5, seq), in order
+int check_get_accepted(uint8_t *out, int max)
+{
+    int count = check_accepted_count < max ? check_accepted_count : max;
+    memcpy(out, check_accepted, (size_t)count * 3);
+    return check_accepted_count;
+}
+"""
+
+
+def load_filter(workdir):
+    """Build the adv worker, the scan filter and the sequence window over the stub headers."""
+    dll = build_host(workdir, SHIM, ["mem_budget.c", "ble_scan_filter.c", "tag_seq_filter.c"], HEADERS)
+    dll.check_start.restype = ctypes.c_int
+    dll.check_submit.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_uint8, ctypes.c_int64]
+    dll.check_get_accepted.restype = ctypes.c_int
+    dll.check_get_accepted.argtypes = [ctypes.c_char_p, ctypes.c_int]
+    dll.ble_adv_get_stats.argtypes = [ctypes.POINTER(AdvStats)]
+    dll.ble_scan_filter_get_stats.argtypes = [ctypes.POINTER(ctypes.c_uint32), ctypes.POINTER(ctypes.c_uint32),
+                                              ctypes.POINTER(ctypes.c_int)]
+    return dll
+
+
+def scan_stream(cfg, rng):
+    """Time ordered scan results (time us, tag or None, seq, first copy of its range)."""
+    end_us = int(cfg["duration_s"] * 1e6)
+    period_us = int(1e6 / cfg["rate"])
+    adv_us = int(1e6 / cfg["adv_rate"])
+    results = []
+    for tag in range(cfg["tags"]):
+        # One tag per case goes silent past the stale time and restarts its sequence numbers
+        silent = (end_us // 3, end_us // 3 + (STALE_MS + 2000) * 1000) if tag == 0 else None
+        seq = rng.randrange(256)
+        t = rng.randrange(period_us)
+        n = 0                   # Range count of the tag, the sequence number before wrapping
+        while t < end_us:
+            if silent and silent[0] <= t < silent[1]:
+                t, seq = silent[1], rng.randrange(256)
+                continue
+            seq, n = (seq + 1) & 0xff, n + 1
+            if rng.random() >= cfg["range_loss"]:
+                # Copies of this range until the next one, each heard or not; some are held up behind later ones
+                for a in range(t, min(t + period_us, end_us), adv_us):
+                    if rng.random() < cfg["rx"]:
+                        late = rng.random() < cfg["late"]
+                        delay = rng.randrange(period_us, period_us * (WINDOW // 2)) if late else rng.randrange(500)
+                        results.append([a + delay, tag, seq, n])
+            t += period_us
+    foreign = int(len(results) * cfg["foreign"] / (1 - cfg["foreign"]))
+    for _ in range(foreign):
+        results.append([rng.randrange(end_us), None, 0, 0])
+    results.sort(key=lambda r: r[0])
+
+    # Reference: the first copy heard of each range
+    seen = set()
+    for r in results:
+        _, tag, _, n = r
+        r[3] = tag is not None and (tag, n) not in seen
+        seen.add((tag, n))
+    return results
+
+
+def run_case(dll, cfg, rng):
+    results = scan_stream(cfg, rng)
+    if dll.check_start() != 0:
+        raise SystemExit("ble_scan_filter_start() or ble_adv_worker_start() failed")
+    for t, tag, seq, _ in results:
+        if tag is None:
+            bda, data = bytes((0xd0, 0x11, 0, 0, rng.randrange(256), rng.randrange(256))), FOREIGN_ADV
+        else:
+            bda, data = bytes((0x24, 0x0a, 0xc4, 0, tag >> 8, tag & 0xff)), tag_adv(150 + tag, seq)
+        dll.check_submit(bda, -60, data, len(data), t)
+
+    buf = ctypes.create_string_buffer(3 * len(results))
+    count = dll.check_get_accepted(buf, len(results))
+    accepted = [((buf.raw[3 * i] << 8) | buf.raw[3 * i + 1], buf.raw[3 * i + 2]) for i in range(count)]
+    expected = [(tag, seq) for _, tag, seq, first in results if first]
+    stats = AdvStats()
+    dll.ble_adv_get_stats(ctypes.byref(stats))
+    seq_accepted, seq_duplicates, tags = ctypes.c_uint32(), ctypes.c_uint32(), ctypes.c_int()
+    dll.ble_scan_filter_get_stats(ctypes.byref(seq_accepted), ctypes.byref(seq_duplicates), ctypes.byref(tags))
+
+    tag_advs = sum(1 for r in results if r[1] is not None)
+    # Every first copy must be accepted, in order; what is left over are repeats accepted again
+    it = iter(accepted)
+    in_order = all(any(a == e for a in it) for e in expected)
+    readmitted = len(accepted) - len(expected)
+    exact = cfg["tags"] <= TABLE_SIZE
+    ok = (in_order and stats.filtered == len(results) - tag_advs and stats.enqueued == tag_advs and
+          stats.pool_overflow == stats.queue_overflow == 0 and stats.processed == tag_advs and
+          seq_accepted.value == len(accepted) and seq_duplicates.value == tag_advs - len(accepted) and
+          tags.value == min(cfg["tags"], TABLE_SIZE) and (not exact or accepted == expected))
+    return {"scan_results": len(results), "foreign": stats.filtered, "tag_advs": tag_advs,
+            "ranges_heard": len(expected), "accepted": len(accepted), "duplicates_dropped": seq_duplicates.value,
+            "readmitted": readmitted, "dropped_share": round(1 - len(accepted) / len(results), 3),
+            "tags_tracked": tags.value, "in_order": in_order, "ok": ok}
+
+
+# python3 tag_seq_check.py --tags 20,64,100 --duration 120
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Check the tag sequence window on the gateway's adv path")
+    parser.add_argument("--tags", default="20,64,100", help="comma separated tag counts, one case each")
+    parser.add_argument("--duration", type=float, default=120.0, help="simulated seconds per case")
+    parser.add_argument("--rate", type=float, default=2.0, help="ranges per second per tag")
+    parser.add_argument("--adv-rate", type=float, default=10.0, help="advertisements per second per tag")
+    parser.add_argument("--foreign", type=float, default=0.5, help="share of scan results from foreign devices")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    failed = False
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_filter(workdir)
+        for tags in (int(v) for v in args.tags.split(",") if v):
+            cfg = {"tags": tags, "duration_s": args.duration, "rate": args.rate, "adv_rate": args.adv_rate,
+                   "rx": 0.8, "range_loss": 0.05, "late": 0.02, "foreign": args.foreign}
+            result = run_case(dll, cfg, random.Random(args.seed + tags))
+            failed |= not result["ok"]
+            print(json.dumps({"tags": tags, **result}))
+    sys.exit(1 if failed else 0)
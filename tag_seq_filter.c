@@ -0,0 +1,113 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tag_seq_filter.h"
+
+#include <string.h>
+
+static void tag_seq_entry_reset(TAG_SEQ_ENTRY *entry, uint8_t seq, uint32_t now_ms)
+{
+    entry->last_seq = seq;
+    entry->seen_mask = 1;
+    entry->last_ms = now_ms;
+}
+
+static TAG_SEQ_ENTRY *tag_seq_filter_lookup(TAG_SEQ_FILTER *filter, const uint8_t addr[TAG_ADDR_LEN], bool *created,
+                                            uint32_t now_ms)
+{
+    TAG_SEQ_ENTRY *victim = NULL;
+
+    *created = false;
+    for (int i = 0; i < TAG_SEQ_TABLE_SIZE; i++) {
+        TAG_SEQ_ENTRY *entry = &filter->entries[i];
+        if (!entry->used) {
+            if (victim == NULL || victim->used) {
+                victim = entry;
+            }
+            continue;
+        }
+        if (memcmp(entry->addr, addr, TAG_ADDR_LEN) == 0) {
+            return entry;
+        }
+        if (victim == NULL || (victim->used && (now_ms - entry->last_ms) > (now_ms - victim->last_ms))) {
+            victim = entry;
+        }
+    }
+
+    if (victim->used) {
+        filter->evictions++;
+    }
+    memcpy(victim->addr, addr, TAG_ADDR_LEN);
+    victim->used = true;
+    *created = true;
+    return victim;
+}
+
+tag_seq_result_t tag_seq_filter_check(TAG_SEQ_FILTER *filter, const uint8_t addr[TAG_ADDR_LEN], uint8_t seq,
+                                      uint32_t now_ms)
+{
+    bool created;
+    TAG_SEQ_ENTRY *entry = tag_seq_filter_lookup(filter, addr, &created, now_ms);
+
+    if (created) {
+        tag_seq_entry_reset(entry, seq, now_ms);
+        filter->accepted++;
+        return TAG_SEQ_NEW;
+    }
+    if (now_ms - entry->last_ms > TAG_SEQ_STALE_MS) {
+        tag_seq_entry_reset(entry, seq, now_ms);
+        filter->accepted++;
+        filter->resyncs++;
+        return TAG_SEQ_RESYNC;
+    }
+
+    uint8_t ahead = (uint8_t)(seq - entry->last_seq);
+    uint8_t behind = (uint8_t)(entry->last_seq - seq);
+    entry->last_ms = now_ms;
+
+    if (ahead == 0) {
+        filter->duplicates++;
+        return TAG_SEQ_DUPLICATE;
+    }
+    if (ahead < 128) {
+        // Newer sequence number: slide the window forward
+        entry->seen_mask = (ahead >= TAG_SEQ_WINDOW) ? 1 : ((entry->seen_mask << ahead) | 1);
+        entry->last_seq = seq;
+        filter->accepted++;
+        return TAG_SEQ_NEW;
+    }
+    if (behind < TAG_SEQ_WINDOW) {
+        // Late sequence number inside the window: accept once
+        uint32_t bit = 1UL << behind;
+        if (entry->seen_mask & bit) {
+            filter->duplicates++;
+            return TAG_SEQ_DUPLICATE;
+        }
+        entry->seen_mask |= bit;
+        filter->accepted++;
+        return TAG_SEQ_NEW;
+    }
+
+    tag_seq_entry_reset(entry, seq, now_ms);
+    filter->accepted++;
+    filter->resyncs++;
+    return TAG_SEQ_RESYNC;
+}
+
+void tag_seq_filter_init(TAG_SEQ_FILTER *filter)
+{
+    memset(filter, 0, sizeof(*filter));
+}
+
+int tag_seq_filter_count(const TAG_SEQ_FILTER *filter)
+{
+    int count = 0;
+
+    for (int i = 0; i < TAG_SEQ_TABLE_SIZE; i++) {
+        count += filter->entries[i].used ? 1 : 0;
+    }
+    return count;
+}
@@ -0,0 +1,75 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TAG_ADDR_LEN 6
+#define TAG_SEQ_TABLE_SIZE 64       // Tags tracked at once, least recently heard is evicted
+#define TAG_SEQ_WINDOW 32           // Sequence numbers remembered behind the newest one
+#define TAG_SEQ_STALE_MS 10000      // A tag silent for this long starts a fresh window
+
+/**
+ * @brief Verdict for one received sequence number.
+ *
+ */
+typedef enum {
+    TAG_SEQ_NEW = 0,        // First time this sequence number is seen
+    TAG_SEQ_DUPLICATE,      // Repeat of a sequence number inside the window
+    TAG_SEQ_RESYNC,         // Far outside the window (tag restart or long gap), accepted and window restarted
+} tag_seq_result_t;
+
+typedef struct tag_seq_entry {
+    uint8_t addr[TAG_ADDR_LEN];
+    bool used;
+    uint8_t last_seq;       // Newest sequence number accepted
+    uint32_t seen_mask;     // Bit n set: last_seq - n was seen
+    uint32_t last_ms;
+} TAG_SEQ_ENTRY;
+
+typedef struct tag_seq_filter {
+    TAG_SEQ_ENTRY entries[TAG_SEQ_TABLE_SIZE];
+    uint32_t accepted;
+    uint32_t duplicates;
+    uint32_t resyncs;
+    uint32_t evictions;
+} TAG_SEQ_FILTER;
+
+/**
+ * @brief Reset the filter to an empty tag table.
+ *
+ */
+void tag_seq_filter_init(TAG_SEQ_FILTER *filter);
+
+/**
+ * @brief Check a tag sequence number against that tag's window and record it.
+ *
+ * @param[in] filter    The filter. Not thread safe, use from a single task.
+ * @param[in] addr      Tag address.
+ * @param[in] seq       Sequence number carried by the advertisement.
+ * @param[in] now_ms    Current time in milliseconds.
+ *
+ * @return
+ *      - TAG_SEQ_DUPLICATE if the sample must be dropped, otherwise TAG_SEQ_NEW or TAG_SEQ_RESYNC.
+ */
+tag_seq_result_t tag_seq_filter_check(TAG_SEQ_FILTER *filter, const uint8_t addr[TAG_ADDR_LEN], uint8_t seq,
+                                      uint32_t now_ms);
+
+/**
+ * @brief Number of tags currently tracked.
+ *
+ */
+int tag_seq_filter_count(const TAG_SEQ_FILTER *filter);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,156 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tag_window_agg.h"
+
+#include <string.h>
+
+static void tag_agg_pane_reset(TAG_AGG_PANE *pane)
+{
+    memset(pane, 0, sizeof(*pane));
+}
+
+static uint32_t tag_agg_hash(const uint8_t addr[TAG_ADDR_LEN])
+{
+    // FNV-1a, the low address bytes alone collide for tags from one batch
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < TAG_ADDR_LEN; i++) {
+        hash = (hash ^ addr[i]) * 16777619u;
+    }
+    return hash & (TAG_AGG_HASH_SIZE - 1);
+}
+
+static TAG_AGG_ENTRY *tag_agg_lookup(TAG_WINDOW_AGG *agg, const uint8_t addr[TAG_ADDR_LEN])
+{
+    uint32_t bucket = tag_agg_hash(addr);
+
+    for (int i = agg->buckets[bucket]; i >= 0; i = agg->entries[i].next) {
+        if (memcmp(agg->entries[i].addr, addr, TAG_ADDR_LEN) == 0) {
+            return &agg->entries[i];
+        }
+    }
+    for (int i = 0; i < TAG_AGG_TABLE_SIZE; i++) {
+        TAG_AGG_ENTRY *entry = &agg->entries[i];
+        if (!entry->used) {
+            memset(entry, 0, sizeof(*entry));
+            memcpy(entry->addr, addr, TAG_ADDR_LEN);
+            entry->used = true;
+            entry->next = agg->buckets[bucket];
+            agg->buckets[bucket] = i;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void tag_agg_remove(TAG_WINDOW_AGG *agg, int index)
+{
+    int8_t *link = &agg->buckets[tag_agg_hash(agg->entries[index].addr)];
+
+    while (*link != index) {
+        link = &agg->entries[*link].next;
+    }
+    *link = agg->entries[index].next;
+    agg->entries[index].used = false;
+}
+
+bool tag_window_agg_init(TAG_WINDOW_AGG *agg, uint32_t pane_ms, uint8_t pane_count)
+{
+    if (pane_ms == 0 || pane_count == 0 || pane_count > TAG_AGG_MAX_PANES) {
+        return false;
+    }
+    memset(agg, 0, sizeof(*agg));
+    memset(agg->buckets, -1, sizeof(agg->buckets));
+    agg->pane_ms = pane_ms;
+    agg->pane_count = pane_count;
+    return true;
+}
+
+bool tag_window_agg_add(TAG_WINDOW_AGG *agg, const uint8_t addr[TAG_ADDR_LEN], int32_t value)
+{
+    TAG_AGG_ENTRY *entry = tag_agg_lookup(agg, addr);
+
+    if (entry == NULL) {
+        agg->unslotted++;
+        return false;
+    }
+    TAG_AGG_PANE *pane = &entry->panes[agg->current];
+    if (pane->count == 0 || value < pane->min) {
+        pane->min = value;
+    }
+    if (pane->count == 0 || value > pane->max) {
+        pane->max = value;
+    }
+    pane->count++;
+    pane->sum += value;
+    pane->sum_sq += (uint64_t)((int64_t)value * value);
+    entry->last = value;
+    agg->samples++;
+    return true;
+}
+
+void tag_window_agg_flush(TAG_WINDOW_AGG *agg, tag_agg_result_cb_t cb, void *ctx)
+{
+    uint8_t next = (agg->current + 1) % agg->pane_count;
+
+    for (int i = 0; i < TAG_AGG_TABLE_SIZE; i++) {
+        TAG_AGG_ENTRY *entry = &agg->entries[i];
+        TAG_AGG_RESULT result = {0};
+        int64_t sum = 0;
+        uint64_t sum_sq = 0;
+
+        if (!entry->used) {
+            continue;
+        }
+        for (int p = 0; p < agg->pane_count; p++) {
+            const TAG_AGG_PANE *pane = &entry->panes[p];
+            if (pane->count == 0) {
+                continue;
+            }
+            if (result.count == 0 || pane->min < result.min) {
+                result.min = pane->min;
+            }
+            if (result.count == 0 || pane->max > result.max) {
+                result.max = pane->max;
+            }
+            result.count += pane->count;
+            sum += pane->sum;
+            sum_sq += pane->sum_sq;
+        }
+
+        if (result.count > 0 && entry->panes[agg->current].count > 0) {
+            // Only report windows that moved, a silent tag stops reporting after one pane
+            int64_t n = result.count;
+            memcpy(result.addr, entry->addr, TAG_ADDR_LEN);
+            result.window_ms = agg->pane_ms * agg->pane_count;
+            result.mean = (int32_t)((sum >= 0 ? sum + n / 2 : sum - n / 2) / n);
+            result.variance = (uint32_t)(((uint64_t)n * sum_sq - (uint64_t)(sum * sum)) / (uint64_t)(n * n));
+            result.last = entry->last;
+            agg->results++;
+            if (cb != NULL) {
+                cb(&result, ctx);
+            }
+        }
+
+        // The oldest pane leaves the window and becomes the new current one
+        uint32_t remaining = result.count - entry->panes[next].count;
+        tag_agg_pane_reset(&entry->panes[next]);
+        if (remaining == 0) {
+            tag_agg_remove(agg, i);
+        }
+    }
+    agg->current = next;
+}
+
+int tag_window_agg_count(const TAG_WINDOW_AGG *agg)
+{
+    int count = 0;
+
+    for (int i = 0; i < TAG_AGG_TABLE_SIZE; i++) {
+        count += agg->entries[i].used;
+    }
+    return count;
+}
@@ -0,0 +1,106 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "tag_seq_filter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TAG_AGG_TABLE_SIZE 64           // Tags aggregated at once, new tags are left to the caller when full
+#define TAG_AGG_HASH_SIZE 128           // Power of two
+#define TAG_AGG_MAX_PANES 8             // Panes per sliding window, 1 for a tumbling window
+
+/**
+ * @brief Running statistics of one pane (one hop of the window).
+ *
+ */
+typedef struct tag_agg_pane {
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    uint64_t sum_sq;
+} TAG_AGG_PANE;
+
+typedef struct tag_agg_entry {
+    uint8_t addr[TAG_ADDR_LEN];
+    bool used;
+    int8_t next;                    // Next entry in the same hash bucket, -1 for none
+    int32_t last;
+    TAG_AGG_PANE panes[TAG_AGG_MAX_PANES];
+} TAG_AGG_ENTRY;
+
+/**
+ * @brief Window summary of one tag.
+ *
+ */
+typedef struct tag_agg_result {
+    uint8_t addr[TAG_ADDR_LEN];
+    uint32_t window_ms;
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+    int32_t mean;                   // Rounded to the nearest integer
+    uint32_t variance;              // Population variance, rounded down
+    int32_t last;
+} TAG_AGG_RESULT;
+
+typedef void (*tag_agg_result_cb_t)(const TAG_AGG_RESULT *result, void *ctx);
+
+typedef struct tag_window_agg {
+    uint32_t pane_ms;               // Hop: a summary per tag is produced every pane_ms
+    uint8_t pane_count;             // Window length is pane_ms * pane_count
+    uint8_t current;                // Pane receiving samples
+    int8_t buckets[TAG_AGG_HASH_SIZE];
+    TAG_AGG_ENTRY entries[TAG_AGG_TABLE_SIZE];
+    uint32_t samples;
+    uint32_t results;
+    uint32_t unslotted;             // Samples of new tags while the table was full, not aggregated
+} TAG_WINDOW_AGG;
+
+/**
+ * @brief Reset the aggregator.
+ *
+ * @param[in] agg           The aggregator. Not thread safe, callers serialise access.
+ * @param[in] pane_ms       Hop between two summaries.
+ * @param[in] pane_count    1 for a tumbling window, up to TAG_AGG_MAX_PANES for a sliding window of
+ *                          pane_ms * pane_count.
+ *
+ * @return
+ *      - false if the configuration is invalid.
+ */
+bool tag_window_agg_init(TAG_WINDOW_AGG *agg, uint32_t pane_ms, uint8_t pane_count);
+
+/**
+ * @brief Add one sample of a tag, O(1).
+ *
+ * @return
+ *      - false if the table is full and the tag has no entry: the sample is not part of any summary.
+ */
+bool tag_window_agg_add(TAG_WINDOW_AGG *agg, const uint8_t addr[TAG_ADDR_LEN], int32_t value);
+
+/**
+ * @brief Close the current pane: report the window of every tag with samples in it, then start a new pane.
+ *
+ * Call every pane_ms. Tags without samples in the whole window are forgotten.
+ *
+ */
+void tag_window_agg_flush(TAG_WINDOW_AGG *agg, tag_agg_result_cb_t cb, void *ctx);
+
+/**
+ * @brief Number of tags currently aggregated.
+ *
+ */
+int tag_window_agg_count(const TAG_WINDOW_AGG *agg);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,254 @@
+import argparse
+import json
+import math
+import os
+import random
+import re
+import sys
+
+from tag_rate_sim import EXCHANGE_MS, POLL_AIR_MS, RESP_AIR_MS, RESP_DELAY_MS
+from tdoa_solver import DWT_TIME_UNITS, DWT_TS_MOD, SPEED_OF_LIGHT, SYNC_INTERVAL_S, TdoaSolver
+
+# Host check of the TDoA path on simulated timestamps, and tag capacity of TDoA blinks against TWR.
+#
+# Solver check: anchors with their own 40-bit DW3000 clocks (random offset, drift, timestamp noise) timestamp the
+# reference's sync frames and the tags' blinks as uwb_anchor_tdoa.ino does, including sync slots the reference
+# skips and receptions that are lost. Their reports go through the forwarded line format into tdoa_solver.py and
+# the fixes are compared with the true positions. Exits 1 when the p95 error is above --max-error or too few
+# blinks are solved.
+#
+# Capacity: tags on one channel, either blinking (TDoA) or ranging with every anchor (TWR, one poll and one
+# response per anchor), with the reference's syncs on air in TDoA mode. A fix survives when its frames overlap no other frame;
+# TWR needs 3 clean exchanges out of the anchors. Reports the largest tag count keeping --target of the fixes.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+BLINK_AIR_MS = 0.17         # 6-byte blink with FCS, same preamble as the poll
+SYNC_AIR_MS = 0.18          # 14-byte sync frame
+LINE_LEN = 54               # One forwarded "tdoa,..." line and its separator
+REPORT_FRAME_LEN = 1000     # As in uwb_anchor_tdoa.ino
+BLE_ADV_MIN_MS = 20         # Fastest legacy advertising interval, one report per advertisement
+
+
+def sketch_sync_interval_s():
+    """Sync grid of uwb_anchor_tdoa.ino in seconds, from its own constants."""
+    with open(os.path.join(HERE, "uwb_anchor_tdoa.ino")) as f:
+        text = f.read()
+    defines = dict(re.findall(r"#define (SYNC_INTERVAL_MS|DWT_HI32_PER_MS) (\d+)", text))
+    return int(defines["SYNC_INTERVAL_MS"]) * int(defines["DWT_HI32_PER_MS"]) * 256 * DWT_TIME_UNITS
+
+
+class Clock:
+    """A DW3000 counter: seconds of true time to 40-bit ticks, with offset, drift and timestamp noise."""
+
+    def __init__(self, rng, drift_ppm, noise_s):
+        self.rng = rng
+        self.offset = rng.randrange(DWT_TS_MOD)
+        self.rate = 1.0 + rng.uniform(-drift_ppm, drift_ppm) * 1e-6
+        self.noise_s = noise_s
+
+    def ticks(self, t):
+        return (self.offset + round((t * self.rate + self.rng.gauss(0, self.noise_s)) / DWT_TIME_UNITS)) % DWT_TS_MOD
+
+
+def check_solver(cfg):
+    rng = random.Random(cfg["seed"])
+    room, height = cfg["room_m"], 2.5
+    corners = [(0.0, 0.0), (room, 0.0), (room, room), (0.0, room), (room / 2, 0.0), (room / 2, room)]
+    positions = {f"a0b1c2d3e4{i:02x}": corners[i] + (height,) for i in range(cfg["anchors"])}
+    addrs = list(positions)
+    ref = addrs[0]
+    clocks = {a: Clock(rng, cfg["drift_ppm"] if a != ref else 0.0, cfg["noise_ns"] * 1e-9) for a in addrs}
+    solver = TdoaSolver(positions, ref, tag_height=1.0)
+    tags = {tag: (rng.uniform(1, room - 1), rng.uniform(1, room - 1), 1.0) for tag in range(1, cfg["tags"] + 1)}
+
+    def flight(a, p):
+        return math.dist(positions[a], p) / SPEED_OF_LIGHT
+
+    # Every transmission in true time: syncs on the reference grid (a skipped slot keeps its number), then blinks
+    events = []
+    grid_s = sketch_sync_interval_s()
+    sync_start = rng.uniform(0, grid_s)
+    skipped = 0
+    for k in range(int(cfg["duration_s"] / grid_s)):
+        if rng.random() < cfg["late"]:
+            skipped += 1
+            continue
+        events.append((sync_start + k * grid_s / clocks[ref].rate, "sync", k % 256))
+    period = 1.0 / cfg["rate"]
+    for tag in tags:
+        t, seq = rng.uniform(0, period), 0
+        while t < cfg["duration_s"]:
+            events.append((t, "blink", (tag, seq % 256)))
+            t += period * rng.uniform(0.9, 1.1)
+            seq += 1
+    events.sort(key=lambda e: e[0])
+
+    last_sync = {}                  # anchor -> (sync seq, rx ticks)
+    truth, errors = {}, []
+    blinks = solved = 0
+    lost = cfg["loss"]
+    for t, kind, what in events:
+        if kind == "sync":
+            for a in addrs:
+                if a == ref or rng.random() >= lost:
+                    last_sync[a] = (what, clocks[a].ticks(t + flight(a, positions[ref])))
+            continue
+        tag, seq = what
+        if t >= cfg["warmup_s"]:
+            blinks += 1
+            truth[(tag, seq)] = tags[tag]
+        for a in addrs:
+            if a not in last_sync or rng.random() < lost:
+                continue
+            sync_seq, sync_ts = last_sync[a]
+            line = "tdoa,%s,%u,%u,%u,%010x,%010x" % (a, tag, seq, sync_seq, clocks[a].ticks(t + flight(a, tags[tag])),
+                                                     sync_ts)
+            solver.parse_and_add(line, t)
+        for fix_tag, fix_seq, x, y, rms in solver.flush(t):
+            pos = truth.pop((fix_tag, fix_seq), None)
+            if pos is not None:
+                solved += 1
+                errors.append(math.hypot(x - pos[0], y - pos[1]))
+    for fix_tag, fix_seq, x, y, rms in solver.flush(cfg["duration_s"] + 1.0):
+        pos = truth.pop((fix_tag, fix_seq), None)
+        if pos is not None:
+            solved += 1
+            errors.append(math.hypot(x - pos[0], y - pos[1]))
+
+    errors.sort()
+    p95 = errors[int(len(errors) * 0.95)] if errors else float("inf")
+    # A blink needs 3 of the anchors; with independent losses this is the share that can be solved at all
+    n, q = cfg["anchors"], 1 - lost
+    expected = sum(math.comb(n, k) * q ** k * lost ** (n - k) for k in range(3, n + 1))
+    ok = (abs(grid_s - SYNC_INTERVAL_S) < 1e-12 and p95 <= cfg["max_error_m"]
+          and solved >= 0.9 * expected * blinks)
+    return {
+        "check": "solver",
+        "config": cfg,
+        "sync_grid_s": grid_s,
+        "syncs_skipped": skipped,
+        "blinks": blinks,
+        "solved": solved,
+        "solvable_expected": round(expected * blinks),
+        "error_m": {"p50": round(errors[len(errors) // 2], 3), "p95": round(p95, 3),
+                    "max": round(errors[-1], 3)} if errors else None,
+        "ok": ok,
+    }
+
+
+def overlapped(frames):
+    """frames: (start, end, fix id). Returns the set of fix ids with at least one frame overlapped by another."""
+    frames.sort(key=lambda f: f[0])
+    hit = set()
+    reach_end, reach_id = -1.0, None
+    for start, end, fix in frames:
+        if start < reach_end:
+            hit.add(fix)
+            if reach_id is not None:
+                hit.add(reach_id)
+        if end > reach_end:
+            reach_end, reach_id = end, fix
+    return hit
+
+
+def fix_success(mode, tags, rate, anchors, duration_s, rng):
+    period_ms = 1000.0 / rate
+    frames, fixes = [], []
+    # The reference's syncs share the channel with the blinks
+    t = 0.0
+    while mode == "tdoa" and t < duration_s * 1000:
+        frames.append((t, t + SYNC_AIR_MS, None))
+        t += SYNC_INTERVAL_S * 1000
+    for tag in range(tags):
+        t = rng.uniform(0, period_ms)
+        while t < duration_s * 1000:
+            if mode == "tdoa":
+                fix = (tag, t)
+                fixes.append(fix)
+                frames.append((t, t + BLINK_AIR_MS, fix))
+            else:
+                # One exchange per anchor, each once the previous response timeout is over
+                start = t
+                for a in range(anchors):
+                    fix = (tag, t, a)
+                    fixes.append(fix)
+                    frames.append((start, start + POLL_AIR_MS, fix))
+                    frames.append((start + RESP_DELAY_MS, start + RESP_DELAY_MS + RESP_AIR_MS, fix))
+                    start += EXCHANGE_MS
+            t += period_ms * rng.uniform(0.9, 1.1)
+    hit = overlapped(frames)
+    hit.discard(None)
+    if mode == "tdoa":
+        return 1 - len(hit) / len(fixes) if fixes else 1.0
+    per_fix = {}
+    for fix in fixes:
+        per_fix.setdefault(fix[:2], 0)
+        if fix not in hit:
+            per_fix[fix[:2]] += 1
+    return sum(1 for clean in per_fix.values() if clean >= 3) / len(per_fix) if per_fix else 1.0
+
+
+def capacity(mode, rate, cfg):
+    """Largest tag count whose fixes succeed at least cfg["target"] of the time."""
+    rng = random.Random(cfg["seed"])
+    duration = cfg["capacity_duration_s"]
+
+    def ok(tags):
+        return fix_success(mode, tags, rate, cfg["anchors"], duration, rng) >= cfg["target"]
+
+    low, high = 0, 1
+    while ok(high):
+        low, high = high, high * 2
+    while high - low > max(1, low // 50):
+        mid = (low + high) // 2
+        low, high = (mid, high) if ok(mid) else (low, mid)
+    return low
+
+
+def capacity_report(rate, cfg):
+    twr = capacity("twr", rate, cfg)
+    tdoa = capacity("tdoa", rate, cfg)
+    reports_s = tdoa * rate
+    lines_per_datagram = REPORT_FRAME_LEN // LINE_LEN
+    return {
+        "capacity": {"rate_hz": rate, "anchors": cfg["anchors"], "target": cfg["target"]},
+        "twr_tags": twr,
+        "tdoa_tags": tdoa,
+        "tdoa_vs_twr": round(tdoa / twr, 1) if twr else None,
+        # Uplink of each anchor at the TDoA capacity
+        "anchor_reports_s": round(reports_s),
+        "wifi_datagrams_s": math.ceil(reports_s / lines_per_datagram),
+        "wifi_kbytes_s": round(reports_s * LINE_LEN / 1000, 1),
+        "ble_report_tags": int(1000 / BLE_ADV_MIN_MS / rate),
+    }
+
+
+# python3 tdoa_sim.py --tags 20 --rate 10 --duration 60
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="TDoA solver check on simulated timestamps, TDoA vs TWR capacity")
+    parser.add_argument("--anchors", type=int, default=4)
+    parser.add_argument("--room", type=float, default=20.0, help="room side, m, anchors on the walls")
+    parser.add_argument("--tags", type=int, default=20)
+    parser.add_argument("--rate", type=float, default=10.0, help="blinks per tag per second")
+    parser.add_argument("--duration", type=float, default=60.0, help="simulated seconds, past the 40-bit wrap")
+    parser.add_argument("--noise", type=float, default=0.1, help="timestamp noise standard deviation, ns")
+    parser.add_argument("--drift", type=float, default=20.0, help="anchor clock drift bound, ppm")
+    parser.add_argument("--loss", type=float, default=0.05, help="share of frames an anchor misses")
+    parser.add_argument("--late", type=float, default=0.02, help="share of sync slots the reference skips")
+    parser.add_argument("--max-error", type=float, default=0.5, help="p95 position error allowed, m")
+    parser.add_argument("--rates", default="1,10", help="fix rates for the capacity comparison, Hz")
+    parser.add_argument("--target", type=float, default=0.9, help="share of fixes that must succeed")
+    parser.add_argument("--capacity-duration", type=float, default=5.0, help="simulated seconds per capacity run")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    cfg = {"anchors": args.anchors, "room_m": args.room, "tags": args.tags, "rate": args.rate,
+           "duration_s": args.duration, "warmup_s": 0.5, "noise_ns": args.noise, "drift_ppm": args.drift,
+           "loss": args.loss, "late": args.late, "max_error_m": args.max_error, "target": args.target,
+           "capacity_duration_s": args.capacity_duration, "seed": args.seed}
+    result = check_solver(cfg)
+    print(json.dumps(result))
+    for rate in [float(r) for r in args.rates.split(",")]:
+        print(json.dumps(capacity_report(rate, cfg)))
+    sys.exit(0 if result["ok"] else 1)
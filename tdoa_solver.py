@@ -0,0 +1,160 @@
+import math
+
+from bridge_msg import parse_line
+
+# DW3000 timestamps: 40-bit counter ticking at 499.2 MHz * 128
+DWT_TIME_UNITS = 1.0 / 499.2e6 / 128.0
+DWT_TS_MOD = 1 << 40
+SPEED_OF_LIGHT = 299702547.0   # in air, m/s
+
+SYNC_INTERVAL_S = 0.1          # Must match SYNC_INTERVAL_MS in uwb_anchor_tdoa.ino
+DRIFT_ALPHA = 0.2              # EWMA weight of a new clock drift measurement
+GROUP_TIMEOUT_S = 0.3          # How long to wait for the other anchors' reports of one blink
+
+
+def ts_diff(a, b):
+    """Signed difference a - b of two 40-bit DW3000 timestamps, in ticks."""
+    d = (a - b) % DWT_TS_MOD
+    return d - DWT_TS_MOD if d >= DWT_TS_MOD // 2 else d
+
+
+def seq_diff(a, b):
+    """Signed difference a - b of two 8-bit sequence numbers."""
+    d = (a - b) % 256
+    return d - 256 if d >= 128 else d
+
+
+class AnchorClock:
+    """Tracks one anchor's clock against the reference anchor from the sync frames it received.
+
+    The reference sends sync k exactly k * SYNC_INTERVAL_S after sync 0 in its own clock, so the
+    anchor's receive time of sync k, minus the reference->anchor flight time, pins the offset
+    and two syncs give the drift ratio.
+    """
+
+    def __init__(self, flight_time_s):
+        self.flight_time_s = flight_time_s
+        self.sync_seq = None
+        self.sync_rx_ts = None
+        self.ratio = 1.0           # anchor clock seconds per reference clock second
+        self.ratio_valid = False
+
+    def on_sync(self, sync_seq, sync_rx_ts):
+        if self.sync_seq is not None and sync_seq != self.sync_seq:
+            dk = seq_diff(sync_seq, self.sync_seq)
+            if dk > 0:
+                measured = ts_diff(sync_rx_ts, self.sync_rx_ts) * DWT_TIME_UNITS / (dk * SYNC_INTERVAL_S)
+                if abs(measured - 1.0) < 100e-6:          # reject anything beyond +-100 ppm
+                    if self.ratio_valid:
+                        self.ratio += DRIFT_ALPHA * (measured - self.ratio)
+                    else:
+                        self.ratio = measured
+                        self.ratio_valid = True
+            if dk < 0:
+                return
+        self.sync_seq = sync_seq
+        self.sync_rx_ts = sync_rx_ts
+
+    def to_reference(self, sync_seq, sync_rx_ts, rx_ts):
+        """Blink arrival in reference seconds, relative to sync 0 of the current 256-sync era."""
+        self.on_sync(sync_seq, sync_rx_ts)
+        since_sync = ts_diff(rx_ts, sync_rx_ts) * DWT_TIME_UNITS / self.ratio
+        return sync_seq * SYNC_INTERVAL_S + self.flight_time_s + since_sync
+
+
+def solve_position(anchors, arrivals, z=0.0, iterations=20):
+    """Hyperbolic (TDoA) least squares fix.
+
+    anchors: list of (x, y, z) positions, arrivals: matching arrival times in seconds on a common
+    clock. Solves x, y at a fixed height with Gauss-Newton on the range differences against the
+    first anchor. Returns (x, y, rms_residual_m) or None when it does not converge.
+    """
+    if len(anchors) < 3:
+        return None
+    x = sum(a[0] for a in anchors) / len(anchors)
+    y = sum(a[1] for a in anchors) / len(anchors)
+    ref = anchors[0]
+    measured = [SPEED_OF_LIGHT * (t - arrivals[0]) for t in arrivals[1:]]
+
+    for _ in range(iterations):
+        d0 = math.dist((x, y, z), ref) or 1e-9
+        jtj = [[0.0, 0.0], [0.0, 0.0]]
+        jtr = [0.0, 0.0]
+        residual_sq = 0.0
+        for anchor, rd in zip(anchors[1:], measured):
+            di = math.dist((x, y, z), anchor) or 1e-9
+            r = (di - d0) - rd
+            gx = (x - anchor[0]) / di - (x - ref[0]) / d0
+            gy = (y - anchor[1]) / di - (y - ref[1]) / d0
+            jtj[0][0] += gx * gx
+            jtj[0][1] += gx * gy
+            jtj[1][1] += gy * gy
+            jtr[0] += gx * r
+            jtr[1] += gy * r
+            residual_sq += r * r
+        det = jtj[0][0] * jtj[1][1] - jtj[0][1] * jtj[0][1]
+        if abs(det) < 1e-12:
+            return None
+        dx = (jtj[1][1] * jtr[0] - jtj[0][1] * jtr[1]) / det
+        dy = (jtj[0][0] * jtr[1] - jtj[0][1] * jtr[0]) / det
+        x -= dx
+        y -= dy
+        if abs(dx) < 1e-4 and abs(dy) < 1e-4:
+            return x, y, math.sqrt(residual_sq / len(measured))
+    return None
+
+
+class TdoaSolver:
+    """Groups anchor reports per blink (tag id, tag seq) and solves positions.
+
+    anchor_positions maps the anchor BLE address (hex string, as forwarded by the gateway) to
+    (x, y, z) in metres. reference is the address of anchor 0, the sync transmitter.
+    """
+
+    def __init__(self, anchor_positions, reference, tag_height=0.0):
+        self.positions = anchor_positions
+        self.tag_height = tag_height
+        ref_pos = anchor_positions[reference]
+        self.clocks = {
+            addr: AnchorClock(math.dist(pos, ref_pos) / SPEED_OF_LIGHT)
+            for addr, pos in anchor_positions.items()
+        }
+        self.pending = {}          # (tag, seq) -> (first_seen, {anchor: (sync_seq, ref_time)})
+
+    def add_report(self, anchor, tag, seq, sync_seq, rx_ts, sync_rx_ts, now):
+        clock = self.clocks.get(anchor)
+        if clock is None:
+            return
+        t = clock.to_reference(sync_seq, sync_rx_ts, rx_ts)
+        first_seen, reports = self.pending.setdefault((tag, seq), (now, {}))
+        reports[anchor] = (sync_seq, t)
+
+    def parse_and_add(self, line, now):
+        """Add a "tdoa,<anchor>,<tag>,<seq>,<sync seq>,<rx ts hex>,<sync rx ts hex>" line from the gateway."""
+        if not line.startswith("tdoa,"):
+            return False
+        parsed = parse_line(line)
+        if parsed is None:
+            return False
+        self.add_report(*parsed[1], now)
+        return True
+
+    def flush(self, now):
+        """Solve every blink that all anchors reported or that timed out. Yields (tag, seq, x, y, rms)."""
+        for key in list(self.pending):
+            first_seen, reports = self.pending[key]
+            if len(reports) < len(self.positions) and now - first_seen < GROUP_TIMEOUT_S:
+                continue
+            del self.pending[key]
+            if len(reports) < 3:
+                continue
+            # Put every arrival on the same sync era as the first report before differencing
+            base_seq = next(iter(reports.values()))[0]
+            anchors, arrivals = [], []
+            for anchor, (sync_seq, t) in reports.items():
+                wrap = (seq_diff(sync_seq, base_seq) - (sync_seq - base_seq)) * SYNC_INTERVAL_S
+                anchors.append(self.positions[anchor])
+                arrivals.append(t + wrap)
+            fix = solve_position(anchors, arrivals, self.tag_height)
+            if fix is not None:
+                yield (key[0], key[1]) + fix
@@ -0,0 +1,162 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "trace_capture.h"
+
+#include <string.h>
+
+static void trace_put_le(uint8_t *dst, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        dst[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t trace_get_le(const uint8_t *src, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | src[i];
+    }
+    return value;
+}
+
+static void trace_ring_write(TRACE_RING *ring, const uint8_t *data, uint32_t len)
+{
+    uint32_t first = ring->size - ring->head;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&ring->buf[ring->head], data, first);
+    memcpy(ring->buf, data + first, len - first);
+    ring->head = (ring->head + len) % ring->size;
+    ring->used += len;
+}
+
+static void trace_ring_read(TRACE_RING *ring, uint32_t offset, uint8_t *data, uint32_t len)
+{
+    uint32_t pos = (ring->tail + offset) % ring->size;
+    uint32_t first = ring->size - pos;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(data, &ring->buf[pos], first);
+    memcpy(data + first, ring->buf, len - first);
+}
+
+static void trace_ring_write_record(TRACE_RING *ring, uint8_t source, uint32_t delta_us, const uint8_t *payload,
+                                    uint16_t len)
+{
+    uint8_t hdr[TRACE_RECORD_HDR_LEN];
+
+    hdr[0] = source;
+    trace_put_le(&hdr[1], len, 2);
+    trace_put_le(&hdr[3], delta_us, 4);
+    trace_ring_write(ring, hdr, sizeof(hdr));
+    trace_ring_write(ring, payload, len);
+}
+
+void trace_ring_init(TRACE_RING *ring, uint8_t *buf, uint32_t size)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->buf = buf;
+    ring->size = size;
+}
+
+bool trace_ring_put(TRACE_RING *ring, trace_source_t source, uint64_t time_us, const uint8_t *payload, uint16_t len)
+{
+    uint8_t extra[8];
+    bool sync = !ring->started || time_us - ring->last_put_us > UINT32_MAX;
+    uint32_t need = TRACE_RECORD_HDR_LEN + len;
+
+    if (len > TRACE_MAX_PAYLOAD) {
+        return false;
+    }
+    need += sync ? TRACE_RECORD_HDR_LEN + 8 : 0;
+    need += ring->pending_drops ? TRACE_RECORD_HDR_LEN + 4 : 0;
+    if (need > ring->size - ring->used) {
+        ring->pending_drops++;
+        ring->dropped++;
+        return false;
+    }
+
+    // A clock jump goes in as SYNC, so the deltas after it stay small
+    if (sync) {
+        trace_put_le(extra, time_us, 8);
+        trace_ring_write_record(ring, TRACE_SRC_SYNC, 0, extra, 8);
+        ring->last_put_us = time_us;
+        ring->started = true;
+    }
+    if (ring->pending_drops) {
+        trace_put_le(extra, ring->pending_drops, 4);
+        trace_ring_write_record(ring, TRACE_SRC_DROP, (uint32_t)(time_us - ring->last_put_us), extra, 4);
+        ring->last_put_us = time_us;
+        ring->pending_drops = 0;
+    }
+    trace_ring_write_record(ring, source, (uint32_t)(time_us - ring->last_put_us), payload, len);
+    ring->last_put_us = time_us;
+    ring->records++;
+    return true;
+}
+
+size_t trace_ring_take(TRACE_RING *ring, uint8_t *out, size_t cap)
+{
+    uint8_t hdr[TRACE_RECORD_HDR_LEN];
+    size_t pos = TRACE_CHUNK_HDR_LEN + TRACE_RECORD_HDR_LEN + 8;
+
+    if (ring->used == 0 || cap < pos + TRACE_RECORD_HDR_LEN + TRACE_MAX_PAYLOAD) {
+        return 0;
+    }
+    // The chunk's SYNC carries the time its first delta is relative to
+    out[TRACE_CHUNK_HDR_LEN] = TRACE_SRC_SYNC;
+    trace_put_le(&out[TRACE_CHUNK_HDR_LEN + 1], 8, 2);
+    trace_put_le(&out[TRACE_CHUNK_HDR_LEN + 3], 0, 4);
+    trace_put_le(&out[TRACE_CHUNK_HDR_LEN + TRACE_RECORD_HDR_LEN], ring->last_take_us, 8);
+
+    while (ring->used > 0) {
+        trace_ring_read(ring, 0, hdr, sizeof(hdr));
+        uint32_t len = TRACE_RECORD_HDR_LEN + (uint32_t)trace_get_le(&hdr[1], 2);
+        if (pos + len > cap) {
+            break;
+        }
+        trace_ring_read(ring, 0, &out[pos], len);
+        if (hdr[0] == TRACE_SRC_SYNC) {
+            ring->last_take_us = trace_get_le(&out[pos + TRACE_RECORD_HDR_LEN], 8);
+        } else {
+            ring->last_take_us += trace_get_le(&hdr[3], 4);
+        }
+        pos += len;
+        ring->tail = (ring->tail + len) % ring->size;
+        ring->used -= len;
+    }
+
+    out[0] = TRACE_CHUNK_MAGIC0;
+    out[1] = TRACE_CHUNK_MAGIC1;
+    trace_put_le(&out[2], pos - TRACE_CHUNK_HDR_LEN, 2);
+    return pos;
+}
+
+size_t trace_record_decode(const uint8_t *buf, size_t len, uint64_t *clock_us, TRACE_RECORD *record)
+{
+    if (len < TRACE_RECORD_HDR_LEN) {
+        return 0;
+    }
+    uint16_t payload_len = (uint16_t)trace_get_le(&buf[1], 2);
+    if (len < TRACE_RECORD_HDR_LEN + (size_t)payload_len) {
+        return 0;
+    }
+
+    record->source = buf[0];
+    record->len = payload_len;
+    record->payload = &buf[TRACE_RECORD_HDR_LEN];
+    if (record->source == TRACE_SRC_SYNC && payload_len >= 8) {
+        *clock_us = trace_get_le(record->payload, 8);
+    } else {
+        *clock_us += trace_get_le(&buf[3], 4);
+    }
+    record->time_us = *clock_us;
+    return TRACE_RECORD_HDR_LEN + payload_len;
+}
@@ -0,0 +1,112 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Record: source (u8), payload length (u16 LE), microseconds since the previous record (u32 LE), payload.
+// A capture file starts with TRACE_FILE_MAGIC and TRACE_VERSION; a streamed chunk starts with a SYNC record
+// so that each chunk can be placed on the timeline even when the previous one was lost.
+#define TRACE_FILE_MAGIC "UTRC"
+#define TRACE_VERSION 1
+#define TRACE_FILE_HDR_LEN 8            // Magic, version, 3 reserved bytes
+#define TRACE_RECORD_HDR_LEN 7
+#define TRACE_MAX_PAYLOAD 255
+
+// Chunk framing on the gateway stream (UDP datagram or UART): 0xA5, 0x5A, records length (u16 LE), records
+#define TRACE_CHUNK_MAGIC0 0xA5
+#define TRACE_CHUNK_MAGIC1 0x5A
+#define TRACE_CHUNK_HDR_LEN 4
+
+/**
+ * @brief Record sources.
+ *
+ */
+typedef enum {
+    TRACE_SRC_SYNC = 0,             // Absolute time of the previous record (u64 LE, us)
+    TRACE_SRC_DROP = 1,             // Records lost before this one because the buffer was full (u32 LE)
+    TRACE_SRC_BLE_ADV = 2,          // Tag address (6), RSSI (i8), adv data length (u8), adv + scan response data
+    TRACE_SRC_UDP_RX = 3,           // Peer address length (u8), address text, port (u16 LE), datagram
+} trace_source_t;
+
+typedef struct trace_record {
+    uint8_t source;
+    uint16_t len;
+    uint64_t time_us;               // Absolute, rebuilt from the deltas and SYNC records
+    const uint8_t *payload;
+} TRACE_RECORD;
+
+/**
+ * @brief Byte ring of encoded records between a capture hook and the task streaming them out.
+ *
+ */
+typedef struct trace_ring {
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t head;                  // Write offset, only whole records are between tail and head
+    uint32_t tail;
+    uint32_t used;
+    uint64_t last_put_us;           // Time of the newest record in the ring
+    uint64_t last_take_us;          // Time of the newest record taken out
+    bool started;
+    uint32_t pending_drops;         // Lost since the last record that fitted, reported in a DROP record
+    uint32_t records;
+    uint32_t dropped;
+} TRACE_RING;
+
+/**
+ * @brief Initialise an empty ring on a caller-provided buffer.
+ *
+ * @param[in] ring  The ring. Not thread safe, callers serialise access.
+ *
+ */
+void trace_ring_init(TRACE_RING *ring, uint8_t *buf, uint32_t size);
+
+/**
+ * @brief Append one record, or count it as dropped when the ring is full.
+ *
+ * @param[in] time_us   Capture time in microseconds, non-decreasing.
+ * @param[in] len       Payload length, at most TRACE_MAX_PAYLOAD.
+ *
+ * @return
+ *      - true if the record was buffered.
+ */
+bool trace_ring_put(TRACE_RING *ring, trace_source_t source, uint64_t time_us, const uint8_t *payload, uint16_t len);
+
+/**
+ * @brief Take whole records out as one chunk: chunk header, a SYNC record, then as many records as fit.
+ *
+ * @param[out] out  Chunk buffer.
+ * @param[in]  cap  Size of out, at least TRACE_CHUNK_HDR_LEN + 2 * TRACE_RECORD_HDR_LEN + 8 + TRACE_MAX_PAYLOAD.
+ *
+ * @return
+ *      - Chunk length, 0 if the ring is empty.
+ */
+size_t trace_ring_take(TRACE_RING *ring, uint8_t *out, size_t cap);
+
+/**
+ * @brief Decode the record at the start of buf.
+ *
+ * @param[in]     buf       Records.
+ * @param[in]     len       Bytes available in buf.
+ * @param[in,out] clock_us  Time of the previous record, updated to this one's; SYNC records set it.
+ * @param[out]    record    Decoded record, its payload points into buf.
+ *
+ * @return
+ *      - Record length, 0 if buf holds no complete record.
+ */
+size_t trace_record_decode(const uint8_t *buf, size_t len, uint64_t *clock_us, TRACE_RECORD *record);
+
+#ifdef __cplusplus
+}
+#endif
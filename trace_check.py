@@ -0,0 +1,267 @@
+import argparse
+import ctypes
+import hashlib
+import io
+import json
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+from bridge_bench import tag_adv
+from bridge_trace import (SRC_BLE_ADV, SRC_DROP, SRC_SYNC, SRC_UDP_RX, GatewayModel, TraceWriter, read_records,
+                          replay, run_pipeline)
+from tag_rate_sim import Walker
+
+# Host check of the capture format and its replay:
+#  - gateway_stream: trace_capture.c compiled for the host buffers synthetic advertisements in a GW_TRACE_BUF_SIZE
+#    ring, a burst overflows it and the clock jumps past the u32 delta; chunks are taken every GW_TRACE_FLUSH_MS as
+#    gw_trace.c does, some are lost, and the rest are written by "bridge_trace.py capture". Reading the file back
+#    must give the records of the delivered chunks with their exact times, and DROP records for the overflow.
+#  - bridge_roundtrip: TraceWriter records datagrams from several gateways; the file reads back identical, and a
+#    copy cut mid-record reads back as its complete prefix.
+#  - determinism: "bridge_trace.py pipeline" on a capture of both sources gives the same output in-process, in
+#    fresh interpreters with other hash seeds and through replay() as fast as possible; replay() at 1x is timed.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+TRACE_BUF_SIZE = 8192       # GW_TRACE_BUF_SIZE
+TRACE_CHUNK_LEN = 512       # GW_TRACE_CHUNK_LEN
+TRACE_FLUSH_US = 100000     # GW_TRACE_FLUSH_MS
+CLOCK_JUMP_US = 5000 << 20  # Past a u32 of microseconds: written as a SYNC record
+
+SHIM = """
+#include <stdlib.h>
+#include "trace_capture.h"
+
+TRACE_RING *check_ring_new(uint32_t size)
+{
+    TRACE_RING *ring = malloc(sizeof(*ring));
+    trace_ring_init(ring, malloc(size), size);
+    return ring;
+}
+
+uint32_t check_ring_dropped(const TRACE_RING *ring)
+{
+    return ring->dropped;
+}
+"""
+
+
+def load_trace(workdir):
+    """Build trace_capture.c into a shared library."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        raise SystemExit("a host C compiler is needed to run trace_capture.c")
+    shim = os.path.join(workdir, "shim.c")
+    with open(shim, "w") as f:
+        f.write(SHIM)
+    lib = os.path.join(workdir, "trace_capture.so")
+    subprocess.run([cc, "-O2", "-shared", "-fPIC", "-I", HERE, "-o", lib, shim,
+                    os.path.join(HERE, "trace_capture.c")], check=True)
+    dll = ctypes.CDLL(lib)
+    dll.check_ring_new.restype = ctypes.c_void_p
+    dll.check_ring_new.argtypes = [ctypes.c_uint32]
+    dll.check_ring_dropped.restype = ctypes.c_uint32
+    dll.check_ring_dropped.argtypes = [ctypes.c_void_p]
+    dll.trace_ring_put.restype = ctypes.c_bool
+    dll.trace_ring_put.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_uint64, ctypes.c_char_p,
+                                   ctypes.c_uint16]
+    dll.trace_ring_take.restype = ctypes.c_size_t
+    dll.trace_ring_take.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
+    return dll
+
+
+def advertisements(cfg, rng):
+    """(time_us, payload) of tags walking around the anchor, plus a burst and a clock jump half way."""
+    walkers = [Walker(random.Random(cfg["seed"] * 1000 + k), cfg) for k in range(cfg["tags"])]
+    phases = [rng.uniform(0, 1 / cfg["rate"]) for _ in walkers]
+    out = []
+    for j in range(int(cfg["duration_s"] * cfg["rate"])):
+        for k, walker in enumerate(walkers):
+            t = j / cfg["rate"] + phases[k]
+            adv = tag_adv(max(0, min(0xFFFF, int(walker.at(t) * 100))), j % 256)
+            addr = bytes((0xC0, 0xDE, 0, 0, k >> 8, k & 0xFF))
+            out.append((int(t * 1e6), addr + struct.pack("<bB", rng.randrange(-90, -40), len(adv)) + adv))
+    out.sort()
+    half = len(out) // 2
+    # A burst of scan results at one instant, more than the ring holds, then the clock steps forward
+    burst = [(out[half][0], out[half][1])] * cfg["burst"]
+    return out[:half] + burst + [(t + CLOCK_JUMP_US, p) for t, p in out[half:]]
+
+
+def data_records(path):
+    return [(s, t, p) for s, t, p in read_records(path) if s not in (SRC_SYNC, SRC_DROP)]
+
+
+def check_gateway_stream(dll, cfg, workdir):
+    rng = random.Random(cfg["seed"])
+    ring = dll.check_ring_new(TRACE_BUF_SIZE)
+    chunk = ctypes.create_string_buffer(TRACE_CHUNK_LEN)
+    path = os.path.join(workdir, "gateway.utrc")
+    writer = TraceWriter(path)
+    accepted, chunks, lost_chunks = [], 0, 0
+    advs = advertisements(cfg, rng)
+    next_flush = advs[0][0] + TRACE_FLUSH_US
+
+    def take():
+        nonlocal chunks, lost_chunks
+        while True:
+            length = dll.trace_ring_take(ring, chunk, TRACE_CHUNK_LEN)
+            if length == 0:
+                return
+            chunks += 1
+            if rng.random() < cfg["chunk_loss"]:
+                lost_chunks += 1
+            else:
+                writer.write_chunk(chunk.raw[:length])
+
+    for time_us, payload in advs:
+        while time_us >= next_flush:
+            take()
+            next_flush = max(next_flush + TRACE_FLUSH_US, time_us - time_us % TRACE_FLUSH_US)
+        if dll.trace_ring_put(ring, SRC_BLE_ADV, time_us, payload, len(payload)):
+            accepted.append((SRC_BLE_ADV, time_us, payload))
+    take()
+    writer.close()
+
+    read = data_records(path)
+    drops = sum(struct.unpack("<I", p)[0] for s, _, p in read_records(path) if s == SRC_DROP)
+    # Without chunk loss every accepted record comes back; with it, the delivered ones in order, times intact
+    it = iter(accepted)
+    in_order = all(record in it for record in read)
+    exact = read == accepted if cfg["chunk_loss"] == 0 else in_order
+    dropped = dll.check_ring_dropped(ring)
+    ok = exact and dropped > 0 and (drops == dropped or cfg["chunk_loss"] > 0)
+    return {"case": "gateway_stream", "records": len(advs), "buffered": len(accepted), "dropped": dropped,
+            "drop_records_total": drops, "chunks": chunks, "chunks_lost": lost_chunks, "read_back": len(read),
+            "bytes": os.path.getsize(path), "ok": ok}, path
+
+
+def check_bridge_roundtrip(cfg, workdir, advs_path):
+    """Datagrams as the gateways would forward the captured advertisements, from several gateways."""
+    rng = random.Random(cfg["seed"] + 1)
+    model = GatewayModel()
+    path = os.path.join(workdir, "bridge.utrc")
+    writer = TraceWriter(path)
+    written = []
+    for _, time_us, payload in data_records(advs_path):
+        line = model.process(time_us, payload)
+        if line is None:
+            continue
+        for g in range(cfg["gateways"]):
+            if rng.random() < 0.8:
+                addr = (f"fd00::{g + 1}", 49152 + g)
+                t = time_us + rng.randrange(5000, 40000)
+                written.append((t, addr, line.encode()))
+    written.sort(key=lambda w: w[0])
+    for t, addr, data in written:
+        writer.udp_rx(addr, data, t)
+    writer.close()
+    host = lambda a: a[0].encode()
+    expected = [(SRC_UDP_RX, t, bytes((len(host(a)),)) + host(a) + struct.pack("<H", a[1]) + d)
+                for t, a, d in written]
+    read = data_records(path)
+
+    with open(path, "rb") as f:
+        data = f.read()
+    cut = os.path.join(workdir, "cut.utrc")
+    with open(cut, "wb") as f:
+        f.write(data[:len(data) * 2 // 3])
+    prefix = data_records(cut)
+    ok = read == expected and 0 < len(prefix) < len(read) and prefix == read[:len(prefix)]
+    return {"case": "bridge_roundtrip", "datagrams": len(written), "read_back": len(read),
+            "bytes_per_record": round(len(data) / max(1, len(written)), 1), "cut_prefix": len(prefix), "ok": ok}, path
+
+
+def merged_capture(workdir, paths):
+    """One capture of both sources, in time order, as a bridge next to a tracing gateway would hold."""
+    records = sorted((r for p in paths for r in data_records(p)), key=lambda r: r[1])
+    path = os.path.join(workdir, "merged.utrc")
+    writer = TraceWriter(path)
+    for source, time_us, payload in records:
+        writer.write(source, time_us, payload)
+    writer.close()
+    return path, records
+
+
+def check_determinism(cfg, path, records):
+    out = io.StringIO()
+    start = time.monotonic()
+    lines = run_pipeline(read_records(path), out)
+    elapsed = time.monotonic() - start
+    reference = hashlib.sha256(out.getvalue().encode()).hexdigest()
+    digests = {"in_process": reference}
+
+    again = io.StringIO()
+    run_pipeline(read_records(path), again)
+    digests["in_process_again"] = hashlib.sha256(again.getvalue().encode()).hexdigest()
+    for seed in ("0", "12345"):
+        env = dict(os.environ, PYTHONHASHSEED=seed)
+        proc = subprocess.run([sys.executable, os.path.join(HERE, "bridge_trace.py"), "pipeline", path],
+                              capture_output=True, env=env, check=True)
+        digests[f"hash_seed_{seed}"] = hashlib.sha256(proc.stdout).hexdigest()
+
+    # replay() as fast as possible hands the pipeline the same records in the same order
+    delivered = []
+    replay(read_records(path), lambda s, t, p: delivered.append((s, t, p)), 0)
+    replayed = io.StringIO()
+    run_pipeline(iter(delivered), replayed)
+    digests["replay_fast"] = hashlib.sha256(replayed.getvalue().encode()).hexdigest()
+
+    # At 1x, each record is handed over at its capture offset; lateness is how far past it
+    window = [r for r in records if r[1] - records[0][1] <= cfg["realtime_s"] * 1e6]
+    start_wall, lateness = None, []
+
+    def timed(source, time_us, payload):
+        nonlocal start_wall
+        now = time.monotonic()
+        if start_wall is None:
+            start_wall = now
+        lateness.append(now - start_wall - (time_us - window[0][1]) / 1e6)
+
+    replay(iter(window), timed, 1.0)
+    lateness.sort()
+    ok = lines > 0 and all(d == reference for d in digests.values()) and \
+        [r for r in delivered if r[0] not in (SRC_SYNC, SRC_DROP)] == records
+    return {"case": "determinism", "records": len(records), "lines": lines,
+            "pipeline_records_per_s": round(len(records) / elapsed),
+            "identical": sorted(k for k, d in digests.items() if d == reference), "sha256": reference[:16],
+            "realtime_lateness_ms": {"p50": round(lateness[len(lateness) // 2] * 1000, 3),
+                                     "p99": round(lateness[int(len(lateness) * 0.99)] * 1000, 3),
+                                     "max": round(lateness[-1] * 1000, 3)}, "ok": ok}
+
+
+# python3 trace_check.py --tags 50 --rate 10 --duration 60 --chunk-loss 0.02
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Capture format round trip and deterministic replay")
+    parser.add_argument("--tags", type=int, default=50)
+    parser.add_argument("--rate", type=float, default=10.0, help="ranges per second per tag")
+    parser.add_argument("--duration", type=float, default=60.0, help="seconds of advertisements")
+    parser.add_argument("--burst", type=int, default=400, help="scan results at one instant, to overflow the ring")
+    parser.add_argument("--gateways", type=int, default=3, help="gateways forwarding each range to the bridge")
+    parser.add_argument("--chunk-loss", type=float, default=0.0, help="share of streamed chunks lost")
+    parser.add_argument("--realtime", type=float, default=2.0, help="seconds of capture replayed at 1x")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    cfg = {"tags": args.tags, "rate": args.rate, "duration_s": args.duration, "burst": args.burst,
+           "gateways": args.gateways, "chunk_loss": args.chunk_loss, "realtime_s": args.realtime,
+           "seed": args.seed, "room_m": 20.0, "still_s": 30.0, "speed_m_s": (0.5, 1.5)}
+    failed = False
+    with tempfile.TemporaryDirectory() as workdir:
+        dll = load_trace(workdir)
+        result, gateway_path = check_gateway_stream(dll, cfg, workdir)
+        failed |= not result["ok"]
+        print(json.dumps(result))
+        result, bridge_path = check_bridge_roundtrip(cfg, workdir, gateway_path)
+        failed |= not result["ok"]
+        print(json.dumps(result))
+        result = check_determinism(cfg, *merged_capture(workdir, [gateway_path, bridge_path]))
+        failed |= not result["ok"]
+        print(json.dumps(result))
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,117 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "traffic_shaper.h"
+
+#include <string.h>
+
+static void traffic_shaper_refill(TRAFFIC_SHAPER *shaper, uint32_t now_ms)
+{
+    uint32_t elapsed_ms = now_ms - shaper->last_refill_ms;
+
+    if (elapsed_ms == 0) {
+        return;
+    }
+    shaper->last_refill_ms = now_ms;
+    for (int i = 0; i < SHAPER_CLASS_COUNT; i++) {
+        TRAFFIC_SHAPER_BUCKET *bucket = &shaper->buckets[i];
+        uint64_t max_x1000 = (uint64_t)bucket->config.burst * 1000;
+        bucket->tokens_x1000 += (uint64_t)bucket->config.rate * elapsed_ms;
+        if (bucket->tokens_x1000 > max_x1000) {
+            bucket->tokens_x1000 = max_x1000;
+        }
+    }
+}
+
+static bool traffic_shaper_take(TRAFFIC_SHAPER_BUCKET *bucket, uint32_t bytes)
+{
+    uint64_t cost_x1000 = (uint64_t)bytes * 1000;
+
+    if (bucket->tokens_x1000 < cost_x1000) {
+        return false;
+    }
+    bucket->tokens_x1000 -= cost_x1000;
+    return true;
+}
+
+void traffic_shaper_init(TRAFFIC_SHAPER *shaper, const TRAFFIC_SHAPER_RATE *config, uint32_t now_ms)
+{
+    memset(shaper, 0, sizeof(*shaper));
+    for (int i = 0; i < SHAPER_CLASS_COUNT; i++) {
+        shaper->buckets[i].config = config[i];
+        shaper->buckets[i].tokens_x1000 = (uint64_t)config[i].burst * 1000;
+    }
+    shaper->last_refill_ms = now_ms;
+    shaper->last_update_ms = now_ms;
+}
+
+void traffic_shaper_set_rate(TRAFFIC_SHAPER *shaper, shaper_class_t cls, const TRAFFIC_SHAPER_RATE *rate,
+                             uint32_t now_ms)
+{
+    traffic_shaper_refill(shaper, now_ms);
+    shaper->buckets[cls].config = *rate;
+    shaper->buckets[cls].tokens_x1000 = (uint64_t)rate->burst * 1000;
+}
+
+bool traffic_shaper_consume(TRAFFIC_SHAPER *shaper, shaper_class_t cls, uint32_t bytes, uint32_t now_ms)
+{
+    TRAFFIC_SHAPER_BUCKET *bucket = &shaper->buckets[cls];
+    bool admitted = false;
+
+    traffic_shaper_refill(shaper, now_ms);
+    if (cls == SHAPER_CLASS_EVENT) {
+        // An event may use any class's tokens: its own first, then the lowest class
+        static const shaper_class_t borrow_order[] = {SHAPER_CLASS_EVENT, SHAPER_CLASS_STATS, SHAPER_CLASS_SAMPLE};
+        for (int i = 0; i < SHAPER_CLASS_COUNT && !admitted; i++) {
+            admitted = traffic_shaper_take(&shaper->buckets[borrow_order[i]], bytes);
+        }
+    } else {
+        admitted = traffic_shaper_take(bucket, bytes);
+    }
+
+    if (admitted) {
+        bucket->sent++;
+        bucket->sent_bytes += bytes;
+    } else if (cls == SHAPER_CLASS_EVENT) {
+        bucket->held++;
+    } else {
+        bucket->dropped++;
+        if (cls == SHAPER_CLASS_SAMPLE) {
+            shaper->sample_deficit = true;
+        }
+    }
+    return admitted;
+}
+
+uint8_t traffic_shaper_update(TRAFFIC_SHAPER *shaper, uint32_t now_ms)
+{
+    const TRAFFIC_SHAPER_BUCKET *samples = &shaper->buckets[SHAPER_CLASS_SAMPLE];
+    uint8_t level = shaper->level;
+
+    traffic_shaper_refill(shaper, now_ms);
+    if (shaper->sample_deficit && level < TRAFFIC_SHAPER_MAX_LEVEL) {
+        level++;
+    } else if (!shaper->sample_deficit && level > 0 &&
+               samples->tokens_x1000 >= (uint64_t)samples->config.burst * 500) {
+        level--;
+    }
+    if (level != shaper->level) {
+        shaper->level = level;
+        shaper->level_changes++;
+    }
+    shaper->sample_deficit = false;
+    shaper->last_update_ms = now_ms;
+    return level;
+}
+
+bool traffic_shaper_keep_sample(TRAFFIC_SHAPER *shaper, uint8_t seq)
+{
+    if ((seq & ((1u << shaper->level) - 1)) == 0) {
+        return true;
+    }
+    shaper->downsampled++;
+    return false;
+}
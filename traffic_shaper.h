@@ -0,0 +1,107 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRAFFIC_SHAPER_MAX_LEVEL 4      // Samples are decimated down to 1 in 2^level
+
+/**
+ * @brief Traffic classes, in priority order.
+ *
+ */
+typedef enum {
+    SHAPER_CLASS_EVENT = 0,         // Zone events: never dropped, held until tokens are available
+    SHAPER_CLASS_SAMPLE,            // Ranges and TDoA reports: downsampled when over budget
+    SHAPER_CLASS_STATS,             // Window summaries and anything else: dropped first
+    SHAPER_CLASS_COUNT,
+} shaper_class_t;
+
+typedef struct traffic_shaper_rate {
+    uint32_t rate;                  // Bytes per second
+    uint32_t burst;                 // Bucket size in bytes
+} TRAFFIC_SHAPER_RATE;
+
+// Per gateway: a few gateways together stay well below the mesh's usable share of 250 kbps
+#define TRAFFIC_SHAPER_CONFIG_DEFAULT() {       \
+    [SHAPER_CLASS_EVENT] = {200, 1200},         \
+    [SHAPER_CLASS_SAMPLE] = {1500, 3000},       \
+    [SHAPER_CLASS_STATS] = {300, 1200},         \
+}
+
+typedef struct traffic_shaper_bucket {
+    TRAFFIC_SHAPER_RATE config;
+    uint64_t tokens_x1000;          // Milli-bytes, so that slow rates still refill every millisecond
+    uint32_t sent;                  // Messages admitted
+    uint32_t sent_bytes;
+    uint32_t held;                  // Events put back for a later TX window
+    uint32_t dropped;
+} TRAFFIC_SHAPER_BUCKET;
+
+typedef struct traffic_shaper {
+    TRAFFIC_SHAPER_BUCKET buckets[SHAPER_CLASS_COUNT];
+    uint32_t last_refill_ms;
+    uint32_t last_update_ms;
+    uint8_t level;                  // Sample decimation level
+    bool sample_deficit;            // A sample was over budget since the last update
+    uint32_t downsampled;           // Samples skipped by decimation
+    uint32_t level_changes;
+} TRAFFIC_SHAPER;
+
+/**
+ * @brief Initialise the shaper with full buckets.
+ *
+ * @param[in] shaper    The shaper. Not thread safe, callers serialise access.
+ * @param[in] config    Array of SHAPER_CLASS_COUNT rates.
+ * @param[in] now_ms    Current time in milliseconds.
+ *
+ */
+void traffic_shaper_init(TRAFFIC_SHAPER *shaper, const TRAFFIC_SHAPER_RATE *config, uint32_t now_ms);
+
+/**
+ * @brief Change the rate of one class, its bucket is refilled to the new burst.
+ *
+ */
+void traffic_shaper_set_rate(TRAFFIC_SHAPER *shaper, shaper_class_t cls, const TRAFFIC_SHAPER_RATE *rate,
+                             uint32_t now_ms);
+
+/**
+ * @brief Take tokens for one message.
+ *
+ * Events borrow from the lower classes when their own bucket is empty.
+ *
+ * @return
+ *      - true if the message may be sent now. Otherwise events are counted as held, the others as dropped.
+ */
+bool traffic_shaper_consume(TRAFFIC_SHAPER *shaper, shaper_class_t cls, uint32_t bytes, uint32_t now_ms);
+
+/**
+ * @brief Adjust the sample decimation level, call about once per second.
+ *
+ * The level rises while samples are over budget and falls once the sample bucket is half full again.
+ *
+ * @return
+ *      - The new level.
+ */
+uint8_t traffic_shaper_update(TRAFFIC_SHAPER *shaper, uint32_t now_ms);
+
+/**
+ * @brief Decimate a tag's samples by sequence number at the current level.
+ *
+ * @return
+ *      - true if the sample is kept.
+ */
+bool traffic_shaper_keep_sample(TRAFFIC_SHAPER *shaper, uint8_t seq);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,113 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "udp_reliable.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include "openthread/cli.h"
+
+#define RELIABLE_TAG "udp_reliable"
+
+static REL_LINK rel_link;
+static SemaphoreHandle_t rel_lock;     // The sender task owns the link, the CLI only reads it
+
+static uint32_t udp_reliable_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+esp_err_t udp_reliable_init(void)
+{
+    rel_lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(rel_lock != NULL, ESP_FAIL, RELIABLE_TAG, "Fail to create reliable lock");
+    rel_link_init(&rel_link, (uint16_t)esp_random());
+    return ESP_OK;
+}
+
+int udp_reliable_window_room(void)
+{
+    xSemaphoreTake(rel_lock, portMAX_DELAY);
+    int room = REL_LINK_WINDOW - rel_link_in_flight(&rel_link);
+    xSemaphoreGive(rel_lock);
+    return room;
+}
+
+esp_err_t udp_reliable_send(const void *payload, size_t len, udp_reliable_tx_fn_t tx, void *ctx)
+{
+    esp_err_t ret = ESP_OK;
+    size_t frame_len;
+
+    ESP_RETURN_ON_FALSE(len <= REL_LINK_FRAME_MAX, ESP_ERR_INVALID_SIZE, RELIABLE_TAG, "Reliable payload too long: %u",
+                        (unsigned)len);
+    xSemaphoreTake(rel_lock, portMAX_DELAY);
+    const uint8_t *frame = rel_link_send(&rel_link, payload, len, udp_reliable_now_ms(), &frame_len);
+    if (frame != NULL) {
+        tx(frame, frame_len, ctx);
+    } else {
+        ret = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(rel_lock);
+    ESP_RETURN_ON_FALSE(ret == ESP_OK, ret, RELIABLE_TAG, "Reliable window full, frame dropped");
+    return ESP_OK;
+}
+
+uint32_t udp_reliable_poll(int sock)
+{
+    uint8_t buf[REL_LINK_ACK_LEN];
+    int len;
+
+    xSemaphoreTake(rel_lock, portMAX_DELAY);
+    while ((len = recvfrom(sock, buf, sizeof(buf), MSG_DONTWAIT, NULL, NULL)) > 0) {
+        rel_link_on_ack(&rel_link, buf, len, udp_reliable_now_ms());
+    }
+    uint32_t timeout_ms = rel_link_next_timeout_ms(&rel_link, udp_reliable_now_ms());
+    xSemaphoreGive(rel_lock);
+    return timeout_ms == UINT32_MAX ? UINT32_MAX : MIN(timeout_ms, UDP_RELIABLE_ACK_POLL_MS);
+}
+
+void udp_reliable_retransmit(udp_reliable_tx_fn_t tx, void *ctx)
+{
+    const uint8_t *frame;
+    size_t frame_len;
+
+    xSemaphoreTake(rel_lock, portMAX_DELAY);
+    while ((frame = rel_link_next_retransmit(&rel_link, udp_reliable_now_ms(), &frame_len)) != NULL) {
+        tx(frame, frame_len, ctx);
+    }
+    xSemaphoreGive(rel_lock);
+}
+
+otError esp_ot_process_reliable(void *aContext, uint8_t aArgsLength, char *aArgs[])
+{
+    if (rel_lock == NULL) {
+        otCliOutputFormat("Reliable stream is not started\n");
+        return OT_ERROR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(rel_lock, portMAX_DELAY);
+    otCliOutputFormat("next seq: %u\tin flight: %d/%d\n", rel_link.next_seq, rel_link_in_flight(&rel_link),
+                      REL_LINK_WINDOW);
+    if (rel_link.rtt_valid) {
+        otCliOutputFormat("srtt: %" PRIu32 " ms\trttvar: %" PRIu32 " ms\trto: %" PRIu32 " ms\n", rel_link.srtt_ms,
+                          rel_link.rttvar_ms, rel_link.rto_ms);
+    } else {
+        otCliOutputFormat("rto: %" PRIu32 " ms (no RTT sample yet)\n", rel_link.rto_ms);
+    }
+    otCliOutputFormat("sent: %" PRIu32 "\tacked: %" PRIu32 "\tretransmits: %" PRIu32 "\texpired: %" PRIu32
+                      "\tacks: %" PRIu32 "\twindow full: %" PRIu32 "\n", rel_link.sent, rel_link.acked,
+                      rel_link.retransmits, rel_link.expired, rel_link.acks, rel_link.window_full);
+    xSemaphoreGive(rel_lock);
+    return OT_ERROR_NONE;
+}
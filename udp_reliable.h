@@ -0,0 +1,81 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openthread/error.h>
+#include "esp_err.h"
+#include "rel_link.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UDP_RELIABLE_ACK_POLL_MS 20    // ACK polling period while frames are in flight, bounds the RTT error
+
+/**
+ * @brief Transmit one frame on the UDP socket.
+ *
+ */
+typedef void (*udp_reliable_tx_fn_t)(const uint8_t *frame, size_t len, void *ctx);
+
+/**
+ * @brief Initialise the reliable stream with a random first sequence number.
+ *
+ */
+esp_err_t udp_reliable_init(void);
+
+/**
+ * @brief Frames the reliable stream can take before its window is full.
+ *
+ * Only the sender task adds frames, so the room it reads can only grow until it sends.
+ *
+ */
+int udp_reliable_window_room(void);
+
+/**
+ * @brief Send a payload on the reliable stream.
+ *
+ * @param[in] payload   Payload, at most REL_LINK_FRAME_MAX bytes.
+ * @param[in] len       Payload length.
+ * @param[in] tx        Transmit function.
+ * @param[in] ctx       Passed to tx.
+ *
+ * @return
+ *      - ESP_OK on success.
+ *      - ESP_ERR_INVALID_SIZE if the payload is too long.
+ *      - ESP_ERR_NO_MEM if the window is full, see udp_reliable_window_room().
+ */
+esp_err_t udp_reliable_send(const void *payload, size_t len, udp_reliable_tx_fn_t tx, void *ctx);
+
+/**
+ * @brief Read the pending ACKs from the socket without blocking.
+ *
+ * @param[in] sock  UDP socket the reliable frames are sent on.
+ *
+ * @return
+ *      - Milliseconds until the socket must be polled again, 0 if a retransmission is due,
+ *        UINT32_MAX if nothing is in flight.
+ */
+uint32_t udp_reliable_poll(int sock);
+
+/**
+ * @brief Retransmit the frames whose timeout expired.
+ *
+ */
+void udp_reliable_retransmit(udp_reliable_tx_fn_t tx, void *ctx);
+
+/**
+ * @brief User command "reliable" process.
+ *
+ */
+otError esp_ot_process_reliable(void *aContext, uint8_t aArgsLength, char *aArgs[]);
+
+#ifdef __cplusplus
+}
+#endif
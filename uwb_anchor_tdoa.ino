@@ -0,0 +1,295 @@
+
+// 1: reports go straight to the bridge (mqttconnection.py) as "tdoa,..." lines over Wi-Fi UDP, batched per datagram
+// 0: one BLE advertisement per report, forwarded by the gateway; the advertisement is replaced by the next report,
+//    so this only keeps up with a handful of tags
+#define REPORT_OVER_WIFI 1
+
+#if REPORT_OVER_WIFI
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "esp_mac.h"
+
+WiFiUDP udp;
+#else
+#include <BLEDevice.h>
+#include <BLEUtils.h>
+#include <BLEAdvertising.h>
+
+BLEAdvertising *pAdvertising;
+#endif
+
+#include "dw3000.h"
+#include "uwb_msg.h"   // Report and line formats, generated by uwb_schema.py
+
+#define APP_NAME "TDOA ANCHOR v1.0"
+
+const uint8_t PIN_RST = 27;
+const uint8_t PIN_IRQ = 34;
+const uint8_t PIN_SS = 4;
+
+// Anchor 0 is the clock reference: it transmits the sync frames every other anchor timestamps
+#define ANCHOR_ID 0
+#define SYNC_INTERVAL_MS 100
+// The delayed sync TX is armed this long before its slot; the receiver is off only for that long
+#define SYNC_ARM_LEAD_MS 2
+
+#define WIFI_SSID "ssid"
+#define WIFI_PASSWORD "password"
+#define BRIDGE_HOST "192.168.0.2"   // UDP_IP of mqttconnection.py
+#define BRIDGE_PORT 12345           // UDP_PORT of mqttconnection.py
+#define REPORT_FRAME_LEN 1000       // Lines joined by '\n', within the bridge's 1024-byte receive buffer
+#define REPORT_FLUSH_MS 20          // Longest a report waits for others to share its datagram
+
+static dwt_config_t config = {
+  5,
+  DWT_PLEN_128, 
+  DWT_PAC8,
+  9,
+  9,
+  1,
+  DWT_BR_6M8,
+  DWT_PHRMODE_STD,
+  DWT_PHRRATE_STD,
+  (128 + 1 + 8 - 8),
+  DWT_STS_MODE_OFF,
+  DWT_STS_LEN_128,
+  DWT_PDOA_M0
+};
+
+#define TX_ANT_DLY 16399
+#define RX_ANT_DLY 16399
+
+// System time as read by dwt_readsystimestamphi32(): the high 32 bits of the 40-bit counter at 499.2 MHz * 128
+#define DWT_HI32_PER_MS 249600UL
+#define SYNC_INTERVAL_HI32 (SYNC_INTERVAL_MS * DWT_HI32_PER_MS)
+#define SYNC_ARM_LEAD_HI32 (SYNC_ARM_LEAD_MS * DWT_HI32_PER_MS)
+
+// Sync: data frame, seq, PAN, dest broadcast, src anchor, 'S','Y', sync seq, 2 bytes FCS.
+// The reference schedules sync k exactly k * SYNC_INTERVAL after sync 0 in its own clock,
+// so the solver only needs each anchor's receive times to track its clock offset and drift.
+// A slot the reference misses is skipped along with its sequence number, never shifted.
+static uint8_t tx_sync_msg[] = {0x41, 0x88, 0, 0xCA, 0xDE, 0xFF, 0xFF, ANCHOR_ID, 0, 'S', 'Y', 0, 0, 0};
+#define SYNC_MSG_COMMON_LEN 7
+#define SYNC_MSG_TYPE_IDX 9
+#define SYNC_MSG_SEQ_IDX 11
+
+// Blink from uwb_tag.ino in TDoA mode
+#define BLINK_FRAME_CTRL 0xC5
+#define BLINK_MSG_SN_IDX 1
+#define BLINK_MSG_ID_IDX 2
+#define BLINK_MSG_LEN 6
+
+#define RX_BUF_LEN 20
+static uint8_t rx_buffer[RX_BUF_LEN];
+static uint32_t status_reg = 0;
+static bool rx_on = false;
+
+static uint8_t sync_seq = 0;
+static uint8_t last_sync_seq = 0;
+static uint8_t last_sync_rx_ts[5];
+static bool sync_seen = false;
+static uint32_t next_sync_tx_time = 0;    // Reference only, high 32 bits of the scheduled TX time
+
+#if REPORT_OVER_WIFI
+static uint8_t anchor_addr[6];             // Bluetooth MAC, the address the gateway forwarded BLE reports with
+static char report_frame[REPORT_FRAME_LEN];
+static size_t report_frame_len = 0;
+static unsigned long report_frame_ms = 0;  // When the first line of the pending datagram was added
+#endif
+
+extern dwt_txconfig_t txconfig_options;
+
+void setup() {
+  Serial.begin(115200);
+  UART_init();
+  test_run_info((unsigned char *)APP_NAME);
+
+  spiBegin(PIN_IRQ, PIN_RST);
+  spiSelect(PIN_SS);
+  delay(2);
+
+  while (!dwt_checkidlerc()) {
+    Serial.println("IDLE FAILED");
+    while (1);
+  }
+
+  if (dwt_initialise(DWT_DW_INIT) == DWT_ERROR) {
+    Serial.println("INIT FAILED");
+    while (1);
+  }
+
+  dwt_setleds(DWT_LEDS_ENABLE | DWT_LEDS_INIT_BLINK);
+
+  if (dwt_configure(&config)) {
+    Serial.println("CONFIG FAILED");
+    while (1);
+  }
+
+  dwt_configuretxrf(&txconfig_options);
+  dwt_setrxantennadelay(RX_ANT_DLY);
+  dwt_settxantennadelay(TX_ANT_DLY);
+  dwt_setrxtimeout(0);
+  dwt_setlnapamode(DWT_LNA_ENABLE | DWT_PA_ENABLE);
+
+#if REPORT_OVER_WIFI
+  esp_read_mac(anchor_addr, ESP_MAC_BT);
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(100);
+  }
+  udp.begin(BRIDGE_PORT);
+#else
+  BLEDevice::init("UWB_Anchor");
+  pAdvertising = BLEDevice::getAdvertising();
+  pAdvertising->setMinPreferred(0x06);
+  pAdvertising->setMinPreferred(0x12);
+  pAdvertising->start();
+#endif
+
+  if (ANCHOR_ID == 0) {
+    next_sync_tx_time = dwt_readsystimestamphi32() + SYNC_INTERVAL_HI32;
+  }
+  Serial.println("TDoA anchor started.");
+}
+
+// Reference only: true once the next slot is within SYNC_ARM_LEAD_MS, on the DW3000 clock the grid is defined on
+static bool sync_due() {
+  return (int32_t)(next_sync_tx_time - dwt_readsystimestamphi32()) <= (int32_t)SYNC_ARM_LEAD_HI32;
+}
+
+static void send_sync() {
+  // Scheduled on the exact grid so that T(k) - T(0) = k * SYNC_INTERVAL in the reference clock
+  tx_sync_msg[SYNC_MSG_SEQ_IDX] = sync_seq;
+  dwt_forcetrxoff();
+  rx_on = false;
+  dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_TXFRS_BIT_MASK);
+  dwt_writetxdata(sizeof(tx_sync_msg), tx_sync_msg, 0);
+  dwt_writetxfctrl(sizeof(tx_sync_msg), 0, 0);
+  dwt_setdelayedtrxtime(next_sync_tx_time);
+  if (dwt_starttx(DWT_START_TX_DELAYED) == DWT_SUCCESS) {
+    // Armed SYNC_ARM_LEAD_MS ahead, so this waits about that long
+    while (!(dwt_read32bitreg(SYS_STATUS_ID) & SYS_STATUS_TXFRS_BIT_MASK)) { }
+    dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_TXFRS_BIT_MASK);
+
+    // The reference hears its own sync at its TX time
+    uint64_t tx_ts = (((uint64_t)(next_sync_tx_time & 0xFFFFFFFEUL)) << 8) + TX_ANT_DLY;
+    for (int i = 0; i < 5; i++) {
+      last_sync_rx_ts[i] = (uint8_t)(tx_ts >> (8 * i));
+    }
+    last_sync_seq = sync_seq;
+    sync_seen = true;
+  } else {
+    Serial.println("Sync TX late, skipping slot");
+  }
+
+  // Move to the first slot that can still be armed in time; missed slots take their sequence numbers with them
+  do {
+    sync_seq++;
+    next_sync_tx_time += SYNC_INTERVAL_HI32;
+  } while ((int32_t)(next_sync_tx_time - dwt_readsystimestamphi32()) <= (int32_t)SYNC_ARM_LEAD_HI32);
+}
+
+#if REPORT_OVER_WIFI
+static void report_flush() {
+  if (report_frame_len == 0) {
+    return;
+  }
+  udp.beginPacket(BRIDGE_HOST, BRIDGE_PORT);
+  udp.write((const uint8_t *)report_frame, report_frame_len);
+  udp.endPacket();
+  report_frame_len = 0;
+}
+
+static void report_append(const char *line, size_t len) {
+  if (report_frame_len > 0 && report_frame_len + 1 + len > sizeof(report_frame)) {
+    report_flush();
+  }
+  if (report_frame_len == 0) {
+    report_frame_ms = millis();
+  } else {
+    report_frame[report_frame_len++] = '\n';
+  }
+  memcpy(&report_frame[report_frame_len], line, len);
+  report_frame_len += len;
+}
+#endif
+
+static void report_blink(uint16_t tag_id, uint8_t tag_seq, const uint8_t blink_rx_ts[5]) {
+  UWB_MSG_TDOA_REPORT report;
+  report.tag_id = tag_id;
+  report.seq = tag_seq;
+  report.sync_seq = last_sync_seq;
+  report.rx_ts = 0;
+  report.sync_ts = 0;
+  for (int i = 4; i >= 0; i--) {
+    report.rx_ts = (report.rx_ts << 8) | blink_rx_ts[i];
+    report.sync_ts = (report.sync_ts << 8) | last_sync_rx_ts[i];
+  }
+#if REPORT_OVER_WIFI
+  // Same line as the gateway forwards from a BLE report, so the bridge handles both alike
+  char line[64];
+  int len = snprintf(line, sizeof(line), UWB_LINE_TDOA_FMT, UWB_LINE_BDA_ARGS(anchor_addr), report.tag_id,
+                     report.seq, report.sync_seq, (unsigned long long)report.rx_ts,
+                     (unsigned long long)report.sync_ts);
+  report_append(line, len);
+#else
+  uint8_t mfg_data[UWB_MSG_TDOA_REPORT_ADV_LEN];
+  uwb_msg_tdoa_report_encode(mfg_data, &report);
+
+  String mfgString = "";
+  for (size_t i = 0; i < sizeof(mfg_data); i++) {
+    mfgString += (char)mfg_data[i];
+  };
+  BLEAdvertisementData oAdvertisementData;
+  oAdvertisementData.setFlags(0x06); // General discoverable
+  oAdvertisementData.setManufacturerData(mfgString);
+
+  pAdvertising->setAdvertisementData(oAdvertisementData);
+  pAdvertising->start();
+#endif
+}
+
+void loop() {
+  if (ANCHOR_ID == 0 && sync_due()) {
+    send_sync();
+  }
+#if REPORT_OVER_WIFI
+  if (report_frame_len > 0 && millis() - report_frame_ms >= REPORT_FLUSH_MS) {
+    report_flush();
+  }
+#endif
+
+  // The receiver stays on between frames; loop() only polls it, so the sync and the reports are served meanwhile
+  if (!rx_on) {
+    dwt_rxenable(DWT_START_RX_IMMEDIATE);
+    rx_on = true;
+  }
+  status_reg = dwt_read32bitreg(SYS_STATUS_ID);
+
+  if (status_reg & SYS_STATUS_RXFCG_BIT_MASK) {
+    uint32_t frame_len;
+    uint8_t rx_ts[5];
+    rx_on = false;
+    dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_RXFCG_BIT_MASK);
+    frame_len = dwt_read32bitreg(RX_FINFO_ID) & RXFLEN_MASK;
+
+    if (frame_len <= sizeof(rx_buffer)) {
+      dwt_readrxdata(rx_buffer, frame_len, 0);
+      dwt_readrxtimestamp(rx_ts);
+
+      if (frame_len == BLINK_MSG_LEN && rx_buffer[0] == BLINK_FRAME_CTRL && sync_seen) {
+        uint16_t tag_id = rx_buffer[BLINK_MSG_ID_IDX] | (rx_buffer[BLINK_MSG_ID_IDX + 1] << 8);
+        report_blink(tag_id, rx_buffer[BLINK_MSG_SN_IDX], rx_ts);
+      } else if (frame_len == sizeof(tx_sync_msg) && memcmp(rx_buffer, tx_sync_msg, SYNC_MSG_COMMON_LEN) == 0 &&
+                 rx_buffer[SYNC_MSG_TYPE_IDX] == 'S' && rx_buffer[SYNC_MSG_TYPE_IDX + 1] == 'Y') {
+        last_sync_seq = rx_buffer[SYNC_MSG_SEQ_IDX];
+        memcpy(last_sync_rx_ts, rx_ts, 5);
+        sync_seen = true;
+      }
+    }
+  } else if (status_reg & (SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR)) {
+    rx_on = false;
+    dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
+  }
+}
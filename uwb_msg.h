@@ -0,0 +1,133 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Generated by uwb_schema.py, edit the schema and regenerate instead of this file.
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UWB_MSG_MANUFACTURER_ID 0x1234
+#define UWB_MSG_ID_LEN 2                // Manufacturer ID ahead of every payload
+#define UWB_MSG_TYPE_IDX 3
+
+// uwb_tag.ino (TWR): dist_cm (u16), seq (u8), type (u8)
+#define UWB_MSG_TYPE_RANGE 0x00
+#define UWB_MSG_RANGE_LEN 4
+#define UWB_MSG_RANGE_ADV_LEN (UWB_MSG_ID_LEN + UWB_MSG_RANGE_LEN)
+
+typedef struct uwb_msg_range {
+    uint16_t dist_cm;
+    uint8_t seq;
+} UWB_MSG_RANGE;
+
+static inline size_t uwb_msg_range_encode(uint8_t buf[UWB_MSG_RANGE_ADV_LEN], const UWB_MSG_RANGE *msg)
+{
+    buf[0] = (uint8_t)UWB_MSG_MANUFACTURER_ID;
+    buf[1] = (uint8_t)(UWB_MSG_MANUFACTURER_ID >> 8);
+    buf[UWB_MSG_ID_LEN + 0] = (uint8_t)(msg->dist_cm);
+    buf[UWB_MSG_ID_LEN + 1] = (uint8_t)(msg->dist_cm >> 8);
+    buf[UWB_MSG_ID_LEN + 2] = (uint8_t)(msg->seq);
+    buf[UWB_MSG_ID_LEN + 3] = (uint8_t)(UWB_MSG_TYPE_RANGE);
+    return UWB_MSG_RANGE_ADV_LEN;
+}
+
+static inline bool uwb_msg_range_decode(const uint8_t *payload, size_t len, UWB_MSG_RANGE *msg)
+{
+    if (len < UWB_MSG_RANGE_LEN || payload[UWB_MSG_TYPE_IDX] != UWB_MSG_TYPE_RANGE) {
+        return false;
+    }
+    msg->dist_cm = (uint16_t)(payload[0] | ((uint16_t)payload[1] << 8));
+    msg->seq = (uint8_t)(payload[2]);
+    return true;
+}
+
+// uwb_anchor_tdoa.ino: tag_id (u16), seq (u8), type (u8), sync_seq (u8), rx_ts (u40), sync_ts (u40)
+#define UWB_MSG_TYPE_TDOA_REPORT 0x01
+#define UWB_MSG_TDOA_REPORT_LEN 15
+#define UWB_MSG_TDOA_REPORT_ADV_LEN (UWB_MSG_ID_LEN + UWB_MSG_TDOA_REPORT_LEN)
+
+typedef struct uwb_msg_tdoa_report {
+    uint16_t tag_id;
+    uint8_t seq;
+    uint8_t sync_seq;
+    uint64_t rx_ts;
+    uint64_t sync_ts;
+} UWB_MSG_TDOA_REPORT;
+
+static inline size_t uwb_msg_tdoa_report_encode(uint8_t buf[UWB_MSG_TDOA_REPORT_ADV_LEN], const UWB_MSG_TDOA_REPORT *msg)
+{
+    buf[0] = (uint8_t)UWB_MSG_MANUFACTURER_ID;
+    buf[1] = (uint8_t)(UWB_MSG_MANUFACTURER_ID >> 8);
+    buf[UWB_MSG_ID_LEN + 0] = (uint8_t)(msg->tag_id);
+    buf[UWB_MSG_ID_LEN + 1] = (uint8_t)(msg->tag_id >> 8);
+    buf[UWB_MSG_ID_LEN + 2] = (uint8_t)(msg->seq);
+    buf[UWB_MSG_ID_LEN + 3] = (uint8_t)(UWB_MSG_TYPE_TDOA_REPORT);
+    buf[UWB_MSG_ID_LEN + 4] = (uint8_t)(msg->sync_seq);
+    buf[UWB_MSG_ID_LEN + 5] = (uint8_t)(msg->rx_ts);
+    buf[UWB_MSG_ID_LEN + 6] = (uint8_t)(msg->rx_ts >> 8);
+    buf[UWB_MSG_ID_LEN + 7] = (uint8_t)(msg->rx_ts >> 16);
+    buf[UWB_MSG_ID_LEN + 8] = (uint8_t)(msg->rx_ts >> 24);
+    buf[UWB_MSG_ID_LEN + 9] = (uint8_t)(msg->rx_ts >> 32);
+    buf[UWB_MSG_ID_LEN + 10] = (uint8_t)(msg->sync_ts);
+    buf[UWB_MSG_ID_LEN + 11] = (uint8_t)(msg->sync_ts >> 8);
+    buf[UWB_MSG_ID_LEN + 12] = (uint8_t)(msg->sync_ts >> 16);
+    buf[UWB_MSG_ID_LEN + 13] = (uint8_t)(msg->sync_ts >> 24);
+    buf[UWB_MSG_ID_LEN + 14] = (uint8_t)(msg->sync_ts >> 32);
+    return UWB_MSG_TDOA_REPORT_ADV_LEN;
+}
+
+static inline bool uwb_msg_tdoa_report_decode(const uint8_t *payload, size_t len, UWB_MSG_TDOA_REPORT *msg)
+{
+    if (len < UWB_MSG_TDOA_REPORT_LEN || payload[UWB_MSG_TYPE_IDX] != UWB_MSG_TYPE_TDOA_REPORT) {
+        return false;
+    }
+    msg->tag_id = (uint16_t)(payload[0] | ((uint16_t)payload[1] << 8));
+    msg->seq = (uint8_t)(payload[2]);
+    msg->sync_seq = (uint8_t)(payload[4]);
+    msg->rx_ts = (uint64_t)(payload[5] | ((uint64_t)payload[6] << 8) | ((uint64_t)payload[7] << 16) | ((uint64_t)payload[8] << 24) | ((uint64_t)payload[9] << 32));
+    msg->sync_ts = (uint64_t)(payload[10] | ((uint64_t)payload[11] << 8) | ((uint64_t)payload[12] << 16) | ((uint64_t)payload[13] << 24) | ((uint64_t)payload[14] << 32));
+    return true;
+}
+
+// UDP frame records, one per line: printf formats and the order of their arguments
+#define UWB_LINE_BDA_ARGS(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+
+// addr (UWB_LINE_BDA_ARGS), seq (u), dist_cm (u), rssi (i)
+#define UWB_LINE_RANGE_FMT "%02x%02x%02x%02x%02x%02x,%u,%u,%d"
+// anchor (UWB_LINE_BDA_ARGS), tag_id (u), seq (u), sync_seq (u), rx_ts (x40), sync_ts (x40)
+#define UWB_LINE_TDOA_FMT "tdoa,%02x%02x%02x%02x%02x%02x,%u,%u,%u,%010llx,%010llx"
+// addr (UWB_LINE_BDA_ARGS), event (s), zone_id (u), inside_ms (u32)
+#define UWB_LINE_ZONE_FMT "zone,%02x%02x%02x%02x%02x%02x,%s,%u,%" PRIu32
+// addr (UWB_LINE_BDA_ARGS), window_ms (u32), count (u32), min (i32), max (i32), mean (i32), variance (u32), last (i32)
+#define UWB_LINE_AGG_FMT "agg,%02x%02x%02x%02x%02x%02x,%" PRIu32 ",%" PRIu32 ",%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRIu32 ",%" PRId32
+
+#ifdef UWB_MSG_GOLDEN
+// Golden vectors, checked by "uwb_schema.py --check"
+typedef struct uwb_msg_golden {
+    uint8_t type;
+    uint8_t len;
+    uint8_t bytes[32];
+    uint64_t fields[8];
+} UWB_MSG_GOLDEN_VECTOR;
+
+static const UWB_MSG_GOLDEN_VECTOR uwb_msg_golden[] = {
+    {0x00, 4, {0xd2, 0x04, 0x07, 0x00}, {1234ull, 7ull}},
+    {0x00, 4, {0xff, 0xff, 0xff, 0x00}, {65535ull, 255ull}},
+    {0x01, 15, {0x02, 0x01, 0x09, 0x01, 0xc8, 0x05, 0x04, 0x03, 0x02, 0x01, 0xbb, 0xcc, 0xdd, 0xee, 0xff}, {258ull, 9ull, 200ull, 4328719365ull, 1099224173755ull}},
+};
+#endif
+
+#ifdef __cplusplus
+}
+#endif
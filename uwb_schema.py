@@ -0,0 +1,429 @@
+import argparse
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+# Single source of the payload contract between tag / anchor, gateway and bridge.
+#
+# ADV_MESSAGES: BLE manufacturer data after the 2-byte manufacturer ID, little endian; every message
+# carries its type at TYPE_IDX. LINES: the text records the gateway (and the bridge, for "gap") put in
+# UDP frames, one per line, comma separated, a fixed prefix naming the record except for plain ranges.
+#
+# "python3 uwb_schema.py" regenerates uwb_msg.h (C, firmware and sketches) and bridge_msg.py (bridge);
+# "--check" verifies both are current and agree with the golden vectors below, "--bench" times the
+# Python decoders.
+
+MANUFACTURER_ID = 0x1234
+TYPE_IDX = 3
+
+FIELD_TYPES = {"u8": (1, "uint8_t", "B"), "u16": (2, "uint16_t", "H"), "u32": (4, "uint32_t", "I"),
+               "u40": (5, "uint64_t", "5s")}
+
+ADV_MESSAGES = [
+    {
+        "name": "range", "type": 0x00, "source": "uwb_tag.ino (TWR)",
+        "fields": [("dist_cm", "u16"), ("seq", "u8"), ("type", "u8")],
+        "golden": [({"dist_cm": 1234, "seq": 7}, "d2040700"),
+                   ({"dist_cm": 65535, "seq": 255}, "ffffff00")],
+    },
+    {
+        "name": "tdoa_report", "type": 0x01, "source": "uwb_anchor_tdoa.ino",
+        "fields": [("tag_id", "u16"), ("seq", "u8"), ("type", "u8"), ("sync_seq", "u8"), ("rx_ts", "u40"),
+                   ("sync_ts", "u40")],
+        "golden": [({"tag_id": 0x0102, "seq": 9, "sync_seq": 200, "rx_ts": 0x0102030405,
+                     "sync_ts": 0xFFEEDDCCBB}, "02010901c80504030201bbccddeeff")],
+    },
+]
+
+# Field kinds and their C argument types: bda (esp_bd_addr_t, 12 hex digits), u / i (unsigned / int),
+# u32 / i32 (uint32_t / int32_t), x40 (unsigned long long, 10 hex digits), s (text)
+LINES = [
+    {"name": "range", "prefix": None, "source": "gateway",
+     "fields": [("addr", "bda"), ("seq", "u"), ("dist_cm", "u"), ("rssi", "i")],
+     "golden": (("c0de00000001", 7, 1234, -61), "c0de00000001,7,1234,-61")},
+    {"name": "tdoa", "prefix": "tdoa", "source": "gateway",
+     "fields": [("anchor", "bda"), ("tag_id", "u"), ("seq", "u"), ("sync_seq", "u"), ("rx_ts", "x40"),
+                ("sync_ts", "x40")],
+     "golden": (("a1a2a3a4a5a6", 258, 9, 200, 0x0102030405, 0xFFEEDDCCBB),
+                "tdoa,a1a2a3a4a5a6,258,9,200,0102030405,ffeeddccbb")},
+    {"name": "zone", "prefix": "zone", "source": "gateway",
+     "fields": [("addr", "bda"), ("event", "s"), ("zone_id", "u"), ("inside_ms", "u32")],
+     "golden": (("c0de00000001", "enter", 3, 0), "zone,c0de00000001,enter,3,0")},
+    {"name": "agg", "prefix": "agg", "source": "gateway",
+     "fields": [("addr", "bda"), ("window_ms", "u32"), ("count", "u32"), ("min", "i32"), ("max", "i32"),
+                ("mean", "i32"), ("variance", "u32"), ("last", "i32")],
+     "golden": (("c0de00000001", 1000, 10, 95, 130, 110, 81, 120), "agg,c0de00000001,1000,10,95,130,110,81,120")},
+    {"name": "gap", "prefix": "gap", "source": "bridge",
+     "fields": [("tag", "s"), ("first_seq", "u"), ("count", "u")],
+     "golden": (("c0de00000001", 250, 8), "gap,c0de00000001,250,8")},
+]
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+C_HEADER = os.path.join(HERE, "uwb_msg.h")
+PY_MODULE = os.path.join(HERE, "bridge_msg.py")
+
+C_LINE_FORMATS = {"bda": "%02x%02x%02x%02x%02x%02x", "u": "%u", "i": "%d", "u32": "%\" PRIu32 \"",
+                  "i32": "%\" PRId32 \"", "x40": "%010llx", "s": "%s"}
+
+
+def msg_len(msg):
+    return sum(FIELD_TYPES[kind][0] for _, kind in msg["fields"])
+
+
+def msg_struct(msg):
+    return "<" + "".join(FIELD_TYPES[kind][2] for _, kind in msg["fields"])
+
+
+def encode_golden(msg, values):
+    """Reference encoder, independent of the generated code."""
+    out = bytearray()
+    for name, kind in msg["fields"]:
+        value = msg["type"] if name == "type" else values[name]
+        out += value.to_bytes(FIELD_TYPES[kind][0], "little")
+    return bytes(out)
+
+
+def validate():
+    for msg in ADV_MESSAGES:
+        offset = 0
+        for name, kind in msg["fields"]:
+            if name == "type":
+                assert offset == TYPE_IDX, f"{msg['name']}: type must be at offset {TYPE_IDX}"
+            offset += FIELD_TYPES[kind][0]
+        for values, hex_bytes in msg["golden"]:
+            assert encode_golden(msg, values).hex() == hex_bytes, f"{msg['name']}: golden vector mismatch"
+
+
+def generate_c():
+    out = ["/*",
+           " * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD",
+           " *",
+           " * SPDX-License-Identifier: Apache-2.0",
+           " */",
+           "",
+           "// Generated by uwb_schema.py, edit the schema and regenerate instead of this file.",
+           "",
+           "#pragma once",
+           "",
+           "#include <inttypes.h>",
+           "#include <stdbool.h>",
+           "#include <stddef.h>",
+           "#include <stdint.h>",
+           "",
+           "#ifdef __cplusplus",
+           'extern "C" {',
+           "#endif",
+           "",
+           f"#define UWB_MSG_MANUFACTURER_ID 0x{MANUFACTURER_ID:04X}",
+           "#define UWB_MSG_ID_LEN 2                // Manufacturer ID ahead of every payload",
+           f"#define UWB_MSG_TYPE_IDX {TYPE_IDX}",
+           ""]
+    for msg in ADV_MESSAGES:
+        upper = msg["name"].upper()
+        struct_fields = [(n, k) for n, k in msg["fields"] if n != "type"]
+        out += [f"// {msg['source']}: " + ", ".join(f"{n} ({k})" for n, k in msg["fields"]),
+                f"#define UWB_MSG_TYPE_{upper} 0x{msg['type']:02X}",
+                f"#define UWB_MSG_{upper}_LEN {msg_len(msg)}",
+                f"#define UWB_MSG_{upper}_ADV_LEN (UWB_MSG_ID_LEN + UWB_MSG_{upper}_LEN)",
+                "",
+                f"typedef struct uwb_msg_{msg['name']} {{"]
+        out += [f"    {FIELD_TYPES[k][1]} {n};" for n, k in struct_fields]
+        out += [f"}} UWB_MSG_{upper};", ""]
+
+        # Encoder: manufacturer ID then the payload, ready for the advertisement
+        out += [f"static inline size_t uwb_msg_{msg['name']}_encode(uint8_t buf[UWB_MSG_{upper}_ADV_LEN], "
+                f"const UWB_MSG_{upper} *msg)",
+                "{",
+                "    buf[0] = (uint8_t)UWB_MSG_MANUFACTURER_ID;",
+                "    buf[1] = (uint8_t)(UWB_MSG_MANUFACTURER_ID >> 8);"]
+        offset = 0
+        for name, kind in msg["fields"]:
+            size = FIELD_TYPES[kind][0]
+            value = f"UWB_MSG_TYPE_{upper}" if name == "type" else f"msg->{name}"
+            for i in range(size):
+                shift = f" >> {8 * i}" if i else ""
+                out.append(f"    buf[UWB_MSG_ID_LEN + {offset + i}] = (uint8_t)({value}{shift});")
+            offset += size
+        out += [f"    return UWB_MSG_{upper}_ADV_LEN;", "}", ""]
+
+        # Decoder: payload after the manufacturer ID
+        out += [f"static inline bool uwb_msg_{msg['name']}_decode(const uint8_t *payload, size_t len, "
+                f"UWB_MSG_{upper} *msg)",
+                "{",
+                f"    if (len < UWB_MSG_{upper}_LEN || payload[UWB_MSG_TYPE_IDX] != UWB_MSG_TYPE_{upper}) {{",
+                "        return false;",
+                "    }"]
+        offset = 0
+        for name, kind in msg["fields"]:
+            size = FIELD_TYPES[kind][0]
+            if name != "type":
+                ctype = FIELD_TYPES[kind][1]
+                terms = [f"(({ctype})payload[{offset + i}] << {8 * i})" if i else f"payload[{offset}]"
+                         for i in range(size)]
+                out.append(f"    msg->{name} = ({ctype})({' | '.join(terms)});")
+            offset += size
+        out += ["    return true;", "}", ""]
+
+    out += ["// UDP frame records, one per line: printf formats and the order of their arguments",
+            "#define UWB_LINE_BDA_ARGS(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]",
+            ""]
+    for line in LINES:
+        if line["source"] != "gateway":
+            continue
+        fmt = ",".join(C_LINE_FORMATS[kind] for _, kind in line["fields"])
+        if line["prefix"]:
+            fmt = line["prefix"] + "," + fmt
+        args = ", ".join(f"{n} ({'UWB_LINE_BDA_ARGS' if k == 'bda' else k})" for n, k in line["fields"])
+        fmt = f"\"{fmt}\"".replace(" \"\"", "")
+        out += [f"// {args}",
+                f"#define UWB_LINE_{line['name'].upper()}_FMT {fmt}"]
+    out += [""]
+
+    out += ["#ifdef UWB_MSG_GOLDEN",
+            "// Golden vectors, checked by \"uwb_schema.py --check\"",
+            "typedef struct uwb_msg_golden {",
+            "    uint8_t type;",
+            "    uint8_t len;",
+            "    uint8_t bytes[32];",
+            "    uint64_t fields[8];",
+            "} UWB_MSG_GOLDEN_VECTOR;",
+            "",
+            "static const UWB_MSG_GOLDEN_VECTOR uwb_msg_golden[] = {"]
+    for msg in ADV_MESSAGES:
+        for values, hex_bytes in msg["golden"]:
+            raw = bytes.fromhex(hex_bytes)
+            fields = [str(values[n]) + "ull" for n, _ in msg["fields"] if n != "type"]
+            out.append(f"    {{0x{msg['type']:02X}, {len(raw)}, {{{', '.join(f'0x{b:02x}' for b in raw)}}}, "
+                       f"{{{', '.join(fields)}}}}},")
+    out += ["};", "#endif", "",
+            "#ifdef __cplusplus",
+            "}",
+            "#endif",
+            ""]
+    return "\n".join(out)
+
+
+def generate_py():
+    out = ["# Generated by uwb_schema.py, edit the schema and regenerate instead of this file.",
+           "import struct",
+           "",
+           "try:",
+           "    import numpy",
+           "except ImportError:",
+           "    numpy = None",
+           "",
+           f"MANUFACTURER_ID = 0x{MANUFACTURER_ID:04X}",
+           f"TYPE_IDX = {TYPE_IDX}",
+           ""]
+    for msg in ADV_MESSAGES:
+        upper = msg["name"].upper()
+        out += [f"TYPE_{upper} = 0x{msg['type']:02X}",
+                f"{upper}_LEN = {msg_len(msg)}",
+                f"{upper}_FIELDS = {tuple(n for n, _ in msg['fields'])!r}",
+                f"{upper}_STRUCT = struct.Struct({msg_struct(msg)!r})"]
+        if not any(k == "u40" for _, k in msg["fields"]):
+            out.append(f"{upper}_DTYPE = None if numpy is None else numpy.dtype([" + ", ".join(
+                f"({n!r}, '<u{FIELD_TYPES[k][0]}')" for n, k in msg["fields"]) + "])")
+    out += ["", ""]
+
+    # Scalar decoders
+    out += ["def _u40(raw):", "    return int.from_bytes(raw, \"little\")", "", ""]
+    for msg in ADV_MESSAGES:
+        upper = msg["name"].upper()
+        names = ["_type" if n == "type" else n for n, _ in msg["fields"]]
+        converted = [f"_u40({n})" if k == "u40" else n for n, k in msg["fields"] if n != "type"]
+        out += [f"def decode_{msg['name']}(payload):",
+                f"    \"\"\"({', '.join(n for n in names if n != '_type')}) of one payload after the manufacturer "
+                f"ID, or None.\"\"\"",
+                f"    if len(payload) < {upper}_LEN or payload[TYPE_IDX] != TYPE_{upper}:",
+                "        return None",
+                f"    {', '.join(names)}, = {upper}_STRUCT.unpack_from(payload)" if len(names) == 1 else
+                f"    {', '.join(names)} = {upper}_STRUCT.unpack_from(payload)",
+                f"    return ({', '.join(converted)},)" if len(converted) == 1 else
+                f"    return ({', '.join(converted)})",
+                "",
+                ""]
+        fields = [n for n, _ in msg["fields"] if n != "type"]
+        out += [f"def encode_{msg['name']}({', '.join(fields)}):",
+                "    \"\"\"Manufacturer ID and payload, as the sketch advertises them.\"\"\"",
+                f"    return struct.pack(\"<H\", MANUFACTURER_ID) + {upper}_STRUCT.pack("
+                + ", ".join(f"TYPE_{upper}" if n == "type" else
+                            (f"{n}.to_bytes(5, \"little\")" if k == "u40" else n) for n, k in msg["fields"]) + ")",
+                "",
+                ""]
+
+    # Batch decoder for fixed-size records, the common case being ranges from a capture
+    for msg in ADV_MESSAGES:
+        upper = msg["name"].upper()
+        if any(k == "u40" for _, k in msg["fields"]):
+            continue
+        out += [f"def decode_{msg['name']}_batch(buf):",
+                f"    \"\"\"Decode back-to-back {upper}_LEN-byte payloads: a numpy record array when numpy is",
+                "    available, else a list of tuples from struct.iter_unpack.\"\"\"",
+                "    if numpy is not None:",
+                f"        return numpy.frombuffer(buf, dtype={upper}_DTYPE)",
+                f"    return list({upper}_STRUCT.iter_unpack(buf))",
+                "",
+                ""]
+
+    out += ["def decode_adv(payload):",
+            "    \"\"\"(message name, fields) of one payload after the manufacturer ID, or None.\"\"\"",
+            f"    if len(payload) <= TYPE_IDX:",
+            "        return None"]
+    for msg in ADV_MESSAGES:
+        out += [f"    if payload[TYPE_IDX] == TYPE_{msg['name'].upper()}:",
+                f"        fields = decode_{msg['name']}(payload)",
+                f"        return None if fields is None else ({msg['name']!r}, fields)"]
+    out += ["    return None", "", ""]
+
+    # Lines
+    out += ["# UDP frame records: name -> (prefix or None, field names, field kinds)",
+            "LINES = {"]
+    for line in LINES:
+        out.append(f"    {line['name']!r}: ({line['prefix']!r}, {tuple(n for n, _ in line['fields'])!r}, "
+                   f"{tuple(k for _, k in line['fields'])!r}),")
+    out += ["}",
+            "_PREFIXES = {prefix: name for name, (prefix, _, _) in LINES.items() if prefix}",
+            "_CONVERT = {\"bda\": str, \"s\": str, \"u\": int, \"i\": int, \"u32\": int, \"i32\": int, \"x40\": lambda v: int(v, 16)}",
+            "",
+            "",
+            "def parse_line(text):",
+            "    \"\"\"(record name, field values) of one UDP frame line, or None if it matches no record.\"\"\"",
+            "    fields = text.split(\",\")",
+            "    name = _PREFIXES.get(fields[0])",
+            "    if name is None:",
+            "        name = \"range\"",
+            "    else:",
+            "        fields = fields[1:]",
+            "    _, _, kinds = LINES[name]",
+            "    if len(fields) != len(kinds):",
+            "        return None",
+            "    try:",
+            "        return name, tuple(_CONVERT[kind](value) for kind, value in zip(kinds, fields))",
+            "    except ValueError:",
+            "        return None",
+            "",
+            "",
+            "def format_line(name, *values):",
+            "    prefix, _, kinds = LINES[name]",
+            "    text = \",\".join(f\"{v:010x}\" if kind == \"x40\" else str(v) for kind, v in zip(kinds, values))",
+            "    return text if prefix is None else prefix + \",\" + text",
+            ""]
+    return "\n".join(out)
+
+
+def check_c(header):
+    """Compile and run a throwaway program against the generated header and its golden vectors."""
+    cc = shutil.which("cc") or shutil.which("gcc")
+    if cc is None:
+        print("no C compiler, C golden vectors not checked")
+        return True
+    lines = ["#define UWB_MSG_GOLDEN", f"#include \"{header}\"", "#include <stdio.h>", "#include <string.h>",
+             "int main(void)", "{", "    int bad = 0;", "    uint8_t buf[64];",
+             "    for (size_t i = 0; i < sizeof(uwb_msg_golden) / sizeof(uwb_msg_golden[0]); i++) {",
+             "        const UWB_MSG_GOLDEN_VECTOR *g = &uwb_msg_golden[i];"]
+    for msg in ADV_MESSAGES:
+        upper = msg["name"].upper()
+        fields = [n for n, _ in msg["fields"] if n != "type"]
+        lines += [f"        if (g->type == UWB_MSG_TYPE_{upper}) {{",
+                  f"            UWB_MSG_{upper} msg = {{0}}, back;"]
+        lines += [f"            msg.{n} = g->fields[{i}];" for i, n in enumerate(fields)]
+        lines += [f"            size_t n = uwb_msg_{msg['name']}_encode(buf, &msg);",
+                  "            bad |= n != (size_t)g->len + UWB_MSG_ID_LEN || memcmp(&buf[UWB_MSG_ID_LEN], g->bytes, "
+                  "g->len) != 0;",
+                  f"            bad |= !uwb_msg_{msg['name']}_decode(g->bytes, g->len, &back) || memcmp(&back, &msg, "
+                  "sizeof(msg)) != 0;",
+                  "        }"]
+    lines += ["    }", "    char text[128];"]
+    c_casts = {"u": "(unsigned)", "i": "(int)", "u32": "(uint32_t)", "i32": "(int32_t)",
+               "x40": "(unsigned long long)", "s": ""}
+    for line in LINES:
+        if line["source"] != "gateway":
+            continue
+        values, text = line["golden"]
+        args = []
+        for (name, kind), value in zip(line["fields"], values):
+            if kind == "bda":
+                args.append(", ".join(f"0x{b:02x}" for b in bytes.fromhex(value)))
+            else:
+                args.append(f"\"{value}\"" if kind == "s" else f"{c_casts[kind]}{value}LL")
+        lines += [f"    snprintf(text, sizeof(text), UWB_LINE_{line['name'].upper()}_FMT, {', '.join(args)});",
+                  f"    bad |= strcmp(text, \"{text}\") != 0;"]
+    lines += ["    return bad;", "}", ""]
+    with tempfile.TemporaryDirectory() as tmp:
+        src = os.path.join(tmp, "golden.c")
+        with open(src, "w") as f:
+            f.write("\n".join(lines))
+        exe = os.path.join(tmp, "golden")
+        build = subprocess.run([cc, "-std=c99", "-Wall", "-Werror", "-o", exe, src], capture_output=True, text=True)
+        if build.returncode != 0:
+            print(build.stderr)
+            return False
+        return subprocess.run([exe]).returncode == 0
+
+
+def check_py():
+    sys.path.insert(0, HERE)
+    import bridge_msg
+    ok = True
+    for msg in ADV_MESSAGES:
+        for values, hex_bytes in msg["golden"]:
+            raw = bytes.fromhex(hex_bytes)
+            expected = tuple(values[n] for n, _ in msg["fields"] if n != "type")
+            ok &= getattr(bridge_msg, f"decode_{msg['name']}")(raw) == expected
+            ok &= getattr(bridge_msg, f"encode_{msg['name']}")(*expected)[2:] == raw
+            ok &= bridge_msg.decode_adv(raw) == (msg["name"], expected)
+    for line in LINES:
+        values, text = line["golden"]
+        ok &= bridge_msg.parse_line(text) == (line["name"], values)
+        ok &= bridge_msg.format_line(line["name"], *values) == text
+    return ok
+
+
+def bench():
+    sys.path.insert(0, HERE)
+    import bridge_msg
+    count = 200_000
+    ranges = b"".join(bridge_msg.encode_range(i % 5000, i % 256)[2:] for i in range(count))
+    results = {}
+    start = time.perf_counter()
+    for i in range(0, len(ranges), bridge_msg.RANGE_LEN):
+        bridge_msg.decode_range(ranges[i:i + bridge_msg.RANGE_LEN])
+    results["decode_range"] = count / (time.perf_counter() - start)
+    start = time.perf_counter()
+    bridge_msg.decode_range_batch(ranges)
+    results["decode_range_batch" + ("" if bridge_msg.numpy is None else " (numpy)")] = \
+        count / (time.perf_counter() - start)
+    lines = [bridge_msg.format_line("range", "c0de%08x" % (i % 1000), i % 256, i % 5000, -60) for i in range(count)]
+    start = time.perf_counter()
+    for text in lines:
+        bridge_msg.parse_line(text)
+    results["parse_line"] = count / (time.perf_counter() - start)
+    for name, rate in results.items():
+        print(f"{name:32s} {rate / 1e6:8.2f} M/s")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Generate uwb_msg.h and bridge_msg.py from the payload schema")
+    parser.add_argument("--check", action="store_true", help="verify the generated files and the golden vectors")
+    parser.add_argument("--bench", action="store_true", help="time the Python decoders")
+    args = parser.parse_args()
+
+    validate()
+    if args.bench:
+        bench()
+    elif args.check:
+        current = all(open(path).read() == text for path, text in ((C_HEADER, generate_c()),
+                                                                   (PY_MODULE, generate_py())))
+        ok = current and check_py() and check_c(C_HEADER)
+        print("generated files current" if current else "generated files out of date, run uwb_schema.py")
+        print("golden vectors OK" if ok else "golden vectors FAILED")
+        sys.exit(0 if ok else 1)
+    else:
+        for path, text in ((C_HEADER, generate_c()), (PY_MODULE, generate_py())):
+            with open(path, "w") as f:
+                f.write(text)
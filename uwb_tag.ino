@@ -6,6 +6,8 @@
 BLEAdvertising *pAdvertising;
 
 #include "dw3000.h"
+#include "uwb_msg.h"   // Advertised payload, generated by uwb_schema.py
+#include "tag_rate.h"  // Motion-adaptive ranging rate
 
 #define APP_NAME "SS TWR INIT v1.0"
 
@@ -32,13 +34,30 @@ static dwt_config_t config = {
   DWT_PDOA_M0
 };
 
+// 0: single-sided TWR with one anchor, range advertised over BLE
+// 1: TDoA, the tag only transmits blinks and the anchors timestamp them (see uwb_anchor_tdoa.ino)
+#define UWB_MODE_TDOA 0
+
+// 1: range at up to 50 Hz while moving and back off to a heartbeat when still (tag_rate.c)
+// 0: range every RNG_DELAY_MS
+#define RNG_ADAPTIVE 1
 #define RNG_DELAY_MS 100
+#define BLINK_INTERVAL_MS 100
+// The DW3000 sleeps between exchanges at least this far apart; waking it takes about 2 ms
+#define DW_SLEEP_MIN_MS 10
+// BLE advertisements per range, so a gateway scanning part of the time still catches each one
+#define ADV_COPIES_PER_RANGE 4
+#define TAG_ID 0x0001
 #define TX_ANT_DLY 16399
 #define RX_ANT_DLY 16399
 
 static uint8_t tx_poll_msg[] = {0x41, 0x88, 0, 0xCA, 0xDE, 'W', 'A', 'V', 'E', 0xE0, 0, 0};
 static uint8_t rx_resp_msg[] = {0x41, 0x88, 0, 0xCA, 0xDE, 'V', 'E', 'W', 'A', 0xE1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
+// Blink: 802.15.4 blink frame control, seq, 16-bit tag id (little endian), 2 bytes FCS added by the DW3000
+static uint8_t tx_blink_msg[] = {0xC5, 0, (uint8_t)(TAG_ID & 0xFF), (uint8_t)(TAG_ID >> 8), 0, 0};
+#define BLINK_MSG_SN_IDX 1
+
 #define ALL_MSG_COMMON_LEN 10
 #define ALL_MSG_SN_IDX 2
 #define RESP_MSG_POLL_RX_TS_IDX 10
@@ -46,6 +65,8 @@ static uint8_t rx_resp_msg[] = {0x41, 0x88, 0, 0xCA, 0xDE, 'V', 'E', 'W', 'A', 0
 #define RESP_MSG_TS_LEN 4
 
 static uint8_t frame_seq_nb = 0;
+// Advertised sequence number, one step per published range: a failed exchange leaves no gap downstream
+static uint8_t range_seq = 0;
 #define RX_BUF_LEN 20
 static uint8_t rx_buffer[RX_BUF_LEN];
 
@@ -55,6 +76,41 @@ static uint32_t status_reg = 0;
 
 extern dwt_txconfig_t txconfig_options;
 
+static TAG_RATE_POLICY rate_policy;
+static const TAG_RATE_CONFIG rate_config = TAG_RATE_CONFIG_DEFAULT();
+
+// Settings that are not kept across DW3000 deep sleep
+static void dw_apply_runtime_config() {
+  dwt_setrxantennadelay(RX_ANT_DLY);
+  dwt_settxantennadelay(TX_ANT_DLY);
+  dwt_setrxaftertxdelay(POLL_TX_TO_RESP_RX_DLY_UUS);
+  dwt_setrxtimeout(RESP_RX_TIMEOUT_UUS);
+  dwt_setlnapamode(DWT_LNA_ENABLE | DWT_PA_ENABLE);
+}
+
+// Wait for the next exchange, with the DW3000 in deep sleep when the wait is long enough to pay for the wake-up
+static void dw_wait(uint32_t wait_ms) {
+  if (wait_ms < DW_SLEEP_MIN_MS) {
+    delay(wait_ms);
+    return;
+  }
+  dwt_entersleep(DWT_DW_IDLE_RC);
+  delay(wait_ms - 2);
+  dwt_wakeup_ic();
+  delay(2);
+  while (!dwt_checkidlerc()) { }
+  dwt_restoreconfig();
+  dw_apply_runtime_config();
+}
+
+// Advertise a few times per range at the current rate, between 20 ms and 1 s
+static void adv_set_interval(uint32_t range_interval_ms) {
+  uint32_t units = range_interval_ms * 16 / (10 * ADV_COPIES_PER_RANGE);   // 0.625 ms units
+  units = units < 0x20 ? 0x20 : (units > 0x640 ? 0x640 : units);
+  pAdvertising->setMinInterval(units);
+  pAdvertising->setMaxInterval(units + units / 4);
+}
+
 void setup() {
   Serial.begin(115200);
   UART_init();
@@ -82,11 +138,10 @@ void setup() {
   }
 
   dwt_configuretxrf(&txconfig_options);
-  dwt_setrxantennadelay(RX_ANT_DLY);
-  dwt_settxantennadelay(TX_ANT_DLY);
-  dwt_setrxaftertxdelay(POLL_TX_TO_RESP_RX_DLY_UUS);
-  dwt_setrxtimeout(RESP_RX_TIMEOUT_UUS);
-  dwt_setlnapamode(DWT_LNA_ENABLE | DWT_PA_ENABLE);
+  dw_apply_runtime_config();
+  // Deep sleep keeps the configuration in the always-on memory, waking on SPI chip select
+  dwt_configuresleep(DWT_CONFIG | DWT_PGFCAL, DWT_PRES_SLEEP | DWT_WAKE_CSN | DWT_SLP_EN);
+  tag_rate_init(&rate_policy, &rate_config, millis());
 
     // BLE Init
   BLEDevice::init("UWB_Tag");
@@ -104,7 +159,25 @@ void setup() {
   Serial.println("BLE advertising started.");
 }
 
+#if UWB_MODE_TDOA
+void loop() {
+  // No response expected: one short frame per position fix, the anchors do the rest
+  tx_blink_msg[BLINK_MSG_SN_IDX] = frame_seq_nb++;
+  dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_TXFRS_BIT_MASK);
+  dwt_writetxdata(sizeof(tx_blink_msg), tx_blink_msg, 0);
+  dwt_writetxfctrl(sizeof(tx_blink_msg), 0, 0);
+  dwt_starttx(DWT_START_TX_IMMEDIATE);
+
+  while (!(dwt_read32bitreg(SYS_STATUS_ID) & SYS_STATUS_TXFRS_BIT_MASK)) { }
+  dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_TXFRS_BIT_MASK);
+
+  // The blink carries no range to adapt on, the rate stays fixed
+  dw_wait(BLINK_INTERVAL_MS);
+}
+#else
 void loop() {
+  bool ranged = false;
+
   tx_poll_msg[ALL_MSG_SN_IDX] = frame_seq_nb;
   dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_TXFRS_BIT_MASK);
   dwt_writetxdata(sizeof(tx_poll_msg), tx_poll_msg, 0);
@@ -148,13 +221,12 @@ void loop() {
         Serial.println(" cm");
         
        // BLE Advertise
-        uint16_t dist_cm = (uint16_t)(distance * 100);  // convert to cm
-        uint8_t mfg_data[6] = {
-          0x34, 0x12,  // Manufacturer ID = 0x1234
-          (uint8_t)(dist_cm & 0xFF),
-          (uint8_t)(dist_cm >> 8),
-          0x00, 0x00   // padding or future data
-        };
+        UWB_MSG_RANGE range;
+        range.dist_cm = (uint16_t)(distance * 100);  // convert to cm
+        range.seq = range_seq++;                     // lets the gateway drop repeated advs, the bridge spot lost ranges
+        uint8_t mfg_data[UWB_MSG_RANGE_ADV_LEN];
+        uwb_msg_range_encode(mfg_data, &range);
+        ranged = true;
       
         String mfgString = "";
         for (size_t i = 0; i < sizeof(mfg_data); i++) {
@@ -172,5 +244,12 @@ void loop() {
     dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
   }
 
-  delay(RNG_DELAY_MS);
+#if RNG_ADAPTIVE
+  uint32_t wait_ms = tag_rate_update(&rate_policy, millis(), ranged, (uint16_t)(distance * 100), esp_random());
+  adv_set_interval(rate_policy.interval_ms);
+#else
+  uint32_t wait_ms = RNG_DELAY_MS;
+#endif
+  dw_wait(wait_ms);
 }
+#endif